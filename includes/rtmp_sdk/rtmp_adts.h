@@ -0,0 +1,65 @@
+#ifndef __RTMP_ADTS__
+#define __RTMP_ADTS__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RTMP_PUB_AAC_CONFIG_SIZE        2
+#define RTMP_PUB_ADTS_MAX_FRAMES        64      // 一次RtmpPubAdtsDemux最多解析的帧数
+
+// 检查_pData开头的adts帧, 返回整个帧的长度, 格式错误或者不完整返回-1
+int RtmpPubParseAdts(const char * _pData, unsigned int _nSize, unsigned int * _pHeaderSize, unsigned int * _pDurationMs);
+// 用adts头生成AudioSpecificConfig, _pConfig至少RTMP_PUB_AAC_CONFIG_SIZE字节
+void RtmpPubAdtsToConfig(const char * _pAdts, char * _pConfig);
+
+// 一个去掉adts头(和crc)的aac帧, 指向输入数据, 不拥有内存
+typedef struct {
+        const char * m_pData;
+        unsigned int m_nSize;
+        unsigned int m_nPts;
+} RtmpPubAdtsFrame;
+
+/*
+ * adts解复用: AudioSpecificConfig从adts头里生成, 不需要调用者写死
+ * 采样率/声道数/profile在中途变化时(摄像头切换到48k或者立体声)重新生成并通知调用者
+ * 只由一个投递线程使用
+ */
+typedef struct {
+        char m_config[RTMP_PUB_AAC_CONFIG_SIZE];        // 当前的AudioSpecificConfig
+        int m_bHasConfig;
+        int m_bConfigPending;                           // 配置还没有投递成功, 之后的帧先不投递
+        unsigned long long m_nFrames;
+        unsigned long long m_nConfigChanges;
+} RtmpPubAdtsDemuxer;
+
+void RtmpPubAdtsDemuxerInit(RtmpPubAdtsDemuxer * _pDemuxer);
+
+/*
+ * 解析_pData开头连续的adts帧(一次可以是多帧), 不拷贝, 帧的位置写入_pFrames
+ * 第一帧的时间戳是_nPts, 之后每帧按1024个样本的时长递增
+ * 遇到配置变化的帧时停在它前面, 下一次调用从这一帧开始, 并把*_pConfigChanged置1, 新配置在m_config里
+ * *_pConsumed返回已经解析的字节数, 返回帧数, 格式错误返回-1
+ */
+int RtmpPubAdtsDemux(RtmpPubAdtsDemuxer * _pDemuxer, const char * _pData, unsigned int _nSize, unsigned int _nPts,
+                     RtmpPubAdtsFrame * _pFrames, unsigned int _nMaxFrames, unsigned int * _pConsumed, int * _pConfigChanged);
+
+// 解复用之后的投递目标, 返回值小于0表示投递失败(队列满)
+typedef struct {
+        int (*m_pOnConfig)(void * _pOpaque, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+        int (*m_pOnFrame)(void * _pOpaque, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+        void * m_pOpaque;
+} RtmpPubAdtsOutput;
+
+/*
+ * 解复用整个缓冲并逐帧投递, 配置(第一次或者变化时)在对应的帧之前投递
+ * 配置投递失败时丢弃它之后的帧, 下一次调用重新投递配置
+ * 返回投递成功的帧数, 有帧投递失败或者格式错误时返回-1
+ */
+int RtmpPubAdtsDemuxerPush(RtmpPubAdtsDemuxer * _pDemuxer, const char * _pData, unsigned int _nSize, unsigned int _nPts,
+                           const RtmpPubAdtsOutput * _pOutput);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
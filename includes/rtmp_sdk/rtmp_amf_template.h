@@ -0,0 +1,62 @@
+#ifndef __RTMP_AMF_TEMPLATE__
+#define __RTMP_AMF_TEMPLATE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "rtmp_publish.h"
+
+typedef enum {
+        RTMP_PUB_CMD_CONNECT = 0,
+        RTMP_PUB_CMD_RELEASE_STREAM,
+        RTMP_PUB_CMD_FC_PUBLISH,
+        RTMP_PUB_CMD_CREATE_STREAM,
+        RTMP_PUB_CMD_PUBLISH,
+        RTMP_PUB_CMD_COUNT
+} RtmpPubCommand;
+
+/*
+ * 推流握手之后的几个命令, 每次(重)连接都一样, 只有事务id不同
+ * 和流无关的部分(命令名、事务id占位、type/flashVer、null、"live")在进程里只用AMF_Encode*编码一次,
+ * 创建会话时拼上app、tcUrl和流名, 之后每次连接只改写事务id的8个字节, 不再经过AMF编码
+ */
+typedef struct {
+        char * m_pData;                         // 所有命令连续存放
+        unsigned int m_nOffset[RTMP_PUB_CMD_COUNT];
+        unsigned int m_nSize[RTMP_PUB_CMD_COUNT];
+} RtmpPubCommandSet;
+
+// 字符串超过65535字节或者内存不足返回-1
+int RtmpPubCommandSetInit(RtmpPubCommandSet * _pSet, const AVal * _pApp, const AVal * _pTcUrl, const AVal * _pStreamName);
+void RtmpPubCommandSetDestroy(RtmpPubCommandSet * _pSet);
+// 改写事务id, 返回命令的AMF0 body, 下一次Get同一个命令之前有效
+const char * RtmpPubCommandSetGet(RtmpPubCommandSet * _pSet, RtmpPubCommand _nCommand, double _fTransaction,
+                                  unsigned int * _pSize);
+
+typedef enum {
+        RTMP_PUB_META_DURATION = 0,
+        RTMP_PUB_META_WIDTH,
+        RTMP_PUB_META_HEIGHT,
+        RTMP_PUB_META_VIDEO_DATARATE,           // kbps
+        RTMP_PUB_META_FRAMERATE,
+        RTMP_PUB_META_VIDEO_CODECID,            // 7: h264, hevc是FourCC 'hvc1'的数值
+        RTMP_PUB_META_AUDIO_DATARATE,
+        RTMP_PUB_META_AUDIO_SAMPLERATE,
+        RTMP_PUB_META_AUDIO_SAMPLESIZE,
+        RTMP_PUB_META_STEREO,                   // boolean, 非0为true
+        RTMP_PUB_META_AUDIO_CODECID,            // 10: aac
+        RTMP_PUB_META_FIELDS
+} RtmpPubMetaField;
+
+/*
+ * @setDataFrame("onMetaData", {...})的body, 字段名和顺序固定, 进程里只编码一次
+ * 生成时只把_pValues(RTMP_PUB_META_FIELDS个)改写到各个数值的位置
+ */
+unsigned int RtmpPubGetMetadataSize(void);
+// _pBody至少RtmpPubGetMetadataSize()字节, 返回body长度
+unsigned int RtmpPubBuildMetadata(char * _pBody, const double * _pValues);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,58 @@
+#ifndef __RTMP_BUFFER_POOL__
+#define __RTMP_BUFFER_POOL__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdatomic.h>
+
+#define RTMP_PUB_BUFFER_HEADROOM        32      // 不小于RTMP_MAX_HEADER_SIZE + flv视频tag头
+#define RTMP_PUB_BUFFER_MIN_SHIFT       8       // 最小规格256字节
+#define RTMP_PUB_BUFFER_MAX_SHIFT       22      // 最大规格4MB, 更大的直接malloc, 不进池
+#define RTMP_PUB_BUFFER_CLASSES         (RTMP_PUB_BUFFER_MAX_SHIFT - RTMP_PUB_BUFFER_MIN_SHIFT + 1)
+#define RTMP_PUB_BUFFER_CACHE_BYTES     (4 << 20)       // 每个线程每种规格最多缓存的空闲内存
+
+typedef struct RtmpPubBufferPool RtmpPubBufferPool;
+
+/*
+ * 带引用计数的帧/包缓冲
+ * m_pData前面保留RTMP_PUB_BUFFER_HEADROOM字节, 可以直接作为RTMPPacket的m_body
+ * 同一个缓冲可以同时在发送队列、GOP缓存和重发列表里, 都只持有引用, 不拷贝数据
+ * 被多处引用时数据只读(RtmpPubBufferShared)
+ */
+typedef struct RtmpPubBuffer {
+        atomic_int m_nRef;
+        int m_nClass;                           // -1表示不属于任何规格
+        RtmpPubBufferPool * m_pOwner;           // 分配它的线程的池
+        struct RtmpPubBuffer * m_pNext;         // 空闲链表
+        char * m_pData;
+        unsigned int m_nSize;                   // 有效数据长度, 由使用者设置
+        unsigned int m_nCapacity;
+} RtmpPubBuffer;
+
+typedef struct {
+        unsigned long long m_nAllocs;
+        unsigned long long m_nHits;             // 从线程缓存里直接拿到的
+        unsigned long long m_nRemoteFrees;      // 在其它线程释放, 归还给分配线程的
+        unsigned long long m_nCachedBytes;      // 所有线程当前缓存的空闲内存
+} RtmpPubBufferPoolStats;
+
+/*
+ * 按2的幂分规格, 每个线程一个池, 分配和本线程释放都不加锁
+ * 其它线程释放的缓冲无锁地挂回分配线程的池, 由分配线程下一次缺货时收回,
+ * 所以采集线程分配、发送线程释放的模式下内存也能循环使用
+ * 线程退出时它缓存的空闲缓冲会被释放, 还在使用中的之后直接free
+ */
+RtmpPubBuffer * RtmpPubBufferAlloc(unsigned int _nSize);
+void RtmpPubBufferRef(RtmpPubBuffer * _pBuffer);
+void RtmpPubBufferUnref(RtmpPubBuffer * _pBuffer);
+#define RtmpPubBufferShared(_pBuffer) (atomic_load_explicit(&(_pBuffer)->m_nRef, memory_order_acquire) > 1)
+
+// 释放本线程缓存的所有空闲缓冲
+void RtmpPubBufferPoolTrim(void);
+void RtmpPubBufferPoolGetStats(RtmpPubBufferPoolStats * _pStats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,58 @@
+#ifndef __RTMP_CHANNEL_TABLE__
+#define __RTMP_CHANNEL_TABLE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "rtmp_publish.h"
+
+#define RTMP_PUB_INLINE_CHANNELS        8
+
+/*
+ * 发送方向每个chunk stream上一条消息的头信息, 用于chunk头压缩
+ * librtmp的struct RTMP为65600个chunk stream各留了收发两个RTMPPacket指针和一个时间戳,
+ * 单个会话超过1MB, 而推流只用到2(协议控制)、3(命令)、4(音视频)这几个csid
+ * 这里小csid放在内联数组里, 其它csid放在按csid排序的稀疏数组里
+ */
+typedef struct {
+        uint32_t m_nTimeStamp;
+        uint32_t m_nBodySize;
+        int32_t m_nStreamId;
+        uint8_t m_nType;
+        uint8_t m_nHeaderType;
+        uint8_t m_bValid;
+} RtmpPubChannel;
+
+typedef struct {
+        int m_nChannel;
+        RtmpPubChannel m_channel;
+} RtmpPubSparseChannel;
+
+typedef struct {
+        RtmpPubChannel m_inline[RTMP_PUB_INLINE_CHANNELS];
+        RtmpPubSparseChannel * m_pSparse;
+        unsigned int m_nSparse;
+        unsigned int m_nSparseCapacity;
+} RtmpPubChannelTable;
+
+void RtmpPubChannelTableInit(RtmpPubChannelTable * _pTable);
+void RtmpPubChannelTableDestroy(RtmpPubChannelTable * _pTable);
+
+// 没有发送过消息的csid返回NULL
+RtmpPubChannel * RtmpPubChannelTableFind(RtmpPubChannelTable * _pTable, int _nChannel);
+// 不存在时创建一个m_bValid为0的表项, 内存不足返回NULL
+RtmpPubChannel * RtmpPubChannelTableGet(RtmpPubChannelTable * _pTable, int _nChannel);
+
+/*
+ * 通过sdk建立的会话仍然使用librtmp的struct RTMP, 它的结构在预编译的librtmp里无法修改
+ * RTMP_Init会把整个结构体memset一遍, 使未使用的channel数组也全部常驻内存
+ * 连接成功之后调用, 把这些数组里全为0的整页交还给内核, 读到时仍然是0, 内容不变
+ * 返回释放的字节数
+ */
+unsigned long RtmpPubTrimChannels(RtmpPubContext * _pRtmp);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
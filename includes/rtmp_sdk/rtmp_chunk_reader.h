@@ -0,0 +1,57 @@
+#ifndef __RTMP_CHUNK_READER__
+#define __RTMP_CHUNK_READER__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "rtmp_channel_table.h"
+
+#define RTMP_PUB_READER_MAX_CHANNELS    8
+
+// 一条完整的rtmp消息, m_pBody只在回调期间有效
+typedef struct {
+        int m_nChannel;
+        uint8_t m_nType;
+        uint32_t m_nTimeStamp;
+        int32_t m_nStreamId;
+        char * m_pBody;
+        uint32_t m_nBodySize;
+} RtmpPubMessage;
+
+typedef int (*RtmpPubMessageCallback)(void * _pOpaque, RtmpPubMessage * _pMessage);
+
+typedef struct {
+        int m_nChannel;                 // -1表示空闲
+        RtmpPubChannel m_header;
+        uint32_t m_nDelta;
+        char * m_pBody;
+        uint32_t m_nBodyRead;
+        uint32_t m_nCapacity;
+} RtmpPubReaderChannel;
+
+/*
+ * 非阻塞的rtmp chunk解析, 调用者负责收数据, 这里只解析已经收到的字节
+ * 对端同时使用的chunk stream最多RTMP_PUB_READER_MAX_CHANNELS个, 服务端一般只用2、3、5
+ * Set Chunk Size和Abort在内部处理, 同时也会回调给调用者
+ */
+typedef struct {
+        RtmpPubReaderChannel m_channels[RTMP_PUB_READER_MAX_CHANNELS];
+        uint32_t m_nChunkSize;
+        RtmpPubMessageCallback m_pCallback;
+        void * m_pOpaque;
+} RtmpPubChunkReader;
+
+void RtmpPubChunkReaderInit(RtmpPubChunkReader * _pReader, RtmpPubMessageCallback _pCallback, void * _pOpaque);
+void RtmpPubChunkReaderDestroy(RtmpPubChunkReader * _pReader);
+
+/*
+ * 解析_pData里所有完整的chunk, 不完整的chunk留给下一次
+ * 返回消耗的字节数, 协议错误或回调返回<0时返回-1
+ */
+int RtmpPubChunkReaderParse(RtmpPubChunkReader * _pReader, const char * _pData, unsigned int _nSize);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
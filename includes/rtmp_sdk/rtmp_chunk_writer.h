@@ -0,0 +1,112 @@
+#ifndef __RTMP_CHUNK_WRITER__
+#define __RTMP_CHUNK_WRITER__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <sys/uio.h>
+#include "rtmp_publish.h"
+#include "rtmp_channel_table.h"
+#include "rtmp_metrics.h"
+#include "rtmp_transport.h"
+
+#define RTMP_PUB_WRITER_MAX_IOV         512
+#define RTMP_PUB_WRITER_HEADER_ARENA    (RTMP_PUB_WRITER_MAX_IOV * RTMP_MAX_HEADER_SIZE)
+#define RTMP_PUB_WRITER_SCRATCH_SIZE    4096
+#define RTMP_PUB_WRITER_WAIT_MS         5000
+
+/*
+ * rtmp chunk的批量输出
+ * 消息体以iovec的形式给出, 直接指向原始数据, chunk头和消息体交错组成一个iovec数组,
+ * 一条或多条消息攒在一起用一次writev发出去, 不再拷贝消息体, 也不再每个chunk一次send
+ * Flush之前消息体指向的内存必须保持有效
+ * 绑定到librtmp会话时, 每个chunk stream的头信息直接读写librtmp的m_vecChannelsOut,
+ * 所以和RTMP_SendPacket混用时头压缩依然正确(混用前要先Flush)
+ * 只绑定socket时不依赖struct RTMP, 头信息保存在紧凑的m_channels里
+ * 数据通过m_pTransport写出去, 默认是sendmsg, 异步传输层的请求没有完成时Flush和socket写不完一样返回1
+ */
+typedef struct {
+        struct RTMP * m_pRtmp;                  // 只绑定socket时为NULL
+        int m_nSocket;
+        int m_nChunkSize;
+        RtmpPubChannelTable m_channels;
+        struct iovec m_iov[RTMP_PUB_WRITER_MAX_IOV];
+        int m_nIov;
+        char m_headers[RTMP_PUB_WRITER_HEADER_ARENA];
+        unsigned int m_nHeaderUsed;
+        char m_scratch[RTMP_PUB_WRITER_SCRATCH_SIZE];   // flv tag头、nalu长度等小块数据
+        unsigned int m_nScratchUsed;
+        unsigned int m_nQueuedMessages;
+        // RtmpPubChunkWriterBegin打开、消息体还没有追加完的消息
+        int m_nOpenChannel;
+        uint32_t m_nOpenLeft;
+        int m_nOpenChunkLeft;                   // 当前chunk还能放的字节数
+        uint32_t m_nOpenDelta;
+        int m_bOpenExtTimestamp;
+        int m_nError;                           // 写socket失败时的errno, 之后连接不能再用
+        RtmpPubTransport * m_pTransport;        // NULL表示socket
+        RtmpPubTransportOp m_op;                // 正在进行的发送, 总是从m_iov[0]开始
+
+        unsigned long long m_nWritevCalls;
+        unsigned long long m_nMessages;
+        unsigned long long m_nBytes;
+        RtmpPubHistogram * m_pSendLatency;      // 不为NULL时记录每次sendmsg的耗时
+        unsigned long long m_nSendNs;           // sendmsg累计耗时, 用来从封装耗时里扣除
+} RtmpPubChunkWriter;
+
+void RtmpPubChunkWriterInit(RtmpPubChunkWriter * _pWriter, struct RTMP * _pRtmp);
+void RtmpPubChunkWriterInitSocket(RtmpPubChunkWriter * _pWriter, int _nSocket, int _nChunkSize);
+// 取消还没有完成的异步发送, 之后消息体可以释放
+void RtmpPubChunkWriterDestroy(RtmpPubChunkWriter * _pWriter);
+/*
+ * 换传输层, 只能在没有数据排队时调用, Init之后恢复成socket
+ * _pOwner是异步传输层完成时RtmpPubTransportNextDone返回的请求的m_pOwner
+ */
+void RtmpPubChunkWriterSetTransport(RtmpPubChunkWriter * _pWriter, RtmpPubTransport * _pTransport, void * _pOwner);
+
+// 确保scratch至少还有_nSize字节, 不够时先Flush, 只能在两条消息之间调用
+int RtmpPubChunkWriterReserve(RtmpPubChunkWriter * _pWriter, unsigned int _nSize);
+// 从scratch分配一小块内存, 下一次Flush之前有效, 空间不足返回NULL
+char * RtmpPubChunkWriterAlloc(RtmpPubChunkWriter * _pWriter, unsigned int _nSize);
+
+/*
+ * 把一条消息切成chunk加入发送队列
+ * _nHeaderType为RTMP_PACKET_SIZE_LARGE时总是使用完整的chunk头, 否则和librtmp一样按上一条消息压缩
+ */
+int RtmpPubChunkWriterQueue(RtmpPubChunkWriter * _pWriter, int _nChannel, uint8_t _nType, uint8_t _nHeaderType,
+                            uint32_t _nTimeStamp, int32_t _nStreamId, const struct iovec * _pPayload, int _nPayload);
+/*
+ * 消息体分多次给出: Begin按声明的长度写出第一个chunk头, 之后Append追加消息体, 追加满_nBodySize字节时消息结束
+ * 消息结束之前不能再Begin/Queue其它消息(包括其它chunk stream上的), 追加超过声明的长度返回-1
+ * 已经追加的部分在Flush时就会发出去, 用于边编码边发送
+ */
+int RtmpPubChunkWriterBegin(RtmpPubChunkWriter * _pWriter, int _nChannel, uint8_t _nType, uint8_t _nHeaderType,
+                            uint32_t _nTimeStamp, int32_t _nStreamId, uint32_t _nBodySize);
+int RtmpPubChunkWriterAppend(RtmpPubChunkWriter * _pWriter, const struct iovec * _pPayload, int _nPayload);
+// 是否有还没有追加完的消息
+#define RtmpPubChunkWriterOpen(_pWriter) ((_pWriter)->m_nOpenLeft > 0)
+// 不经过chunk封装直接发送的数据, 比如握手
+int RtmpPubChunkWriterQueueRaw(RtmpPubChunkWriter * _pWriter, const char * _pData, unsigned int _nSize);
+/*
+ * 发送所有排队的数据, 成功返回0
+ * 非阻塞socket暂时写不完时返回1, 剩下的数据留在队列里, socket可写后再次调用,
+ * 返回0之前不能释放消息体, 也不能再加入新的消息
+ */
+int RtmpPubChunkWriterFlush(RtmpPubChunkWriter * _pWriter);
+// 是否还有没写完的数据
+#define RtmpPubChunkWriterPending(_pWriter) ((_pWriter)->m_nIov > 0)
+// 是否有提交给异步传输层还没有完成的发送, 这时等待的是传输层的完成事件而不是socket可写
+#define RtmpPubChunkWriterInFlight(_pWriter) ((_pWriter)->m_op.m_bInFlight)
+// 是否写socket失败过
+#define RtmpPubChunkWriterFailed(_pWriter) ((_pWriter)->m_nError != 0)
+
+// 只绑定socket时使用: 把Set Chunk Size加入队列, 之后的消息按新的chunk大小切分
+int RtmpPubChunkWriterSetChunkSize(RtmpPubChunkWriter * _pWriter, int _nChunkSize);
+
+// 发送Set Chunk Size, 之后librtmp和RtmpPubChunkWriter都按新的chunk大小切分
+int RtmpPubSetChunkSize(RtmpPubContext * _pRtmp, int _nChunkSize);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
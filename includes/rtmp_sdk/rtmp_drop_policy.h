@@ -0,0 +1,51 @@
+#ifndef __RTMP_DROP_POLICY__
+#define __RTMP_DROP_POLICY__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdatomic.h>
+
+/*
+ * 上行带宽不足时按GOP丢帧, 保证排队延时有界
+ * 排队延时 = 帧出队时刻 - 入队时刻
+ * 1. 超过m_nLatencyBudgetMs: 丢弃非参考帧(nal_ref_idc == 0)
+ * 2. 超过m_nGopDropLatencyMs: 丢弃当前GOP剩下的所有帧, 直到下一个IDR
+ * 音频、sps/pps和IDR永远不丢
+ * 内核发送缓冲里的数据不计入排队延时, 所以开启丢帧时socket里没有发出去的数据限制在
+ * RTMP_PUB_DROP_NOTSENT_LOWAT以内, 积压留在发送队列里
+ */
+#define RTMP_PUB_DROP_NOTSENT_LOWAT     (32 << 10)
+
+typedef struct {
+        unsigned int m_nLatencyBudgetMs;        // 0表示不丢帧
+        unsigned int m_nGopDropLatencyMs;       // 0表示取2倍的m_nLatencyBudgetMs
+} RtmpPubDropConfig;
+
+typedef struct {
+        unsigned long long m_nDroppedNonRef;
+        unsigned long long m_nDroppedGop;
+        unsigned long long m_nGopSkips;         // 进入"丢到下一个IDR"状态的次数
+} RtmpPubDropStats;
+
+// 只由发送线程(或者session所属的worker)调用Check, 计数可以在其它线程读取
+typedef struct {
+        RtmpPubDropConfig m_config;
+        int m_bSkipUntilIdr;
+        atomic_ullong m_nDroppedNonRef;
+        atomic_ullong m_nDroppedGop;
+        atomic_ullong m_nGopSkips;
+} RtmpPubDropPolicy;
+
+void RtmpPubDropPolicyInit(RtmpPubDropPolicy * _pPolicy, const RtmpPubDropConfig * _pConfig);
+
+// 返回1表示这一帧视频应当丢弃
+int RtmpPubDropPolicyCheck(RtmpPubDropPolicy * _pPolicy, int _bIsIdr, int _bIsReference, long long int _nLatencyUs);
+void RtmpPubDropPolicyGetStats(RtmpPubDropPolicy * _pPolicy, RtmpPubDropStats * _pStats);
+// 每次建立连接后调用, 没有开启丢帧时不改socket
+void RtmpPubDropPolicyLimitSocket(const RtmpPubDropPolicy * _pPolicy, int _nSocket);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,73 @@
+#ifndef __RTMP_ENCODER_POOL__
+#define __RTMP_ENCODER_POOL__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "rtmp_publish.h"
+#include "rtmp_buffer_pool.h"
+#include "rtmp_frame_ring.h"
+#include "rtmp_engine.h"
+#include "rtmp_publish_sender.h"
+
+#define RTMP_PUB_ENCODER_FRAME_SAMPLES  1024    // 一个aac帧的样本数, 也是一个编码任务的大小
+#define RTMP_PUB_ENCODER_DEFAULT_RATE   8000
+#define RTMP_PUB_ENCODER_MAX_BATCH      8       // 一路流一次最多编码的任务数, 超过后让给其它流
+
+typedef struct RtmpPubEncoderPool RtmpPubEncoderPool;
+typedef struct RtmpPubEncoderStream RtmpPubEncoderStream;
+
+/*
+ * 编码完成的输出, 在编码线程里调用, 同一路流的调用不会并发, 并且按输入顺序
+ * m_pOnConfig在第一帧之前调用一次, m_pOnFrame的_pFrame是不带adts头的aac帧, 调用者需要时自己加引用
+ */
+typedef struct {
+        int (*m_pOnConfig)(void * _pOpaque, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+        int (*m_pOnFrame)(void * _pOpaque, RtmpPubBuffer * _pFrame, unsigned int _nPts);
+        void * m_pOpaque;
+} RtmpPubEncoderOutput;
+
+// 输出直接投递到session/sender的音频队列, 这一路的音频之后只能由编码线程投递
+void RtmpPubEncoderOutputToSession(RtmpPubEncoderOutput * _pOutput, RtmpPubSession * _pSession);
+void RtmpPubEncoderOutputToSender(RtmpPubEncoderOutput * _pOutput, RtmpPubSender * _pSender);
+
+typedef struct {
+        RtmpPubAudioType m_nInputType;          // RTMP_PUB_AUDIO_G711A/G711U/PCM
+        unsigned int m_nSampleRate;             // 0表示8000
+        unsigned int m_nChannels;               // 0表示单声道
+        unsigned int m_nJobSlots;               // 排队的编码任务数, 0表示16, 满了之后丢弃
+} RtmpPubEncoderStreamConfig;
+
+typedef struct {
+        unsigned long long m_nJobs;             // 编码完成的任务数
+        unsigned long long m_nFrames;           // 输出的aac帧数
+        unsigned long long m_nEncodeNs;         // 解码+编码的累计耗时
+        unsigned long long m_nDropped;          // 队列满丢弃的任务数
+} RtmpPubEncoderPoolStats;
+
+/*
+ * 多路g711/pcm转aac的编码线程池
+ * sdk里每个RtmpPubContext在调用者线程里同步编码, 路数多时采集回调被编码拖慢, 也只能用到一个核
+ * 这里采集线程只把输入拷贝到当前任务里, 攒够1024个样本(正好一个aac帧)后交给线程池,
+ * 编码器和解码arena仍然每路一个, 同一时刻一路流只会在一个编码线程里处理, 所以输出保持输入顺序
+ * 发送端只看到编码好的aac帧, 和aac输入完全一样
+ */
+// _nWorkers为0时等于cpu个数
+RtmpPubEncoderPool * RtmpPubEncoderPoolNew(unsigned int _nWorkers);
+// 调用之前所有流都要已经删除
+void RtmpPubEncoderPoolDel(RtmpPubEncoderPool * _pPool);
+unsigned int RtmpPubEncoderPoolGetWorkers(RtmpPubEncoderPool * _pPool);
+void RtmpPubEncoderPoolGetStats(RtmpPubEncoderPool * _pPool, RtmpPubEncoderPoolStats * _pStats);
+
+RtmpPubEncoderStream * RtmpPubEncoderStreamNew(RtmpPubEncoderPool * _pPool, const RtmpPubEncoderStreamConfig * _pConfig,
+                                               const RtmpPubEncoderOutput * _pOutput);
+// 等这一路已经排队的任务编码完成后删除, 调用之前要停止投递, 不足一个aac帧的尾部丢弃
+void RtmpPubEncoderStreamDel(RtmpPubEncoderStream * _pStream);
+// 只允许一个投递线程, 不会阻塞, 队列满时返回-1
+int RtmpPubEncoderStreamPush(RtmpPubEncoderStream * _pStream, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+void RtmpPubEncoderStreamGetStats(RtmpPubEncoderStream * _pStream, RtmpPubRingStats * _pStats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
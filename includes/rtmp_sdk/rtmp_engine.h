@@ -0,0 +1,123 @@
+#ifndef __RTMP_ENGINE__
+#define __RTMP_ENGINE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "rtmp_publish.h"
+#include "rtmp_frame_ring.h"
+#include "rtmp_drop_policy.h"
+#include "rtmp_reconnect.h"
+#include "rtmp_metrics.h"
+#include "rtmp_transport.h"
+
+/*
+ * 多路推流引擎
+ * 固定数量的worker线程, 每个worker一个epoll, 每路推流(session)创建时绑定到一个worker,
+ * 之后它的连接、握手、发送、定时器都只在这个worker线程里处理, 热路径上没有锁
+ * 采集线程通过每个session自己的无锁队列投递音视频帧, 再用eventfd唤醒worker
+ * 每个session内部仍然是一个RtmpPubContext(只用到它的sps/pps、时间戳和音频转码),
+ * socket由引擎自己以非阻塞方式管理, 不调用RtmpPubConnect
+ */
+typedef struct RtmpPubEngine RtmpPubEngine;
+typedef struct RtmpPubSession RtmpPubSession;
+
+typedef enum {
+        RTMP_PUB_SESSION_INIT = 0,
+        RTMP_PUB_SESSION_CONNECTING,    // tcp连接中
+        RTMP_PUB_SESSION_HANDSHAKE,
+        RTMP_PUB_SESSION_COMMANDS,      // connect/createStream/publish
+        RTMP_PUB_SESSION_PUBLISHING,
+        RTMP_PUB_SESSION_RECONNECT_WAIT, // 连接断开, 等待重连
+        RTMP_PUB_SESSION_CLOSED,        // 失败或者被服务端关闭, 开启重连时不会进入
+} RtmpPubSessionState;
+
+/*
+ * 建立连接时哪些命令不等服务端回应就先发出去
+ * 默认在回C2时就发connect, 紧接着发releaseStream/FCPublish/createStream, publish等createStream的结果
+ * PUBLISH还会假定服务端给第一个流分配的id是1(nginx-rtmp、srs都是这样), publish和其它命令一起发出,
+ * 整个过程只要tcp + 2个RTT, 服务端分配的id不是1时连接失败
+ */
+typedef enum {
+        RTMP_PUB_PIPELINE_COMMANDS = 0,
+        RTMP_PUB_PIPELINE_NONE,         // 和librtmp一样每一步都等回应
+        RTMP_PUB_PIPELINE_PUBLISH,
+} RtmpPubPipelineMode;
+
+// 连接各阶段完成的时间, 除了域名解析都是从开始tcp连接算起, 流水线时各阶段会重叠, 0表示还没完成
+typedef struct {
+        long long int m_nResolveUs;             // 域名解析耗时
+        long long int m_nTcpUs;
+        long long int m_nHandshakeUs;           // 收到S2
+        long long int m_nConnectUs;             // connect的_result
+        long long int m_nCreateStreamUs;
+        long long int m_nPublishUs;             // NetStream.Publish.Start
+} RtmpPubConnectTiming;
+
+typedef struct {
+        RtmpPubAudioType m_nAudioInputType;
+        RtmpPubAudioType m_nAudioOutputType;
+        RtmpPubTimeStampPolicy m_nTimePolicy;
+        unsigned int m_nTimeout;                // 秒, 连接建立的每个阶段的超时
+        unsigned int m_nChunkSize;              // 0表示4096
+        unsigned int m_nVideoSlots;
+        unsigned int m_nAudioSlots;
+        RtmpPubDropConfig m_drop;
+        RtmpPubPipelineMode m_nPipeline;
+        RtmpPubReconnectConfig m_reconnect;     // 开启GOP缓存时, 推流开始之前投递的帧也只保留最近一个GOP
+} RtmpPubSessionConfig;
+
+typedef struct {
+        RtmpPubSessionState m_nState;
+        RtmpPubRingStats m_video;
+        RtmpPubRingStats m_audio;
+        unsigned long long m_nWritevCalls;
+        unsigned long long m_nMessages;
+        unsigned long long m_nBytes;
+        unsigned long long m_nSendErrors;
+        unsigned long long m_nReconnects;
+        RtmpPubConnectTiming m_timing;          // 最近一次进入PUBLISHING时的连接耗时, 之前全为0
+} RtmpPubSessionStats;
+
+// _nWorkers为0时取cpu个数, worker线程依次绑定到各个cpu
+RtmpPubEngine * RtmpPubEngineNew(unsigned int _nWorkers);
+/*
+ * worker写socket的方式, 需要在RtmpPubEngineStart之前设置, 默认socket
+ * io_uring时每个worker一个ring, 一轮事件里所有session的发送只提交一次, 完成事件通过epoll通知,
+ * 某个worker创建ring失败时它退回socket
+ */
+void RtmpPubEngineSetTransport(RtmpPubEngine * _pEngine, RtmpPubTransportType _nType);
+int RtmpPubEngineStart(RtmpPubEngine * _pEngine);
+// 停止所有worker并释放所有session
+void RtmpPubEngineDel(RtmpPubEngine * _pEngine);
+unsigned int RtmpPubEngineGetWorkers(RtmpPubEngine * _pEngine);
+// 所有worker的传输层计数之和, 返回第一个worker实际使用的传输层的名字
+const char * RtmpPubEngineGetTransport(RtmpPubEngine * _pEngine, RtmpPubTransportStats * _pStats);
+
+/*
+ * 新建一路推流并开始连接, 在调用线程里解析url和域名, 之后的工作都交给绑定的worker
+ * 连接完成之前投递的帧会在队列里等待
+ */
+RtmpPubSession * RtmpPubEngineAddSession(RtmpPubEngine * _pEngine, const char * _pUrl, const RtmpPubSessionConfig * _pConfig);
+// 关闭并释放session, 调用之前生产者必须已经停止投递, 返回后不能再使用_pSession
+void RtmpPubEngineCloseSession(RtmpPubSession * _pSession);
+
+// 和RtmpPubSender一样, 每个轨道只允许一个生产者线程
+int RtmpPubSessionPushVideo(RtmpPubSession * _pSession, const char * _pData, unsigned int _nSize, unsigned int _nPts, int _bIsKey);
+int RtmpPubSessionPushAudio(RtmpPubSession * _pSession, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+// 不拷贝, 同RtmpPubSenderPushVideoBuffer
+int RtmpPubSessionPushVideoBuffer(RtmpPubSession * _pSession, RtmpPubBuffer * _pBuffer, unsigned int _nPts, int _bIsKey);
+int RtmpPubSessionPushAudioBuffer(RtmpPubSession * _pSession, RtmpPubBuffer * _pBuffer, unsigned int _nPts);
+int RtmpPubSessionPushAudioConfig(RtmpPubSession * _pSession, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+// 带adts头的aac, 同RtmpPubSenderPushAdts
+int RtmpPubSessionPushAdts(RtmpPubSession * _pSession, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+
+RtmpPubSessionState RtmpPubSessionGetState(RtmpPubSession * _pSession);
+void RtmpPubSessionGetStats(RtmpPubSession * _pSession, RtmpPubSessionStats * _pStats);
+// 各阶段耗时和每个轨道的计数
+void RtmpPubSessionGetMetrics(RtmpPubSession * _pSession, RtmpPubMetricsSnapshot * _pSnapshot);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
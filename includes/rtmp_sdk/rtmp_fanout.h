@@ -0,0 +1,40 @@
+#ifndef __RTMP_FANOUT__
+#define __RTMP_FANOUT__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "rtmp_engine.h"
+
+#define RTMP_PUB_FANOUT_MAX_PARAM_SET   256     // sps/pps的最大长度
+
+/*
+ * 同一路编码数据推给多个地址(主备ingest、多个cdn)
+ * annexb转avcc和flv video tag封装只在投递线程里做一次, 结果放在一个带引用计数的缓冲里,
+ * 每个目的地的session只持有引用, 各自有独立的队列、丢帧策略、重连和GOP缓存,
+ * 某个目的地变慢只会让它自己的队列变深/丢帧, 不影响其它目的地
+ * 只支持aac输入输出, 音频帧也是共享同一个缓冲
+ * 和session一样, 视频和音频各自只允许一个投递线程
+ */
+typedef struct RtmpPubFanout RtmpPubFanout;
+
+// 为每个url新建一个session, 都使用_pConfig, 任何一个创建失败都返回NULL
+RtmpPubFanout * RtmpPubFanoutNew(RtmpPubEngine * _pEngine, const char * const * _pUrls, unsigned int _nCount,
+                                 const RtmpPubSessionConfig * _pConfig);
+// 关闭所有session, 调用之前投递线程必须已经停止
+void RtmpPubFanoutDel(RtmpPubFanout * _pFanout);
+unsigned int RtmpPubFanoutGetCount(RtmpPubFanout * _pFanout);
+// 用于查询单个目的地的状态和统计
+RtmpPubSession * RtmpPubFanoutGetSession(RtmpPubFanout * _pFanout, unsigned int _nIndex);
+
+// 返回成功入队的目的地个数, 格式错误返回-1; 码流里有IDR或者_bIsKey为1时都作为关键帧投递
+int RtmpPubFanoutPushVideo(RtmpPubFanout * _pFanout, const char * _pData, unsigned int _nSize, unsigned int _nPts, int _bIsKey);
+int RtmpPubFanoutPushAudio(RtmpPubFanout * _pFanout, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+int RtmpPubFanoutPushAudioConfig(RtmpPubFanout * _pFanout, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+// 带adts头的aac, 配置变化时所有目的地都重新发送; 返回投递的帧数, 格式错误或者分配失败返回-1
+int RtmpPubFanoutPushAdts(RtmpPubFanout * _pFanout, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
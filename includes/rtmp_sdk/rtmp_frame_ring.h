@@ -0,0 +1,84 @@
+#ifndef __RTMP_FRAME_RING__
+#define __RTMP_FRAME_RING__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stdatomic.h>
+#include "rtmp_buffer_pool.h"
+
+typedef enum {
+        RTMP_PUB_FRAME_VIDEO = 1,
+        RTMP_PUB_FRAME_AUDIO,
+        RTMP_PUB_FRAME_AUDIO_CONFIG,
+        RTMP_PUB_FRAME_VIDEO_TAG,       // 已经封装好的flv video tag body(avcc), 多路分发时只转换一次
+        RTMP_PUB_FRAME_VIDEO_CONFIG,    // AVC sequence header的tag body, 之后的关键帧前发送
+        RTMP_PUB_FRAME_VIDEO_SLICE,     // 一帧里的一部分nalu(annexb), 低延时模式下边编码边发送
+        RTMP_PUB_FRAME_VIDEO_AVCC,      // 一帧avcc格式(4字节长度)的视频, 其它同RTMP_PUB_FRAME_VIDEO
+} RtmpPubFrameType;
+
+// VIDEO_SLICE在一帧里的位置
+#define RTMP_PUB_SLICE_FIRST            0x01
+#define RTMP_PUB_SLICE_LAST             0x02
+
+#define RtmpPubFrameIsConfig(_nType) ((_nType) == RTMP_PUB_FRAME_AUDIO_CONFIG || (_nType) == RTMP_PUB_FRAME_VIDEO_CONFIG)
+
+typedef struct {
+        RtmpPubFrameType m_nType;
+        unsigned int m_nPts;
+        int m_bIsKey;
+        int m_bIsReference;             // 只有VIDEO_TAG使用, 其它类型发送时从码流里解析
+        int m_nSliceFlags;              // 只有VIDEO_SLICE使用, RTMP_PUB_SLICE_*
+        char * m_pData;                 // 即m_pBuffer->m_pData
+        unsigned int m_nSize;
+        RtmpPubBuffer * m_pBuffer;      // 槽位持有一个引用, Release时归还
+        long long int m_nEnqueueTime;   // 入队时刻, 单调时钟, 单位us
+} RtmpPubFrame;
+
+typedef struct {
+        unsigned int m_nDepth;
+        unsigned int m_nHighWater;
+        unsigned long long m_nPushed;
+        unsigned long long m_nDropped;
+} RtmpPubRingStats;
+
+/*
+ * 单生产者单消费者的有界环形队列, 无锁
+ * 生产者: Reserve -> 填充 -> Commit; 消费者: Peek -> 处理 -> Release
+ * 队列满时Reserve返回NULL并计入丢帧
+ * 帧数据放在生产者线程的缓冲池里, 消费者Release之后由池回收, 稳定运行时没有malloc
+ */
+typedef struct {
+        RtmpPubFrame * m_pSlots;
+        unsigned int m_nMask;
+        _Alignas(64) atomic_uint m_nHead;       // 生产者写
+        atomic_uint m_nHighWater;
+        atomic_ullong m_nPushed;
+        atomic_ullong m_nDropped;
+        _Alignas(64) atomic_uint m_nTail;       // 消费者写
+} RtmpPubFrameRing;
+
+// _nSlots会向上取整为2的幂
+int RtmpPubFrameRingInit(RtmpPubFrameRing * _pRing, unsigned int _nSlots);
+void RtmpPubFrameRingDestroy(RtmpPubFrameRing * _pRing);
+
+RtmpPubFrame * RtmpPubFrameRingReserve(RtmpPubFrameRing * _pRing, unsigned int _nSize);
+// 不拷贝数据, 槽位增加_pBuffer的一个引用, 帧长度是_pBuffer->m_nSize
+RtmpPubFrame * RtmpPubFrameRingReserveBuffer(RtmpPubFrameRing * _pRing, RtmpPubBuffer * _pBuffer);
+void RtmpPubFrameRingCommit(RtmpPubFrameRing * _pRing);
+
+RtmpPubFrame * RtmpPubFrameRingPeek(RtmpPubFrameRing * _pRing);
+void RtmpPubFrameRingRelease(RtmpPubFrameRing * _pRing);
+// 批量发送时使用: 查看队头之后的第_nIndex帧, 发送完成后一次释放_nCount帧
+RtmpPubFrame * RtmpPubFrameRingPeekAt(RtmpPubFrameRing * _pRing, unsigned int _nIndex);
+void RtmpPubFrameRingReleaseN(RtmpPubFrameRing * _pRing, unsigned int _nCount);
+
+void RtmpPubFrameRingGetStats(RtmpPubFrameRing * _pRing, RtmpPubRingStats * _pStats);
+
+long long int RtmpPubNowUs(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,59 @@
+#ifndef __RTMP_HEVC__
+#define __RTMP_HEVC__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "rtmp_publish.h"
+#include "rtmp_publish_nalu.h"
+#include "rtmp_chunk_writer.h"
+
+typedef enum {
+        RTMP_PUB_VIDEO_H264 = 0,
+        RTMP_PUB_VIDEO_HEVC,
+} RtmpPubVideoCodec;
+
+/*
+ * hevc按Enhanced RTMP(FourCC hvc1)发送:
+ * sequence header是PacketType SequenceStart + HEVCDecoderConfigurationRecord,
+ * 帧是CodedFramesX(没有B帧, composition time为0), 和avc一样每个nalu前加4字节长度, nalu数据不拷贝
+ * sdk只认识h264, vps/sps/pps不放在RtmpPubContext里, 由这里缓存, 按原始字节比较,
+ * 任何一个变化时重新生成record, 下一个关键帧之前重新发送
+ * sequence header是否已经发送仍然用RtmpPubContext的m_nIsVideoConfigSent, 重连时和avc一样被重置
+ * 不是线程安全的, 只在发送线程里使用
+ */
+typedef struct {
+        RtmpPubNalUnit m_vps;
+        RtmpPubNalUnit m_sps;
+        RtmpPubNalUnit m_pps;
+        unsigned int m_nTemporalLayers;         // 当前sps的sps_max_sub_layers_minus1 + 1, 解析失败时为0
+        char * m_pConfig;                       // sequence header的tag body
+        unsigned int m_nConfig;                 // 0表示参数集变了, 发送前重新生成
+        unsigned long long m_nChanges;          // 开始推流之后参数集变化的次数
+} RtmpPubHevcParams;
+
+void RtmpPubHevcParamsInit(RtmpPubHevcParams * _pParams);
+void RtmpPubHevcParamsDestroy(RtmpPubHevcParams * _pParams);
+
+// 用给定的vps/sps/pps生成sequence header的tag body, 参数集不全或者sps解析失败时大小返回0
+unsigned int RtmpPubGetHevcRecordSize(const RtmpPubNalUnit * _pVps, const RtmpPubNalUnit * _pSps, const RtmpPubNalUnit * _pPps);
+int RtmpPubBuildHevcRecord(const RtmpPubNalUnit * _pVps, const RtmpPubNalUnit * _pSps, const RtmpPubNalUnit * _pPps,
+                           char * _pBody);
+
+/*
+ * 同RtmpPubPrepareVideoFrame, 但按hevc的nalu头解析:
+ * vps/sps/pps存入_pParams, _pNalus里只留下slice和sei(m_nType是hevc的nalu类型), 返回它们的个数
+ * IRAP(BLA/IDR/CRA)帧是关键帧, 最高时间层的sub-layer non-reference帧是非参考帧
+ */
+int RtmpPubPrepareHevcFrame(RtmpPubContext * _pRtmp, RtmpPubHevcParams * _pParams, char * _pData, unsigned int _nSize,
+                            RtmpPubAuFormat _nFormat, unsigned int _nPts, int _bInPlace, RtmpPubNaluSpan * _pNalus,
+                            unsigned int _nMaxNalus, int * _pTimebaseSet, int * _pIsKey, int * _pIsReference);
+
+// 同RtmpPubWriteVideoNalus, 关键帧且sequence header尚未发送时先发送, 数据拷贝到_pWriter的scratch里
+int RtmpPubWriteHevcNalus(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, RtmpPubHevcParams * _pParams,
+                          const RtmpPubNaluSpan * _pNalus, unsigned int _nCount, int _bIsKey, unsigned int _presentationTime);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
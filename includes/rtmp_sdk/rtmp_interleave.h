@@ -0,0 +1,84 @@
+#ifndef __RTMP_INTERLEAVE__
+#define __RTMP_INTERLEAVE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdatomic.h>
+
+#define RTMP_PUB_INTERLEAVE_MAX_TRACKS  4
+
+/*
+ * 音视频由两个独立的线程采集, 到达发送线程的先后和时间戳的先后不一定一致,
+ * 某个轨道抖动时直接按到达顺序发送, 服务端会收到时间戳回退的消息
+ * 交错器在一个时间窗口内等待其它轨道, 按时间戳顺序决定下一个发送哪个轨道的队头:
+ *   每个轨道自己按fifo排队(比如sender的ring), 这里只记录各轨道的队头时间戳, 按它建最小堆
+ *   堆顶的帧在以下情况可以发送:
+ *     其它每个轨道要么也有队头(堆顶就是最小的), 要么已经发出过不早于它的帧,
+ *     要么从来没有出现过, 要么超过m_nSilenceMs没有新帧(静默, 立即放行, 不再等它)
+ *   否则最多等m_nWindowMs, 超时强制发出, 之后迟到的帧时间戳会回退, 计入m_nLate
+ * 时间戳按32位回绕比较, 同一轨道内要求单调(没有B帧的dts), 回退时按上一帧算
+ * 不是线程安全的, 只在发送线程里使用, 计数可以通过RtmpPubInterleaverGetStats在其它线程读取
+ */
+typedef struct {
+        unsigned int m_nWindowMs;               // 队头最多等待其它轨道的时间, 0表示不等待, 只在已经到达的帧里取最小的
+        unsigned int m_nSilenceMs;              // 轨道超过这么久没有新帧就不再等它, 0表示等于m_nWindowMs
+} RtmpPubInterleaveConfig;
+
+typedef struct {
+        int m_bHasHead;
+        int m_bSeen;                            // 出现过至少一帧
+        int m_bHeld;                            // 当前队头因为等待其它轨道没有发出
+        int m_nHeapIndex;                       // 不在堆里时为-1
+        unsigned int m_nDts;                    // 队头(或者最近一个队头)的时间戳
+        long long int m_nArrivalUs;             // 队头(或者最近一个队头)的到达时间
+        long long int m_nHeldSinceUs;           // 第一次因为等待没有发出的时间
+} RtmpPubInterleaveTrack;
+
+typedef struct {
+        RtmpPubInterleaveConfig m_config;
+        unsigned int m_nTracks;
+        RtmpPubInterleaveTrack m_tracks[RTMP_PUB_INTERLEAVE_MAX_TRACKS];
+        unsigned int m_heap[RTMP_PUB_INTERLEAVE_MAX_TRACKS];
+        unsigned int m_nHeap;
+        int m_bEmitted;
+        unsigned int m_nLastDts;                // 最近发出的一帧
+        atomic_ullong m_nFrames;
+        atomic_ullong m_nHeld;
+        atomic_ullong m_nForced;
+        atomic_ullong m_nLate;
+        atomic_ullong m_nHoldUs;
+        atomic_ullong m_nMaxHoldUs;
+} RtmpPubInterleaver;
+
+typedef struct {
+        unsigned long long m_nFrames;
+        unsigned long long m_nHeld;             // 等待过其它轨道的帧数
+        unsigned long long m_nForced;           // 等待超时强制发出的帧数
+        unsigned long long m_nLate;             // 时间戳比已经发出的帧小的帧数
+        unsigned long long m_nHoldUs;           // 等待的总时长, 也就是交错带来的额外延时
+        unsigned long long m_nMaxHoldUs;
+} RtmpPubInterleaveStats;
+
+// _pConfig为NULL时不等待, _nTracks不超过RTMP_PUB_INTERLEAVE_MAX_TRACKS
+void RtmpPubInterleaverInit(RtmpPubInterleaver * _pInterleaver, unsigned int _nTracks, const RtmpPubInterleaveConfig * _pConfig);
+
+#define RtmpPubInterleaverHasHead(i, t) ((i)->m_tracks[t].m_bHasHead)
+// 轨道_nTrack有了新的队头(队列从空变为非空, 或者上一个队头已经Pop), _nArrivalUs是它的到达时间
+void RtmpPubInterleaverPush(RtmpPubInterleaver * _pInterleaver, unsigned int _nTrack, unsigned int _nDts, long long int _nArrivalUs);
+/*
+ * 返回现在应当发送队头的轨道, 没有可以发送的返回-1,
+ * 此时*_pWaitUs是堆顶最晚还要等多久(之后再调用一次), 没有任何队头时是-1
+ */
+int RtmpPubInterleaverNext(RtmpPubInterleaver * _pInterleaver, long long int _nNowUs, long long int * _pWaitUs);
+/*
+ * 取走轨道_nTrack的队头, 一般是Next返回的轨道, 也可以由调用者直接指定(比如正在发送一帧的slice)
+ * Next返回轨道之后应当接着Pop, 返回这一帧因为等待其它轨道多出的延时(us)
+ */
+unsigned long long RtmpPubInterleaverPop(RtmpPubInterleaver * _pInterleaver, unsigned int _nTrack, long long int _nNowUs);
+void RtmpPubInterleaverGetStats(RtmpPubInterleaver * _pInterleaver, RtmpPubInterleaveStats * _pStats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,94 @@
+#ifndef __RTMP_METADATA__
+#define __RTMP_METADATA__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "rtmp_publish.h"
+#include "rtmp_chunk_writer.h"
+#include "rtmp_amf_template.h"
+
+#define RTMP_PUB_META_MAX_SPS           256     // 超过的sps不解析
+#define RTMP_PUB_META_MAX_AAC           8
+
+typedef struct {
+        unsigned int m_nProfile;
+        unsigned int m_nLevel;
+        unsigned int m_nWidth;                  // 已经减去裁剪
+        unsigned int m_nHeight;
+        double m_fFrameRate;                    // vui里没有timing信息时为0
+} RtmpPubSpsInfo;
+
+// _pData是不带startcode的sps nalu(包括nalu头), 格式错误返回-1
+int RtmpPubParseSps(const char * _pData, unsigned int _nSize, RtmpPubSpsInfo * _pInfo);
+
+typedef struct {
+        unsigned int m_nProfileSpace;
+        unsigned int m_nTier;
+        unsigned int m_nProfile;
+        uint32_t m_nCompatibility;              // general_profile_compatibility_flags
+        uint8_t m_constraints[6];               // general_constraint_indicator_flags, 原样拷贝
+        unsigned int m_nLevel;
+        unsigned int m_nChromaFormat;
+        unsigned int m_nBitDepthLuma;
+        unsigned int m_nBitDepthChroma;
+        unsigned int m_nTemporalLayers;         // sps_max_sub_layers_minus1 + 1
+        int m_bTemporalIdNested;
+        unsigned int m_nWidth;                  // 已经减去conformance window
+        unsigned int m_nHeight;
+} RtmpPubHevcSpsInfo;
+
+// hevc的sps(包括2字节nalu头), 只解析到位深为止, 生成HEVCDecoderConfigurationRecord和宽高够用
+int RtmpPubParseHevcSps(const char * _pData, unsigned int _nSize, RtmpPubHevcSpsInfo * _pInfo);
+
+typedef struct {
+        unsigned int m_nObjectType;             // 2: LC, 5: SBR(HE-AAC)
+        unsigned int m_nSampleRate;             // 有SBR时是输出采样率
+        unsigned int m_nChannels;
+} RtmpPubAacInfo;
+
+// AudioSpecificConfig, 格式错误返回-1
+int RtmpPubParseAacConfig(const char * _pData, unsigned int _nSize, RtmpPubAacInfo * _pInfo);
+
+/*
+ * 根据sps和AudioSpecificConfig自动生成onMetaData
+ * 播放器拿不到宽高、帧率和采样率时要多探测一段数据才开始播放
+ * 每次设置时只比较原始字节, 相同就不再解析; 解析出来的参数变了才需要重新发送
+ * 新的连接上在第一帧之前发送一次, 不是线程安全的, 只在发送线程里使用
+ */
+typedef struct {
+        double m_values[RTMP_PUB_META_FIELDS];
+        char m_sps[RTMP_PUB_META_MAX_SPS];      // 上一次解析的sps
+        unsigned int m_nSps;
+        char m_aac[RTMP_PUB_META_MAX_AAC];
+        unsigned int m_nAac;
+        int m_bHasVideo;
+        int m_bHasAudio;
+        int m_bChanged;                         // m_values变了还没有发送
+        int m_bSent;                            // 当前连接上已经发送过
+} RtmpPubMetadata;
+
+void RtmpPubMetadataInit(RtmpPubMetadata * _pMeta);
+// 新连接上需要重新发送
+void RtmpPubMetadataReset(RtmpPubMetadata * _pMeta);
+
+void RtmpPubMetadataSetSps(RtmpPubMetadata * _pMeta, const char * _pSps, unsigned int _nSize);
+// hevc的sps, videocodecid是FourCC 'hvc1'(Enhanced RTMP), 不解析vui, 没有帧率
+void RtmpPubMetadataSetHevcSps(RtmpPubMetadata * _pMeta, const char * _pSps, unsigned int _nSize);
+// AVC sequence header的flv tag body, 取出里面的第一个sps
+void RtmpPubMetadataSetAvcConfig(RtmpPubMetadata * _pMeta, const char * _pBody, unsigned int _nSize);
+void RtmpPubMetadataSetAac(RtmpPubMetadata * _pMeta, const char * _pConfig, unsigned int _nSize);
+// 不转码直接发送的g711等, _nCodecId是flv的SoundFormat
+void RtmpPubMetadataSetAudio(RtmpPubMetadata * _pMeta, unsigned int _nCodecId, unsigned int _nSampleRate,
+                             unsigned int _nChannels);
+// 用_pRtmp当前的sps和aac配置更新, 不转码的g711按8k单声道
+void RtmpPubMetadataUpdate(RtmpPubMetadata * _pMeta, RtmpPubContext * _pRtmp);
+
+// 还没有在当前连接上发送或者参数有变化时, 把@setDataFrame加入发送队列, 数据拷贝到_pWriter的scratch里
+int RtmpPubWriteMetadata(RtmpPubChunkWriter * _pWriter, RtmpPubMetadata * _pMeta, int32_t _nStreamId);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,103 @@
+#ifndef __RTMP_METRICS__
+#define __RTMP_METRICS__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdatomic.h>
+
+/*
+ * 一帧从采集回调到写进socket各个阶段的耗时, 以及每个轨道的帧数/字节数/丢帧数
+ * 直方图是HDR风格的对数线性分桶: 每个2的幂区间分成8个桶, 相对误差不超过12.5%, 单位ns
+ * 所有计数只由发送线程(或session所属的worker)写, 写入不需要原子的读改写,
+ * 其它线程随时可以取快照, 快照里各个数之间不保证是同一时刻的
+ */
+#define RTMP_PUB_HISTOGRAM_SUB_BITS     3
+#define RTMP_PUB_HISTOGRAM_MAX_BITS     40      // 超过2^40ns(约18分钟)的记在最后一个桶
+#define RTMP_PUB_HISTOGRAM_BUCKETS      ((RTMP_PUB_HISTOGRAM_MAX_BITS - RTMP_PUB_HISTOGRAM_SUB_BITS + 1) << RTMP_PUB_HISTOGRAM_SUB_BITS)
+
+typedef enum {
+        RTMP_PUB_STAGE_CONVERT,                 // annexb转换, 需要转码的音频是转码加发送
+        RTMP_PUB_STAGE_QUEUE,                   // 入队到发送线程取出
+        RTMP_PUB_STAGE_INTERLEAVE,              // 其中交错器等待其它轨道的时间, 没有等待的帧记0
+        RTMP_PUB_STAGE_SERIALIZE,               // 封装flv tag和chunk, 不包括其中写socket的时间
+        RTMP_PUB_STAGE_SEND,                    // 每次sendmsg系统调用
+        RTMP_PUB_STAGE_COUNT
+} RtmpPubStage;
+
+typedef enum {
+        RTMP_PUB_TRACK_VIDEO,
+        RTMP_PUB_TRACK_AUDIO,
+        RTMP_PUB_TRACK_COUNT
+} RtmpPubTrack;
+
+typedef enum {
+        RTMP_PUB_METRICS_TEXT,
+        RTMP_PUB_METRICS_PROMETHEUS,
+} RtmpPubMetricsFormat;
+
+typedef struct {
+        atomic_uint m_nBuckets[RTMP_PUB_HISTOGRAM_BUCKETS];
+        atomic_ullong m_nSum;
+        atomic_ullong m_nMax;
+} RtmpPubHistogram;
+
+typedef struct {
+        atomic_ullong m_nFrames;
+        atomic_ullong m_nBytes;
+        atomic_ullong m_nDropped;               // 发送线程丢弃的帧, 不包括队列满时生产者丢弃的
+} RtmpPubTrackMetrics;
+
+typedef struct {
+        RtmpPubHistogram m_stages[RTMP_PUB_STAGE_COUNT];
+        RtmpPubTrackMetrics m_tracks[RTMP_PUB_TRACK_COUNT];
+} RtmpPubMetrics;
+
+typedef struct {
+        unsigned long long m_nCount;
+        unsigned long long m_nSum;
+        unsigned long long m_nMax;
+        unsigned int m_nBuckets[RTMP_PUB_HISTOGRAM_BUCKETS];
+} RtmpPubHistogramSnapshot;
+
+typedef struct {
+        unsigned long long m_nFrames;
+        unsigned long long m_nBytes;
+        unsigned long long m_nDropped;          // 包括队列满丢弃的
+} RtmpPubTrackSnapshot;
+
+typedef struct {
+        RtmpPubHistogramSnapshot m_stages[RTMP_PUB_STAGE_COUNT];
+        RtmpPubTrackSnapshot m_tracks[RTMP_PUB_TRACK_COUNT];
+        unsigned long long m_nReconnects;
+        unsigned long long m_nSendErrors;
+} RtmpPubMetricsSnapshot;
+
+long long int RtmpPubNowNs(void);
+
+void RtmpPubMetricsInit(RtmpPubMetrics * _pMetrics);
+// 以下三个只能由同一个线程调用
+void RtmpPubHistogramRecord(RtmpPubHistogram * _pHistogram, unsigned long long _nValue);
+void RtmpPubMetricsAddFrame(RtmpPubMetrics * _pMetrics, RtmpPubTrack _nTrack, unsigned int _nBytes);
+void RtmpPubMetricsAddDrop(RtmpPubMetrics * _pMetrics, RtmpPubTrack _nTrack);
+#define RtmpPubMetricsRecord(_pMetrics, _nStage, _nValue) RtmpPubHistogramRecord(&(_pMetrics)->m_stages[_nStage], _nValue)
+
+// 快照里的丢帧数只有发送线程丢弃的部分, 调用者再加上队列的丢帧数
+void RtmpPubMetricsGetSnapshot(RtmpPubMetrics * _pMetrics, RtmpPubMetricsSnapshot * _pSnapshot);
+// 多路汇总
+void RtmpPubMetricsMerge(RtmpPubMetricsSnapshot * _pDst, const RtmpPubMetricsSnapshot * _pSrc);
+// 返回不小于_fPercentile(0~100)分位的值, 精度是所在桶的上界
+unsigned long long RtmpPubHistogramPercentile(const RtmpPubHistogramSnapshot * _pHistogram, double _fPercentile);
+
+/*
+ * 把_nCount路的快照格式化到_pBuf, _pNames是每一路的名字(prometheus里的stream标签)
+ * 返回写入的长度, _pBuf不够时返回-1
+ * prometheus格式的直方图使用固定的le, 每个le只统计上界不超过它的桶
+ */
+int RtmpPubMetricsDump(RtmpPubMetricsFormat _nFormat, const RtmpPubMetricsSnapshot * _pSnapshots, const char * const * _pNames,
+                       unsigned int _nCount, char * _pBuf, unsigned int _nSize);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,30 @@
+#ifndef __RTMP_PUBLISH_AUDIO__
+#define __RTMP_PUBLISH_AUDIO__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "rtmp_publish.h"
+#include "rtmp_chunk_writer.h"
+
+/*
+ * 设置AudioSpecificConfig, 和当前的不同时在下一个音频帧之前重新发送sequence header
+ * RtmpPubSetAac只保存配置, 已经发送过就不会再发送, 中途变化的配置需要用这个接口
+ */
+void RtmpPubUpdateAac(RtmpPubContext * _pRtmp, const char * _pData, unsigned int _nSize);
+
+/*
+ * 不带adts头的aac帧作为flv audio tag加入_pWriter的发送队列, 帧数据不拷贝
+ * AudioSpecificConfig(RtmpPubSetAac设置)尚未发送时先发送AAC sequence header
+ * 输入和输出都是aac时才能使用
+ */
+int RtmpPubWriteAacFrame(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, const char * _pData, unsigned int _nSize,
+                         unsigned int _presentationTime);
+// 同上, 但帧数据拷贝到_pWriter的scratch里, 调用返回后_pData就可以复用, 用于转码输出这类小帧
+int RtmpPubWriteAacFrameCopy(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, const char * _pData, unsigned int _nSize,
+                             unsigned int _presentationTime);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
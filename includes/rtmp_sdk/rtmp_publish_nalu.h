@@ -0,0 +1,102 @@
+#ifndef __RTMP_PUBLISH_NALU__
+#define __RTMP_PUBLISH_NALU__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "rtmp_publish.h"
+#include "rtmp_chunk_writer.h"
+
+#define RTMP_PUB_MAX_TAG_NALUS          64
+
+// 一个nalu在原始码流中的位置, 不拥有数据
+typedef struct {
+        int m_nType;
+        const char * m_pData;           // 指向nalu头(不包含startcode/长度)
+        unsigned int m_nSize;
+        int m_bPrefixed;                // m_pData前4字节已经是大端的nalu长度
+} RtmpPubNaluSpan;
+
+// 一帧视频(access unit)的格式
+typedef enum {
+        RTMP_PUB_AU_ANNEXB = 0,                 // startcode分隔
+        RTMP_PUB_AU_AVCC,                       // 每个nalu前4字节大端长度, mp4和一些硬件编码器的输出
+} RtmpPubAuFormat;
+
+/*
+ * sps/pps的64位哈希, 每个关键帧都带参数集, 和上一次相同时不再交给sdk,
+ * 变化时才重新发送AVC sequence header, 哈希为0表示还没有收到过
+ */
+typedef struct {
+        uint64_t m_nSpsHash;
+        uint64_t m_nPpsHash;
+        unsigned long long m_nChanges;          // 开始推流之后参数集变化的次数
+} RtmpPubAvcParamState;
+
+typedef enum {
+        RTMP_PUB_STARTCODE_SCALAR = 0,
+        RTMP_PUB_STARTCODE_SSE2,
+        RTMP_PUB_STARTCODE_AVX2,
+        RTMP_PUB_STARTCODE_NEON,
+} RtmpPubStartcodeKernel;
+
+// 返回startcode的起始位置(4字节startcode返回前导的0), 没找到返回_pEnd
+const uint8_t * RtmpPubFindStartcode(const uint8_t * _pStart, const uint8_t * _pEnd);
+
+// 默认在第一次扫描时按cpu能力自动选择最快的kernel, 这里可以强制指定, cpu不支持时返回-1
+int RtmpPubSelectStartcodeKernel(RtmpPubStartcodeKernel _nKernel);
+RtmpPubStartcodeKernel RtmpPubGetStartcodeKernel(void);
+const char * RtmpPubGetStartcodeKernelName(RtmpPubStartcodeKernel _nKernel);
+
+/*
+ * 原地将annexb格式的一帧转换为nalu列表, 不拷贝数据
+ * 4字节startcode会被直接改写为大端的nalu长度(m_bPrefixed = 1),
+ * 3字节startcode的nalu只记录位置, 发送时再补长度
+ * 返回nalu个数, _nMaxNalus不够用时返回-1
+ */
+int RtmpPubAnnexbToNalus(char * _pData, unsigned int _nSize, RtmpPubNaluSpan * _pNalus, unsigned int _nMaxNalus);
+// 同上, 但不修改数据, 所有nalu都是m_bPrefixed = 0, 用于多处共享的帧缓冲
+int RtmpPubAnnexbParseNalus(const char * _pData, unsigned int _nSize, RtmpPubNaluSpan * _pNalus, unsigned int _nMaxNalus);
+
+// avcc格式的一帧转换为nalu列表, 长度已经就位, 所有nalu都是m_bPrefixed = 1, 长度越界或者_nMaxNalus不够用时返回-1
+int RtmpPubAvccParseNalus(const char * _pData, unsigned int _nSize, RtmpPubNaluSpan * _pNalus, unsigned int _nMaxNalus);
+// 按_nFormat转换一帧, annexb时_bInPlace为1同RtmpPubAnnexbToNalus, 为0同RtmpPubAnnexbParseNalus
+int RtmpPubAccessUnitToNalus(char * _pData, unsigned int _nSize, RtmpPubAuFormat _nFormat, int _bInPlace,
+                             RtmpPubNaluSpan * _pNalus, unsigned int _nMaxNalus);
+
+// 不修改数据, 判断一帧annexb是否是IDR, 扫描到第一个slice为止
+int RtmpPubAnnexbIsIdr(const char * _pData, unsigned int _nSize);
+
+/*
+ * 将多个nalu打包成一个flv video tag发送, 从nalu所在的内存到rtmp packet只有一次拷贝
+ * 关键帧且sps/pps尚未发送时会先发送AVC sequence header
+ */
+int RtmpPubSendVideoNalus(RtmpPubContext * _pRtmp, const RtmpPubNaluSpan * _pNalus, unsigned int _nCount, int _bIsKey,
+                                                                unsigned int _presentationTime);
+
+/*
+ * 同RtmpPubSendVideoNalus, 但不拷贝nalu数据, 而是作为iovec加入_pWriter的发送队列,
+ * 调用者在RtmpPubChunkWriterFlush之前要保证nalu所在的内存有效
+ * 一个tag最多RTMP_PUB_MAX_TAG_NALUS个nalu
+ */
+int RtmpPubWriteVideoNalus(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, const RtmpPubNaluSpan * _pNalus,
+                           unsigned int _nCount, int _bIsKey, unsigned int _presentationTime);
+
+/*
+ * 把nalu列表封装成完整的flv video tag body(5字节头 + 每个nalu前加4字节长度), 只拷贝一次
+ * _pBody至少要有RtmpPubGetVideoTagSize字节, 返回写入的字节数
+ */
+unsigned int RtmpPubGetVideoTagSize(const RtmpPubNaluSpan * _pNalus, unsigned int _nCount);
+unsigned int RtmpPubBuildVideoTag(const RtmpPubNaluSpan * _pNalus, unsigned int _nCount, int _bIsKey, char * _pBody);
+
+/*
+ * 发送RtmpPubBuildVideoTag封装好的tag, 不拷贝, 只重新计算时间戳
+ * 关键帧且sequence header尚未发送时先发送_pConfig(AVC sequence header的tag body)
+ */
+int RtmpPubWriteVideoTag(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, const char * _pConfig, unsigned int _nConfigSize,
+                         const char * _pTag, unsigned int _nSize, int _bIsKey, unsigned int _presentationTime);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,155 @@
+#ifndef __RTMP_PUBLISH_SENDER__
+#define __RTMP_PUBLISH_SENDER__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <pthread.h>
+#include <semaphore.h>
+#include "rtmp_publish.h"
+#include "rtmp_publish_nalu.h"
+#include "rtmp_frame_ring.h"
+#include "rtmp_drop_policy.h"
+#include "rtmp_chunk_writer.h"
+#include "rtmp_reconnect.h"
+#include "rtmp_metrics.h"
+#include "rtmp_transcode.h"
+#include "rtmp_metadata.h"
+#include "rtmp_adts.h"
+#include "rtmp_slice.h"
+#include "rtmp_interleave.h"
+#include "rtmp_hevc.h"
+#include "rtmp_transport.h"
+
+#define RTMP_PUB_SENDER_MAX_NALUS       RTMP_PUB_MAX_TAG_NALUS
+#define RTMP_PUB_SENDER_MAX_BATCH       16
+
+/*
+ * 采集回调和网络发送解耦:
+ * 采集线程只把帧拷贝(或者引用)进对应轨道的无锁队列, 由独立的发送线程按时间戳顺序取出并发送,
+ * 网络阻塞时只会让队列变深/丢帧, 不会阻塞采集回调
+ * 每个轨道只允许一个生产者线程, 两个轨道之间按时间戳交错, 可以设置等待迟到轨道的窗口
+ * 队列里积压了多帧时, 最多RTMP_PUB_SENDER_MAX_BATCH帧合并成一次writev发送
+ * 开启重连后, 连接断开时发送线程自己按退避时间重新RtmpPubConnect, 采集线程不受影响
+ */
+typedef struct {
+        RtmpPubContext * m_pRtmp;
+        RtmpPubFrameRing m_video;
+        RtmpPubFrameRing m_audio;
+        sem_t m_wakeup;
+        pthread_t m_thread;
+        atomic_int m_bRunning;
+        atomic_ullong m_nSendErrors;
+        atomic_ullong m_nWritevCalls;
+        atomic_ullong m_nMessages;
+        atomic_ullong m_nBytes;
+        atomic_ullong m_nReconnects;
+        atomic_ullong m_nParamChanges;          // m_avc和m_hevc里变化次数之和, 发送线程维护
+        // 以下只在发送线程访问
+        int m_bVideoTimebaseSet;
+        RtmpPubAvcParamState m_avc;
+        RtmpPubDropPolicy m_drop;
+        RtmpPubNaluSpan m_nalus[RTMP_PUB_SENDER_MAX_NALUS];
+        RtmpPubChunkWriter m_writer;
+        unsigned int m_nVideoInFlight;          // 已经加入m_writer但还没有Flush的帧数
+        unsigned int m_nAudioInFlight;
+        RtmpPubBackoff m_backoff;
+        RtmpPubGopCache m_cache;
+        RtmpPubGopCache m_replay;               // 重发时引用的GOP, 重发过程中m_cache可能被清空
+        int m_bConnected;
+        int m_bWaitKey;                         // 重连之后音视频都从第一个视频关键帧开始发送
+        int m_nChunkSize;                       // 重连之后重新协商
+        RtmpPubMetrics m_metrics;               // 只由发送线程写
+        RtmpPubTranscoder m_transcoder;         // g711/pcm输入转aac
+        RtmpPubMetadata m_metadata;
+        RtmpPubSliceTag m_slice;                // 低延时模式下正在发送的一帧
+        RtmpPubInterleaver m_interleave;        // 轨道序号是RTMP_PUB_TRACK_VIDEO/AUDIO
+        RtmpPubVideoCodec m_nVideoCodec;
+        RtmpPubHevcParams m_hevc;               // hevc的vps/sps/pps
+        RtmpPubTransportType m_nTransportType;
+        RtmpPubTransport * m_pTransport;        // Start时按m_nTransportType创建, 同步模式
+        RtmpPubAdtsDemuxer m_adts;              // 只由音频投递线程访问
+        // 以下只由视频投递线程访问
+        int m_bSliceOpen;                       // 上一个slice不是一帧的最后一个
+        int m_bSliceDropped;                    // 这一帧有slice入队失败
+} RtmpPubSender;
+
+RtmpPubSender * RtmpPubSenderNew(RtmpPubContext * _pRtmp, unsigned int _nVideoSlots, unsigned int _nAudioSlots);
+// 拥塞丢帧策略, 需要在RtmpPubSenderStart之前设置, 默认不丢帧
+void RtmpPubSenderSetDropPolicy(RtmpPubSender * _pSender, const RtmpPubDropConfig * _pConfig);
+// 断线重连和GOP缓存, 需要在RtmpPubSenderStart之前设置, 默认不重连
+void RtmpPubSenderSetReconnect(RtmpPubSender * _pSender, const RtmpPubReconnectConfig * _pConfig);
+/*
+ * 低延时模式下每帧声明的flv tag长度, 需要在RtmpPubSenderStart之前设置
+ * 编码器有vbv限制时按它的最大帧大小设置, 就不会出现超出预算丢slice的情况; 都为0时按最近的帧自动估计(默认)
+ */
+void RtmpPubSenderSetSliceBudget(RtmpPubSender * _pSender, unsigned int _nKeyBytes, unsigned int _nInterBytes);
+/*
+ * 音视频交错的等待窗口, 需要在RtmpPubSenderStart之前设置, 默认(NULL)不等待, 两个队列里谁的时间戳小先发谁
+ * 采集线程抖动较大时设置窗口, 一个轨道的帧最多多等m_nWindowMs, 另一个轨道静默超过m_nSilenceMs就不再等它
+ */
+void RtmpPubSenderSetInterleave(RtmpPubSender * _pSender, const RtmpPubInterleaveConfig * _pConfig);
+// 视频编码格式, 需要在RtmpPubSenderStart之前设置, 默认h264; hevc按Enhanced RTMP发送, 服务端和播放器需要支持
+void RtmpPubSenderSetVideoCodec(RtmpPubSender * _pSender, RtmpPubVideoCodec _nCodec);
+/*
+ * 发送线程写socket的方式, 需要在RtmpPubSenderStart之前设置, 默认socket
+ * io_uring只有一个连接时没有可以合并的提交, 主要省的是大关键帧的拷贝(零拷贝), 不支持时退回socket
+ */
+void RtmpPubSenderSetTransport(RtmpPubSender * _pSender, RtmpPubTransportType _nType);
+// 需要在RtmpPubConnect成功之后调用
+int RtmpPubSenderStart(RtmpPubSender * _pSender);
+void RtmpPubSenderDel(RtmpPubSender * _pSender);
+
+/*
+ * 一帧完整的h264(或者hevc, 见RtmpPubSenderSetVideoCodec), annexb或者avcc格式, 关键帧带上sps/pps(hevc还有vps)
+ * 一帧里的所有slice打包成一个flv tag, 参数集和上一次相同时直接跳过, 变化时在下一个关键帧之前重新发送sequence header
+ * 队列满时返回-1(丢帧)
+ */
+int RtmpPubSenderPushAccessUnit(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, RtmpPubAuFormat _nFormat,
+                                unsigned int _nPts, int _bIsKey);
+// 同RtmpPubSenderPushAccessUnit, annexb格式
+int RtmpPubSenderPushVideo(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, unsigned int _nPts, int _bIsKey);
+/*
+ * 低延时模式: 编码器每输出一个或几个slice(annexb, 关键帧的第一个slice可以带sps/pps)就投递一次,
+ * 同一帧的slice时间戳相同, 最后一个slice的_bIsLast为1
+ * 发送线程收到第一个slice就开始发送, 不用等整帧编码完, 长度声明和退化情况见RtmpPubSliceTag
+ * 某个slice入队失败时这一帧剩下的slice都返回-1, 已经发出的部分由发送线程补齐
+ * 和RtmpPubSenderPushVideo不能在同一帧里混用, 只支持h264
+ */
+int RtmpPubSenderPushSlice(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, unsigned int _nPts, int _bIsKey,
+                           int _bIsLast);
+// 不带adts头的aac
+int RtmpPubSenderPushAudio(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+/*
+ * 不拷贝, 队列持有_pBuffer的一个引用, 帧长度是_pBuffer->m_nSize, 调用者仍然持有自己的引用
+ * 同一个缓冲可以推给多个sender/session; 入队之后调用者不能再修改数据
+ */
+int RtmpPubSenderPushVideoBuffer(RtmpPubSender * _pSender, RtmpPubBuffer * _pBuffer, unsigned int _nPts, int _bIsKey);
+int RtmpPubSenderPushAudioBuffer(RtmpPubSender * _pSender, RtmpPubBuffer * _pBuffer, unsigned int _nPts);
+// AudioSpecificConfig, 和音频帧走同一个队列, 保证在音频帧之前发送
+int RtmpPubSenderPushAudioConfig(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+/*
+ * 带adts头的aac, 可以一次投递多帧, 第一帧的时间戳是_nPts
+ * AudioSpecificConfig从adts头生成, 第一次和中途变化时自动在对应的帧之前投递
+ * 返回入队的帧数, 有帧丢弃或者格式错误返回-1
+ */
+int RtmpPubSenderPushAdts(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, unsigned int _nPts);
+
+void RtmpPubSenderGetStats(RtmpPubSender * _pSender, RtmpPubRingStats * _pVideo, RtmpPubRingStats * _pAudio);
+void RtmpPubSenderGetDropStats(RtmpPubSender * _pSender, RtmpPubDropStats * _pStats);
+void RtmpPubSenderGetInterleaveStats(RtmpPubSender * _pSender, RtmpPubInterleaveStats * _pStats);
+// 开始推流之后视频参数集变化(重新发送sequence header)的次数
+unsigned long long RtmpPubSenderGetParamChanges(RtmpPubSender * _pSender);
+// 累计的writev调用次数、发送的rtmp消息数和字节数
+void RtmpPubSenderGetWriteStats(RtmpPubSender * _pSender, unsigned long long * _pWritevCalls, unsigned long long * _pMessages,
+                                unsigned long long * _pBytes);
+unsigned long long RtmpPubSenderGetReconnects(RtmpPubSender * _pSender);
+// 实际使用的传输层的名字和计数, socket的计数都是0(见RtmpPubSenderGetWriteStats)
+const char * RtmpPubSenderGetTransport(RtmpPubSender * _pSender, RtmpPubTransportStats * _pStats);
+// 各阶段耗时和每个轨道的计数, 可以在任意线程调用
+void RtmpPubSenderGetMetrics(RtmpPubSender * _pSender, RtmpPubMetricsSnapshot * _pSnapshot);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
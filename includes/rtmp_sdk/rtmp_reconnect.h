@@ -0,0 +1,76 @@
+#ifndef __RTMP_RECONNECT__
+#define __RTMP_RECONNECT__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "rtmp_frame_ring.h"
+
+#define RTMP_PUB_RECONNECT_MAX_DELAY_MS 30000
+#define RTMP_PUB_GOP_CACHE_MAX_FRAMES   1024
+
+/*
+ * 断线自动重连
+ * 每次重连前等待的时间从m_nMinDelayMs开始按2倍增长, 最多m_nMaxDelayMs, 推流成功后恢复
+ * 实际等待时间在[delay/2, delay]之间随机, 服务端重启时大量连接不会在同一时刻重连
+ * 开启GOP缓存时, 断线期间采集的帧继续进入缓存, 重新publish之后立即重发最近一个GOP,
+ * 时间戳从这个GOP的IDR开始重新计算, 观众不用等下一个IDR
+ */
+typedef struct {
+        unsigned int m_nMinDelayMs;             // 0表示不自动重连
+        unsigned int m_nMaxDelayMs;             // 0表示RTMP_PUB_RECONNECT_MAX_DELAY_MS
+        unsigned int m_nGopCacheBytes;          // GOP缓存的内存上限, 0表示不缓存
+} RtmpPubReconnectConfig;
+
+typedef struct {
+        RtmpPubReconnectConfig m_config;
+        unsigned int m_nDelayMs;
+        unsigned int m_nSeed;
+        unsigned long long m_nReconnects;       // 重连成功的次数
+} RtmpPubBackoff;
+
+void RtmpPubBackoffInit(RtmpPubBackoff * _pBackoff, const RtmpPubReconnectConfig * _pConfig);
+// 返回下一次重连前要等待的毫秒数
+unsigned int RtmpPubBackoffNext(RtmpPubBackoff * _pBackoff);
+// 重连成功后调用
+void RtmpPubBackoffReset(RtmpPubBackoff * _pBackoff);
+#define RtmpPubBackoffEnabled(_pBackoff) ((_pBackoff)->m_config.m_nMinDelayMs > 0)
+
+/*
+ * 最近一个GOP的缓存: 最后一个IDR以及之后的所有音视频帧, 按发送顺序保存
+ * 帧数据保存的是入队时的原始数据(annexb的h264或者封装好的video tag, 不带adts的aac), 只持有帧缓冲的引用, 不拷贝
+ * 被缓存的帧发送时不会原地改写, 内存上限按缓冲的实际容量计算
+ * 超过内存上限时清空, 直到下一个IDR重新开始缓存
+ */
+typedef struct {
+        RtmpPubFrameType m_nType;
+        unsigned int m_nPts;
+        int m_bIsKey;
+        int m_bIsReference;
+        int m_nSliceFlags;
+        RtmpPubBuffer * m_pBuffer;
+} RtmpPubGopEntry;
+
+typedef struct {
+        unsigned int m_nCapacity;
+        unsigned int m_nUsed;
+        RtmpPubGopEntry * m_pEntries;
+        unsigned int m_nEntries;
+        unsigned long long m_nOverflows;        // 因为超过上限被清空的次数
+} RtmpPubGopCache;
+
+void RtmpPubGopCacheInit(RtmpPubGopCache * _pCache, unsigned int _nBytes);
+void RtmpPubGopCacheDestroy(RtmpPubGopCache * _pCache);
+// 视频关键帧开始新的GOP, 还没有收到关键帧时其它帧不缓存
+void RtmpPubGopCacheAdd(RtmpPubGopCache * _pCache, const RtmpPubFrame * _pFrame);
+// _pDst引用_pSrc里的所有帧, _pDst需要用同样的上限初始化, 失败返回-1
+int RtmpPubGopCacheCopy(RtmpPubGopCache * _pDst, const RtmpPubGopCache * _pSrc);
+// 第_nIndex帧, 不增加引用, 返回的帧在下一次Add/Copy/Clear之前有效
+void RtmpPubGopCacheGet(RtmpPubGopCache * _pCache, unsigned int _nIndex, RtmpPubFrame * _pFrame);
+void RtmpPubGopCacheClear(RtmpPubGopCache * _pCache);
+#define RtmpPubGopCacheEnabled(_pCache) ((_pCache)->m_nCapacity > 0)
+
+#ifdef __cplusplus
+}
+#endif
+#endif
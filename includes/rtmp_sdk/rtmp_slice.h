@@ -0,0 +1,69 @@
+#ifndef __RTMP_SLICE__
+#define __RTMP_SLICE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "rtmp_publish.h"
+#include "rtmp_publish_nalu.h"
+#include "rtmp_chunk_writer.h"
+
+#define RTMP_PUB_SLICE_FILLER_MIN       6       // 4字节长度 + nalu头 + rbsp_trailing_bits
+#define RTMP_PUB_SLICE_HEADROOM         4       // 预算 = 最近的帧大小 * (1 + 1/4)
+#define RTMP_PUB_SLICE_DECAY            8       // 帧变小时预算每帧向实际大小靠近1/8
+
+/*
+ * 低延时模式: 一帧的slice边编码边发送, 整个帧仍然是一个flv video tag
+ * rtmp消息的长度在第一个chunk头里给出, 发出去之后不能再修改, 所以按预算声明长度:
+ * 预算由同类型(关键帧/非关键帧)最近的帧大小估计, 或者由调用者按编码器的最大帧大小(vbv)固定,
+ * 帧结束时没有用完的部分用filler nalu(类型12)补齐, 解码器会忽略filler, 代价是每帧多发出预算余量那么多字节,
+ * 帧大小波动大的vbr码流上额外的带宽可能成倍增加, 适合cbr/有vbv限制的编码器
+ * 长度在这一帧第一个有数据的slice到达时声明
+ * 退化情况:
+ *   还没有同类型帧的历史(开始推流、重连之后), 或者第一个slice就超出预算:
+ *                  这一帧拷贝攒齐, 结束时按实际长度整帧发送, 不丢数据, 只是没有低延时
+ *   之后的slice超出预算: 已经声明的消息放不下, 这一帧剩下的slice丢弃并补齐,
+ *                  播放端这一帧缺少的部分要靠错误隐藏, 直到下一个IDR; 预算立即提高到这一帧的实际大小
+ * 一帧的消息结束之前同一个writer上不能发送其它消息, 音频要等这一帧结束
+ * 不是线程安全的, 只在发送线程里使用
+ */
+typedef struct {
+        int m_bActive;                          // Begin之后End之前
+        int m_bIsKey;
+        unsigned int m_nPts;
+        unsigned int m_nSize;                   // 这一帧的tag body大小(不含filler, 包括丢弃的slice)
+        unsigned int m_nLeft;                   // 已经声明的长度里还没有写出的字节数, 包括filler
+        int m_bOpened;                          // 已经声明长度并写出了消息头
+        int m_bTruncated;                       // 超出预算, 之后的slice丢弃
+        int m_bBuffering;                       // 没有预算或者第一个slice就放不下, 这一帧攒齐再发
+        char * m_pPending;                      // 没有预算时整帧攒在这里(avcc)
+        unsigned int m_nPending;
+        unsigned int m_nPendingCapacity;
+        unsigned int m_nBudget[2];              // 非关键帧/关键帧的tag body预算, 0表示还没有历史
+        int m_bFixedBudget;                     // 预算由调用者设置, 不再自动估计
+        unsigned long long m_nFrames;
+        unsigned long long m_nBuffered;         // 退化为整帧发送的帧数
+        unsigned long long m_nOverflows;
+        unsigned long long m_nPadding;          // filler累计字节数
+} RtmpPubSliceTag;
+
+void RtmpPubSliceTagInit(RtmpPubSliceTag * _pSlice);
+void RtmpPubSliceTagDestroy(RtmpPubSliceTag * _pSlice);
+// 固定每帧的预算(tag body字节数), 都为0时恢复自动估计
+void RtmpPubSliceTagSetBudget(RtmpPubSliceTag * _pSlice, unsigned int _nKeyBytes, unsigned int _nInterBytes);
+// 连接断开时调用, 丢弃没有发完的一帧, 预算保留
+void RtmpPubSliceTagReset(RtmpPubSliceTag * _pSlice);
+
+// 开始一帧, 关键帧且sequence header还没有发送时, 在这一帧的消息真正开始(收齐sps/pps之后)前先发送
+int RtmpPubSliceTagBegin(RtmpPubSliceTag * _pSlice, RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, int _bIsKey,
+                         unsigned int _nPts);
+// 追加一组nalu(RtmpPubPrepareVideoFrame的输出), Flush之前nalu所在的内存要保持有效
+int RtmpPubSliceTagWrite(RtmpPubSliceTag * _pSlice, RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp,
+                         const RtmpPubNaluSpan * _pNalus, unsigned int _nCount);
+// 结束一帧并补齐filler; 退化为整帧发送时消息体在m_pPending里, 返回之前会Flush, 只能用于阻塞socket
+int RtmpPubSliceTagEnd(RtmpPubSliceTag * _pSlice, RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
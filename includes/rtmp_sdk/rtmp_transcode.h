@@ -0,0 +1,65 @@
+#ifndef __RTMP_TRANSCODE__
+#define __RTMP_TRANSCODE__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "rtmp_publish.h"
+#include "rtmp_chunk_writer.h"
+#include "rtmp_adts.h"
+
+typedef enum {
+        RTMP_PUB_G711_SCALAR = 0,
+        RTMP_PUB_G711_SSSE3,
+        RTMP_PUB_G711_NEON,
+} RtmpPubG711Kernel;
+
+// g711a/g711u展开成16bit pcm, _nType只能是RTMP_PUB_AUDIO_G711A或RTMP_PUB_AUDIO_G711U
+void RtmpPubG711Decode(RtmpPubAudioType _nType, int16_t * _pOut, const uint8_t * _pIn, unsigned int _nSamples);
+
+// 默认在第一次解码时按cpu能力自动选择最快的kernel, 这里可以强制指定, cpu不支持时返回-1
+int RtmpPubSelectG711Kernel(RtmpPubG711Kernel _nKernel);
+RtmpPubG711Kernel RtmpPubGetG711Kernel(void);
+const char * RtmpPubGetG711KernelName(RtmpPubG711Kernel _nKernel);
+
+/*
+ * g711/pcm转aac, 代替sdk里RtmpPubSendAudioFrame的转码路径
+ * sdk每一帧都要malloc pcm和aac输出两块内存, pcm还要先memset再逐个样本调用解码函数,
+ * 这里解码和编码输出都放在m_pArena里, 只在帧变大时重新分配, 解码用查表的simd kernel
+ * 编码器仍然是RtmpPubNew创建的那个, 输出的adts帧去掉头之后和aac输入一样经过RtmpPubChunkWriter发送
+ * 不是线程安全的, 每个RtmpPubContext一个, 只在发送线程里使用
+ */
+typedef struct {
+        char * m_pArena;                // 前半部分是pcm, 后半部分是编码器输出
+        unsigned int m_nArenaSize;
+        unsigned long long m_nFrames;   // 以下统计只由发送线程写
+        unsigned long long m_nSamples;
+        unsigned long long m_nDecodeNs;
+        unsigned long long m_nEncodeNs;
+} RtmpPubTranscoder;
+
+void RtmpPubTranscoderInit(RtmpPubTranscoder * _pTranscoder);
+void RtmpPubTranscoderDestroy(RtmpPubTranscoder * _pTranscoder);
+
+/*
+ * 用_pEncoder(AacEncoderContext)编码一帧g711/pcm, *_ppOut指向m_pArena里编码器输出的adts数据
+ * (可能没有, 也可能有多个adts帧), 下一次调用之前有效, 返回输出长度, 出错返回-1
+ */
+int RtmpPubEncodeAudio(RtmpPubTranscoder * _pTranscoder, void * _pEncoder, RtmpPubAudioType _nType, const char * _pData,
+                       unsigned int _nSize, const char ** _ppOut);
+// 同上, 输入类型和编码器来自_pRtmp
+int RtmpPubTranscodeAudio(RtmpPubTranscoder * _pTranscoder, RtmpPubContext * _pRtmp, const char * _pData, unsigned int _nSize,
+                          const char ** _ppOut);
+
+/*
+ * 转码一帧并把输出的每个adts帧作为flv audio tag加入_pWriter的发送队列, 数据拷贝到writer的scratch里
+ * AudioSpecificConfig还没有设置时用第一个adts头生成
+ */
+int RtmpPubWriteTranscodedAudio(RtmpPubTranscoder * _pTranscoder, RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp,
+                                const char * _pData, unsigned int _nSize, unsigned int _presentationTime);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,99 @@
+#ifndef __RTMP_TRANSPORT__
+#define __RTMP_TRANSPORT__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+typedef enum {
+        RTMP_PUB_TRANSPORT_SOCKET = 0,          // 直接sendmsg
+        RTMP_PUB_TRANSPORT_URING,               // io_uring, 不支持时退回socket
+} RtmpPubTransportType;
+
+#define RTMP_PUB_URING_ENTRIES          256
+#define RTMP_PUB_URING_ZC_MIN           (64 * 1024)    // 一次发送超过这么多字节(大的关键帧)才用零拷贝
+
+/*
+ * RtmpPubChunkWriter下面的传输层
+ * librtmp的RTMPSockBuf在预编译库里换不掉, 它只负责握手和命令; 音视频都由RtmpPubChunkWriter聚集写出去,
+ * 所以可替换的传输层放在这里, 每个writer同一时间最多一个发送请求(RtmpPubTransportOp)
+ *   socket: sendmsg, 立即得到结果
+ *   io_uring: 提交IORING_OP_SENDMSG, 超过RTMP_PUB_URING_ZC_MIN字节时用SENDMSG_ZC,
+ *             零拷贝的请求要等内核的通知(notif)之后才算完成, 之前iovec指向的内存都不能释放
+ *     同步模式(发送线程): Send提交后等待完成, 和sendmsg的用法一样
+ *     异步模式(引擎的worker): Send只把请求放进提交队列, worker每轮事件处理完一次性Submit,
+ *             同一个worker上所有session的发送合并成一次io_uring_enter,
+ *             ring的fd加入epoll, 可读时Reap, 完成的请求通过RtmpPubTransportNextDone交回给各个session
+ * 传输层对象不是线程安全的, 只在一个线程里使用
+ */
+typedef struct RtmpPubTransportOp {
+        struct msghdr m_msg;
+        int m_bInFlight;                        // 已经提交, 结果或者零拷贝通知还没有到
+        int m_bDone;                            // m_nResult有效, 取走结果后清零
+        int m_bNotifPending;
+        int m_bOnDoneList;
+        long m_nResult;                         // 写出的字节数, 失败时是-errno
+        void * m_pOwner;                        // 异步完成时交回给谁
+        struct RtmpPubTransportOp * m_pNextDone;
+} RtmpPubTransportOp;
+
+typedef struct {
+        unsigned long long m_nSends;            // 发送请求数
+        unsigned long long m_nSyscalls;         // 发送用的系统调用数(sendmsg或者io_uring_enter)
+        unsigned long long m_nZeroCopy;         // 零拷贝的发送请求数
+        unsigned long long m_nZeroCopyCopied;   // 其中内核实际还是拷贝了的(比如loopback)
+} RtmpPubTransportStats;
+
+typedef struct RtmpPubTransport RtmpPubTransport;
+
+struct RtmpPubTransport {
+        RtmpPubTransportType m_nType;
+        const char * m_pName;
+        int m_bAsync;
+        // 成功提交返回0, 同步后端这时已经完成(m_bDone), 提交失败返回-1
+        int (*m_pfnSend)(RtmpPubTransport * _pTransport, RtmpPubTransportOp * _pOp, int _nSocket, unsigned int _nBytes);
+        // 等待_pOp完成, 同步后端什么都不做
+        int (*m_pfnWait)(RtmpPubTransport * _pTransport, RtmpPubTransportOp * _pOp);
+        // 取消还没有完成的_pOp并等它结束, 之后它引用的内存可以释放
+        void (*m_pfnCancel)(RtmpPubTransport * _pTransport, RtmpPubTransportOp * _pOp);
+        void (*m_pfnDestroy)(RtmpPubTransport * _pTransport);
+        atomic_ullong m_nSends;
+        atomic_ullong m_nSyscalls;
+        atomic_ullong m_nZeroCopy;
+        atomic_ullong m_nZeroCopyCopied;
+};
+
+// 所有writer共用的socket后端, 不需要释放
+RtmpPubTransport * RtmpPubSocketTransport(void);
+/*
+ * 新建io_uring后端, 内核不支持(或者编译时没有linux/io_uring.h)返回NULL, 调用者退回socket
+ * _bAsync为0时是同步模式
+ */
+RtmpPubTransport * RtmpPubUringTransportNew(int _bAsync);
+// 按类型新建, socket类型返回RtmpPubSocketTransport()
+RtmpPubTransport * RtmpPubTransportNew(RtmpPubTransportType _nType, int _bAsync);
+void RtmpPubTransportDel(RtmpPubTransport * _pTransport);
+
+#define RtmpPubTransportSend(_pTransport, _pOp, _nSocket, _nBytes) \
+        ((_pTransport)->m_pfnSend((_pTransport), (_pOp), (_nSocket), (_nBytes)))
+#define RtmpPubTransportWait(_pTransport, _pOp) ((_pTransport)->m_pfnWait((_pTransport), (_pOp)))
+#define RtmpPubTransportCancel(_pTransport, _pOp) ((_pTransport)->m_pfnCancel((_pTransport), (_pOp)))
+
+// 以下只用于异步的io_uring后端
+// 加入epoll的fd, 可读表示有完成的请求, 其它后端返回-1
+int RtmpPubTransportGetFd(RtmpPubTransport * _pTransport);
+// 一次系统调用提交所有排队的请求
+int RtmpPubTransportSubmit(RtmpPubTransport * _pTransport);
+// 取出所有已经完成的请求
+void RtmpPubTransportReap(RtmpPubTransport * _pTransport);
+// 依次取走Reap(包括Wait和Cancel里顺带)收到的已完成请求, 没有了返回NULL
+RtmpPubTransportOp * RtmpPubTransportNextDone(RtmpPubTransport * _pTransport);
+
+void RtmpPubTransportGetStats(RtmpPubTransport * _pTransport, RtmpPubTransportStats * _pStats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,1244 @@
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "rtmp_publish.h"
+#include "rtmp_publish_sender.h"
+#include "rtmp_chunk_writer.h"
+#include "rtmp_engine.h"
+#include "rtmp_fanout.h"
+#include "rtmp_buffer_pool.h"
+#include "rtmp_transcode.h"
+#include "rtmp_encoder_pool.h"
+#include "rtmp_amf_template.h"
+#include "rtmp_interleave.h"
+#include "rtmp_publish_nalu.h"
+#include "aac_encoder.h"
+#include "../ipc_simulator.h"
+#include "../demo_common.h"
+
+/*
+* 推流路径的离线压测, 需要网络的几项配合rtmp-sink使用, 和demo共用ipc模拟和session配置
+*/
+
+#define log(fmt, args...) printf("%s $ "fmt"\n", __FUNCTION__, ##args)
+
+#define BENCH_G711_FRAME    160 // 8k采样20ms一帧
+#define BENCH_AUDIO_SECS    60 // 每一路转码的音频时长
+#define BENCH_AMF_BUF       2048 // 一次重连的全部命令和onMetaData
+#define BENCH_SC_SHIFTS     32 // 对照检查时扫描范围的起止偏移0~31字节, 覆盖各种对齐
+#define BENCH_IL_SECS       600 // 模拟的推流时长
+#define BENCH_IL_VIDEO_MS   40 // 25fps
+#define BENCH_IL_AUDIO_MS   64 // 16k aac, 1024个样本一帧
+#define BENCH_IL_SILENCE_MS 200 // 比音频帧间隔加抖动大, 正常的帧间隔不会被当成静默
+#define BENCH_IL_GAP_MS     5000 // 音频中途静默5s
+#define BENCH_SEND_LOOPS    4 // 媒体文件循环推送的遍数
+#define BENCH_SEND_WAIT_US  50 // 队列满时等发送线程腾出位置
+#define BENCH_SEND_STALL_MS 5000 // 队列这么久没有空位就认为连接已经不可用
+#define BENCH_SEND_CONNECT_MS 10000 // 多路时等所有session开始推流
+#define BENCH_DROP_SECS     30 // 限速推流的时长
+#define BENCH_MEM_SESSIONS  100
+#define BENCH_CONNECT_SESSIONS 16
+#define BENCH_RECONNECT_SECS 20 // rtmp-sink -k断开之后还要留出重连和重发GOP的时间
+
+static RtmpPubContext *rtmp_ctx;
+static RtmpPubSender *sender;
+static RtmpPubEngine *engine;
+static RtmpPubSession *sessions[MAX_STREAMS];
+static RtmpPubFanout *fanout;
+static int stream_count;
+
+// 按采集节奏推流的几项压测用, 和demo一样只把帧放入发送队列
+static int on_video(const char *h264, int len, int64_t pts, int is_key)
+{
+	if (RtmpPubSenderPushVideo(sender, h264, len, pts, is_key)) {
+		log("video queue full, drop frame, pts:%"PRId64, pts);
+		return -1;
+	}
+	return 0;
+}
+
+static int on_audio(const char *aac, int len, int64_t pts)
+{
+	if (RtmpPubSenderPushAdts(sender, aac, len, pts) < 0) {
+		log("audio queue full, drop frame, pts:%"PRId64, pts);
+		return -1;
+	}
+	return 0;
+}
+
+static int on_fanout_video(const char *h264, int len, int64_t pts, int is_key)
+{
+	return RtmpPubFanoutPushVideo(fanout, h264, len, pts, is_key) < 0 ? -1 : 0;
+}
+
+static int on_fanout_audio(const char *aac, int len, int64_t pts)
+{
+	return RtmpPubFanoutPushAdts(fanout, aac, len, pts) < 0 ? -1 : 0;
+}
+
+typedef struct {
+	unsigned int last_pts;
+	unsigned long long frames;
+	unsigned long long out_of_order;
+} bench_output_t;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int on_bench_config(void *opaque, const char *data, unsigned int size, unsigned int pts)
+{
+	return 0;
+}
+
+// 同一路的输出必须按时间戳顺序
+static int on_bench_frame(void *opaque, RtmpPubBuffer *frame, unsigned int pts)
+{
+	bench_output_t *out = opaque;
+
+	if (out->frames++ && (int)(pts - out->last_pts) <= 0)
+		out->out_of_order++;
+	out->last_pts = pts;
+	return 0;
+}
+
+// 同样的输入交给编码线程池, 看多核上的总耗时
+static int run_pool_bench(int count, int frames, const uint8_t *g711, int64_t single_ns)
+{
+	RtmpPubEncoderPool *pool = RtmpPubEncoderPoolNew(0);
+	RtmpPubEncoderStream **streams = calloc(count, sizeof(RtmpPubEncoderStream *));
+	bench_output_t *outputs = calloc(count, sizeof(bench_output_t));
+	RtmpPubEncoderStreamConfig config = { RTMP_PUB_AUDIO_G711A, 0, 0, 0 };
+	RtmpPubEncoderOutput output = { on_bench_config, on_bench_frame, NULL };
+	RtmpPubEncoderPoolStats stats;
+	unsigned long long out_of_order = 0;
+
+	if (!pool || !streams || !outputs)
+		return -1;
+	// 一次投递完所有输入, 队列要放得下
+	config.m_nJobSlots = frames * BENCH_G711_FRAME / RTMP_PUB_ENCODER_FRAME_SAMPLES + 1;
+	for (int i = 0; i < count; i++) {
+		output.m_pOpaque = &outputs[i];
+		if (!(streams[i] = RtmpPubEncoderStreamNew(pool, &config, &output)))
+			return -1;
+	}
+	int64_t start = now_ns();
+	for (int n = 0; n < frames; n++) {
+		for (int i = 0; i < count; i++)
+			RtmpPubEncoderStreamPush(streams[i], (const char *)g711, BENCH_G711_FRAME, n * 20);
+	}
+	int64_t push_ns = now_ns() - start;
+	for (int i = 0; i < count; i++) {
+		RtmpPubEncoderStreamDel(streams[i]);
+		out_of_order += outputs[i].out_of_order;
+	}
+	int64_t wall_ns = now_ns() - start;
+	RtmpPubEncoderPoolGetStats(pool, &stats);
+	log("pool: %u workers wall:%.1fms speedup:%.1fx push:%.2fus/frame jobs:%llu aac frames:%llu dropped:%llu out of order:%llu",
+	    RtmpPubEncoderPoolGetWorkers(pool), wall_ns / 1e6, (double)single_ns / wall_ns,
+	    push_ns / 1000.0 / count / frames, stats.m_nJobs, stats.m_nFrames, stats.m_nDropped, out_of_order);
+	RtmpPubEncoderPoolDel(pool);
+	free(streams);
+	free(outputs);
+	return 0;
+}
+
+static int64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// 不连接服务器, 把count路g711a各转码BENCH_AUDIO_SECS秒, 和sdk原来的转码路径对比每一路占用的cpu,
+// 最后再用编码线程池跑一遍
+static int run_audio_bench(int count)
+{
+	int frames = BENCH_AUDIO_SECS * 8000 / BENCH_G711_FRAME;
+	uint8_t g711[BENCH_G711_FRAME];
+	RtmpPubContext **ctx = calloc(count, sizeof(RtmpPubContext *));
+	AacEncoderContext **sdk = calloc(count, sizeof(AacEncoderContext *));
+	RtmpPubTranscoder *transcoder = calloc(count, sizeof(RtmpPubTranscoder));
+	uint32_t seed = 1;
+
+	if (count <= 0 || !ctx || !sdk || !transcoder) {
+		log("bench streams must be > 0");
+		return -1;
+	}
+	for (int i = 0; i < count; i++) {
+		ctx[i] = RtmpPubNew("rtmp://127.0.0.1/live/bench", 10, RTMP_PUB_AUDIO_G711A, RTMP_PUB_AUDIO_AAC,
+				    RTMP_PUB_TIMESTAMP_ABSOLUTE);
+		sdk[i] = AacEncoderNew();
+		if (!ctx[i] || RtmpPubInit(ctx[i]) || !sdk[i] || AacEncoderInit(sdk[i]) < 0) {
+			log("init encoder %d err", i);
+			return -1;
+		}
+		RtmpPubTranscoderInit(&transcoder[i]);
+	}
+	// 固定种子的噪声, 两条路径的输入完全一样
+	for (int i = 0; i < BENCH_G711_FRAME; i++) {
+		seed = seed * 1103515245 + 12345;
+		g711[i] = (uint8_t)(seed >> 16);
+	}
+
+	// sdk的路径: 每帧malloc输出, AacEncoderEncodePcma里再malloc+memset pcm, 逐样本解码
+	int64_t start = thread_cpu_ns();
+	for (int n = 0; n < frames; n++) {
+		for (int i = 0; i < count; i++) {
+			size_t out_size = 0;
+			char *out = malloc((BENCH_G711_FRAME + 0x1400) * 2);
+			AacEncoderEncodePcma(sdk[i], out, &out_size, g711, BENCH_G711_FRAME);
+			free(out);
+		}
+	}
+	int64_t sdk_ns = thread_cpu_ns() - start;
+
+	start = thread_cpu_ns();
+	for (int n = 0; n < frames; n++) {
+		for (int i = 0; i < count; i++) {
+			const char *out;
+			RtmpPubTranscodeAudio(&transcoder[i], ctx[i], (const char *)g711, BENCH_G711_FRAME, &out);
+		}
+	}
+	int64_t ext_ns = thread_cpu_ns() - start;
+
+	unsigned long long decode_ns = 0, encode_ns = 0;
+	for (int i = 0; i < count; i++) {
+		decode_ns += transcoder[i].m_nDecodeNs;
+		encode_ns += transcoder[i].m_nEncodeNs;
+		RtmpPubTranscoderDestroy(&transcoder[i]);
+		AacEncoderDel(sdk[i]);
+		RtmpPubDel(ctx[i]);
+	}
+	// 每一路的cpu占用 = 转码耗时 / 音频时长
+	double total = (double)count * frames;
+	log("audio bench %d streams x %ds g711a->aac, g711 kernel:%s", count, BENCH_AUDIO_SECS,
+	    RtmpPubGetG711KernelName(RtmpPubGetG711Kernel()));
+	log("sdk: %.1fus/frame cpu per stream:%.3f%% total:%.1f%%", sdk_ns / total / 1000,
+	    sdk_ns / 1e7 / BENCH_AUDIO_SECS / count, sdk_ns / 1e7 / BENCH_AUDIO_SECS);
+	log("ext: %.1fus/frame (decode %.2fus encode %.1fus) cpu per stream:%.3f%% total:%.1f%%", ext_ns / total / 1000,
+	    decode_ns / total / 1000, encode_ns / total / 1000, ext_ns / 1e7 / BENCH_AUDIO_SECS / count,
+	    ext_ns / 1e7 / BENCH_AUDIO_SECS);
+	free(ctx);
+	free(sdk);
+	free(transcoder);
+	return run_pool_bench(count, frames, g711, ext_ns);
+}
+
+static const AVal bench_app = AVC("live");
+static const AVal bench_tc_url = AVC("rtmp://127.0.0.1:1935/live");
+static const AVal bench_stream = AVC("camera_0001");
+static const char *bench_commands[RTMP_PUB_CMD_COUNT] = { "connect", "releaseStream", "FCPublish", "createStream", "publish" };
+static const char *bench_meta_names[RTMP_PUB_META_FIELDS] = {
+	"duration", "width", "height", "videodatarate", "framerate", "videocodecid",
+	"audiodatarate", "audiosamplerate", "audiosamplesize", "stereo", "audiocodecid"
+};
+static const double bench_meta[RTMP_PUB_META_FIELDS] = { 0, 1920, 1080, 2048, 25, 7, 32, 8000, 16, 0, 10 };
+
+static void add_prop(AMFObject *obj, const char *name, AMFDataType type, double number, const AVal *str)
+{
+	AMFObjectProperty prop;
+
+	memset(&prop, 0, sizeof(prop));
+	if (name) {
+		prop.p_name.av_val = (char *)name;
+		prop.p_name.av_len = strlen(name);
+	}
+	prop.p_type = type;
+	if (type == AMF_STRING)
+		prop.p_vu.p_aval = *str;
+	else
+		prop.p_vu.p_number = number;
+	AMF_AddProp(obj, &prop);
+}
+
+static char *encode_props(AMFObject *obj, char *p, char *end)
+{
+	for (int i = 0; p && i < obj->o_num; i++)
+		p = AMFProp_Encode(&obj->o_props[i], p, end);
+	AMF_Reset(obj);
+	return p;
+}
+
+// 通用路径: 每个命令先组装AMFObject再编码, 参数都是单独分配的属性数组
+// AMFProp_Encode不支持ECMA array, onMetaData用object代替, 长度只差几个字节
+static int encode_amf_object(char *buf, int transaction)
+{
+	static const AVal nonprivate = AVC("nonprivate"), version = AVC("FMLE/3.0 (compatible; FMSc/1.0)");
+	static const AVal live = AVC("live"), set_data_frame = AVC("@setDataFrame"), on_metadata = AVC("onMetaData");
+	char *p = buf, *end = buf + BENCH_AMF_BUF;
+	AMFObject obj = { 0 }, args = { 0 };
+	AMFObjectProperty prop;
+
+	for (int i = 0; i < RTMP_PUB_CMD_COUNT; i++) {
+		AVal name = { (char *)bench_commands[i], strlen(bench_commands[i]) };
+		add_prop(&obj, NULL, AMF_STRING, 0, &name);
+		add_prop(&obj, NULL, AMF_NUMBER, transaction + i, NULL);
+		if (i == RTMP_PUB_CMD_CONNECT) {
+			add_prop(&args, "type", AMF_STRING, 0, &nonprivate);
+			add_prop(&args, "flashVer", AMF_STRING, 0, &version);
+			add_prop(&args, "app", AMF_STRING, 0, &bench_app);
+			add_prop(&args, "tcUrl", AMF_STRING, 0, &bench_tc_url);
+			memset(&prop, 0, sizeof(prop));
+			prop.p_type = AMF_OBJECT;
+			prop.p_vu.p_object = args;
+			AMF_AddProp(&obj, &prop);
+			args.o_num = 0;
+			args.o_props = NULL;
+		} else {
+			add_prop(&obj, NULL, AMF_NULL, 0, NULL);
+			if (i != RTMP_PUB_CMD_CREATE_STREAM)
+				add_prop(&obj, NULL, AMF_STRING, 0, &bench_stream);
+			if (i == RTMP_PUB_CMD_PUBLISH)
+				add_prop(&obj, NULL, AMF_STRING, 0, &live);
+		}
+		p = encode_props(&obj, p, end);
+	}
+	add_prop(&obj, NULL, AMF_STRING, 0, &set_data_frame);
+	add_prop(&obj, NULL, AMF_STRING, 0, &on_metadata);
+	for (int i = 0; i < RTMP_PUB_META_FIELDS; i++)
+		add_prop(&args, bench_meta_names[i], i == RTMP_PUB_META_STEREO ? AMF_BOOLEAN : AMF_NUMBER, bench_meta[i], NULL);
+	memset(&prop, 0, sizeof(prop));
+	prop.p_type = AMF_OBJECT;
+	prop.p_vu.p_object = args;
+	AMF_AddProp(&obj, &prop);
+	p = encode_props(&obj, p, end);
+	return p ? p - buf : -1;
+}
+
+// 会话原来的路径: 直接调用AMF_Encode*函数, 和模板的输出逐字节相同
+static int encode_amf_functions(char *buf, int transaction)
+{
+	static const AVal app = AVC("app"), type = AVC("type"), nonprivate = AVC("nonprivate"), tc_url = AVC("tcUrl");
+	static const AVal flash_ver = AVC("flashVer"), version = AVC("FMLE/3.0 (compatible; FMSc/1.0)"), live = AVC("live");
+	static const AVal set_data_frame = AVC("@setDataFrame"), on_metadata = AVC("onMetaData");
+	static const AVal encoder = AVC("encoder"), encoder_name = AVC("rtmp_sdk");
+	char *p = buf, *end = buf + BENCH_AMF_BUF;
+
+	for (int i = 0; p && i < RTMP_PUB_CMD_COUNT; i++) {
+		AVal name = { (char *)bench_commands[i], strlen(bench_commands[i]) };
+		p = AMF_EncodeString(p, end, &name);
+		p = p ? AMF_EncodeNumber(p, end, transaction + i) : NULL;
+		if (!p)
+			break;
+		if (i == RTMP_PUB_CMD_CONNECT) {
+			*p++ = AMF_OBJECT;
+			p = AMF_EncodeNamedString(p, end, &type, &nonprivate);
+			p = p ? AMF_EncodeNamedString(p, end, &flash_ver, &version) : NULL;
+			p = p ? AMF_EncodeNamedString(p, end, &app, &bench_app) : NULL;
+			p = p ? AMF_EncodeNamedString(p, end, &tc_url, &bench_tc_url) : NULL;
+			p = p ? AMF_EncodeInt24(p, end, AMF_OBJECT_END) : NULL;
+			continue;
+		}
+		*p++ = AMF_NULL;
+		if (i != RTMP_PUB_CMD_CREATE_STREAM)
+			p = AMF_EncodeString(p, end, &bench_stream);
+		if (p && i == RTMP_PUB_CMD_PUBLISH)
+			p = AMF_EncodeString(p, end, &live);
+	}
+	p = p ? AMF_EncodeString(p, end, &set_data_frame) : NULL;
+	p = p ? AMF_EncodeString(p, end, &on_metadata) : NULL;
+	if (!p)
+		return -1;
+	*p++ = AMF_ECMA_ARRAY;
+	p = AMF_EncodeInt32(p, end, RTMP_PUB_META_FIELDS + 1);
+	for (int i = 0; p && i < RTMP_PUB_META_FIELDS; i++) {
+		AVal name = { (char *)bench_meta_names[i], strlen(bench_meta_names[i]) };
+		if (i == RTMP_PUB_META_STEREO)
+			p = AMF_EncodeNamedBoolean(p, end, &name, bench_meta[i] != 0);
+		else
+			p = AMF_EncodeNamedNumber(p, end, &name, bench_meta[i]);
+	}
+	p = p ? AMF_EncodeNamedString(p, end, &encoder, &encoder_name) : NULL;
+	p = p ? AMF_EncodeInt24(p, end, AMF_OBJECT_END) : NULL;
+	return p ? p - buf : -1;
+}
+
+// 模板: 只改写事务id和元数据的数值, 和另外两条路径一样拷贝到输出缓冲区
+static int encode_amf_template(char *buf, int transaction, RtmpPubCommandSet *set)
+{
+	char *p = buf;
+
+	for (int i = 0; i < RTMP_PUB_CMD_COUNT; i++) {
+		unsigned int size;
+		const char *body = RtmpPubCommandSetGet(set, i, transaction + i, &size);
+		memcpy(p, body, size);
+		p += size;
+	}
+	p += RtmpPubBuildMetadata(p, bench_meta);
+	return p - buf;
+}
+
+// 不连接服务器, 比较一次重连要发送的全部命令和onMetaData的编码耗时
+static int run_amf_bench(int reconnects)
+{
+	static char expect[BENCH_AMF_BUF], buf[BENCH_AMF_BUF];
+	RtmpPubCommandSet set;
+	int64_t sum = 0;
+
+	if (reconnects <= 0) {
+		log("bench reconnects must be > 0");
+		return -1;
+	}
+	if (RtmpPubCommandSetInit(&set, &bench_app, &bench_tc_url, &bench_stream) < 0)
+		return -1;
+	int size = encode_amf_functions(expect, 1);
+	if (size < 0 || encode_amf_template(buf, 1, &set) != size || memcmp(buf, expect, size)) {
+		log("template output differs from AMF_Encode*");
+		RtmpPubCommandSetDestroy(&set);
+		return -1;
+	}
+
+	int64_t start = now_ns();
+	for (int n = 0; n < reconnects; n++)
+		sum += encode_amf_object(buf, n);
+	int64_t object_ns = now_ns() - start;
+	start = now_ns();
+	for (int n = 0; n < reconnects; n++)
+		sum += encode_amf_functions(buf, n);
+	int64_t functions_ns = now_ns() - start;
+	start = now_ns();
+	for (int n = 0; n < reconnects; n++)
+		sum += encode_amf_template(buf, n, &set);
+	int64_t template_ns = now_ns() - start;
+
+	log("amf bench %d reconnects, %d bytes (%d commands + onMetaData) each, checksum %" PRId64, reconnects, size,
+	    RTMP_PUB_CMD_COUNT, sum);
+	log("AMFObject: %.1fns/reconnect", (double)object_ns / reconnects);
+	log("AMF_Encode*: %.1fns/reconnect", (double)functions_ns / reconnects);
+	log("template: %.1fns/reconnect (%.1fx vs AMFObject, %.1fx vs AMF_Encode*)", (double)template_ns / reconnects,
+	    (double)object_ns / template_ns, (double)functions_ns / template_ns);
+	RtmpPubCommandSetDestroy(&set);
+	return 0;
+}
+
+static char *bench_es;
+static int bench_es_size;
+static int bench_es_capacity;
+
+// 把整个视频文件的annex-b码流拼到一起
+static int on_startcode_video(const char *h264, int len, int64_t pts, int is_key)
+{
+	if (bench_es_size + len > bench_es_capacity) {
+		int capacity = bench_es_capacity ? bench_es_capacity : 1 << 20;
+		char *p;
+
+		while (capacity < bench_es_size + len)
+			capacity *= 2;
+		if (!(p = realloc(bench_es, capacity)))
+			return -1;
+		bench_es = p;
+		bench_es_capacity = capacity;
+	}
+	memcpy(bench_es + bench_es_size, h264, len);
+	bench_es_size += len;
+	return 0;
+}
+
+static int on_startcode_audio(const char *aac, int len, int64_t pts)
+{
+	return 0;
+}
+
+// 用当前的kernel找出[start, end)里所有startcode相对buf的偏移, offsets为NULL时只计数
+static int scan_startcodes(const uint8_t *buf, const uint8_t *start, const uint8_t *end, int *offsets)
+{
+	int n = 0;
+
+	for (const uint8_t *p = RtmpPubFindStartcode(start, end); p < end; p = RtmpPubFindStartcode(p + 3, end)) {
+		if (offsets)
+			offsets[n] = p - buf;
+		n++;
+	}
+	return n;
+}
+
+// 不连接服务器, 所有可用的startcode kernel扫描自带的视频文件, 偏移必须和标量版本完全一致, 再比较扫描速度
+static int run_startcode_bench(int passes)
+{
+	RtmpPubStartcodeKernel best = RtmpPubGetStartcodeKernel();
+	int *expect = NULL, *got = NULL, count, ret = -1;
+	long long total = 0;
+
+	if (passes <= 0) {
+		log("bench passes must be > 0");
+		return -1;
+	}
+	if (run_media_unthrottled(1, on_startcode_video, on_startcode_audio) < 0 || !bench_es_size) {
+		log("no video to scan");
+		return -1;
+	}
+	const uint8_t *buf = (const uint8_t *)bench_es, *end = buf + bench_es_size;
+
+	RtmpPubSelectStartcodeKernel(RTMP_PUB_STARTCODE_SCALAR);
+	count = scan_startcodes(buf, buf, end, NULL);
+	expect = malloc((count + 1) * sizeof(int));
+	got = malloc((count + 1) * sizeof(int));
+	if (!expect || !got)
+		goto out;
+	log("startcode bench %d bytes, %d startcodes, %d passes, auto selected %s", bench_es_size, count, passes,
+	    RtmpPubGetStartcodeKernelName(best));
+	for (int k = RTMP_PUB_STARTCODE_SCALAR; k <= RTMP_PUB_STARTCODE_NEON; k++) {
+		const char *name = RtmpPubGetStartcodeKernelName(k);
+
+		if (RtmpPubSelectStartcodeKernel(k) < 0) {
+			log("%s: not available", name);
+			continue;
+		}
+		for (int shift = 0; k != RTMP_PUB_STARTCODE_SCALAR && shift < BENCH_SC_SHIFTS; shift++) {
+			const uint8_t *start = buf + shift, *stop = end - (shift * 7) % BENCH_SC_SHIFTS;
+
+			RtmpPubSelectStartcodeKernel(RTMP_PUB_STARTCODE_SCALAR);
+			int n = scan_startcodes(buf, start, stop, expect);
+			RtmpPubSelectStartcodeKernel(k);
+			if (scan_startcodes(buf, start, stop, got) != n || memcmp(got, expect, n * sizeof(int))) {
+				log("%s: startcode offsets differ from scalar, range shift %d", name, shift);
+				goto out;
+			}
+		}
+		total = 0;
+		int64_t start = now_ns();
+		for (int n = 0; n < passes; n++)
+			total += scan_startcodes(buf, buf, end, NULL);
+		int64_t ns = now_ns() - start;
+		if (total != (long long)count * passes) {
+			log("%s: found %lld startcodes, expect %lld", name, total, (long long)count * passes);
+			goto out;
+		}
+		log("%s: %.2f GB/s%s", name, (double)bench_es_size * passes / ns,
+		    k == RTMP_PUB_STARTCODE_SCALAR ? "" : ", offsets match scalar");
+	}
+	ret = 0;
+out:
+	RtmpPubSelectStartcodeKernel(best);
+	free(expect);
+	free(got);
+	free(bench_es);
+	bench_es = NULL;
+	bench_es_size = bench_es_capacity = 0;
+	return ret;
+}
+
+typedef struct {
+	int64_t *arrival_us;
+	unsigned int *dts;
+	int count;
+	int popped;
+} bench_track_t;
+
+// 按帧间隔生成时间戳, 到达时间加上0~jitter的均匀随机延迟, 同一轨道内不会乱序
+// 从gap_from_ms开始静默BENCH_IL_GAP_MS, 这段时间另一个轨道不应当被阻塞
+static int gen_bench_track(bench_track_t *track, int interval_ms, int jitter_ms, unsigned int gap_from_ms)
+{
+	int total = BENCH_IL_SECS * 1000 / interval_ms;
+	int64_t last = 0;
+
+	track->arrival_us = malloc(total * sizeof(int64_t));
+	track->dts = malloc(total * sizeof(unsigned int));
+	if (!track->arrival_us || !track->dts)
+		return -1;
+	track->count = 0;
+	for (int i = 0; i < total; i++) {
+		unsigned int dts = i * interval_ms;
+		if (dts >= gap_from_ms && dts < gap_from_ms + BENCH_IL_GAP_MS)
+			continue;
+		int64_t arrival = (int64_t)dts * 1000 + (jitter_ms ? rand() % (jitter_ms * 1000) : 0);
+		if (arrival < last)
+			arrival = last;
+		track->arrival_us[track->count] = last = arrival;
+		track->dts[track->count++] = dts;
+	}
+	return 0;
+}
+
+// 用模拟的时钟驱动交错器, 每个事件(帧到达或者等待到期)之后取出所有可以发送的帧
+static void run_interleave_case(bench_track_t *tracks, unsigned int window_ms)
+{
+	RtmpPubInterleaveConfig config = { window_ms, BENCH_IL_SILENCE_MS };
+	RtmpPubInterleaver il;
+	RtmpPubInterleaveStats stats;
+	long long wait;
+	int64_t now = 0;
+
+	RtmpPubInterleaverInit(&il, RTMP_PUB_TRACK_COUNT, &config);
+	for (int i = 0; i < RTMP_PUB_TRACK_COUNT; i++)
+		tracks[i].popped = 0;
+	for (;;) {
+		int64_t next = INT64_MAX;
+		int track;
+
+		for (int i = 0; i < RTMP_PUB_TRACK_COUNT; i++) {
+			bench_track_t *t = &tracks[i];
+			if (!RtmpPubInterleaverHasHead(&il, i) && t->popped < t->count && t->arrival_us[t->popped] <= now)
+				RtmpPubInterleaverPush(&il, i, t->dts[t->popped], t->arrival_us[t->popped]);
+		}
+		track = RtmpPubInterleaverNext(&il, now, &wait);
+		if (track >= 0) {
+			RtmpPubInterleaverPop(&il, track, now);
+			tracks[track].popped++;
+			continue;
+		}
+		if (wait >= 0)
+			next = now + wait;
+		for (int i = 0; i < RTMP_PUB_TRACK_COUNT; i++) {
+			bench_track_t *t = &tracks[i];
+			if (!RtmpPubInterleaverHasHead(&il, i) && t->popped < t->count && t->arrival_us[t->popped] < next)
+				next = t->arrival_us[t->popped];
+		}
+		if (next == INT64_MAX)
+			break;
+		now = next;
+	}
+	RtmpPubInterleaverGetStats(&il, &stats);
+	log("window %3ums: out of order %5llu (%.2f%%) held %6llu forced %5llu added latency avg %.3fms max %.1fms",
+	    window_ms, stats.m_nLate, 100.0 * stats.m_nLate / stats.m_nFrames, stats.m_nHeld, stats.m_nForced,
+	    (double)stats.m_nHoldUs / stats.m_nFrames / 1000, stats.m_nMaxHoldUs / 1000.0);
+}
+
+// 不连接服务器, 用带抖动的合成音视频时间线比较不同交错窗口下的乱序帧数和额外延时
+static int run_interleave_bench(int jitter_ms)
+{
+	static const unsigned int windows[] = { 0, 20, 50, 100, 200 };
+	bench_track_t tracks[RTMP_PUB_TRACK_COUNT];
+	int ret = -1;
+
+	if (jitter_ms < 0) {
+		log("bench jitter must be >= 0");
+		return -1;
+	}
+	srand(1);
+	memset(tracks, 0, sizeof(tracks));
+	if (gen_bench_track(&tracks[RTMP_PUB_TRACK_VIDEO], BENCH_IL_VIDEO_MS, jitter_ms, UINT32_MAX) ||
+	    gen_bench_track(&tracks[RTMP_PUB_TRACK_AUDIO], BENCH_IL_AUDIO_MS, jitter_ms, BENCH_IL_SECS * 1000 / 2)) {
+		log("no memory for bench tracks");
+		goto out;
+	}
+	log("interleave bench %ds, video %dms audio %dms, jitter 0~%dms, audio silent for %dms, silence threshold %dms",
+	    BENCH_IL_SECS, BENCH_IL_VIDEO_MS, BENCH_IL_AUDIO_MS, jitter_ms, BENCH_IL_GAP_MS, BENCH_IL_SILENCE_MS);
+	for (unsigned int i = 0; i < sizeof(windows) / sizeof(windows[0]); i++)
+		run_interleave_case(tracks, windows[i]);
+	ret = 0;
+out:
+	for (int i = 0; i < RTMP_PUB_TRACK_COUNT; i++) {
+		free(tracks[i].arrival_us);
+		free(tracks[i].dts);
+	}
+	return ret;
+}
+
+static unsigned long long bench_waits; // 队列满时重试的次数, 每一轮压测开始时清零
+
+// 不丢帧: 队列满时等发送线程, 等待的次数和时间不算推流本身的开销
+static int bench_push(int (*push)(const char *, int, int64_t, int), const char *data, int len, int64_t pts, int is_key)
+{
+	for (int64_t start = 0; push(data, len, pts, is_key); bench_waits++) {
+		if (!start)
+			start = now_ns();
+		else if (now_ns() - start > (int64_t)BENCH_SEND_STALL_MS * 1000000)
+			return -1;
+		usleep(BENCH_SEND_WAIT_US);
+	}
+	return 0;
+}
+
+static int push_bench_video(const char *h264, int len, int64_t pts, int is_key)
+{
+	return RtmpPubSenderPushVideo(sender, h264, len, pts, is_key);
+}
+
+static int push_bench_audio(const char *aac, int len, int64_t pts, int is_key)
+{
+	return RtmpPubSenderPushAdts(sender, aac, len, pts) < 0 ? -1 : 0;
+}
+
+static int on_bench_video(const char *h264, int len, int64_t pts, int is_key)
+{
+	return bench_push(push_bench_video, h264, len, pts, is_key);
+}
+
+static int on_bench_audio(const char *aac, int len, int64_t pts)
+{
+	return bench_push(push_bench_audio, aac, len, pts, 0);
+}
+
+// 多路时每一帧都要推给所有session, 队列满时从没有入队的那一路继续
+static int bench_next_session;
+
+static int push_engine_video(const char *h264, int len, int64_t pts, int is_key)
+{
+	for (; bench_next_session < stream_count; bench_next_session++)
+		if (RtmpPubSessionPushVideo(sessions[bench_next_session], h264, len, pts, is_key))
+			return -1;
+	bench_next_session = 0;
+	return 0;
+}
+
+static int push_engine_audio(const char *aac, int len, int64_t pts, int is_key)
+{
+	for (; bench_next_session < stream_count; bench_next_session++)
+		if (RtmpPubSessionPushAdts(sessions[bench_next_session], aac, len, pts) < 0)
+			return -1;
+	bench_next_session = 0;
+	return 0;
+}
+
+static int on_engine_bench_video(const char *h264, int len, int64_t pts, int is_key)
+{
+	return bench_push(push_engine_video, h264, len, pts, is_key);
+}
+
+static int on_engine_bench_audio(const char *aac, int len, int64_t pts)
+{
+	return bench_push(push_engine_audio, aac, len, pts, 0);
+}
+
+// cpu时间换算成周期数用的频率, x86上用tsc标定, 其它平台返回0, 只报告ns/byte
+static double cycles_per_ns(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	int64_t start = now_ns();
+	unsigned long long tsc = __rdtsc();
+
+	usleep(100000);
+	return (double)(__rdtsc() - tsc) / (now_ns() - start);
+#else
+	return 0;
+#endif
+}
+
+static int64_t clock_cpu_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+typedef struct {
+	const char *transport;
+	unsigned long long bytes;
+	double mbps;
+	double msgs_per_sec;
+	double send_ns_per_byte; // 发送线程(多路时是worker)的cpu
+	unsigned long long sends;
+	unsigned long long syscalls;
+} send_bench_result_t;
+
+static void log_send_bench(const char *name, int loops, int frames, unsigned long long writev_calls, unsigned long long msgs,
+			   int64_t wall, int64_t send_cpu, int64_t push_cpu, double ghz, send_bench_result_t *result)
+{
+	unsigned long long bytes = result->bytes;
+
+	// socket后端不计数, 每次writev就是一次系统调用
+	if (!result->sends)
+		result->syscalls = writev_calls;
+	result->mbps = bytes * 8 / (wall / 1e3);
+	result->msgs_per_sec = msgs / (wall / 1e9);
+	result->send_ns_per_byte = (double)send_cpu / bytes;
+	log("%s over %s, %d loops: %d frames %llu messages %llu bytes in %.2fs", name, result->transport, loops, frames, msgs,
+	    bytes, wall / 1e9);
+	log("throughput %.1f Mbit/s %.0f msgs/s, %.1f msgs/writev", result->mbps, result->msgs_per_sec,
+	    writev_calls ? (double)msgs / writev_calls : 0.0);
+	log("%s cpu %.1f%% %.3f ns/byte, push thread %.3f ns/byte", name, 100.0 * send_cpu / wall, result->send_ns_per_byte,
+	    (double)push_cpu / bytes);
+	if (ghz > 0)
+		log("cycles/byte (tsc %.2fGHz) %s:%.3f push:%.3f total:%.3f", ghz, name, send_cpu * ghz / bytes,
+		    push_cpu * ghz / bytes, (send_cpu + push_cpu) * ghz / bytes);
+	if (result->sends)
+		log("io_uring %llu sends in %llu syscalls", result->sends, result->syscalls);
+}
+
+// 不限速地把媒体文件推给url(一般是本机的rtmp-sink), 测发送路径的吞吐和每字节的cpu开销
+// 发送线程的cpu是转换、封装和writev, 推送线程的cpu是拷贝进队列
+static int run_send_bench(const char *url, int loops, RtmpPubTransportType transport, double ghz, send_bench_result_t *result)
+{
+	RtmpPubRingStats video, audio;
+	RtmpPubTransportStats transport_stats;
+	unsigned long long writev_calls, msgs, bytes;
+	clockid_t sender_clock;
+
+	rtmp_ctx = RtmpPubNew(url, 30, RTMP_PUB_AUDIO_AAC, RTMP_PUB_AUDIO_AAC, RTMP_PUB_TIMESTAMP_ABSOLUTE);
+	if (!rtmp_ctx || RtmpPubInit(rtmp_ctx) || RtmpPubConnect(rtmp_ctx)) {
+		log("rtmp connect %s err, errno:%d", url, errno);
+		return -1;
+	}
+	if (RtmpPubSetChunkSize(rtmp_ctx, OUT_CHUNK_SIZE) || !(sender = RtmpPubSenderNew(rtmp_ctx, VIDEO_QUEUE_SLOTS, AUDIO_QUEUE_SLOTS))) {
+		log("new sender err");
+		return -1;
+	}
+	RtmpPubSenderSetTransport(sender, transport);
+	if (RtmpPubSenderStart(sender) || pthread_getcpuclockid(sender->m_thread, &sender_clock)) {
+		log("start sender err");
+		return -1;
+	}
+	RtmpPubSenderGetWriteStats(sender, &writev_calls, &msgs, &bytes);
+	unsigned long long start_writev = writev_calls, start_msgs = msgs, start_bytes = bytes;
+	int64_t start = now_ns(), sender_cpu = clock_cpu_ns(sender_clock), push_cpu = thread_cpu_ns();
+	bench_waits = 0;
+	int frames = run_media_unthrottled(loops, on_bench_video, on_bench_audio);
+	if (frames < 0) {
+		log("sender stalled, check the server");
+		return -1;
+	}
+	push_cpu = thread_cpu_ns() - push_cpu;
+	// 等发送线程把队列发完, 计时到最后一帧写进socket为止
+	do {
+		usleep(BENCH_SEND_WAIT_US);
+		RtmpPubSenderGetStats(sender, &video, &audio);
+	} while (video.m_nDepth || audio.m_nDepth);
+	// 队列空了之后最后一批可能还在writev里, 等消息数不再增加
+	unsigned long long last_msgs;
+	RtmpPubSenderGetWriteStats(sender, &writev_calls, &msgs, &bytes);
+	do {
+		last_msgs = msgs;
+		usleep(1000);
+		RtmpPubSenderGetWriteStats(sender, &writev_calls, &msgs, &bytes);
+	} while (msgs != last_msgs);
+	int64_t wall = now_ns() - start;
+	sender_cpu = clock_cpu_ns(sender_clock) - sender_cpu;
+	RtmpPubSenderGetWriteStats(sender, &writev_calls, &msgs, &bytes);
+	result->transport = RtmpPubSenderGetTransport(sender, &transport_stats);
+	result->bytes = bytes - start_bytes;
+	result->sends = transport_stats.m_nSends;
+	result->syscalls = transport_stats.m_nSyscalls;
+	log("queue full retries:%llu, ring drops video:%llu audio:%llu", bench_waits, video.m_nDropped, audio.m_nDropped);
+	log_send_bench("sender thread", loops, frames, writev_calls - start_writev, msgs - start_msgs, wall, sender_cpu, push_cpu,
+		       ghz, result);
+	if (transport_stats.m_nZeroCopy)
+		log("zero copy sends:%llu copied by kernel:%llu", transport_stats.m_nZeroCopy, transport_stats.m_nZeroCopyCopied);
+	RtmpPubSenderDel(sender);
+	sender = NULL;
+	RtmpPubDel(rtmp_ctx);
+	rtmp_ctx = NULL;
+	return 0;
+}
+
+// 最多等BENCH_SEND_CONNECT_MS让sessions里的stream_count个session都开始推流, 返回正在推流的个数
+static int wait_publishing(void)
+{
+	int64_t deadline = now_ns() + (int64_t)BENCH_SEND_CONNECT_MS * 1000000;
+	int publishing;
+
+	do {
+		usleep(1000);
+		publishing = 0;
+		for (int i = 0; i < stream_count; i++)
+			publishing += RtmpPubSessionGetState(sessions[i]) == RTMP_PUB_SESSION_PUBLISHING;
+	} while (publishing < stream_count && now_ns() < deadline);
+	return publishing;
+}
+
+// 同上, 但用多路推流引擎同时推streams路(流名加上_0, _1...), 一个worker上的session可以合并提交
+// 推送线程以外的cpu都算worker的
+static int run_engine_send_bench(const char *url, int loops, RtmpPubTransportType transport, int streams, double ghz,
+				 send_bench_result_t *result)
+{
+	RtmpPubSessionConfig config;
+	RtmpPubSessionStats stats;
+	RtmpPubTransportStats transport_stats;
+	char stream_url[1024];
+	unsigned long long writev_calls, msgs, bytes, depth, last_msgs;
+	int publishing;
+
+	init_session_config(&config);
+	engine = RtmpPubEngineNew(0);
+	if (!engine) {
+		log("new engine err");
+		return -1;
+	}
+	RtmpPubEngineSetTransport(engine, transport);
+	if (RtmpPubEngineStart(engine)) {
+		log("start engine err");
+		return -1;
+	}
+	for (stream_count = 0; stream_count < streams; stream_count++) {
+		snprintf(stream_url, sizeof(stream_url), "%s_%d", url, stream_count);
+		if (!(sessions[stream_count] = RtmpPubEngineAddSession(engine, stream_url, &config))) {
+			log("add session %s err", stream_url);
+			return -1;
+		}
+	}
+	publishing = wait_publishing();
+	if (publishing < stream_count) {
+		log("only %d of %d sessions publishing, check the server", publishing, stream_count);
+		return -1;
+	}
+	int64_t start = now_ns(), process_cpu = process_cpu_us(), push_cpu = thread_cpu_ns();
+	bench_waits = 0;
+	int frames = run_media_unthrottled(loops, on_engine_bench_video, on_engine_bench_audio);
+	if (frames < 0) {
+		log("sessions stalled, check the server");
+		return -1;
+	}
+	push_cpu = thread_cpu_ns() - push_cpu;
+	// 等所有session的队列发完并且消息数不再增加
+	msgs = 0;
+	do {
+		last_msgs = msgs;
+		usleep(1000);
+		writev_calls = msgs = bytes = depth = 0;
+		for (int i = 0; i < stream_count; i++) {
+			RtmpPubSessionGetStats(sessions[i], &stats);
+			writev_calls += stats.m_nWritevCalls;
+			msgs += stats.m_nMessages;
+			bytes += stats.m_nBytes;
+			depth += stats.m_video.m_nDepth + stats.m_audio.m_nDepth;
+		}
+	} while (depth || msgs != last_msgs);
+	int64_t wall = now_ns() - start;
+	int64_t worker_cpu = (process_cpu_us() - process_cpu) * 1000 - push_cpu;
+	// 握手和命令的字节很少, 直接算在里面
+	result->transport = RtmpPubEngineGetTransport(engine, &transport_stats);
+	result->bytes = bytes;
+	result->sends = transport_stats.m_nSends;
+	result->syscalls = transport_stats.m_nSyscalls;
+	log("queue full retries:%llu", bench_waits);
+	log_send_bench("workers", loops, frames * stream_count, writev_calls, msgs, wall, worker_cpu, push_cpu, ghz, result);
+	if (transport_stats.m_nZeroCopy)
+		log("zero copy sends:%llu copied by kernel:%llu", transport_stats.m_nZeroCopy, transport_stats.m_nZeroCopyCopied);
+	RtmpPubEngineDel(engine);
+	engine = NULL;
+	stream_count = 0;
+	return 0;
+}
+
+// mode是socket、io_uring或者both, both时先后用两种传输层各跑一遍再对比, rtmp-sink要按连接数加-n
+static int run_send_benches(const char *url, int loops, const char *mode, int streams)
+{
+	static const RtmpPubTransportType transports[] = { RTMP_PUB_TRANSPORT_SOCKET, RTMP_PUB_TRANSPORT_URING };
+	send_bench_result_t results[2];
+	int first = 0, last = 1, ret = 0;
+
+	if (!strcmp(mode, "socket"))
+		last = 0;
+	else if (!strcmp(mode, "io_uring"))
+		first = 1;
+	else if (strcmp(mode, "both")) {
+		log("unknown transport %s", mode);
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	double ghz = cycles_per_ns();
+	memset(results, 0, sizeof(results));
+	for (int i = first; i <= last && !ret; i++)
+		ret = streams > 1 ? run_engine_send_bench(url, loops, transports[i], streams, ghz, &results[i]) :
+				    run_send_bench(url, loops, transports[i], ghz, &results[i]);
+	if (ret || first == last)
+		return ret;
+	log("%s vs %s: %.1f vs %.1f Mbit/s, %.0f vs %.0f msgs/s, send cpu %.3f vs %.3f ns/byte (%+.1f%%), %llu vs %llu syscalls",
+	    results[0].transport, results[1].transport, results[0].mbps, results[1].mbps, results[0].msgs_per_sec,
+	    results[1].msgs_per_sec, results[0].send_ns_per_byte, results[1].send_ns_per_byte,
+	    100.0 * (results[1].send_ns_per_byte - results[0].send_ns_per_byte) / results[0].send_ns_per_byte,
+	    results[0].syscalls, results[1].syscalls);
+	return 0;
+}
+
+// 按采集节奏推流secs秒, rtmp-sink用-r限速读取模拟上行带宽不足, 比如 rtmp-sink -n 1 -r 250 -l 3000
+// 这边报告丢帧和排队延时, rtmp-sink报告端到端延时和参考帧是否连续
+static int run_drop_bench(const char *url, int secs)
+{
+	RtmpPubRingStats video, audio;
+	RtmpPubDropStats drop;
+	RtmpPubMetricsSnapshot snapshot;
+
+	signal(SIGPIPE, SIG_IGN);
+	rtmp_ctx = RtmpPubNew(url, 30, RTMP_PUB_AUDIO_AAC, RTMP_PUB_AUDIO_AAC, RTMP_PUB_TIMESTAMP_ABSOLUTE);
+	if (!rtmp_ctx || RtmpPubInit(rtmp_ctx) || RtmpPubConnect(rtmp_ctx)) {
+		log("rtmp connect %s err, errno:%d", url, errno);
+		return -1;
+	}
+	if (RtmpPubSetChunkSize(rtmp_ctx, OUT_CHUNK_SIZE) || !(sender = RtmpPubSenderNew(rtmp_ctx, VIDEO_QUEUE_SLOTS, AUDIO_QUEUE_SLOTS))) {
+		log("new sender err");
+		return -1;
+	}
+	RtmpPubDropConfig drop_config = { LATENCY_BUDGET_MS, 0 };
+	RtmpPubSenderSetDropPolicy(sender, &drop_config);
+	if (RtmpPubSenderStart(sender)) {
+		log("start sender err");
+		return -1;
+	}
+	start_ipc_simulator(on_video, on_audio);
+	sleep(secs);
+	RtmpPubSenderGetStats(sender, &video, &audio);
+	RtmpPubSenderGetDropStats(sender, &drop);
+	RtmpPubSenderGetMetrics(sender, &snapshot);
+	const RtmpPubHistogramSnapshot *queue = &snapshot.m_stages[RTMP_PUB_STAGE_QUEUE];
+	log("%ds at capture pace: video frames sent:%llu congestion drop non-ref:%llu gop:%llu gop skips:%llu queue full:%llu",
+	    secs, snapshot.m_tracks[RTMP_PUB_TRACK_VIDEO].m_nFrames, drop.m_nDroppedNonRef, drop.m_nDroppedGop,
+	    drop.m_nGopSkips, video.m_nDropped);
+	log("audio frames sent:%llu queue full:%llu", snapshot.m_tracks[RTMP_PUB_TRACK_AUDIO].m_nFrames, audio.m_nDropped);
+	log("queue latency p50:%.1fms p99:%.1fms max:%.1fms, budget %dms",
+	    RtmpPubHistogramPercentile(queue, 50) / 1e6, RtmpPubHistogramPercentile(queue, 99) / 1e6, queue->m_nMax / 1e6,
+	    LATENCY_BUDGET_MS);
+	if (!drop.m_nDroppedNonRef && !drop.m_nDroppedGop) {
+		log("no congestion drop, the link was not throttled below the stream bitrate");
+		return -1;
+	}
+	// 进程退出时连接关闭, rtmp-sink随后打印这个连接的统计
+	return 0;
+}
+
+static long long rss_bytes(void)
+{
+	long long size = 0, resident = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+
+	if (!fp)
+		return 0;
+	if (fscanf(fp, "%lld %lld", &size, &resident) != 2)
+		resident = 0;
+	fclose(fp);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+// 每一路会话常驻内存的增量: 先用librtmp的会话连接count次, 看裁剪channel数组前后, 再用引擎的session连接count次
+// rtmp-sink要加-n 2*count
+static int run_memory_bench(const char *url, int count)
+{
+	RtmpPubContext **contexts;
+	RtmpPubSessionConfig config;
+	char stream_url[1024];
+	unsigned long trimmed = 0;
+	int publishing, ret = -1;
+
+	if (count <= 0 || count > MAX_STREAMS) {
+		log("sessions must be in 1~%d", MAX_STREAMS);
+		return -1;
+	}
+	if (!(contexts = calloc(count, sizeof(RtmpPubContext *))))
+		return -1;
+	signal(SIGPIPE, SIG_IGN);
+	long long base = rss_bytes();
+	for (int i = 0; i < count; i++) {
+		snprintf(stream_url, sizeof(stream_url), "%s_%d", url, i);
+		contexts[i] = RtmpPubNew(stream_url, 30, RTMP_PUB_AUDIO_AAC, RTMP_PUB_AUDIO_AAC, RTMP_PUB_TIMESTAMP_ABSOLUTE);
+		if (!contexts[i] || RtmpPubInit(contexts[i]) || RtmpPubConnect(contexts[i])) {
+			log("rtmp connect %s err, errno:%d", stream_url, errno);
+			goto out;
+		}
+	}
+	long long untrimmed = rss_bytes() - base;
+	for (int i = 0; i < count; i++)
+		trimmed += RtmpPubTrimChannels(contexts[i]);
+	long long trimmed_rss = rss_bytes() - base;
+	log("%d librtmp sessions: %lld bytes/session, after trimming channel tables %lld bytes/session (%lu bytes trimmed each)",
+	    count, untrimmed / count, trimmed_rss / count, trimmed / count);
+	for (int i = 0; i < count; i++) {
+		RtmpPubDel(contexts[i]);
+		contexts[i] = NULL;
+	}
+
+	init_session_config(&config);
+	engine = RtmpPubEngineNew(0);
+	if (!engine || RtmpPubEngineStart(engine)) {
+		log("start engine err");
+		goto out;
+	}
+	// worker线程的栈等不算在session里
+	base = rss_bytes();
+	for (stream_count = 0; stream_count < count; stream_count++) {
+		snprintf(stream_url, sizeof(stream_url), "%s_%d", url, count + stream_count);
+		if (!(sessions[stream_count] = RtmpPubEngineAddSession(engine, stream_url, &config))) {
+			log("add session %s err", stream_url);
+			goto out;
+		}
+	}
+	publishing = wait_publishing();
+	if (publishing < stream_count) {
+		log("only %d of %d sessions publishing, check the server", publishing, stream_count);
+		goto out;
+	}
+	log("%d engine sessions: %lld bytes/session", count, (rss_bytes() - base) / count);
+	ret = 0;
+out:
+	if (engine)
+		RtmpPubEngineDel(engine);
+	engine = NULL;
+	stream_count = 0;
+	for (int i = 0; i < count; i++)
+		if (contexts[i])
+			RtmpPubDel(contexts[i]);
+	free(contexts);
+	return ret;
+}
+
+// 三种流水线方式各用count个session连接一次, 打印各阶段的平均完成时间
+// rtmp-sink加-d模拟RTT, 比如 rtmp-sink -n 3*count -d 50, 不等回应的命令越多publish完成得越早
+static int run_connect_bench(const char *url, int count)
+{
+	static const RtmpPubPipelineMode modes[] = { RTMP_PUB_PIPELINE_NONE, RTMP_PUB_PIPELINE_COMMANDS, RTMP_PUB_PIPELINE_PUBLISH };
+	static const char *names[] = { "none", "commands", "publish" };
+	RtmpPubSessionConfig config;
+	RtmpPubSessionStats stats;
+	char stream_url[1024];
+	int publishing, ret = -1;
+
+	if (count <= 0 || count > MAX_STREAMS) {
+		log("sessions must be in 1~%d", MAX_STREAMS);
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	init_session_config(&config);
+	for (int m = 0; m < 3; m++) {
+		long long tcp = 0, handshake = 0, connect = 0, create_stream = 0, publish = 0;
+
+		config.m_nPipeline = modes[m];
+		engine = RtmpPubEngineNew(0);
+		if (!engine || RtmpPubEngineStart(engine)) {
+			log("start engine err");
+			goto out;
+		}
+		for (stream_count = 0; stream_count < count; stream_count++) {
+			snprintf(stream_url, sizeof(stream_url), "%s_%d", url, m * count + stream_count);
+			if (!(sessions[stream_count] = RtmpPubEngineAddSession(engine, stream_url, &config))) {
+				log("add session %s err", stream_url);
+				goto out;
+			}
+		}
+		publishing = wait_publishing();
+		if (publishing < stream_count) {
+			log("pipeline %s: only %d of %d sessions publishing, check the server", names[m], publishing, stream_count);
+			goto out;
+		}
+		for (int i = 0; i < stream_count; i++) {
+			RtmpPubSessionGetStats(sessions[i], &stats);
+			tcp += stats.m_timing.m_nTcpUs;
+			handshake += stats.m_timing.m_nHandshakeUs;
+			connect += stats.m_timing.m_nConnectUs;
+			create_stream += stats.m_timing.m_nCreateStreamUs;
+			publish += stats.m_timing.m_nPublishUs;
+		}
+		log("pipeline %-8s avg connect timing(us) tcp:%lld handshake:%lld connect:%lld createStream:%lld publish:%lld",
+		    names[m], tcp / count, handshake / count, connect / count, create_stream / count, publish / count);
+		RtmpPubEngineDel(engine);
+		engine = NULL;
+		stream_count = 0;
+	}
+	ret = 0;
+out:
+	if (engine)
+		RtmpPubEngineDel(engine);
+	engine = NULL;
+	stream_count = 0;
+	return ret;
+}
+
+// 同一路采集同时推给发送线程和引擎的session
+static int on_reconnect_video(const char *h264, int len, int64_t pts, int is_key)
+{
+	return on_video(h264, len, pts, is_key) | on_fanout_video(h264, len, pts, is_key);
+}
+
+static int on_reconnect_audio(const char *aac, int len, int64_t pts)
+{
+	return on_audio(aac, len, pts) | on_fanout_audio(aac, len, pts);
+}
+
+// 发送线程和streams个引擎session一起按采集节奏推流secs秒, rtmp-sink用-k中途断开所有连接并停止监听一会,
+// 比如 rtmp-sink -n 2*(1+streams) -k 5, 两边都要重连成功并且重新在推流
+// 重连后的连接从sequence header和关键帧开始、参考帧连续由rtmp-sink检查
+static int run_reconnect_bench(const char *url, int secs, int streams)
+{
+	RtmpPubSessionConfig config;
+	RtmpPubSessionStats stats;
+	int reconnected = 0;
+
+	if (streams <= 0 || streams > MAX_STREAMS) {
+		log("streams must be in 1~%d", MAX_STREAMS);
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	rtmp_ctx = RtmpPubNew(url, 30, RTMP_PUB_AUDIO_AAC, RTMP_PUB_AUDIO_AAC, RTMP_PUB_TIMESTAMP_ABSOLUTE);
+	if (!rtmp_ctx || RtmpPubInit(rtmp_ctx) || RtmpPubConnect(rtmp_ctx)) {
+		log("rtmp connect %s err, errno:%d", url, errno);
+		return -1;
+	}
+	if (RtmpPubSetChunkSize(rtmp_ctx, OUT_CHUNK_SIZE) || !(sender = RtmpPubSenderNew(rtmp_ctx, VIDEO_QUEUE_SLOTS, AUDIO_QUEUE_SLOTS))) {
+		log("new sender err");
+		return -1;
+	}
+	RtmpPubReconnectConfig reconnect_config = { RECONNECT_MIN_MS, RECONNECT_MAX_MS, GOP_CACHE_BYTES };
+	RtmpPubSenderSetReconnect(sender, &reconnect_config);
+	if (RtmpPubSenderStart(sender)) {
+		log("start sender err");
+		return -1;
+	}
+
+	init_session_config(&config);
+	config.m_reconnect = reconnect_config;
+	engine = RtmpPubEngineNew(0);
+	if (!engine || RtmpPubEngineStart(engine)) {
+		log("start engine err");
+		return -1;
+	}
+	if (!(fanout = new_fanout(engine, url, streams, &config)))
+		return -1;
+	for (stream_count = 0; stream_count < streams; stream_count++)
+		sessions[stream_count] = RtmpPubFanoutGetSession(fanout, stream_count);
+	start_ipc_simulator(on_reconnect_video, on_reconnect_audio);
+	sleep(secs);
+	for (int i = 0; i < stream_count; i++) {
+		RtmpPubSessionGetStats(sessions[i], &stats);
+		reconnected += stats.m_nReconnects && stats.m_nState == RTMP_PUB_SESSION_PUBLISHING;
+	}
+	log("sender reconnects:%llu, engine sessions reconnected and publishing:%d of %d",
+	    RtmpPubSenderGetReconnects(sender), reconnected, stream_count);
+	if (!RtmpPubSenderGetReconnects(sender) || reconnected < stream_count) {
+		log("not all streams reconnected, is rtmp-sink running with -k?");
+		return -1;
+	}
+	// 进程退出时连接关闭, rtmp-sink随后打印重连后这些连接的统计
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (!argv[1]) {
+		log("./rtmp-publish-bench audio [streams]");
+		log("./rtmp-publish-bench amf [reconnects]");
+		log("./rtmp-publish-bench startcode [passes]");
+		log("./rtmp-publish-bench interleave [jitter ms]");
+		log("./rtmp-publish-bench send <rtmp url of rtmp-sink> [loops [socket|io_uring|both [streams]]]");
+		log("./rtmp-publish-bench drop <rtmp url of rtmp-sink -r kbps> [secs]");
+		log("./rtmp-publish-bench memory <rtmp url of rtmp-sink> [sessions]");
+		log("./rtmp-publish-bench connect <rtmp url of rtmp-sink -d ms> [sessions]");
+		log("./rtmp-publish-bench reconnect <rtmp url of rtmp-sink -k secs> [secs [streams]]");
+		return 0;
+	}
+	if (!strcmp(argv[1], "audio"))
+		return run_audio_bench(argv[2] ? atoi(argv[2]) : 16) ? 1 : 0;
+	if (!strcmp(argv[1], "amf"))
+		return run_amf_bench(argv[2] ? atoi(argv[2]) : 1000000) ? 1 : 0;
+	if (!strcmp(argv[1], "startcode"))
+		return run_startcode_bench(argv[2] ? atoi(argv[2]) : 100) ? 1 : 0;
+	if (!strcmp(argv[1], "interleave"))
+		return run_interleave_bench(argv[2] ? atoi(argv[2]) : 30) ? 1 : 0;
+	if (!strcmp(argv[1], "send") && argv[2])
+		return run_send_benches(argv[2], argc > 3 ? atoi(argv[3]) : BENCH_SEND_LOOPS, argc > 4 ? argv[4] : "socket",
+					argc > 5 ? atoi(argv[5]) : 1) ? 1 : 0;
+	if (!strcmp(argv[1], "drop") && argv[2])
+		return run_drop_bench(argv[2], argv[3] ? atoi(argv[3]) : BENCH_DROP_SECS) ? 1 : 0;
+	if (!strcmp(argv[1], "memory") && argv[2])
+		return run_memory_bench(argv[2], argv[3] ? atoi(argv[3]) : BENCH_MEM_SESSIONS) ? 1 : 0;
+	if (!strcmp(argv[1], "connect") && argv[2])
+		return run_connect_bench(argv[2], argv[3] ? atoi(argv[3]) : BENCH_CONNECT_SESSIONS) ? 1 : 0;
+	if (!strcmp(argv[1], "reconnect") && argv[2])
+		return run_reconnect_bench(argv[2], argc > 3 ? atoi(argv[3]) : BENCH_RECONNECT_SECS,
+					   argc > 4 ? atoi(argv[4]) : 1) ? 1 : 0;
+	log("unknown bench %s", argv[1]);
+	return 1;
+}
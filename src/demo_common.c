@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "demo_common.h"
+
+#define log(fmt, args...) printf("%s $ "fmt"\n", __FUNCTION__, ##args)
+
+void init_session_config(RtmpPubSessionConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->m_nAudioInputType = RTMP_PUB_AUDIO_AAC;
+	config->m_nAudioOutputType = RTMP_PUB_AUDIO_AAC;
+	config->m_nTimePolicy = RTMP_PUB_TIMESTAMP_ABSOLUTE;
+	config->m_nChunkSize = OUT_CHUNK_SIZE;
+	config->m_nVideoSlots = VIDEO_QUEUE_SLOTS;
+	config->m_nAudioSlots = AUDIO_QUEUE_SLOTS;
+}
+
+RtmpPubFanout *new_fanout(RtmpPubEngine *engine, const char *url, int count, const RtmpPubSessionConfig *config)
+{
+	RtmpPubFanout *fanout = NULL;
+	char stream_url[1024];
+	char **urls;
+
+	if (count <= 0 || count > MAX_STREAMS) {
+		log("streams must be in 1~%d", MAX_STREAMS);
+		return NULL;
+	}
+	if (!(urls = calloc(count, sizeof(char *))))
+		return NULL;
+	for (int i = 0; i < count; i++) {
+		snprintf(stream_url, sizeof(stream_url), "%s_%d", url, i);
+		if (!(urls[i] = strdup(stream_url)))
+			goto out;
+	}
+	if (!(fanout = RtmpPubFanoutNew(engine, (const char * const *)urls, count, config)))
+		log("new fanout err");
+out:
+	for (int i = 0; i < count; i++)
+		free(urls[i]);
+	free(urls);
+	return fanout;
+}
+
+int64_t process_cpu_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,30 @@
+#ifndef __DEMO_COMMON__
+#define __DEMO_COMMON__
+
+#include <stdint.h>
+#include "rtmp_engine.h"
+#include "rtmp_fanout.h"
+
+/*
+* rtmp-publish-demo和rtmp-publish-bench共用的推流参数
+*/
+
+#define VIDEO_QUEUE_SLOTS   64
+#define AUDIO_QUEUE_SLOTS   128
+#define LATENCY_BUDGET_MS   500 // 排队超过500ms开始丢非参考帧, 超过1s丢到下一个IDR
+#define OUT_CHUNK_SIZE      4096 // 默认的128字节chunk, 一个关键帧要切成上千个chunk
+#define MAX_STREAMS         4096
+#define RECONNECT_MIN_MS    500 // 断线后0.5s开始重连, 每次翻倍, 最多30s
+#define RECONNECT_MAX_MS    30000
+#define GOP_CACHE_BYTES     (2 << 20) // 重连后立即重发最近一个GOP, 观众不用等下一个IDR
+
+// 多路推流和压测共用的session配置, 丢帧和重连由调用者按需设置
+void init_session_config(RtmpPubSessionConfig *config);
+
+// 给url_0, url_1...共count个地址新建fanout, count不在1~MAX_STREAMS或者失败时返回NULL
+RtmpPubFanout *new_fanout(RtmpPubEngine *engine, const char *url, int count, const RtmpPubSessionConfig *config);
+
+// 进程累计占用的cpu时间
+int64_t process_cpu_us(void);
+
+#endif
@@ -10,6 +10,13 @@
 #include <math.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include "ipc_simulator.h"
 
 /*
 * 本文件用于使用文件模拟ipc采集一帧h264/aac后，丢给应用层
@@ -20,148 +27,547 @@
 #define log(fmt, args...) printf("%s() "fmt"\n",  __FUNCTION__, ##args)
 
 #define H264_FILE "./video.h264"
+#define HEVC_FILE "./video.h265"
 #define AAC_FILE "./audio.aac"
 #define NAL_NON_IDR (0x01)
+#define NAL_IDR (0x05)
+#define HEVC_NAL_BLA_W_LP (16)
+#define HEVC_NAL_IRAP_MAX (23)
+#define HEVC_NAL_VCL_MAX (31)
 #define VIDEO_FRAME_INTERVAL (40) // 模拟帧率25fps
 
-typedef int (*video_cb_t)(char *h264, int len, int64_t pts, int is_key);
-typedef int (*audio_cb_t)(char *aac, int len, int64_t pts);
+// 文件里的一帧, pts和时长都是微秒, 相对文件开头
+typedef struct {
+	size_t offset;
+	int size;
+	int is_key;
+	int64_t pts;
+	int duration;
+} media_frame_t;
+
+// 媒体文件只mmap一次, 启动时建好帧索引, 采集线程之后只按索引取指针回调
+// 不再有fread/fseek/内存分配, 所有虚拟摄像头共用同一份映射
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	media_frame_t *frames;
+	int nb_frames;
+	int64_t duration; // 整个文件的时长, 循环播放时累加到pts上
+} media_index_t;
+
+// 解析_p处的一帧, 返回这一帧在文件里占用的字节数, 0表示文件结束(包括不完整的最后一帧), -1表示格式错误
+typedef int (*parse_frame_t)(const uint8_t *p, size_t left, media_frame_t *frame);
 
 static video_cb_t video_cb;
 static audio_cb_t audio_cb;
+static media_index_t video_index;
+static media_index_t audio_index;
+static int video_hevc;
 
-// 使用h264文件模拟ipc codec编码一帧h264，回调给应用层
-// 模拟的帧率是25fps,实际的场景是cam sensor采集到yuv/rgb
-// 经过codec编码为h264之后，丢给应用层
-void *video_capture_simulator_thread(void *param)
+static int map_file(const char *path, media_index_t *index)
 {
-	uint8_t *buf = (uint8_t *)malloc(1024);
-	int64_t pts = 0;
-	int nb_buf = 1024;
-	int ret = 0;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
 
-	FILE *fp = fopen(H264_FILE, "r");
-	if (!fp) {
-		log("open file %s err", H264_FILE);
-		return NULL;
+	if (fd < 0) {
+		log("open file %s err", path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+		log("stat file %s err", path);
+		close(fd);
+		return -1;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		log("mmap file %s err", path);
+		return -1;
 	}
+	// 循环播放时顺序读, 让内核提前把整个文件读进page cache
+	madvise(data, st.st_size, MADV_WILLNEED);
+	index->data = (const uint8_t *)data;
+	index->size = st.st_size;
+	return 0;
+}
 
-	log("enter video capture simulator thread");
-	for(;;) {
-		int nalu_len = 0;
-		ret = fread(&nalu_len, 1, 4, fp);
-		if (ret < 0) {
-			log("fread err");
-			return NULL;
+// 扫描两遍: 第一遍只数帧数, 第二遍填索引, 索引只分配一次
+static int build_index(const char *path, media_index_t *index, parse_frame_t parse)
+{
+	media_frame_t frame;
+	int pass, count;
+
+	if (map_file(path, index) < 0)
+		return -1;
+	for (pass = 0; pass < 2; pass++) {
+		size_t pos = 0;
+		int64_t pts = 0;
+		int ret;
+
+		count = 0;
+		while ((ret = parse(index->data + pos, index->size - pos, &frame)) > 0) {
+			frame.offset += pos;
+			frame.pts = pts;
+			if (index->frames)
+				index->frames[count] = frame;
+			pts += frame.duration;
+			pos += ret;
+			count++;
 		}
-		if (ret < 4 && feof(fp)) {
-			// 循环读取
-			log("h264 rewind");
-			fseek(fp, 0, SEEK_SET);
-			continue;
+		if (ret < 0 || !count) {
+			log("parse file %s err, offset:%zu", path, pos);
+			goto err;
 		}
-		assert(nalu_len > 0);
-		if (nalu_len > nb_buf) {
-			buf = (uint8_t *)realloc(buf, nalu_len);
-			if (!buf) {
-				log("realloc err");
-				return NULL;
+		if (!index->frames) {
+			index->frames = (media_frame_t *)malloc(count * sizeof(media_frame_t));
+			if (!index->frames) {
+				log("malloc err");
+				goto err;
 			}
 		}
-		ret = fread(buf, 1, nalu_len, fp);
-		if (ret < 0) {
-			log("fread err");
-			return NULL;
-		}
-		if (ret < nalu_len && feof(fp)) {
-			// 循环读取
-			log("h264 rewind");
-			fseek(fp, 0, SEEK_SET);
+		index->duration = pts;
+	}
+	index->nb_frames = count;
+	log("%s: %d frames, duration %"PRId64"ms", path, count, index->duration / 1000);
+	return 0;
+err:
+	free(index->frames);
+	munmap((void *)index->data, index->size);
+	memset(index, 0, sizeof(*index));
+	return -1;
+}
+
+// 采集数据里的is_key以码流为准: 第一个slice是IDR的帧是关键帧
+static int h264_is_key(const uint8_t *p, int len)
+{
+	for (int i = 0; i + 3 < len; i++) {
+		if (p[i] || p[i+1] || p[i+2] != 1)
 			continue;
-		}
-		//log("len:%x", nalu_len);
-		video_cb(buf, nalu_len, pts, 0);
-		pts += VIDEO_FRAME_INTERVAL;
-		usleep(VIDEO_FRAME_INTERVAL*1000);
+		int type = p[i+3] & 0x1f;
+		if (type == NAL_IDR)
+			return 1;
+		if (type == NAL_NON_IDR)
+			return 0;
+		i += 2;
 	}
-	if (buf)
-		free(buf);
-	return NULL;
+	return 0;
+}
+
+// hevc的nalu类型在第一个字节的1~6位, 第一个slice是IRAP(BLA/IDR/CRA)的帧是关键帧
+static int hevc_is_key(const uint8_t *p, int len)
+{
+	for (int i = 0; i + 3 < len; i++) {
+		if (p[i] || p[i+1] || p[i+2] != 1)
+			continue;
+		int type = (p[i+3] >> 1) & 0x3f;
+		if (type >= HEVC_NAL_BLA_W_LP && type <= HEVC_NAL_IRAP_MAX)
+			return 1;
+		if (type <= HEVC_NAL_VCL_MAX)
+			return 0;
+		i += 2;
+	}
+	return 0;
+}
+
+// h264(h265)文件的每条记录是4字节的长度(本机字节序)加上一帧annexb数据
+static int parse_h264_record(const uint8_t *p, size_t left, media_frame_t *frame)
+{
+	int nalu_len;
+
+	if (left < 4)
+		return 0;
+	memcpy(&nalu_len, p, 4);
+	if (nalu_len <= 0)
+		return -1;
+	if ((size_t)nalu_len > left - 4)
+		return 0;
+	frame->offset = 4;
+	frame->size = nalu_len;
+	frame->is_key = video_hevc ? hevc_is_key(p + 4, nalu_len) : h264_is_key(p + 4, nalu_len);
+	frame->duration = VIDEO_FRAME_INTERVAL * 1000;
+	return 4 + nalu_len;
 }
 
 static int aacfreq[13] = {96000, 88200,64000,48000,44100,32000,24000, 22050 , 16000 ,12000,11025,8000,7350};
 
+static int parse_adts_frame(const uint8_t *p, size_t left, media_frame_t *frame)
+{
+	if (left < 7)
+		return 0;
+	short syncword = (p[0] << 4) | (p[1] >> 4);
+	if (syncword != 0xFFF) {
+		log("check syncword err, %x", syncword);
+		return -1;
+	}
+	short frame_length = ((p[3] & 0x3) << 11) | (p[4] << 3) | (p[5] >> 5);
+	int sampling_freq_idx = (p[2] >> 2) & 0xF;
+	if (frame_length <= 7 || sampling_freq_idx >= 13)
+		return -1;
+	if ((size_t)frame_length > left)
+		return 0;
+	frame->offset = 0;
+	frame->size = frame_length;
+	frame->is_key = 1;
+	frame->duration = (1024*1000000.0)/aacfreq[sampling_freq_idx];
+	return frame_length;
+}
+
+// 使用h264文件模拟ipc codec编码一帧h264，回调给应用层
+// 模拟的帧率是25fps,实际的场景是cam sensor采集到yuv/rgb
+// 经过codec编码为h264之后，丢给应用层
+void *video_capture_simulator_thread(void *param)
+{
+	log("enter video capture simulator thread");
+	for (int64_t base = 0;; base += video_index.duration) {
+		for (int i = 0; i < video_index.nb_frames; i++) {
+			media_frame_t *frame = &video_index.frames[i];
+
+			video_cb((const char *)video_index.data + frame->offset, frame->size, (base + frame->pts) / 1000, frame->is_key);
+			usleep(frame->duration);
+		}
+		// 循环读取
+		log("h264 rewind");
+	}
+	return NULL;
+}
+
 // 使用aac文件模拟ipc codec编码一帧aac，回调给应用层
 // 实际的场景是摄像头采集到一帧pcm，编码为aac，丢给应用层
 void *audio_capture_thread(void *param)
 {
-	FILE *fp = fopen(AAC_FILE, "r");
-	if (!fp) {
-		log("open file %s err", AAC_FILE);
-		return NULL;
-	}
 	log("enter audio capture simulator thread");
-	uint8_t *buf = (uint8_t *)malloc(7);
-	if (!buf) {
-		log("malloc err");
-		return NULL;
-	}
-	int nb_buf = 7, ret = 0;
-	int64_t pts = 0;
-	for (;;) {
-		ret = fread(buf, 1, 7, fp);
-		if (ret < 0) {
-			log("fread err");
-			goto err;
-		}
-		if (ret < 7 && feof(fp)) {
-			// 循环读取
-			log("aac rewind");
-			fseek(fp, 0, SEEK_SET);
-			continue;
-		}
-		short syncword = (buf[0] << 4) | (buf[1] >> 4);
-		if (syncword != 0xFFF) {
-			log("check syncword err, %x", syncword);
-			goto err;
-		}
-		short frame_length = ((buf[3] & 0x3) << 11) | (buf[4] << 3) | (buf[5] >> 5);
-		//log("frame_length:%d", frame_length);
-		assert(frame_length > 7);
-		if (frame_length > nb_buf) {
-			buf = (char *)realloc(buf, frame_length);
-			nb_buf = frame_length;
-		}
-		ret = fread(buf+7, 1, frame_length-7, fp);
-		if (ret < 0) {
-			log("fread err");
-			goto err;
-		}
-		if (ret < frame_length-7 && feof(fp)) {
-			// 循环读取
-			log("aac rewind");
-			fseek(fp, 0, SEEK_SET);
-			continue;
-		}
-		int sampling_freq_idx = (buf[2] >> 2) & 0xF;
-		pts += ((1024*1000.0)/aacfreq[sampling_freq_idx]);
-		audio_cb(buf, frame_length, pts);
-		usleep(((1024*1000.0)/aacfreq[sampling_freq_idx])*1000);
+	for (int64_t base = 0;; base += audio_index.duration) {
+		for (int i = 0; i < audio_index.nb_frames; i++) {
+			media_frame_t *frame = &audio_index.frames[i];
 
+			audio_cb((const char *)audio_index.data + frame->offset, frame->size, (base + frame->pts) / 1000);
+			usleep(frame->duration);
+		}
+		// 循环读取
+		log("aac rewind");
 	}
-err:
-	if (buf)
-		free(buf);
 	return NULL;
 }
 
+// 两个模式共用同一份映射和索引
+static void load_media(void)
+{
+	// 文件打不开或者格式不对时和原来一样, 只是对应的采集不启动
+	if (!video_index.data && build_index(video_hevc ? HEVC_FILE : H264_FILE, &video_index, parse_h264_record) < 0)
+		log("video capture simulator disabled");
+	if (!audio_index.data && build_index(AAC_FILE, &audio_index, parse_adts_frame) < 0)
+		log("audio capture simulator disabled");
+}
+
+int run_media_unthrottled(int loops, video_cb_t vcb, audio_cb_t acb)
+{
+	int frames = 0;
+
+	load_media();
+	if (!video_index.data && !audio_index.data)
+		return -1;
+	for (int loop = 0; loop < loops; loop++) {
+		int64_t video_base = loop * video_index.duration, audio_base = loop * audio_index.duration;
+		int v = 0, a = 0;
+
+		// 两个轨道按时间戳归并, 顺序和实时采集时一样, 只是不再sleep
+		while (v < video_index.nb_frames || a < audio_index.nb_frames) {
+			media_frame_t *video = v < video_index.nb_frames ? &video_index.frames[v] : NULL;
+			media_frame_t *audio = a < audio_index.nb_frames ? &audio_index.frames[a] : NULL;
+			int ret;
+
+			if (video && (!audio || video_base + video->pts <= audio_base + audio->pts)) {
+				ret = vcb((const char *)video_index.data + video->offset, video->size, (video_base + video->pts) / 1000,
+					  video->is_key);
+				v++;
+			} else {
+				ret = acb((const char *)audio_index.data + audio->offset, audio->size, (audio_base + audio->pts) / 1000);
+				a++;
+			}
+			if (ret < 0)
+				return -1;
+			frames++;
+		}
+	}
+	return frames;
+}
+
+void set_ipc_video_hevc(int hevc)
+{
+	video_hevc = hevc;
+}
+
 void start_ipc_simulator(video_cb_t vcb, audio_cb_t acb)
 {
 	pthread_t tid;
 
 	video_cb = vcb;
 	audio_cb = acb;
-	pthread_create(&tid, NULL, video_capture_simulator_thread, NULL);	
-	pthread_create(&tid, NULL, audio_capture_thread, NULL);	
+	load_media();
+	if (video_index.data)
+		pthread_create(&tid, NULL, video_capture_simulator_thread, NULL);
+	if (audio_index.data)
+		pthread_create(&tid, NULL, audio_capture_thread, NULL);
 	log("ipc simulator started");
-}
\ No newline at end of file
+}
+
+#define WHEEL_TICK_US (1000)
+#define WHEEL_SLOTS (1024) // 2的幂, 一圈1s多, 更远的定时器在槽里多转几圈
+#define MAX_WHEEL_THREADS (64)
+#define FILLER_NALU_HEADER_LEN (5)
+
+typedef struct timer_node {
+	struct timer_node *next;
+	int64_t deadline; // CLOCK_MONOTONIC, 微秒
+	struct virtual_camera *camera;
+	int is_video;
+} timer_node_t;
+
+typedef struct virtual_camera {
+	int id;
+	int64_t start;
+	timer_node_t video;
+	timer_node_t audio;
+	int video_next;
+	int64_t video_count;
+	int audio_next;
+	int64_t audio_base;
+	atomic_ullong video_frames;
+	atomic_ullong audio_frames;
+	atomic_ullong late_sum_us;
+	atomic_ullong late_max_us;
+} virtual_camera_t;
+
+typedef struct {
+	pthread_t tid;
+	clockid_t cpu_clock; // 只在创建线程后写一次
+	timer_node_t *slots[WHEEL_SLOTS];
+	int64_t tick;
+	uint8_t *scratch; // 放大码率时拼接filler nalu
+} timer_wheel_t;
+
+static load_generator_config_t loadgen;
+static camera_video_cb_t camera_video_cb;
+static camera_audio_cb_t camera_audio_cb;
+static virtual_camera_t *cameras;
+static timer_wheel_t *wheels;
+static int max_video_frame;
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void wheel_add(timer_wheel_t *wheel, timer_node_t *node)
+{
+	timer_node_t **slot = &wheel->slots[(node->deadline / WHEEL_TICK_US) & (WHEEL_SLOTS - 1)];
+
+	node->next = *slot;
+	*slot = node;
+}
+
+// 下一个到期时间, 只看从当前tick开始的一圈, 一圈内没有就一圈之后再看
+// 落后太多时刚回调过的定时器可能仍然已经到期, 也要算进来
+static int64_t wheel_next(timer_wheel_t *wheel)
+{
+	for (int64_t tick = wheel->tick; tick < wheel->tick + WHEEL_SLOTS; tick++) {
+		int64_t next = INT64_MAX;
+
+		for (timer_node_t *node = wheel->slots[tick & (WHEEL_SLOTS - 1)]; node; node = node->next) {
+			if (node->deadline / WHEEL_TICK_US <= tick && node->deadline < next)
+				next = node->deadline;
+		}
+		if (next != INT64_MAX)
+			return next;
+	}
+	return (wheel->tick + WHEEL_SLOTS) * WHEEL_TICK_US;
+}
+
+static void update_late(virtual_camera_t *camera, int64_t deadline)
+{
+	unsigned long long late = now_us() - deadline;
+
+	atomic_fetch_add_explicit(&camera->late_sum_us, late, memory_order_relaxed);
+	if (late > atomic_load_explicit(&camera->late_max_us, memory_order_relaxed))
+		atomic_store_explicit(&camera->late_max_us, late, memory_order_relaxed);
+}
+
+static void fire_video(timer_wheel_t *wheel, virtual_camera_t *camera)
+{
+	media_frame_t *frame = &video_index.frames[camera->video_next];
+	const uint8_t *data = video_index.data + frame->offset;
+	int len = frame->size;
+	int pad = (int64_t)frame->size * (loadgen.bitrate_percent - 100) / 100;
+
+	update_late(camera, camera->video.deadline);
+	if (pad > FILLER_NALU_HEADER_LEN) {
+		// 00 00 00 01 0c ff ... ff 80, 接收端会直接丢弃的filler data
+		memcpy(wheel->scratch, data, len);
+		memcpy(wheel->scratch + len, "\x00\x00\x00\x01\x0c", FILLER_NALU_HEADER_LEN);
+		memset(wheel->scratch + len + FILLER_NALU_HEADER_LEN, 0xff, pad - FILLER_NALU_HEADER_LEN - 1);
+		wheel->scratch[len + pad - 1] = 0x80;
+		data = wheel->scratch;
+		len += pad;
+	}
+	camera_video_cb(camera->id, (const char *)data, len, camera->video_count * 1000 / loadgen.fps, frame->is_key);
+	atomic_fetch_add_explicit(&camera->video_frames, 1, memory_order_relaxed);
+	camera->video_count++;
+	if (++camera->video_next == video_index.nb_frames)
+		camera->video_next = 0;
+	camera->video.deadline = camera->start + camera->video_count * 1000000 / loadgen.fps;
+}
+
+static void fire_audio(virtual_camera_t *camera)
+{
+	media_frame_t *frame = &audio_index.frames[camera->audio_next];
+
+	update_late(camera, camera->audio.deadline);
+	camera_audio_cb(camera->id, (const char *)audio_index.data + frame->offset, frame->size,
+			(camera->audio_base + frame->pts) / 1000);
+	atomic_fetch_add_explicit(&camera->audio_frames, 1, memory_order_relaxed);
+	if (++camera->audio_next == audio_index.nb_frames) {
+		camera->audio_next = 0;
+		camera->audio_base += audio_index.duration;
+	}
+	frame = &audio_index.frames[camera->audio_next];
+	camera->audio.deadline = camera->start + camera->audio_base + frame->pts;
+}
+
+// 回调当前时刻之前到期的所有定时器, 落后超过一圈时也只扫一圈
+static void wheel_expire(timer_wheel_t *wheel, int64_t now)
+{
+	int64_t cur = now / WHEEL_TICK_US;
+	int64_t end = cur < wheel->tick + WHEEL_SLOTS ? cur : wheel->tick + WHEEL_SLOTS - 1;
+
+	for (int64_t tick = wheel->tick; tick <= end; tick++) {
+		timer_node_t **slot = &wheel->slots[tick & (WHEEL_SLOTS - 1)];
+		timer_node_t *node = *slot, *next;
+
+		*slot = NULL;
+		for (; node; node = next) {
+			next = node->next;
+			if (node->deadline <= now) {
+				if (node->is_video)
+					fire_video(wheel, node->camera);
+				else
+					fire_audio(node->camera);
+			}
+			wheel_add(wheel, node);
+		}
+	}
+	wheel->tick = cur;
+}
+
+static void *timer_wheel_thread(void *param)
+{
+	timer_wheel_t *wheel = (timer_wheel_t *)param;
+
+	for (;;) {
+		wheel_expire(wheel, now_us());
+		int64_t next = wheel_next(wheel);
+		struct timespec ts = { next / 1000000, next % 1000000 * 1000 };
+		// 绝对时间睡眠, 回调耗时不会累积到下一帧
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+	}
+	return NULL;
+}
+
+int start_load_generator(const load_generator_config_t *config, camera_video_cb_t vcb, camera_audio_cb_t acb)
+{
+	int keys = 0;
+
+	loadgen = *config;
+	if (!loadgen.threads)
+		loadgen.threads = 1;
+	if (!loadgen.fps)
+		loadgen.fps = 1000 / VIDEO_FRAME_INTERVAL;
+	if (!loadgen.bitrate_percent)
+		loadgen.bitrate_percent = 100;
+	if (loadgen.cameras <= 0 || loadgen.threads > MAX_WHEEL_THREADS || loadgen.fps > 1000 ||
+	    loadgen.bitrate_percent < 100) {
+		log("invalid config, cameras:%d threads:%d fps:%d bitrate:%d%%",
+		    loadgen.cameras, loadgen.threads, loadgen.fps, loadgen.bitrate_percent);
+		return -1;
+	}
+	if (loadgen.threads > loadgen.cameras)
+		loadgen.threads = loadgen.cameras;
+	camera_video_cb = vcb;
+	camera_audio_cb = acb;
+	load_media();
+	if (!video_index.data || !audio_index.data)
+		return -1;
+	for (int i = 0; i < video_index.nb_frames; i++) {
+		keys += video_index.frames[i].is_key;
+		if (video_index.frames[i].size > max_video_frame)
+			max_video_frame = video_index.frames[i].size;
+	}
+	// 平均GOP时长, 各路的起始时间在一个GOP内均匀分布
+	int64_t gop = (int64_t)video_index.nb_frames / (keys ? keys : 1) * 1000000 / loadgen.fps;
+	int64_t start = now_us() + 100000;
+
+	cameras = (virtual_camera_t *)calloc(loadgen.cameras, sizeof(virtual_camera_t));
+	wheels = (timer_wheel_t *)calloc(loadgen.threads, sizeof(timer_wheel_t));
+	if (!cameras || !wheels) {
+		log("malloc err");
+		return -1;
+	}
+	for (int i = 0; i < loadgen.threads; i++) {
+		wheels[i].tick = start / WHEEL_TICK_US;
+		wheels[i].scratch = (uint8_t *)malloc((int64_t)max_video_frame * loadgen.bitrate_percent / 100 + 1);
+		if (!wheels[i].scratch) {
+			log("malloc err");
+			return -1;
+		}
+	}
+	for (int i = 0; i < loadgen.cameras; i++) {
+		virtual_camera_t *camera = &cameras[i];
+		timer_wheel_t *wheel = &wheels[i % loadgen.threads];
+
+		camera->id = i;
+		camera->start = start + gop * i / loadgen.cameras;
+		camera->video.camera = camera;
+		camera->video.is_video = 1;
+		camera->video.deadline = camera->start;
+		camera->audio.camera = camera;
+		camera->audio.deadline = camera->start;
+		wheel_add(wheel, &camera->video);
+		wheel_add(wheel, &camera->audio);
+	}
+	for (int i = 0; i < loadgen.threads; i++) {
+		// 线程启动前定时器都已经挂好, 之后每个时间轮只被自己的线程访问
+		if (pthread_create(&wheels[i].tid, NULL, timer_wheel_thread, &wheels[i])) {
+			log("pthread_create err");
+			return -1;
+		}
+		pthread_getcpuclockid(wheels[i].tid, &wheels[i].cpu_clock);
+	}
+	log("load generator started, cameras:%d threads:%d fps:%d bitrate:%d%% gop:%"PRId64"ms",
+	    loadgen.cameras, loadgen.threads, loadgen.fps, loadgen.bitrate_percent, gop / 1000);
+	return 0;
+}
+
+void get_camera_stats(int camera, camera_stats_t *stats)
+{
+	virtual_camera_t *cam = &cameras[camera];
+
+	stats->video_frames = atomic_exchange_explicit(&cam->video_frames, 0, memory_order_relaxed);
+	stats->audio_frames = atomic_exchange_explicit(&cam->audio_frames, 0, memory_order_relaxed);
+	stats->late_sum_us = atomic_exchange_explicit(&cam->late_sum_us, 0, memory_order_relaxed);
+	stats->late_max_us = atomic_exchange_explicit(&cam->late_max_us, 0, memory_order_relaxed);
+}
+
+int64_t get_load_generator_cpu_us(void)
+{
+	int64_t total = 0;
+	struct timespec ts;
+
+	for (int i = 0; i < loadgen.threads; i++) {
+		if (!clock_gettime(wheels[i].cpu_clock, &ts))
+			total += (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+	return total;
+}
@@ -0,0 +1,51 @@
+#ifndef __IPC_SIMULATOR__
+#define __IPC_SIMULATOR__
+
+#include <stdint.h>
+
+/*
+* 用文件模拟ipc采集, 与sdk的使用没有关系
+*/
+
+typedef int (*video_cb_t)(const char *h264, int len, int64_t pts, int is_key);
+typedef int (*audio_cb_t)(const char *aac, int len, int64_t pts);
+
+// 不起线程也不限速, 在调用者线程里按时间戳顺序回调文件里的所有帧, 循环loops遍, 用于压测
+// 回调返回<0时停止并返回-1, 否则返回回调的帧数
+int run_media_unthrottled(int loops, video_cb_t vcb, audio_cb_t acb);
+
+// 视频文件用HEVC_FILE(h265)代替H264_FILE, 需要在启动之前调用
+void set_ipc_video_hevc(int hevc);
+
+// 模拟一路摄像头, 一个视频线程一个音频线程
+void start_ipc_simulator(video_cb_t vcb, audio_cb_t acb);
+
+/*
+* 压测模式: 少量线程用时间轮驱动N路虚拟摄像头
+* 每路按绝对时间点(clock_nanosleep)出帧, 不会因为回调耗时而累积误差
+* 各路的GOP起始时间均匀错开, 避免所有路同时发IDR
+*/
+typedef int (*camera_video_cb_t)(int camera, const char *h264, int len, int64_t pts, int is_key);
+typedef int (*camera_audio_cb_t)(int camera, const char *aac, int len, int64_t pts);
+
+typedef struct {
+	int cameras;
+	int threads;         // 0表示1个线程
+	int fps;             // 0表示25fps
+	int bitrate_percent; // 视频码率相对文件的百分比, 只能放大, 多出来的部分用filler nalu填充, 0表示100
+} load_generator_config_t;
+
+// 从上一次获取开始的统计, 迟到时间是实际回调时刻相对计划时刻
+typedef struct {
+	unsigned long long video_frames;
+	unsigned long long audio_frames;
+	unsigned long long late_sum_us;
+	unsigned long long late_max_us;
+} camera_stats_t;
+
+int start_load_generator(const load_generator_config_t *config, camera_video_cb_t vcb, camera_audio_cb_t acb);
+void get_camera_stats(int camera, camera_stats_t *stats);
+// 时间轮线程累计占用的cpu时间(包括回调里推入发送队列的开销)
+int64_t get_load_generator_cpu_us(void);
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
@@ -7,203 +8,302 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <pthread.h>
+#include <signal.h>
 #include "rtmp_publish.h"
+#include "rtmp_publish_sender.h"
+#include "rtmp_buffer_pool.h"
+#include "rtmp_publish_nalu.h"
+#include "ipc_simulator.h"
+#include "demo_common.h"
 
 #define log(fmt, args...) printf("%s $ "fmt"\n", __FUNCTION__, ##args)
 
-#define NALU_TYPE_SLICE     1
-#define NALU_TYPE_DPA       2
-#define NALU_TYPE_DPB       3
-#define NALU_TYPE_DPC       4
-#define NALU_TYPE_IDR       5
-#define NALU_TYPE_SEI       6
-#define NALU_TYPE_SPS       7
-#define NALU_TYPE_PPS       8
-#define NALU_TYPE_AUD       9
-#define NALU_TYPE_EOSEQ     10
-#define NALU_TYPE_EOSTREAM  11
-#define NALU_TYPE_FILL      12
-
-typedef int (*video_cb_t)(char *h264, int len, int64_t pts, int is_key);
-typedef int (*audio_cb_t)(char *aac, int len, int64_t pts);
-void start_ipc_simulator(video_cb_t vcb, audio_cb_t acb);
+#define INTERLEAVE_MS       100 // 音视频采集线程抖动时最多等100ms, 按时间戳交错发送
+#define TRACK_SILENCE_MS    200 // 一个轨道200ms没有数据就不再等它
+#define LOADGEN_THREADS     2 // 压测模式下驱动虚拟摄像头的线程数
+#define METRICS_FILE        "./rtmp_publish.prom" // prometheus格式的指标, 给node_exporter的textfile collector读
+#define METRICS_BUF_SIZE    (64 << 10)
+#define AVCC_FRAME_MAX      (1 << 20) // avcc模式下转换一帧的缓冲
 
 static RtmpPubContext *rtmp_ctx;
-static int aac_config_has_been_sent = 0;
-static pthread_mutex_t mutex;
+static RtmpPubSender *sender;
+static RtmpPubEngine *engine;
+static RtmpPubSession *sessions[MAX_STREAMS];
+static RtmpPubFanout *fanout;
+static int stream_count;
+static int low_latency;
+static int avcc;
+static int hevc;
 
-const uint8_t *avc_find_startcode_internal(const uint8_t *p, const uint8_t *end)
+// 模拟ipc的h264回调，模拟ipc编码一帧h264之后，回调此函数，将h264丢给应用层
+// 这里只把帧放入发送队列，真正的网络发送在sdk的发送线程里，不会阻塞采集
+int on_video(const char *h264, int len, int64_t pts, int is_key)
+{
+	/* 3. 将一帧h264(包含sps/pps)交给发送队列 */
+	if (RtmpPubSenderPushVideo(sender, h264, len, pts, is_key)) {
+		log("video queue full, drop frame, pts:%"PRId64, pts);
+		return -1;
+	}
+	return 0;
+}
+
+// 低延时模式: 模拟编码器逐个输出nalu, 每输出一个就交给发送队列, 不等整帧
+int on_video_slices(const char *h264, int len, int64_t pts, int is_key)
 {
-    const uint8_t *a = p + 4 - ((intptr_t)p & 3);
-
-    for (end -= 3; p < a && p < end; p++) {
-        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
-            return p;
-    }
-
-    for (end -= 3; p < end; p += 4) {
-        uint32_t x = *(const uint32_t*)p;
-//      if ((x - 0x01000100) & (~x) & 0x80008000) // little endian
-//      if ((x - 0x00010001) & (~x) & 0x00800080) // big endian
-        if ((x - 0x01010101) & (~x) & 0x80808080) { // generic
-            if (p[1] == 0) {
-                if (p[0] == 0 && p[2] == 1)
-                    return p;
-                if (p[2] == 0 && p[3] == 1)
-                    return p+1;
-            }
-            if (p[3] == 0) {
-                if (p[2] == 0 && p[4] == 1)
-                    return p+2;
-                if (p[4] == 0 && p[5] == 1)
-                    return p+3;
-            }
-        }
-    }
-
-    for (end += 3; p < end; p++) {
-        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
-            return p;
-    }
-
-    return end + 3;
+	const uint8_t *end = (const uint8_t *)h264 + len;
+	const uint8_t *start = RtmpPubFindStartcode((const uint8_t *)h264, end);
+
+	while (start < end) {
+		// 跳过当前的startcode再找下一个
+		const uint8_t *next = RtmpPubFindStartcode(start + 3, end);
+		if (RtmpPubSenderPushSlice(sender, (const char *)start, next - start, pts, is_key, next == end)) {
+			log("video queue full, drop slice, pts:%"PRId64, pts);
+			return -1;
+		}
+		start = next;
+	}
+	return 0;
 }
 
-const uint8_t *avc_find_startcode(const uint8_t *p, const uint8_t *end)
+// avcc模式: 模拟输出avcc(4字节长度)的编码器, 整帧作为一个access unit交给发送队列
+int on_video_avcc(const char *h264, int len, int64_t pts, int is_key)
 {
-    const uint8_t *out = avc_find_startcode_internal(p, end);
-    if(p<out && out<end && !out[-1]) out--;
-    return out;
+	static uint8_t frame[AVCC_FRAME_MAX];
+	const uint8_t *end = (const uint8_t *)h264 + len;
+	const uint8_t *start = RtmpPubFindStartcode((const uint8_t *)h264, end);
+	int size = 0;
+
+	while (start < end) {
+		const uint8_t *nal = start;
+		while (nal < end && !*nal)
+			nal++;
+		nal++;
+		const uint8_t *next = RtmpPubFindStartcode(nal, end);
+		uint32_t nal_len = htonl(next - nal);
+		if (size + 4 + (next - nal) > AVCC_FRAME_MAX)
+			return -1;
+		memcpy(frame + size, &nal_len, 4);
+		memcpy(frame + size + 4, nal, next - nal);
+		size += 4 + (next - nal);
+		start = next;
+	}
+	if (RtmpPubSenderPushAccessUnit(sender, (const char *)frame, size, RTMP_PUB_AU_AVCC, pts, is_key)) {
+		log("video queue full, drop frame, pts:%"PRId64, pts);
+		return -1;
+	}
+	return 0;
 }
 
-int rw_int32(uint8_t *buf_in, uint8_t *buf_out)
+int on_audio(const char *aac, int len, int64_t pts)
 {
-	for (int i=0; i<4; i++) {
-		buf_out[i] = buf_in[4-i-1];
+	/* 4. 直接交出带adts头的aac, sdk去掉adts头并从中生成AudioSpecificConfig, 在第一个音频帧之前发送 */
+	if (RtmpPubSenderPushAdts(sender, aac, len, pts) < 0) {
+		log("audio queue full, drop frame, pts:%"PRId64, pts);
+		return -1;
 	}
 	return 0;
 }
 
-int write_nalu_size(uint8_t *buf_out, int nalu_size)
+// 多路模式下同一份采集数据推给所有session, 转换和封装只做一次
+int on_engine_video(const char *h264, int len, int64_t pts, int is_key)
 {
-	return rw_int32((uint8_t *)&nalu_size, buf_out); 
+	return RtmpPubFanoutPushVideo(fanout, h264, len, pts, is_key) < 0 ? -1 : 0;
 }
 
-// nalu startcode 00000001 to nalu size
-int annexB2avcc(const uint8_t *buf_in, int buf_size, uint8_t *buf_out)
+int on_engine_audio(const char *aac, int len, int64_t pts)
 {
-    const uint8_t *p = buf_in;
-    const uint8_t *end = p + buf_size;
-    const uint8_t *nal_start, *nal_end;
-
-    nal_start = avc_find_startcode(p, end);
-    for (;;) {
-        while (nal_start < end && !*(nal_start++));
-        if (nal_start == end)
-            break;
-
-        nal_end = avc_find_startcode(nal_start, end);
-	write_nalu_size(buf_out, nal_end - nal_start);
-	buf_out += 4;
-	memcpy(buf_out, nal_start, nal_end - nal_start);
-	buf_out += nal_end - nal_start;
-        nal_start = nal_end;
-    }
-    return 0;
+	return RtmpPubFanoutPushAdts(fanout, aac, len, pts) < 0 ? -1 : 0;
 }
 
-// 模拟ipc的h264回调，模拟ipc编码一帧h264之后，回调此函数，将h264丢给应用层
-int on_video(char *h264, int len, int64_t pts, int is_key)
+// 压测模式下每个session对应一路独立的虚拟摄像头
+int on_camera_video(int camera, const char *h264, int len, int64_t pts, int is_key)
 {
-	int ret = 0, offset = 0;
-	// 考虑到有的startcode为3个字节的情况, 这里增加10字节防止溢出
-	uint8_t *avcc = (uint8_t *)malloc(len+10);
-	if (!avcc) {
-		return -1;
-	}
-	annexB2avcc(h264, len, avcc);
-	uint8_t * avcc_end = avcc + len;
-
-	pthread_mutex_lock(&mutex);
-	while(avcc+offset < avcc_end) {
-		uint8_t nalu_type = (avcc+offset)[4]&0x1F;
-		int nalu_size = ntohl(*(int *)(avcc+offset));
-		assert(nalu_size > 0);
-		offset += 4;
-		switch(nalu_type) {
-		case  NALU_TYPE_SPS:
-			/* 3. 将sps数据传递给推流sdk */
-			// codec将关键帧丢给应用层，一般sps/pps是随关键帧一起过来的
-			RtmpPubSetVideoTimebase(rtmp_ctx, pts);
-                	RtmpPubSetSps(rtmp_ctx, avcc+offset, nalu_size);
-			//log("set sps");
-			break;
-		case NALU_TYPE_PPS:
-			/* 4. 将pps数据传递给推流sdk */
-			// codec将关键帧丢给应用层，一般sps/pps是随关键帧一起过来的
-			RtmpPubSetPps(rtmp_ctx, avcc+offset, nalu_size);
-			//log("set pps");
-			break;
-		case NALU_TYPE_IDR:
-			/* 5. 发送关键帧数据 */
-		 	if (RtmpPubSendVideoKeyframe(rtmp_ctx, avcc+offset, nalu_size, pts)) {
-            			log("RtmpPubSendVideoKeyframe() error, errno = %d\n", errno);
-				ret = -1;
-				goto err;
-			}
-			//log("send idr");
-			break;
-        	case NALU_TYPE_SLICE:
-			/* 6. 发送非关键帧数据 */
-			if (RtmpPubSendVideoInterframe(rtmp_ctx, avcc+offset, nalu_size, pts)) {
-            			log("RtmpPubSendVideoInterframe() error, errno = %d\n", errno);
-				ret = -1;
-				goto err;
-			}
-			//log("send slice");
-			break;
-		default:
-			break;
-		}
-		offset += nalu_size;
-	}
+	return RtmpPubSessionPushVideo(sessions[camera], h264, len, pts, is_key);
+}
+
+int on_camera_audio(int camera, const char *aac, int len, int64_t pts)
+{
+	return RtmpPubSessionPushAdts(sessions[camera], aac, len, pts) < 0 ? -1 : 0;
+}
+
+// 打印各阶段耗时, 同时把prometheus格式写到METRICS_FILE, 先写临时文件再rename, 读的一方不会读到一半
+static void dump_metrics(const RtmpPubMetricsSnapshot *snapshot, const char *name)
+{
+	static char buf[METRICS_BUF_SIZE];
+	RtmpPubBufferPoolStats pool;
+	int len;
 
-err:
-	pthread_mutex_unlock(&mutex);
-	if (avcc)
-		free(avcc);
-	return ret;
+	if (RtmpPubMetricsDump(RTMP_PUB_METRICS_TEXT, snapshot, &name, 1, buf, sizeof(buf)) > 0)
+		printf("%s", buf);
+	RtmpPubBufferPoolGetStats(&pool);
+	log("buffer pool allocs:%llu hit:%.1f%% remote frees:%llu cached:%lluKB",
+	    pool.m_nAllocs, pool.m_nAllocs ? 100.0 * pool.m_nHits / pool.m_nAllocs : 0.0, pool.m_nRemoteFrees,
+	    pool.m_nCachedBytes >> 10);
+	len = RtmpPubMetricsDump(RTMP_PUB_METRICS_PROMETHEUS, snapshot, &name, 1, buf, sizeof(buf));
+	if (len < 0)
+		return;
+	FILE *fp = fopen(METRICS_FILE ".tmp", "w");
+	if (!fp)
+		return;
+	fwrite(buf, 1, len, fp);
+	fclose(fp);
+	rename(METRICS_FILE ".tmp", METRICS_FILE);
 }
 
-int on_audio(char *aac, int len, int64_t pts)
+// 压测报告: 实际帧率(平均和最差的一路), 出帧时刻相对计划的迟到, 以及每路推流占用的cpu
+static void log_load_generator(int count, int secs, int fps)
 {
-	pthread_mutex_lock(&mutex);
-	if (!aac_config_has_been_sent) {
-		char audioSpecCfg[] = { 0x14, 0x10 };
-        	RtmpPubSetAudioTimebase(rtmp_ctx, pts);
-        	RtmpPubSetAac(rtmp_ctx, audioSpecCfg, sizeof(audioSpecCfg) );
-		aac_config_has_been_sent = 1;
-	}
-	// rtmp推流不需要adts，所以需要把adts从aac中移除
-	int protection_absent = aac[1] & 0x01;
-	int adts_len = protection_absent ? 7 : 9;
-	/* 7. 发送aac音频 */
-	if (RtmpPubSendAudioFrame(rtmp_ctx, aac+adts_len, len-adts_len, pts) < 0) {
-		log("RtmpPubSendAudioFrame err, %s", strerror(errno));
-		pthread_mutex_unlock(&mutex);
+	static int64_t last_process_cpu, last_generator_cpu;
+	unsigned long long video_frames = 0, late_sum = 0, late_max = 0, frames = 0, min_frames = ~0ULL;
+	camera_stats_t stats;
+
+	for (int i = 0; i < count; i++) {
+		get_camera_stats(i, &stats);
+		video_frames += stats.video_frames;
+		if (stats.video_frames < min_frames)
+			min_frames = stats.video_frames;
+		frames += stats.video_frames + stats.audio_frames;
+		late_sum += stats.late_sum_us;
+		if (stats.late_max_us > late_max)
+			late_max = stats.late_max_us;
+	}
+	int64_t process_cpu = process_cpu_us(), generator_cpu = get_load_generator_cpu_us();
+	// 推流cpu不包括虚拟摄像头线程, 但是包括它们在回调里把帧推入队列的开销
+	double publisher = (double)(process_cpu - last_process_cpu - (generator_cpu - last_generator_cpu)) / (secs * 10000.0);
+	double generator = (double)(generator_cpu - last_generator_cpu) / (secs * 10000.0);
+	log("loadgen fps target:%d avg:%.1f min:%.1f late avg:%lluus max:%lluus cpu per stream:%.3f%% total:%.1f%% generator:%.1f%%",
+	    fps, (double)video_frames / count / secs, (double)min_frames / secs, frames ? late_sum / frames : 0, late_max,
+	    publisher / count, publisher, generator);
+	last_process_cpu = process_cpu;
+	last_generator_cpu = generator_cpu;
+}
+
+// 用多路推流引擎把同一路ipc流推成count路, 流名依次加上_0, _1...
+// loadgen不为NULL时每一路用一个独立的虚拟摄像头, 否则通过fanout分发
+static int run_engine(const char *url, int count, load_generator_config_t *loadgen)
+{
+	RtmpPubSessionConfig config;
+	char stream_url[1024];
+
+	init_session_config(&config);
+	config.m_drop.m_nLatencyBudgetMs = LATENCY_BUDGET_MS;
+	config.m_reconnect.m_nMinDelayMs = RECONNECT_MIN_MS;
+	config.m_reconnect.m_nMaxDelayMs = RECONNECT_MAX_MS;
+	config.m_reconnect.m_nGopCacheBytes = GOP_CACHE_BYTES;
+	engine = RtmpPubEngineNew(0);
+	if (!engine || RtmpPubEngineStart(engine)) {
+		log("start engine err");
 		return -1;
 	}
-	pthread_mutex_unlock(&mutex);
-	//log("send aac");
+	log("engine started with %u workers", RtmpPubEngineGetWorkers(engine));
+	if (!loadgen) {
+		// 同一路ipc流分发到所有地址
+		if (!(fanout = new_fanout(engine, url, count, &config)))
+			return -1;
+		for (stream_count = 0; stream_count < count; stream_count++)
+			sessions[stream_count] = RtmpPubFanoutGetSession(fanout, stream_count);
+	}
+	for (; stream_count < count; stream_count++) {
+		snprintf(stream_url, sizeof(stream_url), "%s_%d", url, stream_count);
+		sessions[stream_count] = RtmpPubEngineAddSession(engine, stream_url, &config);
+		if (!sessions[stream_count]) {
+			log("add session %s err", stream_url);
+			return -1;
+		}
+	}
+	if (loadgen) {
+		loadgen->cameras = count;
+		loadgen->threads = LOADGEN_THREADS;
+		if (start_load_generator(loadgen, on_camera_video, on_camera_audio)) {
+			log("start load generator err");
+			return -1;
+		}
+	} else {
+		start_ipc_simulator(on_engine_video, on_engine_audio);
+	}
+	unsigned long long last_writev = 0, last_bytes = 0;
+	int timing_logged = 0;
+	for (;;) {
+		unsigned long long writev_calls = 0, bytes = 0, video_drop = 0, audio_drop = 0, reconnects = 0;
+		long long tcp = 0, handshake = 0, connect = 0, create_stream = 0, publish = 0;
+		int states[RTMP_PUB_SESSION_CLOSED + 1] = { 0 };
+		RtmpPubSessionStats stats;
+
+		sleep(3);
+		for (int i = 0; i < stream_count; i++) {
+			RtmpPubSessionGetStats(sessions[i], &stats);
+			states[stats.m_nState]++;
+			writev_calls += stats.m_nWritevCalls;
+			bytes += stats.m_nBytes;
+			video_drop += stats.m_video.m_nDropped;
+			audio_drop += stats.m_audio.m_nDropped;
+			reconnects += stats.m_nReconnects;
+			tcp += stats.m_timing.m_nTcpUs;
+			handshake += stats.m_timing.m_nHandshakeUs;
+			connect += stats.m_timing.m_nConnectUs;
+			create_stream += stats.m_timing.m_nCreateStreamUs;
+			publish += stats.m_timing.m_nPublishUs;
+		}
+		// 所有session都开始推流后打印一次连接各阶段的平均完成时间
+		if (!timing_logged && states[RTMP_PUB_SESSION_PUBLISHING] == count) {
+			log("avg connect timing(us) tcp:%lld handshake:%lld connect:%lld createStream:%lld publish:%lld",
+			    tcp / count, handshake / count, connect / count, create_stream / count, publish / count);
+			timing_logged = 1;
+		}
+		log("sessions publishing:%d connecting:%d reconnect wait:%d closed:%d reconnects:%llu",
+		    states[RTMP_PUB_SESSION_PUBLISHING],
+		    count - states[RTMP_PUB_SESSION_PUBLISHING] - states[RTMP_PUB_SESSION_RECONNECT_WAIT] - states[RTMP_PUB_SESSION_CLOSED],
+		    states[RTMP_PUB_SESSION_RECONNECT_WAIT], states[RTMP_PUB_SESSION_CLOSED], reconnects);
+		log("writev/s:%llu kbps:%llu queue drop video:%llu audio:%llu",
+		    (writev_calls - last_writev) / 3, (bytes - last_bytes) * 8 / 3000, video_drop, audio_drop);
+		last_writev = writev_calls;
+		last_bytes = bytes;
+		if (loadgen)
+			log_load_generator(count, 3, loadgen->fps);
+		// 所有session汇总成一路
+		RtmpPubMetricsSnapshot total, snapshot;
+		memset(&total, 0, sizeof(total));
+		for (int i = 0; i < stream_count; i++) {
+			RtmpPubSessionGetMetrics(sessions[i], &snapshot);
+			RtmpPubMetricsMerge(&total, &snapshot);
+		}
+		dump_metrics(&total, "all");
+	}
 	return 0;
 }
 
 int main(int argc, char *argv[])
 {
 	if (!argv[1]) {
-		log("./rtmp-publish-demo <rtmp publish url>");
+		log("./rtmp-publish-demo <rtmp publish url> [streams [fps [bitrate%%]]]");
+		log("./rtmp-publish-demo <rtmp publish url> slices");
+		log("./rtmp-publish-demo <rtmp publish url> hevc");
+		log("./rtmp-publish-demo <rtmp publish url> avcc");
 		return 0;
 	}
+	// 服务端断开后librtmp的send会触发SIGPIPE, 忽略掉由重连处理
+	signal(SIGPIPE, SIG_IGN);
+	if (argv[2] && !strcmp(argv[2], "slices"))
+		low_latency = 1;
+	else if (argv[2] && !strcmp(argv[2], "hevc"))
+		hevc = 1;
+	else if (argv[2] && !strcmp(argv[2], "avcc"))
+		avcc = 1;
+	else if (argv[2]) {
+		int count = atoi(argv[2]);
+		if (count <= 0 || count > MAX_STREAMS) {
+			log("streams must be in 1~%d", MAX_STREAMS);
+			return 0;
+		}
+		if (argc > 3) {
+			// 给了帧率就进入压测模式, 码率百分比默认100
+			load_generator_config_t loadgen = { 0 };
+			loadgen.fps = atoi(argv[3]);
+			loadgen.bitrate_percent = argc > 4 ? atoi(argv[4]) : 100;
+			return run_engine(argv[1], count, &loadgen) ? 1 : 0;
+		}
+		return run_engine(argv[1], count, NULL) ? 1 : 0;
+	}
 	/* 1. 创建推流实例化对象 */
 	rtmp_ctx = RtmpPubNew(argv[1], 30, RTMP_PUB_AUDIO_AAC, RTMP_PUB_AUDIO_AAC, RTMP_PUB_TIMESTAMP_ABSOLUTE);
     	if (RtmpPubInit(rtmp_ctx)) {
@@ -215,16 +315,67 @@ int main(int argc, char *argv[])
 		log("rtmp connect err, errno:%d", errno);
 		return 0;
 	}
-	pthread_mutex_init(&mutex, NULL);
 	log("rtmp connect %s success", argv[1]);
+	// librtmp为65600个chunk stream预留的数组占了1MB多, 推流只用到其中几个
+	log("trim %lu bytes of unused rtmp channel table", RtmpPubTrimChannels(rtmp_ctx));
+	if (RtmpPubSetChunkSize(rtmp_ctx, OUT_CHUNK_SIZE)) {
+		log("set chunk size err, errno:%d", errno);
+		return 0;
+	}
+	sender = RtmpPubSenderNew(rtmp_ctx, VIDEO_QUEUE_SLOTS, AUDIO_QUEUE_SLOTS);
+	if (!sender) {
+		log("new sender err");
+		return 0;
+	}
+	RtmpPubDropConfig drop_config = { LATENCY_BUDGET_MS, 0 };
+	RtmpPubSenderSetDropPolicy(sender, &drop_config);
+	RtmpPubReconnectConfig reconnect_config = { RECONNECT_MIN_MS, RECONNECT_MAX_MS, GOP_CACHE_BYTES };
+	RtmpPubSenderSetReconnect(sender, &reconnect_config);
+	RtmpPubInterleaveConfig interleave_config = { INTERLEAVE_MS, TRACK_SILENCE_MS };
+	RtmpPubSenderSetInterleave(sender, &interleave_config);
+	// hevc按Enhanced RTMP推送, 服务端需要支持FourCC hvc1
+	if (hevc)
+		RtmpPubSenderSetVideoCodec(sender, RTMP_PUB_VIDEO_HEVC);
+	if (RtmpPubSenderStart(sender)) {
+		log("start sender err");
+		return 0;
+	}
 	// h264文件模拟ipc相关代码，相关代码不需要关注
 	// 真实的ipc是codec编码一帧h264之后，丢给应用
 	// 层, on_video/on_audio是注册到模拟ipc的
 	// 回调函数，模拟的ipc采集一帧h264/aac之后，
 	// 会调用这个函数，将h264/aac丢给应用层
-	start_ipc_simulator(on_video, on_audio);
+	set_ipc_video_hevc(hevc);
+	start_ipc_simulator(low_latency ? on_video_slices : avcc ? on_video_avcc : on_video, on_audio);
+	unsigned long long last_writev = 0, last_msgs = 0;
 	for(;;) {
+		RtmpPubRingStats video, audio;
+		RtmpPubDropStats drop;
+		RtmpPubInterleaveStats interleave;
+		unsigned long long writev_calls, msgs, bytes;
+
 		sleep(3);
-	} 
+		RtmpPubSenderGetStats(sender, &video, &audio);
+		RtmpPubSenderGetDropStats(sender, &drop);
+		log("video queue depth:%u hwm:%u drop:%llu, audio queue depth:%u hwm:%u drop:%llu",
+		    video.m_nDepth, video.m_nHighWater, video.m_nDropped,
+		    audio.m_nDepth, audio.m_nHighWater, audio.m_nDropped);
+		log("congestion drop non-ref:%llu gop:%llu gop skips:%llu",
+		    drop.m_nDroppedNonRef, drop.m_nDroppedGop, drop.m_nGopSkips);
+		RtmpPubSenderGetInterleaveStats(sender, &interleave);
+		log("interleave held:%llu forced:%llu out of order:%llu added latency avg:%.2fms max:%.1fms",
+		    interleave.m_nHeld, interleave.m_nForced, interleave.m_nLate,
+		    interleave.m_nFrames ? (double)interleave.m_nHoldUs / interleave.m_nFrames / 1000 : 0.0,
+		    interleave.m_nMaxHoldUs / 1000.0);
+		RtmpPubSenderGetWriteStats(sender, &writev_calls, &msgs, &bytes);
+		log("writev/s:%llu msgs/s:%llu total bytes:%llu reconnects:%llu parameter set changes:%llu",
+		    (writev_calls - last_writev) / 3, (msgs - last_msgs) / 3, bytes, RtmpPubSenderGetReconnects(sender),
+		    RtmpPubSenderGetParamChanges(sender));
+		last_writev = writev_calls;
+		last_msgs = msgs;
+		RtmpPubMetricsSnapshot snapshot;
+		RtmpPubSenderGetMetrics(sender, &snapshot);
+		dump_metrics(&snapshot, "main");
+	}
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include <string.h>
+#include "rtmp_adts.h"
+#include "rtmp_publish_internal.h"
+
+#define ADTS_HEADER_SIZE        7
+#define AAC_FRAME_SAMPLES       1024
+
+static const unsigned int sampleRates[] = {
+        96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+};
+
+static unsigned int AdtsSampleRate(const char * _pAdts)
+{
+        unsigned int nRate = ((unsigned char)_pAdts[2] >> 2) & 0x0F;
+
+        return nRate < sizeof(sampleRates) / sizeof(sampleRates[0]) ? sampleRates[nRate] : 0;
+}
+
+int RtmpPubParseAdts(const char * _pData, unsigned int _nSize, unsigned int * _pHeaderSize, unsigned int * _pDurationMs)
+{
+        const unsigned char * p = (const unsigned char *)_pData;
+        unsigned int nFrameSize, nRate;
+
+        if (_nSize < ADTS_HEADER_SIZE || p[0] != 0xFF || (p[1] & 0xF0) != 0xF0)
+                return -1;
+        nFrameSize = ((p[3] & 0x03) << 11) | (p[4] << 3) | (p[5] >> 5);
+        *_pHeaderSize = (p[1] & 0x01) ? ADTS_HEADER_SIZE : ADTS_HEADER_SIZE + 2;
+        if (nFrameSize <= *_pHeaderSize || nFrameSize > _nSize)
+                return -1;
+        nRate = AdtsSampleRate(_pData);
+        *_pDurationMs = nRate ? AAC_FRAME_SAMPLES * 1000 / nRate : 0;
+        return (int)nFrameSize;
+}
+
+void RtmpPubAdtsToConfig(const char * _pAdts, char * _pConfig)
+{
+        const unsigned char * p = (const unsigned char *)_pAdts;
+        unsigned int nObject = ((p[2] >> 6) & 0x03) + 1;
+        unsigned int nRate = (p[2] >> 2) & 0x0F;
+        unsigned int nChannels = ((p[2] & 0x01) << 2) | (p[3] >> 6);
+
+        _pConfig[0] = (char)((nObject << 3) | (nRate >> 1));
+        _pConfig[1] = (char)(((nRate & 0x01) << 7) | (nChannels << 3));
+}
+
+void RtmpPubAdtsDemuxerInit(RtmpPubAdtsDemuxer * _pDemuxer)
+{
+        memset(_pDemuxer, 0, sizeof(*_pDemuxer));
+}
+
+int RtmpPubAdtsDemux(RtmpPubAdtsDemuxer * _pDemuxer, const char * _pData, unsigned int _nSize, unsigned int _nPts,
+                     RtmpPubAdtsFrame * _pFrames, unsigned int _nMaxFrames, unsigned int * _pConsumed, int * _pConfigChanged)
+{
+        unsigned int nHeaderSize, nDurationMs, nRate, nCount = 0, nOffset = 0;
+        char config[RTMP_PUB_AAC_CONFIG_SIZE];
+        const char * pAdts;
+        int nFrameSize;
+
+        *_pConsumed = 0;
+        *_pConfigChanged = 0;
+        while (nOffset < _nSize && nCount < _nMaxFrames) {
+                pAdts = _pData + nOffset;
+                nFrameSize = RtmpPubParseAdts(pAdts, _nSize - nOffset, &nHeaderSize, &nDurationMs);
+                // 已经解析出的帧先交出去, 错误留给下一次调用返回
+                if (nFrameSize < 0 || !(nRate = AdtsSampleRate(pAdts))) {
+                        if (!nCount)
+                                return -1;
+                        break;
+                }
+                RtmpPubAdtsToConfig(pAdts, config);
+                if (!_pDemuxer->m_bHasConfig || memcmp(config, _pDemuxer->m_config, sizeof(config))) {
+                        if (nCount)
+                                break;
+                        if (_pDemuxer->m_bHasConfig)
+                                _pDemuxer->m_nConfigChanges++;
+                        memcpy(_pDemuxer->m_config, config, sizeof(config));
+                        _pDemuxer->m_bHasConfig = 1;
+                        *_pConfigChanged = 1;
+                }
+                // 按帧序号计算, 毫秒取整的误差不会累积
+                _pFrames[nCount].m_pData = pAdts + nHeaderSize;
+                _pFrames[nCount].m_nSize = nFrameSize - nHeaderSize;
+                _pFrames[nCount].m_nPts = _nPts + (unsigned int)((unsigned long long)nCount * AAC_FRAME_SAMPLES * 1000 / nRate);
+                nCount++;
+                nOffset += nFrameSize;
+        }
+        _pDemuxer->m_nFrames += nCount;
+        *_pConsumed = nOffset;
+        return (int)nCount;
+}
+
+int RtmpPubAdtsDemuxerPush(RtmpPubAdtsDemuxer * _pDemuxer, const char * _pData, unsigned int _nSize, unsigned int _nPts,
+                           const RtmpPubAdtsOutput * _pOutput)
+{
+        RtmpPubAdtsFrame frames[RTMP_PUB_ADTS_MAX_FRAMES];
+        unsigned int nConsumed, nRate;
+        int i, nFrames, bChanged, nPushed = 0, bFailed = 0;
+
+        while (_nSize) {
+                nFrames = RtmpPubAdtsDemux(_pDemuxer, _pData, _nSize, _nPts, frames, RTMP_PUB_ADTS_MAX_FRAMES, &nConsumed,
+                                           &bChanged);
+                if (nFrames < 0) {
+                        RtmpPubLog("bad adts frame");
+                        return -1;
+                }
+                if (bChanged)
+                        _pDemuxer->m_bConfigPending = 1;
+                if (_pDemuxer->m_bConfigPending &&
+                    _pOutput->m_pOnConfig(_pOutput->m_pOpaque, _pDemuxer->m_config, RTMP_PUB_AAC_CONFIG_SIZE, frames[0].m_nPts) >= 0)
+                        _pDemuxer->m_bConfigPending = 0;
+                for (i = 0; i < nFrames; i++) {
+                        if (!_pDemuxer->m_bConfigPending &&
+                            _pOutput->m_pOnFrame(_pOutput->m_pOpaque, frames[i].m_pData, frames[i].m_nSize, frames[i].m_nPts) >= 0)
+                                nPushed++;
+                        else
+                                bFailed = 1;
+                }
+                // 这一批帧的配置就是m_config, 下一批从最后一帧的结束时间开始
+                nRate = sampleRates[((_pDemuxer->m_config[0] & 0x07) << 1) | ((unsigned char)_pDemuxer->m_config[1] >> 7)];
+                _nPts = frames[nFrames - 1].m_nPts + AAC_FRAME_SAMPLES * 1000 / nRate;
+                _pData += nConsumed;
+                _nSize -= nConsumed;
+        }
+        return bFailed ? -1 : nPushed;
+}
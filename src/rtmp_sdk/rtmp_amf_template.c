@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "rtmp_amf_template.h"
+
+#define TEMPLATE_MAX            128
+#define METADATA_MAX            512
+#define AMF_STRING_MAX          0xFFFF
+
+typedef struct {
+        char m_data[TEMPLATE_MAX];
+        unsigned int m_nSize;
+        unsigned int m_nTransaction;    // 事务id的8个字节在命令里的偏移
+} CommandTemplate;
+
+static pthread_once_t templateOnce = PTHREAD_ONCE_INIT;
+static CommandTemplate commands[RTMP_PUB_CMD_COUNT];
+static char live[TEMPLATE_MAX];
+static unsigned int nLiveSize;
+static char metadata[METADATA_MAX];
+static unsigned int nMetadataSize;
+static unsigned int metaOffsets[RTMP_PUB_META_FIELDS];  // 每个字段的值在body里的偏移
+
+// 编码和AMF_EncodeNumber一样, 大端的double
+static void PutNumber(char * _p, double _fValue)
+{
+        uint64_t n;
+
+        memcpy(&n, &_fValue, sizeof(n));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        n = __builtin_bswap64(n);
+#endif
+        memcpy(_p, &n, sizeof(n));
+}
+
+static char * PutString(char * _p, const AVal * _pValue)
+{
+        *_p++ = AMF_STRING;
+        *_p++ = (char)(_pValue->av_len >> 8);
+        *_p++ = (char)_pValue->av_len;
+        memcpy(_p, _pValue->av_val, _pValue->av_len);
+        return _p + _pValue->av_len;
+}
+
+static char * PutNamedString(char * _p, const AVal * _pName, const AVal * _pValue)
+{
+        *_p++ = (char)(_pName->av_len >> 8);
+        *_p++ = (char)_pName->av_len;
+        memcpy(_p, _pName->av_val, _pName->av_len);
+        return PutString(_p + _pName->av_len, _pValue);
+}
+
+static void InitMetadata(void)
+{
+        static const AVal avSetDataFrame = AVC("@setDataFrame"), avOnMetaData = AVC("onMetaData");
+        static const AVal avEncoder = AVC("encoder"), avEncoderName = AVC("rtmp_sdk");
+        static const AVal names[RTMP_PUB_META_FIELDS] = {
+                AVC("duration"), AVC("width"), AVC("height"), AVC("videodatarate"), AVC("framerate"), AVC("videocodecid"),
+                AVC("audiodatarate"), AVC("audiosamplerate"), AVC("audiosamplesize"), AVC("stereo"), AVC("audiocodecid")
+        };
+        char * pEnd = metadata + sizeof(metadata), * p = metadata;
+        int i;
+
+        p = AMF_EncodeString(p, pEnd, &avSetDataFrame);
+        p = AMF_EncodeString(p, pEnd, &avOnMetaData);
+        *p++ = AMF_ECMA_ARRAY;
+        p = AMF_EncodeInt32(p, pEnd, RTMP_PUB_META_FIELDS + 1);
+        for (i = 0; i < RTMP_PUB_META_FIELDS; i++) {
+                if (i == RTMP_PUB_META_STEREO) {
+                        p = AMF_EncodeNamedBoolean(p, pEnd, &names[i], 0);
+                        metaOffsets[i] = p - 1 - metadata;
+                } else {
+                        p = AMF_EncodeNamedNumber(p, pEnd, &names[i], 0);
+                        metaOffsets[i] = p - 8 - metadata;
+                }
+        }
+        p = AMF_EncodeNamedString(p, pEnd, &avEncoder, &avEncoderName);
+        p = AMF_EncodeInt24(p, pEnd, AMF_OBJECT_END);
+        nMetadataSize = p - metadata;
+}
+
+static void InitTemplates(void)
+{
+        static const AVal names[RTMP_PUB_CMD_COUNT] = {
+                AVC("connect"), AVC("releaseStream"), AVC("FCPublish"), AVC("createStream"), AVC("publish")
+        };
+        static const AVal avType = AVC("type"), avNonPrivate = AVC("nonprivate");
+        static const AVal avFlashVer = AVC("flashVer"), avVersion = AVC("FMLE/3.0 (compatible; FMSc/1.0)");
+        static const AVal avLive = AVC("live");
+        CommandTemplate * pTemplate;
+        char * pEnd, * p;
+        int i;
+
+        for (i = 0; i < RTMP_PUB_CMD_COUNT; i++) {
+                pTemplate = &commands[i];
+                pEnd = pTemplate->m_data + sizeof(pTemplate->m_data);
+                p = AMF_EncodeString(pTemplate->m_data, pEnd, &names[i]);
+                pTemplate->m_nTransaction = p + 1 - pTemplate->m_data;
+                p = AMF_EncodeNumber(p, pEnd, 0);
+                if (i == RTMP_PUB_CMD_CONNECT) {
+                        // app和tcUrl放在对象的最后, 由每个会话拼接
+                        *p++ = AMF_OBJECT;
+                        p = AMF_EncodeNamedString(p, pEnd, &avType, &avNonPrivate);
+                        p = AMF_EncodeNamedString(p, pEnd, &avFlashVer, &avVersion);
+                } else {
+                        *p++ = AMF_NULL;
+                }
+                pTemplate->m_nSize = p - pTemplate->m_data;
+        }
+        nLiveSize = AMF_EncodeString(live, live + sizeof(live), &avLive) - live;
+        InitMetadata();
+}
+
+int RtmpPubCommandSetInit(RtmpPubCommandSet * _pSet, const AVal * _pApp, const AVal * _pTcUrl, const AVal * _pStreamName)
+{
+        static const AVal avApp = AVC("app"), avTcUrl = AVC("tcUrl");
+        unsigned int nSize = 0, nName;
+        char * p;
+        int i;
+
+        pthread_once(&templateOnce, InitTemplates);
+        memset(_pSet, 0, sizeof(*_pSet));
+        if (_pApp->av_len > AMF_STRING_MAX || _pTcUrl->av_len > AMF_STRING_MAX || _pStreamName->av_len > AMF_STRING_MAX)
+                return -1;
+        // 和流相关的部分: connect的app和tcUrl, releaseStream/FCPublish/publish的流名
+        nName = 3 + _pStreamName->av_len;
+        _pSet->m_nSize[RTMP_PUB_CMD_CONNECT] = 2 + avApp.av_len + 3 + _pApp->av_len + 2 + avTcUrl.av_len + 3 + _pTcUrl->av_len + 3;
+        _pSet->m_nSize[RTMP_PUB_CMD_RELEASE_STREAM] = nName;
+        _pSet->m_nSize[RTMP_PUB_CMD_FC_PUBLISH] = nName;
+        _pSet->m_nSize[RTMP_PUB_CMD_PUBLISH] = nName + nLiveSize;
+        for (i = 0; i < RTMP_PUB_CMD_COUNT; i++) {
+                _pSet->m_nOffset[i] = nSize;
+                _pSet->m_nSize[i] += commands[i].m_nSize;
+                nSize += _pSet->m_nSize[i];
+        }
+        if (!(_pSet->m_pData = (char *)malloc(nSize)))
+                return -1;
+
+        for (i = 0; i < RTMP_PUB_CMD_COUNT; i++) {
+                p = _pSet->m_pData + _pSet->m_nOffset[i];
+                memcpy(p, commands[i].m_data, commands[i].m_nSize);
+                p += commands[i].m_nSize;
+                switch (i) {
+                case RTMP_PUB_CMD_CONNECT:
+                        p = PutNamedString(p, &avApp, _pApp);
+                        p = PutNamedString(p, &avTcUrl, _pTcUrl);
+                        AMF_EncodeInt24(p, p + 3, AMF_OBJECT_END);
+                        break;
+                case RTMP_PUB_CMD_PUBLISH:
+                        p = PutString(p, _pStreamName);
+                        memcpy(p, live, nLiveSize);
+                        break;
+                case RTMP_PUB_CMD_CREATE_STREAM:
+                        break;
+                default:
+                        PutString(p, _pStreamName);
+                        break;
+                }
+        }
+        return 0;
+}
+
+void RtmpPubCommandSetDestroy(RtmpPubCommandSet * _pSet)
+{
+        free(_pSet->m_pData);
+        memset(_pSet, 0, sizeof(*_pSet));
+}
+
+const char * RtmpPubCommandSetGet(RtmpPubCommandSet * _pSet, RtmpPubCommand _nCommand, double _fTransaction,
+                                  unsigned int * _pSize)
+{
+        char * pCommand = _pSet->m_pData + _pSet->m_nOffset[_nCommand];
+
+        PutNumber(pCommand + commands[_nCommand].m_nTransaction, _fTransaction);
+        *_pSize = _pSet->m_nSize[_nCommand];
+        return pCommand;
+}
+
+unsigned int RtmpPubGetMetadataSize(void)
+{
+        pthread_once(&templateOnce, InitTemplates);
+        return nMetadataSize;
+}
+
+unsigned int RtmpPubBuildMetadata(char * _pBody, const double * _pValues)
+{
+        int i;
+
+        pthread_once(&templateOnce, InitTemplates);
+        memcpy(_pBody, metadata, nMetadataSize);
+        for (i = 0; i < RTMP_PUB_META_FIELDS; i++) {
+                if (i == RTMP_PUB_META_STEREO)
+                        _pBody[metaOffsets[i]] = _pValues[i] != 0;
+                else
+                        PutNumber(_pBody + metaOffsets[i], _pValues[i]);
+        }
+        return nMetadataSize;
+}
@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rtmp_buffer_pool.h"
+
+// 池的主人线程退出后远程释放链表的头, 之后归还给这个池的缓冲直接free
+#define DEAD_POOL       ((RtmpPubBuffer *)1)
+
+struct RtmpPubBufferPool {
+        RtmpPubBuffer * m_pFree[RTMP_PUB_BUFFER_CLASSES];      // 只有主人线程访问
+        unsigned int m_nFree[RTMP_PUB_BUFFER_CLASSES];
+        _Atomic(RtmpPubBuffer *) m_pRemote;                     // 其它线程释放的, Treiber栈
+        atomic_int m_bDead;
+        atomic_ullong m_nAllocs;                                // 只由主人线程写
+        atomic_ullong m_nHits;
+        atomic_ullong m_nCachedBytes;
+        atomic_ullong m_nRemoteFrees;
+        struct RtmpPubBufferPool * m_pNextPool;
+};
+
+static __thread RtmpPubBufferPool * s_pPool;
+static _Atomic(RtmpPubBufferPool *) s_pPools;  // 所有的池, 只增加不删除, 主人线程退出后可以被新线程接管
+static pthread_key_t s_key;
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+
+#define SingleWriterAdd(_pCounter, _nDelta) \
+        atomic_store_explicit(_pCounter, atomic_load_explicit(_pCounter, memory_order_relaxed) + (_nDelta), memory_order_relaxed)
+
+#define ClassBytes(_nClass)     (1U << (RTMP_PUB_BUFFER_MIN_SHIFT + (_nClass)))
+
+static unsigned int ClassLimit(int _nClass)
+{
+        unsigned int nLimit = RTMP_PUB_BUFFER_CACHE_BYTES / ClassBytes(_nClass);
+
+        return nLimit < 2 ? 2 : nLimit;
+}
+
+static int SizeClass(unsigned int _nSize)
+{
+        int nShift;
+
+        if (_nSize <= (1U << RTMP_PUB_BUFFER_MIN_SHIFT))
+                return 0;
+        nShift = 32 - __builtin_clz(_nSize - 1);
+        if (nShift > RTMP_PUB_BUFFER_MAX_SHIFT)
+                return -1;
+        return nShift - RTMP_PUB_BUFFER_MIN_SHIFT;
+}
+
+static RtmpPubBuffer * NewBuffer(int _nClass, unsigned int _nCapacity)
+{
+        RtmpPubBuffer * pBuffer = (RtmpPubBuffer *)malloc(sizeof(RtmpPubBuffer) + RTMP_PUB_BUFFER_HEADROOM + _nCapacity);
+
+        if (!pBuffer)
+                return NULL;
+        pBuffer->m_nClass = _nClass;
+        pBuffer->m_pOwner = NULL;
+        pBuffer->m_pNext = NULL;
+        pBuffer->m_pData = (char *)(pBuffer + 1) + RTMP_PUB_BUFFER_HEADROOM;
+        pBuffer->m_nCapacity = _nCapacity;
+        return pBuffer;
+}
+
+// 放回本线程的空闲链表, 超过上限时直接释放
+static void CacheLocal(RtmpPubBufferPool * _pPool, RtmpPubBuffer * _pBuffer)
+{
+        int nClass = _pBuffer->m_nClass;
+
+        if (_pPool->m_nFree[nClass] >= ClassLimit(nClass)) {
+                free(_pBuffer);
+                return;
+        }
+        _pBuffer->m_pNext = _pPool->m_pFree[nClass];
+        _pPool->m_pFree[nClass] = _pBuffer;
+        _pPool->m_nFree[nClass]++;
+        SingleWriterAdd(&_pPool->m_nCachedBytes, ClassBytes(nClass));
+}
+
+// 一次取走其它线程归还的所有缓冲
+static void DrainRemote(RtmpPubBufferPool * _pPool)
+{
+        RtmpPubBuffer * pBuffer = atomic_exchange_explicit(&_pPool->m_pRemote, NULL, memory_order_acquire);
+        RtmpPubBuffer * pNext;
+
+        for (; pBuffer; pBuffer = pNext) {
+                pNext = pBuffer->m_pNext;
+                CacheLocal(_pPool, pBuffer);
+        }
+}
+
+static void FreeLocal(RtmpPubBufferPool * _pPool)
+{
+        RtmpPubBuffer * pBuffer, * pNext;
+        int i;
+
+        for (i = 0; i < RTMP_PUB_BUFFER_CLASSES; i++) {
+                for (pBuffer = _pPool->m_pFree[i]; pBuffer; pBuffer = pNext) {
+                        pNext = pBuffer->m_pNext;
+                        free(pBuffer);
+                }
+                _pPool->m_pFree[i] = NULL;
+                _pPool->m_nFree[i] = 0;
+        }
+        atomic_store_explicit(&_pPool->m_nCachedBytes, 0, memory_order_relaxed);
+}
+
+static void ThreadExit(void * _pParam)
+{
+        RtmpPubBufferPool * pPool = (RtmpPubBufferPool *)_pParam;
+        RtmpPubBuffer * pBuffer, * pNext;
+
+        pBuffer = atomic_exchange_explicit(&pPool->m_pRemote, DEAD_POOL, memory_order_acquire);
+        for (; pBuffer; pBuffer = pNext) {
+                pNext = pBuffer->m_pNext;
+                free(pBuffer);
+        }
+        FreeLocal(pPool);
+        s_pPool = NULL;
+        atomic_store_explicit(&pPool->m_bDead, 1, memory_order_release);
+}
+
+static void CreateKey(void)
+{
+        pthread_key_create(&s_key, ThreadExit);
+}
+
+static RtmpPubBufferPool * GetPool(void)
+{
+        RtmpPubBufferPool * pPool;
+        int bDead;
+
+        if (s_pPool)
+                return s_pPool;
+        pthread_once(&s_once, CreateKey);
+        for (pPool = atomic_load(&s_pPools); pPool; pPool = pPool->m_pNextPool) {
+                bDead = 1;
+                if (atomic_compare_exchange_strong(&pPool->m_bDead, &bDead, 0)) {
+                        atomic_store(&pPool->m_pRemote, NULL);
+                        break;
+                }
+        }
+        if (!pPool) {
+                pPool = (RtmpPubBufferPool *)calloc(1, sizeof(RtmpPubBufferPool));
+                if (!pPool)
+                        return NULL;
+                pPool->m_pNextPool = atomic_load(&s_pPools);
+                while (!atomic_compare_exchange_weak(&s_pPools, &pPool->m_pNextPool, pPool))
+                        ;
+        }
+        pthread_setspecific(s_key, pPool);
+        s_pPool = pPool;
+        return pPool;
+}
+
+RtmpPubBuffer * RtmpPubBufferAlloc(unsigned int _nSize)
+{
+        RtmpPubBufferPool * pPool;
+        RtmpPubBuffer * pBuffer;
+        int nClass = SizeClass(_nSize);
+
+        if (nClass < 0 || !(pPool = GetPool())) {
+                pBuffer = NewBuffer(-1, _nSize);
+        } else {
+                SingleWriterAdd(&pPool->m_nAllocs, 1);
+                if (!pPool->m_pFree[nClass])
+                        DrainRemote(pPool);
+                if ((pBuffer = pPool->m_pFree[nClass]) != NULL) {
+                        pPool->m_pFree[nClass] = pBuffer->m_pNext;
+                        pPool->m_nFree[nClass]--;
+                        SingleWriterAdd(&pPool->m_nCachedBytes, -(long long)ClassBytes(nClass));
+                        SingleWriterAdd(&pPool->m_nHits, 1);
+                } else if ((pBuffer = NewBuffer(nClass, ClassBytes(nClass))) != NULL) {
+                        pBuffer->m_pOwner = pPool;
+                }
+        }
+        if (!pBuffer)
+                return NULL;
+        atomic_init(&pBuffer->m_nRef, 1);
+        pBuffer->m_nSize = _nSize;
+        return pBuffer;
+}
+
+void RtmpPubBufferRef(RtmpPubBuffer * _pBuffer)
+{
+        atomic_fetch_add_explicit(&_pBuffer->m_nRef, 1, memory_order_relaxed);
+}
+
+void RtmpPubBufferUnref(RtmpPubBuffer * _pBuffer)
+{
+        RtmpPubBufferPool * pOwner;
+        RtmpPubBuffer * pHead;
+
+        if (!_pBuffer || atomic_fetch_sub_explicit(&_pBuffer->m_nRef, 1, memory_order_acq_rel) != 1)
+                return;
+        pOwner = _pBuffer->m_pOwner;
+        if (!pOwner) {
+                free(_pBuffer);
+                return;
+        }
+        if (pOwner == s_pPool) {
+                CacheLocal(pOwner, _pBuffer);
+                return;
+        }
+        pHead = atomic_load_explicit(&pOwner->m_pRemote, memory_order_relaxed);
+        do {
+                if (pHead == DEAD_POOL) {
+                        free(_pBuffer);
+                        return;
+                }
+                _pBuffer->m_pNext = pHead;
+        } while (!atomic_compare_exchange_weak_explicit(&pOwner->m_pRemote, &pHead, _pBuffer,
+                                                        memory_order_release, memory_order_relaxed));
+        atomic_fetch_add_explicit(&pOwner->m_nRemoteFrees, 1, memory_order_relaxed);
+}
+
+void RtmpPubBufferPoolTrim(void)
+{
+        if (!s_pPool)
+                return;
+        DrainRemote(s_pPool);
+        FreeLocal(s_pPool);
+}
+
+void RtmpPubBufferPoolGetStats(RtmpPubBufferPoolStats * _pStats)
+{
+        RtmpPubBufferPool * pPool;
+
+        memset(_pStats, 0, sizeof(*_pStats));
+        for (pPool = atomic_load(&s_pPools); pPool; pPool = pPool->m_pNextPool) {
+                _pStats->m_nAllocs += atomic_load_explicit(&pPool->m_nAllocs, memory_order_relaxed);
+                _pStats->m_nHits += atomic_load_explicit(&pPool->m_nHits, memory_order_relaxed);
+                _pStats->m_nRemoteFrees += atomic_load_explicit(&pPool->m_nRemoteFrees, memory_order_relaxed);
+                _pStats->m_nCachedBytes += atomic_load_explicit(&pPool->m_nCachedBytes, memory_order_relaxed);
+        }
+}
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "rtmp_channel_table.h"
+
+void RtmpPubChannelTableInit(RtmpPubChannelTable * _pTable)
+{
+        memset(_pTable, 0, sizeof(*_pTable));
+}
+
+void RtmpPubChannelTableDestroy(RtmpPubChannelTable * _pTable)
+{
+        free(_pTable->m_pSparse);
+        memset(_pTable, 0, sizeof(*_pTable));
+}
+
+// 返回第一个m_nChannel >= _nChannel的位置
+static unsigned int LowerBound(const RtmpPubChannelTable * _pTable, int _nChannel)
+{
+        unsigned int nLow = 0, nHigh = _pTable->m_nSparse;
+
+        while (nLow < nHigh) {
+                unsigned int nMid = (nLow + nHigh) / 2;
+                if (_pTable->m_pSparse[nMid].m_nChannel < _nChannel)
+                        nLow = nMid + 1;
+                else
+                        nHigh = nMid;
+        }
+        return nLow;
+}
+
+RtmpPubChannel * RtmpPubChannelTableFind(RtmpPubChannelTable * _pTable, int _nChannel)
+{
+        RtmpPubChannel * pChannel = NULL;
+        unsigned int nPos;
+
+        if (_nChannel < 0)
+                return NULL;
+        if (_nChannel < RTMP_PUB_INLINE_CHANNELS) {
+                pChannel = &_pTable->m_inline[_nChannel];
+        } else {
+                nPos = LowerBound(_pTable, _nChannel);
+                if (nPos < _pTable->m_nSparse && _pTable->m_pSparse[nPos].m_nChannel == _nChannel)
+                        pChannel = &_pTable->m_pSparse[nPos].m_channel;
+        }
+        return pChannel && pChannel->m_bValid ? pChannel : NULL;
+}
+
+RtmpPubChannel * RtmpPubChannelTableGet(RtmpPubChannelTable * _pTable, int _nChannel)
+{
+        RtmpPubSparseChannel * pSparse;
+        unsigned int nPos;
+
+        if (_nChannel < 0)
+                return NULL;
+        if (_nChannel < RTMP_PUB_INLINE_CHANNELS)
+                return &_pTable->m_inline[_nChannel];
+
+        nPos = LowerBound(_pTable, _nChannel);
+        if (nPos < _pTable->m_nSparse && _pTable->m_pSparse[nPos].m_nChannel == _nChannel)
+                return &_pTable->m_pSparse[nPos].m_channel;
+        if (_pTable->m_nSparse == _pTable->m_nSparseCapacity) {
+                unsigned int nCapacity = _pTable->m_nSparseCapacity ? _pTable->m_nSparseCapacity * 2 : 4;
+                pSparse = (RtmpPubSparseChannel *)realloc(_pTable->m_pSparse, nCapacity * sizeof(RtmpPubSparseChannel));
+                if (!pSparse)
+                        return NULL;
+                _pTable->m_pSparse = pSparse;
+                _pTable->m_nSparseCapacity = nCapacity;
+        }
+        pSparse = &_pTable->m_pSparse[nPos];
+        memmove(pSparse + 1, pSparse, (_pTable->m_nSparse - nPos) * sizeof(RtmpPubSparseChannel));
+        _pTable->m_nSparse++;
+        memset(pSparse, 0, sizeof(*pSparse));
+        pSparse->m_nChannel = _nChannel;
+        return &pSparse->m_channel;
+}
+
+static int IsZeroPage(const char * _pPage, unsigned long _nPageSize)
+{
+        const unsigned long * p = (const unsigned long *)_pPage;
+        const unsigned long * pEnd = (const unsigned long *)(_pPage + _nPageSize);
+
+        while (p < pEnd)
+                if (*p++)
+                        return 0;
+        return 1;
+}
+
+unsigned long RtmpPubTrimChannels(RtmpPubContext * _pRtmp)
+{
+        struct RTMP * pRtmp = _pRtmp->m_pRtmp;
+        unsigned long nPageSize = sysconf(_SC_PAGESIZE);
+        // m_vecChannelsIn/m_vecChannelsOut/m_channelTimestamp在结构体里是连续的
+        char * pBegin = (char *)(((unsigned long)pRtmp->m_vecChannelsIn + nPageSize - 1) & ~(nPageSize - 1));
+        char * pEnd = (char *)((unsigned long)&pRtmp->m_channelTimestamp[RTMP_CHANNELS] & ~(nPageSize - 1));
+        char * pRun = NULL, * pPage;
+        unsigned long nTrimmed = 0;
+
+        for (pPage = pBegin; pPage <= pEnd; pPage += nPageSize) {
+                if (pPage < pEnd && IsZeroPage(pPage, nPageSize)) {
+                        if (!pRun)
+                                pRun = pPage;
+                        continue;
+                }
+                if (pRun && madvise(pRun, pPage - pRun, MADV_DONTNEED) == 0)
+                        nTrimmed += pPage - pRun;
+                pRun = NULL;
+        }
+        return nTrimmed;
+}
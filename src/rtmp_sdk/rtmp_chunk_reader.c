@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rtmp_chunk_reader.h"
+#include "rtmp_publish_internal.h"
+
+#define RTMP_PUB_EXT_TIMESTAMP          0xffffff
+
+// fmt 0~3的消息头长度(不包含basic header和扩展时间戳)
+static const uint32_t s_nMessageHeaderSize[4] = { 11, 7, 3, 0 };
+
+void RtmpPubChunkReaderInit(RtmpPubChunkReader * _pReader, RtmpPubMessageCallback _pCallback, void * _pOpaque)
+{
+        int i;
+
+        memset(_pReader, 0, sizeof(*_pReader));
+        for (i = 0; i < RTMP_PUB_READER_MAX_CHANNELS; i++)
+                _pReader->m_channels[i].m_nChannel = -1;
+        _pReader->m_nChunkSize = RTMP_DEFAULT_CHUNKSIZE;
+        _pReader->m_pCallback = _pCallback;
+        _pReader->m_pOpaque = _pOpaque;
+}
+
+void RtmpPubChunkReaderDestroy(RtmpPubChunkReader * _pReader)
+{
+        int i;
+
+        for (i = 0; i < RTMP_PUB_READER_MAX_CHANNELS; i++)
+                free(_pReader->m_channels[i].m_pBody);
+        memset(_pReader->m_channels, 0, sizeof(_pReader->m_channels));
+}
+
+static RtmpPubReaderChannel * GetChannel(RtmpPubChunkReader * _pReader, int _nChannel)
+{
+        RtmpPubReaderChannel * pFree = NULL;
+        int i;
+
+        for (i = 0; i < RTMP_PUB_READER_MAX_CHANNELS; i++) {
+                if (_pReader->m_channels[i].m_nChannel == _nChannel)
+                        return &_pReader->m_channels[i];
+                if (!pFree && _pReader->m_channels[i].m_nChannel < 0)
+                        pFree = &_pReader->m_channels[i];
+        }
+        if (pFree) {
+                memset(pFree, 0, sizeof(*pFree));
+                pFree->m_nChannel = _nChannel;
+        }
+        return pFree;
+}
+
+static uint32_t ReadBe24(const uint8_t * _pData)
+{
+        return (_pData[0] << 16) | (_pData[1] << 8) | _pData[2];
+}
+
+static uint32_t ReadBe32(const uint8_t * _pData)
+{
+        return ((uint32_t)_pData[0] << 24) | (_pData[1] << 16) | (_pData[2] << 8) | _pData[3];
+}
+
+static int Deliver(RtmpPubChunkReader * _pReader, RtmpPubReaderChannel * _pChannel)
+{
+        RtmpPubMessage message;
+        uint32_t nValue;
+        int i;
+
+        message.m_nChannel = _pChannel->m_nChannel;
+        message.m_nType = _pChannel->m_header.m_nType;
+        message.m_nTimeStamp = _pChannel->m_header.m_nTimeStamp;
+        message.m_nStreamId = _pChannel->m_header.m_nStreamId;
+        message.m_pBody = _pChannel->m_pBody;
+        message.m_nBodySize = _pChannel->m_header.m_nBodySize;
+        _pChannel->m_nBodyRead = 0;
+
+        if (message.m_nType == RTMP_PACKET_TYPE_CHUNK_SIZE && message.m_nBodySize >= 4) {
+                nValue = ReadBe32((uint8_t *)message.m_pBody) & 0x7fffffff;
+                if (!nValue)
+                        return -1;
+                _pReader->m_nChunkSize = nValue;
+        } else if (message.m_nType == 0x02 && message.m_nBodySize >= 4) {
+                // Abort Message: 丢弃该chunk stream上未收完的消息
+                nValue = ReadBe32((uint8_t *)message.m_pBody);
+                for (i = 0; i < RTMP_PUB_READER_MAX_CHANNELS; i++)
+                        if (_pReader->m_channels[i].m_nChannel == (int)nValue)
+                                _pReader->m_channels[i].m_nBodyRead = 0;
+        }
+        return _pReader->m_pCallback(_pReader->m_pOpaque, &message);
+}
+
+int RtmpPubChunkReaderParse(RtmpPubChunkReader * _pReader, const char * _pData, unsigned int _nSize)
+{
+        const uint8_t * pStart = (const uint8_t *)_pData;
+        const uint8_t * p = pStart, * pEnd = pStart + _nSize;
+
+        for (;;) {
+                RtmpPubReaderChannel * pChannel;
+                const uint8_t * q = p;
+                uint32_t nTimeField = 0, nLeft, nPiece;
+                int nFmt, nChannel, bExt;
+
+                if (q == pEnd)
+                        break;
+                nFmt = q[0] >> 6;
+                nChannel = q[0] & 0x3f;
+                q++;
+                if (nChannel == 0) {
+                        if (pEnd - q < 1)
+                                break;
+                        nChannel = 64 + q[0];
+                        q++;
+                } else if (nChannel == 1) {
+                        if (pEnd - q < 2)
+                                break;
+                        nChannel = 64 + q[0] + (q[1] << 8);
+                        q += 2;
+                }
+                if ((uint32_t)(pEnd - q) < s_nMessageHeaderSize[nFmt])
+                        break;
+                if (!(pChannel = GetChannel(_pReader, nChannel))) {
+                        RtmpPubLog("too many chunk streams, csid = %d", nChannel);
+                        return -1;
+                }
+                // fmt 1只缺消息流id, 默认为0, librtmp的协议控制消息第一次就用fmt 1发送
+                if (nFmt >= 2 && !pChannel->m_header.m_bValid) {
+                        RtmpPubLog("chunk without previous header, csid = %d", nChannel);
+                        return -1;
+                }
+                if (nFmt <= 2)
+                        nTimeField = ReadBe24(q);
+                bExt = nFmt <= 2 ? nTimeField == RTMP_PUB_EXT_TIMESTAMP :
+                                   pChannel->m_nDelta >= RTMP_PUB_EXT_TIMESTAMP;
+                if (bExt && (uint32_t)(pEnd - q) < s_nMessageHeaderSize[nFmt] + 4)
+                        break;
+
+                // 头已经完整, 再检查这个chunk的数据是否已经收全
+                nLeft = nFmt <= 1 ? ReadBe24(q + 3) : pChannel->m_header.m_nBodySize;
+                if (nFmt == 3 && pChannel->m_nBodyRead)
+                        nLeft -= pChannel->m_nBodyRead;
+                nPiece = nLeft < _pReader->m_nChunkSize ? nLeft : _pReader->m_nChunkSize;
+                if ((uint32_t)(pEnd - q) < s_nMessageHeaderSize[nFmt] + (bExt ? 4 : 0) + nPiece)
+                        break;
+
+                if (nFmt <= 1) {
+                        pChannel->m_header.m_nBodySize = ReadBe24(q + 3);
+                        pChannel->m_header.m_nType = q[6];
+                }
+                if (nFmt == 0)
+                        pChannel->m_header.m_nStreamId = q[7] | (q[8] << 8) | (q[9] << 16) | ((uint32_t)q[10] << 24);
+                q += s_nMessageHeaderSize[nFmt];
+                if (bExt) {
+                        if (nFmt <= 2)
+                                nTimeField = ReadBe32(q);
+                        q += 4;
+                }
+                if (nFmt == 0) {
+                        pChannel->m_header.m_nTimeStamp = nTimeField;
+                        pChannel->m_nDelta = 0;
+                } else if (nFmt <= 2) {
+                        pChannel->m_nDelta = nTimeField;
+                        pChannel->m_header.m_nTimeStamp += nTimeField;
+                } else if (!pChannel->m_nBodyRead) {
+                        pChannel->m_header.m_nTimeStamp += pChannel->m_nDelta;
+                }
+                pChannel->m_header.m_bValid = 1;
+                if (nFmt != 3)
+                        pChannel->m_nBodyRead = 0;
+
+                if (pChannel->m_nCapacity < pChannel->m_header.m_nBodySize) {
+                        char * pBody = (char *)realloc(pChannel->m_pBody, pChannel->m_header.m_nBodySize);
+                        if (!pBody)
+                                return -1;
+                        pChannel->m_pBody = pBody;
+                        pChannel->m_nCapacity = pChannel->m_header.m_nBodySize;
+                }
+                memcpy(pChannel->m_pBody + pChannel->m_nBodyRead, q, nPiece);
+                pChannel->m_nBodyRead += nPiece;
+                q += nPiece;
+                p = q;
+                if (pChannel->m_nBodyRead == pChannel->m_header.m_nBodySize && Deliver(_pReader, pChannel) < 0)
+                        return -1;
+        }
+        return p - pStart;
+}
@@ -0,0 +1,468 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "rtmp_chunk_writer.h"
+#include "rtmp_publish_internal.h"
+
+#define RTMP_PUB_CONTROL_CHANNEL        2
+#define RTMP_PUB_EXT_TIMESTAMP          0xffffff
+
+void RtmpPubChunkWriterInit(RtmpPubChunkWriter * _pWriter, struct RTMP * _pRtmp)
+{
+        memset(_pWriter, 0, sizeof(*_pWriter));
+        _pWriter->m_pRtmp = _pRtmp;
+        _pWriter->m_nSocket = -1;
+}
+
+void RtmpPubChunkWriterInitSocket(RtmpPubChunkWriter * _pWriter, int _nSocket, int _nChunkSize)
+{
+        memset(_pWriter, 0, sizeof(*_pWriter));
+        _pWriter->m_nSocket = _nSocket;
+        _pWriter->m_nChunkSize = _nChunkSize;
+        RtmpPubChannelTableInit(&_pWriter->m_channels);
+}
+
+void RtmpPubChunkWriterDestroy(RtmpPubChunkWriter * _pWriter)
+{
+        if (_pWriter->m_op.m_bInFlight || _pWriter->m_op.m_bOnDoneList)
+                RtmpPubTransportCancel(_pWriter->m_pTransport, &_pWriter->m_op);
+        RtmpPubChannelTableDestroy(&_pWriter->m_channels);
+}
+
+void RtmpPubChunkWriterSetTransport(RtmpPubChunkWriter * _pWriter, RtmpPubTransport * _pTransport, void * _pOwner)
+{
+        _pWriter->m_pTransport = _pTransport == RtmpPubSocketTransport() ? NULL : _pTransport;
+        _pWriter->m_op.m_pOwner = _pOwner;
+}
+
+// 绑定librtmp会话时socket和chunk大小随会话变化(重连、Set Chunk Size), 每次都从会话里取
+static int GetSocket(RtmpPubChunkWriter * _pWriter)
+{
+        return _pWriter->m_pRtmp ? _pWriter->m_pRtmp->m_sb.sb_socket : _pWriter->m_nSocket;
+}
+
+static int GetChunkSize(RtmpPubChunkWriter * _pWriter)
+{
+        return _pWriter->m_pRtmp ? _pWriter->m_pRtmp->m_outChunkSize : _pWriter->m_nChunkSize;
+}
+
+static int WaitWritable(int _nSocket)
+{
+        struct pollfd pfd;
+        int ret;
+
+        pfd.fd = _nSocket;
+        pfd.events = POLLOUT;
+        while ((ret = poll(&pfd, 1, RTMP_PUB_WRITER_WAIT_MS)) < 0 && errno == EINTR)
+                ;
+        if (ret == 0)
+                errno = ETIMEDOUT;
+        return ret > 0 ? 0 : -1;
+}
+
+/*
+ * 把已经排队的iovec写出去, scratch里可能还有当前消息尚未入队的数据, 不在这里重置
+ * 非阻塞socket写不完时: _bWait为0则保留剩下的iovec和chunk头返回1,
+ * _bWait为1(正在拼一条消息, iovec数组已满)则等待可写后继续
+ * 异步传输层的请求还没有完成时也一样, _bWait为0返回1, 为1时等它完成
+ */
+static int WriteIov(RtmpPubChunkWriter * _pWriter, int _bWait)
+{
+        RtmpPubTransport * pTransport = _pWriter->m_pTransport ? _pWriter->m_pTransport : RtmpPubSocketTransport();
+        RtmpPubTransportOp * pOp = &_pWriter->m_op;
+        struct iovec * pIov = _pWriter->m_iov;
+        int nIov = _pWriter->m_nIov, ret = 0;
+        int fd = GetSocket(_pWriter);
+        long long int nStart = 0;
+        size_t nBytes;
+        long nWritten;
+        int i;
+
+        while (nIov > 0) {
+                if (!pOp->m_bInFlight && !pOp->m_bDone) {
+                        // 请求完成之前传输层一直引用m_iov, 剩下的部分挪到开头
+                        if (pIov != _pWriter->m_iov) {
+                                memmove(_pWriter->m_iov, pIov, nIov * sizeof(struct iovec));
+                                pIov = _pWriter->m_iov;
+                        }
+                        _pWriter->m_nIov = nIov;
+                        for (i = 0, nBytes = 0; i < nIov; i++)
+                                nBytes += pIov[i].iov_len;
+                        memset(&pOp->m_msg, 0, sizeof(pOp->m_msg));
+                        pOp->m_msg.msg_iov = pIov;
+                        pOp->m_msg.msg_iovlen = nIov;
+                        if (_pWriter->m_pSendLatency)
+                                nStart = RtmpPubNowNs();
+                        if (RtmpPubTransportSend(pTransport, pOp, fd, nBytes) < 0) {
+                                pOp->m_bDone = 1;
+                                pOp->m_nResult = -errno;
+                        }
+                }
+                if (pOp->m_bInFlight) {
+                        if (!_bWait)
+                                return 1;
+                        if (RtmpPubTransportWait(pTransport, pOp) < 0) {
+                                _pWriter->m_nError = errno;
+                                return -1;
+                        }
+                }
+                // 异步完成的请求没有计时, 提交时只是放进队列
+                if (nStart) {
+                        nStart = RtmpPubNowNs() - nStart;
+                        RtmpPubHistogramRecord(_pWriter->m_pSendLatency, nStart);
+                        _pWriter->m_nSendNs += nStart;
+                        nStart = 0;
+                }
+                pOp->m_bDone = 0;
+                nWritten = pOp->m_nResult;
+                if (nWritten < 0) {
+                        errno = (int)-nWritten;
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                if (!_bWait) {
+                                        memmove(_pWriter->m_iov, pIov, nIov * sizeof(struct iovec));
+                                        _pWriter->m_nIov = nIov;
+                                        return 1;
+                                }
+                                if (WaitWritable(fd) == 0)
+                                        continue;
+                        }
+                        RtmpPubLog("writev err, errno = %d", errno);
+                        _pWriter->m_nError = errno;
+                        ret = -1;
+                        break;
+                }
+                _pWriter->m_nWritevCalls++;
+                _pWriter->m_nBytes += nWritten;
+                while (nIov > 0 && (size_t)nWritten >= pIov->iov_len) {
+                        nWritten -= pIov->iov_len;
+                        pIov++;
+                        nIov--;
+                }
+                if (nIov > 0) {
+                        pIov->iov_base = (char *)pIov->iov_base + nWritten;
+                        pIov->iov_len -= nWritten;
+                }
+        }
+        _pWriter->m_nIov = 0;
+        _pWriter->m_nHeaderUsed = 0;
+        return ret;
+}
+
+int RtmpPubChunkWriterFlush(RtmpPubChunkWriter * _pWriter)
+{
+        int ret = 0;
+
+        if (_pWriter->m_nIov && (ret = WriteIov(_pWriter, 0)) > 0)
+                return ret;
+        _pWriter->m_nScratchUsed = 0;
+        _pWriter->m_nQueuedMessages = 0;
+        return ret;
+}
+
+int RtmpPubChunkWriterReserve(RtmpPubChunkWriter * _pWriter, unsigned int _nSize)
+{
+        if (_nSize > RTMP_PUB_WRITER_SCRATCH_SIZE)
+                return -1;
+        if (_pWriter->m_nScratchUsed + _nSize <= RTMP_PUB_WRITER_SCRATCH_SIZE)
+                return 0;
+        // 已经排队的消息可能引用scratch, 非阻塞socket上也要等它们写完
+        if (_pWriter->m_nIov && WriteIov(_pWriter, 1) < 0)
+                return -1;
+        _pWriter->m_nScratchUsed = 0;
+        _pWriter->m_nQueuedMessages = 0;
+        return 0;
+}
+
+char * RtmpPubChunkWriterAlloc(RtmpPubChunkWriter * _pWriter, unsigned int _nSize)
+{
+        char * pBuf;
+
+        if (_pWriter->m_nScratchUsed + _nSize > RTMP_PUB_WRITER_SCRATCH_SIZE)
+                return NULL;
+        pBuf = _pWriter->m_scratch + _pWriter->m_nScratchUsed;
+        _pWriter->m_nScratchUsed += _nSize;
+        return pBuf;
+}
+
+static int PushIov(RtmpPubChunkWriter * _pWriter, const void * _pBase, size_t _nLen)
+{
+        if (_pWriter->m_nIov == RTMP_PUB_WRITER_MAX_IOV && WriteIov(_pWriter, 1) < 0)
+                return -1;
+        _pWriter->m_iov[_pWriter->m_nIov].iov_base = (void *)_pBase;
+        _pWriter->m_iov[_pWriter->m_nIov].iov_len = _nLen;
+        _pWriter->m_nIov++;
+        return 0;
+}
+
+int RtmpPubChunkWriterQueueRaw(RtmpPubChunkWriter * _pWriter, const char * _pData, unsigned int _nSize)
+{
+        return PushIov(_pWriter, _pData, _nSize);
+}
+
+static char * HeaderSpace(RtmpPubChunkWriter * _pWriter)
+{
+        // 留一个iovec给紧跟着的消息体, 避免头和消息体被拆到两次writev里时头所在的区域被覆盖
+        if ((_pWriter->m_nHeaderUsed + RTMP_MAX_HEADER_SIZE > RTMP_PUB_WRITER_HEADER_ARENA ||
+             _pWriter->m_nIov + 2 > RTMP_PUB_WRITER_MAX_IOV) && WriteIov(_pWriter, 1) < 0)
+                return NULL;
+        return _pWriter->m_headers + _pWriter->m_nHeaderUsed;
+}
+
+static int PushHeader(RtmpPubChunkWriter * _pWriter, char * _pHeader, int _nLen)
+{
+        _pWriter->m_nHeaderUsed += _nLen;
+        return PushIov(_pWriter, _pHeader, _nLen);
+}
+
+static int WriteBasicHeader(char * _pOut, int _nFmt, int _nChannel)
+{
+        if (_nChannel < 64) {
+                _pOut[0] = (char)((_nFmt << 6) | _nChannel);
+                return 1;
+        }
+        if (_nChannel < 64 + 256) {
+                _pOut[0] = (char)(_nFmt << 6);
+                _pOut[1] = (char)(_nChannel - 64);
+                return 2;
+        }
+        _pOut[0] = (char)((_nFmt << 6) | 1);
+        _pOut[1] = (char)((_nChannel - 64) & 0xff);
+        _pOut[2] = (char)((_nChannel - 64) >> 8);
+        return 3;
+}
+
+static void WriteBe24(char * _pOut, uint32_t _nVal)
+{
+        _pOut[0] = (char)(_nVal >> 16);
+        _pOut[1] = (char)(_nVal >> 8);
+        _pOut[2] = (char)_nVal;
+}
+
+/*
+ * chunk stream状态的访问层:
+ * 绑定librtmp会话时读写m_vecChannelsOut, 和RTMP_SendPacket看到的是同一份状态,
+ * 否则读写紧凑的m_channels
+ */
+static int LoadChannel(RtmpPubChunkWriter * _pWriter, int _nChannel, RtmpPubChannel * _pChannel)
+{
+        RTMPPacket * pPacket;
+        RtmpPubChannel * pChannel;
+
+        if (!_pWriter->m_pRtmp) {
+                if (!(pChannel = RtmpPubChannelTableFind(&_pWriter->m_channels, _nChannel)))
+                        return -1;
+                *_pChannel = *pChannel;
+                return 0;
+        }
+        if (!(pPacket = _pWriter->m_pRtmp->m_vecChannelsOut[_nChannel]))
+                return -1;
+        _pChannel->m_nTimeStamp = pPacket->m_nTimeStamp;
+        _pChannel->m_nBodySize = pPacket->m_nBodySize;
+        _pChannel->m_nStreamId = pPacket->m_nInfoField2;
+        _pChannel->m_nType = pPacket->m_packetType;
+        _pChannel->m_nHeaderType = pPacket->m_headerType;
+        _pChannel->m_bValid = 1;
+        return 0;
+}
+
+static int StoreChannel(RtmpPubChunkWriter * _pWriter, int _nChannel, const RtmpPubChannel * _pChannel)
+{
+        RTMPPacket * pPacket;
+        RtmpPubChannel * pChannel;
+
+        if (!_pWriter->m_pRtmp) {
+                if (!(pChannel = RtmpPubChannelTableGet(&_pWriter->m_channels, _nChannel)))
+                        return -1;
+                *pChannel = *_pChannel;
+                pChannel->m_bValid = 1;
+                return 0;
+        }
+        // 和RTMP_SendPacket一样, 把这条消息记为该chunk stream上的上一条消息
+        pPacket = _pWriter->m_pRtmp->m_vecChannelsOut[_nChannel];
+        if (!pPacket) {
+                pPacket = (RTMPPacket *)malloc(sizeof(RTMPPacket));
+                if (!pPacket)
+                        return -1;
+                _pWriter->m_pRtmp->m_vecChannelsOut[_nChannel] = pPacket;
+        }
+        memset(pPacket, 0, sizeof(*pPacket));
+        pPacket->m_headerType = _pChannel->m_nHeaderType;
+        pPacket->m_packetType = _pChannel->m_nType;
+        pPacket->m_nChannel = _nChannel;
+        pPacket->m_nTimeStamp = _pChannel->m_nTimeStamp;
+        pPacket->m_nInfoField2 = _pChannel->m_nStreamId;
+        pPacket->m_nBodySize = _pChannel->m_nBodySize;
+        return 0;
+}
+
+int RtmpPubChunkWriterBegin(RtmpPubChunkWriter * _pWriter, int _nChannel, uint8_t _nType, uint8_t _nHeaderType,
+                            uint32_t _nTimeStamp, int32_t _nStreamId, uint32_t _nBodySize)
+{
+        RtmpPubChannel prev;
+        uint32_t nDelta, nLast = 0;
+        int nFmt, nLen, bHasPrev;
+        char * pHeader;
+
+        if (_nChannel < 2 || _nChannel >= RTMP_CHANNELS || _nBodySize > 0xffffff || _pWriter->m_nOpenLeft)
+                return -1;
+
+        bHasPrev = LoadChannel(_pWriter, _nChannel, &prev) == 0;
+        if (!bHasPrev)
+                _nHeaderType = RTMP_PACKET_SIZE_LARGE;
+        if (_nHeaderType != RTMP_PACKET_SIZE_LARGE) {
+                if (prev.m_nBodySize == _nBodySize && prev.m_nType == _nType &&
+                    _nHeaderType == RTMP_PACKET_SIZE_MEDIUM)
+                        _nHeaderType = RTMP_PACKET_SIZE_SMALL;
+                if (prev.m_nTimeStamp == _nTimeStamp && _nHeaderType == RTMP_PACKET_SIZE_SMALL)
+                        _nHeaderType = RTMP_PACKET_SIZE_MINIMUM;
+                nLast = prev.m_nTimeStamp;
+        }
+        nDelta = _nTimeStamp - nLast;
+        _pWriter->m_bOpenExtTimestamp = nDelta >= RTMP_PUB_EXT_TIMESTAMP;
+        nFmt = _nHeaderType;
+
+        // 第一个chunk的完整头
+        if (!(pHeader = HeaderSpace(_pWriter)))
+                return -1;
+        nLen = WriteBasicHeader(pHeader, nFmt, _nChannel);
+        if (nFmt <= RTMP_PACKET_SIZE_SMALL) {
+                WriteBe24(pHeader + nLen, _pWriter->m_bOpenExtTimestamp ? RTMP_PUB_EXT_TIMESTAMP : nDelta);
+                nLen += 3;
+        }
+        if (nFmt <= RTMP_PACKET_SIZE_MEDIUM) {
+                WriteBe24(pHeader + nLen, _nBodySize);
+                pHeader[nLen + 3] = (char)_nType;
+                nLen += 4;
+        }
+        if (nFmt == RTMP_PACKET_SIZE_LARGE) {
+                // stream id是小端
+                pHeader[nLen++] = (char)_nStreamId;
+                pHeader[nLen++] = (char)(_nStreamId >> 8);
+                pHeader[nLen++] = (char)(_nStreamId >> 16);
+                pHeader[nLen++] = (char)(_nStreamId >> 24);
+        }
+        if (_pWriter->m_bOpenExtTimestamp) {
+                RtmpPubWriteBe32(pHeader + nLen, nDelta);
+                nLen += 4;
+        }
+        if (PushHeader(_pWriter, pHeader, nLen) < 0)
+                return -1;
+
+        _pWriter->m_nOpenChannel = _nChannel;
+        _pWriter->m_nOpenLeft = _nBodySize;
+        _pWriter->m_nOpenChunkLeft = GetChunkSize(_pWriter);
+        _pWriter->m_nOpenDelta = nDelta;
+        _pWriter->m_nMessages++;
+        prev.m_nTimeStamp = _nTimeStamp;
+        prev.m_nBodySize = _nBodySize;
+        prev.m_nStreamId = _nStreamId;
+        prev.m_nType = _nType;
+        prev.m_nHeaderType = _nHeaderType;
+        prev.m_bValid = 1;
+        return StoreChannel(_pWriter, _nChannel, &prev);
+}
+
+int RtmpPubChunkWriterAppend(RtmpPubChunkWriter * _pWriter, const struct iovec * _pPayload, int _nPayload)
+{
+        uint32_t nSize = 0;
+        int nLen, i;
+        char * pHeader;
+
+        for (i = 0; i < _nPayload; i++)
+                nSize += _pPayload[i].iov_len;
+        if (nSize > _pWriter->m_nOpenLeft)
+                return -1;
+
+        // 消息体按chunk大小切分, 一个iovec可能跨多个chunk, 一个chunk也可能由多个iovec组成
+        for (i = 0; i < _nPayload; i++) {
+                const char * pBase = (const char *)_pPayload[i].iov_base;
+                size_t nLeft = _pPayload[i].iov_len, nOffset = 0;
+
+                while (nLeft > 0) {
+                        size_t nPiece = nLeft < (size_t)_pWriter->m_nOpenChunkLeft ? nLeft : (size_t)_pWriter->m_nOpenChunkLeft;
+
+                        if (_pWriter->m_nOpenChunkLeft == 0) {
+                                if (!(pHeader = HeaderSpace(_pWriter)))
+                                        return -1;
+                                nLen = WriteBasicHeader(pHeader, RTMP_PACKET_SIZE_MINIMUM, _pWriter->m_nOpenChannel);
+                                if (_pWriter->m_bOpenExtTimestamp) {
+                                        RtmpPubWriteBe32(pHeader + nLen, _pWriter->m_nOpenDelta);
+                                        nLen += 4;
+                                }
+                                if (PushHeader(_pWriter, pHeader, nLen) < 0)
+                                        return -1;
+                                _pWriter->m_nOpenChunkLeft = GetChunkSize(_pWriter);
+                                continue;
+                        }
+                        if (PushIov(_pWriter, pBase + nOffset, nPiece) < 0)
+                                return -1;
+                        nOffset += nPiece;
+                        nLeft -= nPiece;
+                        _pWriter->m_nOpenChunkLeft -= nPiece;
+                }
+        }
+        _pWriter->m_nOpenLeft -= nSize;
+        if (!_pWriter->m_nOpenLeft)
+                _pWriter->m_nQueuedMessages++;
+        return 0;
+}
+
+int RtmpPubChunkWriterQueue(RtmpPubChunkWriter * _pWriter, int _nChannel, uint8_t _nType, uint8_t _nHeaderType,
+                            uint32_t _nTimeStamp, int32_t _nStreamId, const struct iovec * _pPayload, int _nPayload)
+{
+        uint32_t nBodySize = 0;
+        int i;
+
+        for (i = 0; i < _nPayload; i++)
+                nBodySize += _pPayload[i].iov_len;
+        if (RtmpPubChunkWriterBegin(_pWriter, _nChannel, _nType, _nHeaderType, _nTimeStamp, _nStreamId, nBodySize) < 0)
+                return -1;
+        return RtmpPubChunkWriterAppend(_pWriter, _pPayload, _nPayload);
+}
+
+int RtmpPubChunkWriterSetChunkSize(RtmpPubChunkWriter * _pWriter, int _nChunkSize)
+{
+        struct iovec iov;
+
+        if (_pWriter->m_pRtmp || _nChunkSize < RTMP_DEFAULT_CHUNKSIZE || _nChunkSize > 0xffffff)
+                return -1;
+        if (RtmpPubChunkWriterReserve(_pWriter, 4) < 0)
+                return -1;
+        iov.iov_base = RtmpPubChunkWriterAlloc(_pWriter, 4);
+        iov.iov_len = 4;
+        RtmpPubWriteBe32((char *)iov.iov_base, _nChunkSize);
+        if (RtmpPubChunkWriterQueue(_pWriter, RTMP_PUB_CONTROL_CHANNEL, RTMP_PACKET_TYPE_CHUNK_SIZE,
+                                    RTMP_PACKET_SIZE_LARGE, 0, 0, &iov, 1) < 0)
+                return -1;
+        _pWriter->m_nChunkSize = _nChunkSize;
+        return 0;
+}
+
+int RtmpPubSetChunkSize(RtmpPubContext * _pRtmp, int _nChunkSize)
+{
+        struct RTMP * pRtmp = _pRtmp->m_pRtmp;
+        char buf[RTMP_MAX_HEADER_SIZE + 4];
+        RTMPPacket packet;
+
+        if (_nChunkSize < RTMP_DEFAULT_CHUNKSIZE || _nChunkSize > 0xffffff)
+                return -1;
+        RTMPPacket_Reset(&packet);
+        packet.m_body = buf + RTMP_MAX_HEADER_SIZE;     // RTMP_SendPacket会把chunk头写在body前面
+        packet.m_nChannel = RTMP_PUB_CONTROL_CHANNEL;
+        packet.m_headerType = RTMP_PACKET_SIZE_LARGE;
+        packet.m_packetType = RTMP_PACKET_TYPE_CHUNK_SIZE;
+        packet.m_nTimeStamp = 0;
+        packet.m_nInfoField2 = 0;
+        packet.m_hasAbsTimestamp = 0;
+        packet.m_nBodySize = 4;
+        RtmpPubWriteBe32(packet.m_body, _nChunkSize);
+        if (!RTMP_SendPacket(pRtmp, &packet, 0))
+                return -1;
+        pRtmp->m_outChunkSize = _nChunkSize;
+        return 0;
+}
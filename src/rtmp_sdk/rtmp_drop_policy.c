@@ -0,0 +1,63 @@
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "rtmp_drop_policy.h"
+
+void RtmpPubDropPolicyInit(RtmpPubDropPolicy * _pPolicy, const RtmpPubDropConfig * _pConfig)
+{
+        memset(_pPolicy, 0, sizeof(*_pPolicy));
+        atomic_init(&_pPolicy->m_nDroppedNonRef, 0);
+        atomic_init(&_pPolicy->m_nDroppedGop, 0);
+        atomic_init(&_pPolicy->m_nGopSkips, 0);
+        if (!_pConfig)
+                return;
+        _pPolicy->m_config = *_pConfig;
+        if (!_pPolicy->m_config.m_nGopDropLatencyMs)
+                _pPolicy->m_config.m_nGopDropLatencyMs = _pPolicy->m_config.m_nLatencyBudgetMs * 2;
+}
+
+int RtmpPubDropPolicyCheck(RtmpPubDropPolicy * _pPolicy, int _bIsIdr, int _bIsReference, long long int _nLatencyUs)
+{
+        const RtmpPubDropConfig * pConfig = &_pPolicy->m_config;
+
+        if (_bIsIdr) {
+                _pPolicy->m_bSkipUntilIdr = 0;
+                return 0;
+        }
+        if (!pConfig->m_nLatencyBudgetMs)
+                return 0;
+        if (_pPolicy->m_bSkipUntilIdr) {
+                atomic_fetch_add_explicit(&_pPolicy->m_nDroppedGop, 1, memory_order_relaxed);
+                return 1;
+        }
+        if (_nLatencyUs > (long long int)pConfig->m_nGopDropLatencyMs * 1000) {
+                // 参考帧丢了之后本GOP剩下的帧都无法解码, 直接丢到下一个IDR
+                _pPolicy->m_bSkipUntilIdr = 1;
+                atomic_fetch_add_explicit(&_pPolicy->m_nGopSkips, 1, memory_order_relaxed);
+                atomic_fetch_add_explicit(&_pPolicy->m_nDroppedGop, 1, memory_order_relaxed);
+                return 1;
+        }
+        if (_nLatencyUs > (long long int)pConfig->m_nLatencyBudgetMs * 1000 && !_bIsReference) {
+                atomic_fetch_add_explicit(&_pPolicy->m_nDroppedNonRef, 1, memory_order_relaxed);
+                return 1;
+        }
+        return 0;
+}
+
+void RtmpPubDropPolicyGetStats(RtmpPubDropPolicy * _pPolicy, RtmpPubDropStats * _pStats)
+{
+        _pStats->m_nDroppedNonRef = atomic_load_explicit(&_pPolicy->m_nDroppedNonRef, memory_order_relaxed);
+        _pStats->m_nDroppedGop = atomic_load_explicit(&_pPolicy->m_nDroppedGop, memory_order_relaxed);
+        _pStats->m_nGopSkips = atomic_load_explicit(&_pPolicy->m_nGopSkips, memory_order_relaxed);
+}
+
+void RtmpPubDropPolicyLimitSocket(const RtmpPubDropPolicy * _pPolicy, int _nSocket)
+{
+        int nLowat = RTMP_PUB_DROP_NOTSENT_LOWAT;
+
+        if (!_pPolicy->m_config.m_nLatencyBudgetMs || _nSocket < 0)
+                return;
+        // 阻塞的send在没有发出去的数据低于nLowat之前不会返回, epoll也要到那时才报可写
+        setsockopt(_nSocket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &nLowat, sizeof(nLowat));
+}
@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rtmp_encoder_pool.h"
+#include "rtmp_transcode.h"
+#include "rtmp_publish_internal.h"
+#include "aac_encoder.h"
+
+struct RtmpPubEncoderPool {
+        pthread_t * m_pThreads;
+        unsigned int m_nWorkers;
+        unsigned int m_nStarted;
+        pthread_mutex_t m_lock;
+        pthread_cond_t m_work;                  // 有流等待编码
+        pthread_cond_t m_idle;                  // 某一路流处理完一批
+        RtmpPubEncoderStream * m_pHead;         // 等待编码的流, 先进先出
+        RtmpPubEncoderStream * m_pTail;
+        int m_bStop;
+        atomic_ullong m_nJobs;
+        atomic_ullong m_nFrames;
+        atomic_ullong m_nEncodeNs;
+        atomic_ullong m_nDropped;
+};
+
+struct RtmpPubEncoderStream {
+        RtmpPubEncoderPool * m_pPool;
+        RtmpPubEncoderStreamConfig m_config;
+        RtmpPubEncoderOutput m_output;
+        unsigned int m_nSampleBytes;            // 一个样本(所有声道)的输入字节数
+        unsigned int m_nJobBytes;
+        RtmpPubFrameRing m_jobs;
+
+        // 投递线程
+        RtmpPubBuffer * m_pPending;             // 还没攒够一个aac帧的输入
+        unsigned int m_nPendingPts;
+
+        // 编码线程, 同一时刻只有一个
+        void * m_pEncoder;
+        RtmpPubTranscoder m_transcoder;
+        int m_bConfigSent;
+
+        atomic_int m_bNotified;                 // 在等待列表里或者正在编码
+        RtmpPubEncoderStream * m_pNextRun;
+};
+
+// 调用时持有m_lock
+static void Append(RtmpPubEncoderPool * _pPool, RtmpPubEncoderStream * _pStream)
+{
+        _pStream->m_pNextRun = NULL;
+        if (_pPool->m_pTail)
+                _pPool->m_pTail->m_pNextRun = _pStream;
+        else
+                _pPool->m_pHead = _pStream;
+        _pPool->m_pTail = _pStream;
+}
+
+static void Notify(RtmpPubEncoderStream * _pStream)
+{
+        RtmpPubEncoderPool * pPool = _pStream->m_pPool;
+
+        // 已经在等待列表里, 或者编码线程处理完之后会重新检查队列
+        if (atomic_exchange(&_pStream->m_bNotified, 1))
+                return;
+        pthread_mutex_lock(&pPool->m_lock);
+        Append(pPool, _pStream);
+        pthread_cond_signal(&pPool->m_work);
+        pthread_mutex_unlock(&pPool->m_lock);
+}
+
+// 编码一个任务, 输出的每个adts帧去掉头之后单独交给m_pOnFrame
+static void EncodeJob(RtmpPubEncoderStream * _pStream, RtmpPubFrame * _pJob)
+{
+        RtmpPubEncoderPool * pPool = _pStream->m_pPool;
+        RtmpPubEncoderOutput * pOutput = &_pStream->m_output;
+        unsigned int nHeaderSize, nDurationMs, nPts = _pJob->m_nPts, nFrames = 0;
+        long long int nStart = RtmpPubNowNs();
+        char config[RTMP_PUB_AAC_CONFIG_SIZE];
+        const char * pOut, * pEnd;
+        int nOutSize, nFrameSize;
+        RtmpPubBuffer * pFrame;
+
+        nOutSize = RtmpPubEncodeAudio(&_pStream->m_transcoder, _pStream->m_pEncoder, _pStream->m_config.m_nInputType,
+                                      _pJob->m_pData, _pJob->m_nSize, &pOut);
+        atomic_fetch_add_explicit(&pPool->m_nEncodeNs, RtmpPubNowNs() - nStart, memory_order_relaxed);
+        atomic_fetch_add_explicit(&pPool->m_nJobs, 1, memory_order_relaxed);
+        if (nOutSize < 0)
+                return;
+        for (pEnd = pOut + nOutSize; pOut < pEnd; pOut += nFrameSize) {
+                nFrameSize = RtmpPubParseAdts(pOut, pEnd - pOut, &nHeaderSize, &nDurationMs);
+                if (nFrameSize < 0) {
+                        RtmpPubLog("bad adts frame");
+                        break;
+                }
+                // 配置投递失败时下一帧之前重试, 发送端没有配置时不会发送音频
+                if (!_pStream->m_bConfigSent) {
+                        RtmpPubAdtsToConfig(pOut, config);
+                        _pStream->m_bConfigSent = pOutput->m_pOnConfig(pOutput->m_pOpaque, config, sizeof(config), nPts) == 0;
+                }
+                if ((pFrame = RtmpPubBufferAlloc(nFrameSize - nHeaderSize)) != NULL) {
+                        memcpy(pFrame->m_pData, pOut + nHeaderSize, pFrame->m_nSize);
+                        pOutput->m_pOnFrame(pOutput->m_pOpaque, pFrame, nPts);
+                        RtmpPubBufferUnref(pFrame);
+                        nFrames++;
+                }
+                nPts += nDurationMs;
+        }
+        atomic_fetch_add_explicit(&pPool->m_nFrames, nFrames, memory_order_relaxed);
+}
+
+static void * WorkerThread(void * _pParam)
+{
+        RtmpPubEncoderPool * pPool = (RtmpPubEncoderPool *)_pParam;
+        RtmpPubEncoderStream * pStream;
+        RtmpPubFrame * pJob;
+        unsigned int i;
+
+        pthread_mutex_lock(&pPool->m_lock);
+        for (;;) {
+                while (!pPool->m_pHead && !pPool->m_bStop)
+                        pthread_cond_wait(&pPool->m_work, &pPool->m_lock);
+                if (!(pStream = pPool->m_pHead))
+                        break;
+                if (!(pPool->m_pHead = pStream->m_pNextRun))
+                        pPool->m_pTail = NULL;
+                pthread_mutex_unlock(&pPool->m_lock);
+
+                for (i = 0; i < RTMP_PUB_ENCODER_MAX_BATCH && (pJob = RtmpPubFrameRingPeek(&pStream->m_jobs)) != NULL; i++) {
+                        EncodeJob(pStream, pJob);
+                        RtmpPubFrameRingRelease(&pStream->m_jobs);
+                }
+
+                pthread_mutex_lock(&pPool->m_lock);
+                // 先清标记再检查队列, 期间投递的任务要么在这里看到, 要么由投递线程重新加入列表
+                atomic_store(&pStream->m_bNotified, 0);
+                if (RtmpPubFrameRingPeek(&pStream->m_jobs) && !atomic_exchange(&pStream->m_bNotified, 1))
+                        Append(pPool, pStream);
+                pthread_cond_broadcast(&pPool->m_idle);
+        }
+        pthread_mutex_unlock(&pPool->m_lock);
+        return NULL;
+}
+
+RtmpPubEncoderPool * RtmpPubEncoderPoolNew(unsigned int _nWorkers)
+{
+        RtmpPubEncoderPool * pPool;
+
+        if (!_nWorkers) {
+                long nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+                _nWorkers = nCpus > 0 ? nCpus : 1;
+        }
+        pPool = (RtmpPubEncoderPool *)calloc(1, sizeof(RtmpPubEncoderPool));
+        if (!pPool)
+                return NULL;
+        pPool->m_pThreads = (pthread_t *)calloc(_nWorkers, sizeof(pthread_t));
+        if (!pPool->m_pThreads) {
+                free(pPool);
+                return NULL;
+        }
+        pPool->m_nWorkers = _nWorkers;
+        pthread_mutex_init(&pPool->m_lock, NULL);
+        pthread_cond_init(&pPool->m_work, NULL);
+        pthread_cond_init(&pPool->m_idle, NULL);
+        atomic_init(&pPool->m_nJobs, 0);
+        atomic_init(&pPool->m_nFrames, 0);
+        atomic_init(&pPool->m_nEncodeNs, 0);
+        atomic_init(&pPool->m_nDropped, 0);
+        for (; pPool->m_nStarted < _nWorkers; pPool->m_nStarted++) {
+                if (pthread_create(&pPool->m_pThreads[pPool->m_nStarted], NULL, WorkerThread, pPool) != 0) {
+                        RtmpPubLog("create encoder thread err");
+                        RtmpPubEncoderPoolDel(pPool);
+                        return NULL;
+                }
+        }
+        return pPool;
+}
+
+void RtmpPubEncoderPoolDel(RtmpPubEncoderPool * _pPool)
+{
+        unsigned int i;
+
+        if (!_pPool)
+                return;
+        pthread_mutex_lock(&_pPool->m_lock);
+        _pPool->m_bStop = 1;
+        pthread_cond_broadcast(&_pPool->m_work);
+        pthread_mutex_unlock(&_pPool->m_lock);
+        for (i = 0; i < _pPool->m_nStarted; i++)
+                pthread_join(_pPool->m_pThreads[i], NULL);
+        pthread_mutex_destroy(&_pPool->m_lock);
+        pthread_cond_destroy(&_pPool->m_work);
+        pthread_cond_destroy(&_pPool->m_idle);
+        free(_pPool->m_pThreads);
+        free(_pPool);
+}
+
+unsigned int RtmpPubEncoderPoolGetWorkers(RtmpPubEncoderPool * _pPool)
+{
+        return _pPool->m_nWorkers;
+}
+
+void RtmpPubEncoderPoolGetStats(RtmpPubEncoderPool * _pPool, RtmpPubEncoderPoolStats * _pStats)
+{
+        _pStats->m_nJobs = atomic_load_explicit(&_pPool->m_nJobs, memory_order_relaxed);
+        _pStats->m_nFrames = atomic_load_explicit(&_pPool->m_nFrames, memory_order_relaxed);
+        _pStats->m_nEncodeNs = atomic_load_explicit(&_pPool->m_nEncodeNs, memory_order_relaxed);
+        _pStats->m_nDropped = atomic_load_explicit(&_pPool->m_nDropped, memory_order_relaxed);
+}
+
+RtmpPubEncoderStream * RtmpPubEncoderStreamNew(RtmpPubEncoderPool * _pPool, const RtmpPubEncoderStreamConfig * _pConfig,
+                                               const RtmpPubEncoderOutput * _pOutput)
+{
+        RtmpPubEncoderStream * pStream;
+        RtmpPubAudioType nType = _pConfig->m_nInputType;
+
+        if (nType != RTMP_PUB_AUDIO_G711A && nType != RTMP_PUB_AUDIO_G711U && nType != RTMP_PUB_AUDIO_PCM) {
+                RtmpPubLog("encoder pool only supports g711/pcm input");
+                return NULL;
+        }
+        pStream = (RtmpPubEncoderStream *)calloc(1, sizeof(RtmpPubEncoderStream));
+        if (!pStream)
+                return NULL;
+        pStream->m_pPool = _pPool;
+        pStream->m_config = *_pConfig;
+        if (!pStream->m_config.m_nSampleRate)
+                pStream->m_config.m_nSampleRate = RTMP_PUB_ENCODER_DEFAULT_RATE;
+        if (!pStream->m_config.m_nChannels)
+                pStream->m_config.m_nChannels = 1;
+        pStream->m_output = *_pOutput;
+        pStream->m_nSampleBytes = pStream->m_config.m_nChannels * (nType == RTMP_PUB_AUDIO_PCM ? 2 : 1);
+        pStream->m_nJobBytes = RTMP_PUB_ENCODER_FRAME_SAMPLES * pStream->m_nSampleBytes;
+        atomic_init(&pStream->m_bNotified, 0);
+        RtmpPubTranscoderInit(&pStream->m_transcoder);
+        if (RtmpPubFrameRingInit(&pStream->m_jobs, pStream->m_config.m_nJobSlots ? pStream->m_config.m_nJobSlots : 16) < 0)
+                goto err;
+        if (!(pStream->m_pEncoder = AacEncoderNew()))
+                goto err;
+        AacEncoderSetSampleRate(pStream->m_pEncoder, pStream->m_config.m_nSampleRate);
+        AacEncoderSetChannels(pStream->m_pEncoder, pStream->m_config.m_nChannels);
+        if (AacEncoderInit(pStream->m_pEncoder) < 0) {
+                RtmpPubLog("init aac encoder err, rate %u channels %u", pStream->m_config.m_nSampleRate,
+                           pStream->m_config.m_nChannels);
+                goto err;
+        }
+        return pStream;
+err:
+        RtmpPubEncoderStreamDel(pStream);
+        return NULL;
+}
+
+void RtmpPubEncoderStreamDel(RtmpPubEncoderStream * _pStream)
+{
+        RtmpPubEncoderPool * pPool;
+
+        if (!_pStream)
+                return;
+        pPool = _pStream->m_pPool;
+        pthread_mutex_lock(&pPool->m_lock);
+        while (atomic_load(&_pStream->m_bNotified))
+                pthread_cond_wait(&pPool->m_idle, &pPool->m_lock);
+        pthread_mutex_unlock(&pPool->m_lock);
+        RtmpPubBufferUnref(_pStream->m_pPending);
+        RtmpPubFrameRingDestroy(&_pStream->m_jobs);
+        RtmpPubTranscoderDestroy(&_pStream->m_transcoder);
+        if (_pStream->m_pEncoder)
+                AacEncoderDel(_pStream->m_pEncoder);
+        free(_pStream);
+}
+
+// 攒满的任务交给线程池, 队列满时丢弃
+static int Submit(RtmpPubEncoderStream * _pStream)
+{
+        RtmpPubFrame * pJob = RtmpPubFrameRingReserveBuffer(&_pStream->m_jobs, _pStream->m_pPending);
+
+        RtmpPubBufferUnref(_pStream->m_pPending);
+        _pStream->m_pPending = NULL;
+        if (!pJob) {
+                atomic_fetch_add_explicit(&_pStream->m_pPool->m_nDropped, 1, memory_order_relaxed);
+                return -1;
+        }
+        pJob->m_nType = RTMP_PUB_FRAME_AUDIO;
+        pJob->m_nPts = _pStream->m_nPendingPts;
+        RtmpPubFrameRingCommit(&_pStream->m_jobs);
+        Notify(_pStream);
+        return 0;
+}
+
+int RtmpPubEncoderStreamPush(RtmpPubEncoderStream * _pStream, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        RtmpPubBuffer * pPending;
+        unsigned int nCopy, nConsumed = 0;
+        int ret = 0;
+
+        while (nConsumed < _nSize) {
+                if (!(pPending = _pStream->m_pPending)) {
+                        if (!(pPending = RtmpPubBufferAlloc(_pStream->m_nJobBytes)))
+                                return -1;
+                        pPending->m_nSize = 0;
+                        _pStream->m_pPending = pPending;
+                        // 任务的时间戳是它第一个样本的时间
+                        _pStream->m_nPendingPts = _nPts + (unsigned long long)(nConsumed / _pStream->m_nSampleBytes) * 1000 /
+                                                  _pStream->m_config.m_nSampleRate;
+                }
+                nCopy = _pStream->m_nJobBytes - pPending->m_nSize;
+                if (nCopy > _nSize - nConsumed)
+                        nCopy = _nSize - nConsumed;
+                memcpy(pPending->m_pData + pPending->m_nSize, _pData + nConsumed, nCopy);
+                pPending->m_nSize += nCopy;
+                nConsumed += nCopy;
+                if (pPending->m_nSize == _pStream->m_nJobBytes && Submit(_pStream) < 0)
+                        ret = -1;
+        }
+        return ret;
+}
+
+void RtmpPubEncoderStreamGetStats(RtmpPubEncoderStream * _pStream, RtmpPubRingStats * _pStats)
+{
+        RtmpPubFrameRingGetStats(&_pStream->m_jobs, _pStats);
+}
+
+static int SessionConfig(void * _pOpaque, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return RtmpPubSessionPushAudioConfig((RtmpPubSession *)_pOpaque, _pData, _nSize, _nPts);
+}
+
+static int SessionFrame(void * _pOpaque, RtmpPubBuffer * _pFrame, unsigned int _nPts)
+{
+        return RtmpPubSessionPushAudioBuffer((RtmpPubSession *)_pOpaque, _pFrame, _nPts);
+}
+
+static int SenderConfig(void * _pOpaque, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return RtmpPubSenderPushAudioConfig((RtmpPubSender *)_pOpaque, _pData, _nSize, _nPts);
+}
+
+static int SenderFrame(void * _pOpaque, RtmpPubBuffer * _pFrame, unsigned int _nPts)
+{
+        return RtmpPubSenderPushAudioBuffer((RtmpPubSender *)_pOpaque, _pFrame, _nPts);
+}
+
+void RtmpPubEncoderOutputToSession(RtmpPubEncoderOutput * _pOutput, RtmpPubSession * _pSession)
+{
+        _pOutput->m_pOnConfig = SessionConfig;
+        _pOutput->m_pOnFrame = SessionFrame;
+        _pOutput->m_pOpaque = _pSession;
+}
+
+void RtmpPubEncoderOutputToSender(RtmpPubEncoderOutput * _pOutput, RtmpPubSender * _pSender)
+{
+        _pOutput->m_pOnConfig = SenderConfig;
+        _pOutput->m_pOnFrame = SenderFrame;
+        _pOutput->m_pOpaque = _pSender;
+}
@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "rtmp_engine_internal.h"
+#include "rtmp_publish_internal.h"
+
+#define RTMP_PUB_WORKER_MAX_EVENTS      64
+
+static void SwapTimer(RtmpPubWorker * _pWorker, unsigned int _nA, unsigned int _nB)
+{
+        RtmpPubSession * pSession = _pWorker->m_pTimers[_nA];
+
+        _pWorker->m_pTimers[_nA] = _pWorker->m_pTimers[_nB];
+        _pWorker->m_pTimers[_nB] = pSession;
+        _pWorker->m_pTimers[_nA]->m_nHeapIndex = _nA;
+        _pWorker->m_pTimers[_nB]->m_nHeapIndex = _nB;
+}
+
+static void SiftUp(RtmpPubWorker * _pWorker, unsigned int _nIndex)
+{
+        while (_nIndex > 0) {
+                unsigned int nParent = (_nIndex - 1) / 2;
+                if (_pWorker->m_pTimers[nParent]->m_nDeadline <= _pWorker->m_pTimers[_nIndex]->m_nDeadline)
+                        break;
+                SwapTimer(_pWorker, nParent, _nIndex);
+                _nIndex = nParent;
+        }
+}
+
+static void SiftDown(RtmpPubWorker * _pWorker, unsigned int _nIndex)
+{
+        for (;;) {
+                unsigned int nMin = _nIndex, nChild = _nIndex * 2 + 1;
+                if (nChild < _pWorker->m_nTimers &&
+                    _pWorker->m_pTimers[nChild]->m_nDeadline < _pWorker->m_pTimers[nMin]->m_nDeadline)
+                        nMin = nChild;
+                nChild++;
+                if (nChild < _pWorker->m_nTimers &&
+                    _pWorker->m_pTimers[nChild]->m_nDeadline < _pWorker->m_pTimers[nMin]->m_nDeadline)
+                        nMin = nChild;
+                if (nMin == _nIndex)
+                        break;
+                SwapTimer(_pWorker, nMin, _nIndex);
+                _nIndex = nMin;
+        }
+}
+
+void RtmpPubWorkerCancelTimer(RtmpPubSession * _pSession)
+{
+        RtmpPubWorker * pWorker = _pSession->m_pWorker;
+        unsigned int nIndex = _pSession->m_nHeapIndex;
+        RtmpPubSession * pMoved;
+
+        if (_pSession->m_nHeapIndex < 0)
+                return;
+        _pSession->m_nHeapIndex = -1;
+        if (nIndex == --pWorker->m_nTimers)
+                return;
+        // 用最后一个元素填补空位, 它可能需要上浮也可能需要下沉
+        pMoved = pWorker->m_pTimers[pWorker->m_nTimers];
+        pWorker->m_pTimers[nIndex] = pMoved;
+        pMoved->m_nHeapIndex = nIndex;
+        SiftUp(pWorker, nIndex);
+        SiftDown(pWorker, pMoved->m_nHeapIndex);
+}
+
+void RtmpPubWorkerSetTimer(RtmpPubSession * _pSession, long long int _nDeadline)
+{
+        RtmpPubWorker * pWorker = _pSession->m_pWorker;
+
+        RtmpPubWorkerCancelTimer(_pSession);
+        if (pWorker->m_nTimers == pWorker->m_nTimerCapacity) {
+                unsigned int nCapacity = pWorker->m_nTimerCapacity ? pWorker->m_nTimerCapacity * 2 : 64;
+                RtmpPubSession ** pTimers = (RtmpPubSession **)realloc(pWorker->m_pTimers, nCapacity * sizeof(RtmpPubSession *));
+                if (!pTimers) {
+                        RtmpPubLog("no memory for timer");
+                        return;
+                }
+                pWorker->m_pTimers = pTimers;
+                pWorker->m_nTimerCapacity = nCapacity;
+        }
+        _pSession->m_nDeadline = _nDeadline;
+        _pSession->m_nHeapIndex = pWorker->m_nTimers;
+        pWorker->m_pTimers[pWorker->m_nTimers++] = _pSession;
+        SiftUp(pWorker, _pSession->m_nHeapIndex);
+}
+
+int RtmpPubWorkerWatch(RtmpPubSession * _pSession, unsigned int _nEvents)
+{
+        struct epoll_event event;
+        int nOp = _pSession->m_nEvents ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+        if (_pSession->m_nEvents == _nEvents)
+                return 0;
+        event.events = _nEvents;
+        event.data.ptr = _pSession;
+        if (epoll_ctl(_pSession->m_pWorker->m_nEpoll, nOp, _pSession->m_nSocket, &event) < 0) {
+                RtmpPubLog("epoll_ctl err, errno = %d", errno);
+                return -1;
+        }
+        _pSession->m_nEvents = _nEvents;
+        return 0;
+}
+
+void RtmpPubWorkerNotify(RtmpPubSession * _pSession)
+{
+        RtmpPubWorker * pWorker = _pSession->m_pWorker;
+        RtmpPubSession * pHead;
+        uint64_t nOne = 1;
+
+        // 已经在待处理列表里了, worker取走之前会清掉标记
+        if (atomic_exchange(&_pSession->m_bNotified, 1))
+                return;
+        pHead = atomic_load_explicit(&pWorker->m_pNotifyHead, memory_order_relaxed);
+        do {
+                _pSession->m_pNextNotify = pHead;
+        } while (!atomic_compare_exchange_weak_explicit(&pWorker->m_pNotifyHead, &pHead, _pSession,
+                                                        memory_order_release, memory_order_relaxed));
+        // 列表原来为空时worker可能在睡眠
+        if (!pHead && write(pWorker->m_nEventFd, &nOne, sizeof(nOne)) < 0 && errno != EAGAIN)
+                RtmpPubLog("eventfd write err, errno = %d", errno);
+}
+
+/*
+ * 把session从worker上摘下来, 还没有被接管的session不在链表里
+ * 同一轮epoll_wait返回的事件里可能还有它, 先标记为关闭放进待释放列表, 这一轮处理完再由FreeClosed释放
+ */
+static void Detach(RtmpPubWorker * _pWorker, RtmpPubSession * _pSession)
+{
+        RtmpPubWorkerCancelTimer(_pSession);
+        if (_pSession->m_bAttached) {
+                if (_pSession->m_pPrev)
+                        _pSession->m_pPrev->m_pNext = _pSession->m_pNext;
+                else
+                        _pWorker->m_pSessions = _pSession->m_pNext;
+                if (_pSession->m_pNext)
+                        _pSession->m_pNext->m_pPrev = _pSession->m_pPrev;
+                _pSession->m_bAttached = 0;
+        }
+        atomic_store(&_pSession->m_nState, RTMP_PUB_SESSION_CLOSED);
+        _pSession->m_pPrev = NULL;
+        _pSession->m_pNext = _pWorker->m_pClosed;
+        _pWorker->m_pClosed = _pSession;
+}
+
+static void FreeClosed(RtmpPubWorker * _pWorker)
+{
+        RtmpPubSession * pSession;
+
+        while ((pSession = _pWorker->m_pClosed) != NULL) {
+                _pWorker->m_pClosed = pSession->m_pNext;
+                RtmpPubSessionFree(pSession);
+        }
+}
+
+static void HandleNotify(RtmpPubWorker * _pWorker)
+{
+        RtmpPubSession * pSession, * pNext;
+        uint64_t nCount;
+
+        if (read(_pWorker->m_nEventFd, &nCount, sizeof(nCount)) < 0 && errno != EAGAIN)
+                RtmpPubLog("eventfd read err, errno = %d", errno);
+        pSession = atomic_exchange_explicit(&_pWorker->m_pNotifyHead, NULL, memory_order_acquire);
+        for (; pSession; pSession = pNext) {
+                pNext = pSession->m_pNextNotify;
+                atomic_store(&pSession->m_bNotified, 0);
+                if (atomic_load(&pSession->m_bCloseRequested)) {
+                        Detach(_pWorker, pSession);
+                        continue;
+                }
+                if (!pSession->m_bAttached) {
+                        pSession->m_bAttached = 1;
+                        pSession->m_pPrev = NULL;
+                        pSession->m_pNext = _pWorker->m_pSessions;
+                        if (_pWorker->m_pSessions)
+                                _pWorker->m_pSessions->m_pPrev = pSession;
+                        _pWorker->m_pSessions = pSession;
+                        RtmpPubSessionOnStart(pSession);
+                        continue;
+                }
+                RtmpPubSessionOnNotify(pSession);
+        }
+}
+
+static int RunTimers(RtmpPubWorker * _pWorker)
+{
+        long long int nNow = RtmpPubNowUs();
+        RtmpPubSession * pSession;
+
+        while (_pWorker->m_nTimers && _pWorker->m_pTimers[0]->m_nDeadline <= nNow) {
+                pSession = _pWorker->m_pTimers[0];
+                RtmpPubWorkerCancelTimer(pSession);
+                RtmpPubSessionOnTimer(pSession);
+        }
+        if (!_pWorker->m_nTimers)
+                return -1;
+        // 向上取整到毫秒, 避免定时器还差不到1ms时空转
+        return (int)((_pWorker->m_pTimers[0]->m_nDeadline - nNow + 999) / 1000);
+}
+
+// 异步传输层完成的发送交回给各自的session, Wait/Cancel里顺带收到的也在这里处理
+static void HandleSendDone(RtmpPubWorker * _pWorker)
+{
+        RtmpPubTransportOp * pOp;
+
+        while ((pOp = RtmpPubTransportNextDone(_pWorker->m_pTransport)) != NULL)
+                RtmpPubSessionOnSendDone((RtmpPubSession *)pOp->m_pOwner);
+}
+
+static void * WorkerThread(void * _pParam)
+{
+        RtmpPubWorker * pWorker = (RtmpPubWorker *)_pParam;
+        struct epoll_event events[RTMP_PUB_WORKER_MAX_EVENTS];
+        int i, nEvents, nTimeout;
+
+        while (atomic_load(&pWorker->m_bRunning)) {
+                nTimeout = RunTimers(pWorker);
+                // 上一轮所有session排队的发送一次提交
+                HandleSendDone(pWorker);
+                RtmpPubTransportSubmit(pWorker->m_pTransport);
+                nEvents = epoll_wait(pWorker->m_nEpoll, events, RTMP_PUB_WORKER_MAX_EVENTS, nTimeout);
+                if (nEvents < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        RtmpPubLog("epoll_wait err, errno = %d", errno);
+                        break;
+                }
+                for (i = 0; i < nEvents; i++) {
+                        if (events[i].data.ptr == pWorker) {
+                                HandleNotify(pWorker);
+                        } else if (events[i].data.ptr == pWorker->m_pTransport) {
+                                RtmpPubTransportReap(pWorker->m_pTransport);
+                                HandleSendDone(pWorker);
+                        } else {
+                                RtmpPubSessionOnEvent((RtmpPubSession *)events[i].data.ptr, events[i].events);
+                        }
+                }
+                FreeClosed(pWorker);
+        }
+        return NULL;
+}
+
+static int InitWorker(RtmpPubEngine * _pEngine, RtmpPubWorker * _pWorker, unsigned int _nIndex)
+{
+        struct epoll_event event;
+
+        _pWorker->m_pEngine = _pEngine;
+        _pWorker->m_nIndex = _nIndex;
+        _pWorker->m_nEventFd = -1;
+        _pWorker->m_pTransport = RtmpPubSocketTransport();
+        atomic_init(&_pWorker->m_bRunning, 0);
+        atomic_init(&_pWorker->m_pNotifyHead, NULL);
+        _pWorker->m_nEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (_pWorker->m_nEpoll < 0)
+                return -1;
+        _pWorker->m_nEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_pWorker->m_nEventFd < 0)
+                return -1;
+        event.events = EPOLLIN;
+        event.data.ptr = _pWorker;
+        return epoll_ctl(_pWorker->m_nEpoll, EPOLL_CTL_ADD, _pWorker->m_nEventFd, &event);
+}
+
+RtmpPubEngine * RtmpPubEngineNew(unsigned int _nWorkers)
+{
+        RtmpPubEngine * pEngine;
+        unsigned int i;
+
+        if (!_nWorkers) {
+                long nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+                _nWorkers = nCpus > 0 ? nCpus : 1;
+        }
+        pEngine = (RtmpPubEngine *)calloc(1, sizeof(RtmpPubEngine));
+        if (!pEngine)
+                return NULL;
+        pEngine->m_pWorkers = (RtmpPubWorker *)calloc(_nWorkers, sizeof(RtmpPubWorker));
+        if (!pEngine->m_pWorkers) {
+                free(pEngine);
+                return NULL;
+        }
+        pEngine->m_nWorkers = _nWorkers;
+        atomic_init(&pEngine->m_nNextWorker, 0);
+        for (i = 0; i < _nWorkers; i++) {
+                pEngine->m_pWorkers[i].m_nEpoll = -1;
+                pEngine->m_pWorkers[i].m_nEventFd = -1;
+        }
+        for (i = 0; i < _nWorkers; i++) {
+                if (InitWorker(pEngine, &pEngine->m_pWorkers[i], i) < 0) {
+                        RtmpPubLog("init worker err, errno = %d", errno);
+                        RtmpPubEngineDel(pEngine);
+                        return NULL;
+                }
+        }
+        return pEngine;
+}
+
+void RtmpPubEngineSetTransport(RtmpPubEngine * _pEngine, RtmpPubTransportType _nType)
+{
+        _pEngine->m_nTransportType = _nType;
+}
+
+static int InitTransport(RtmpPubWorker * _pWorker)
+{
+        struct epoll_event event;
+        int nFd;
+
+        _pWorker->m_pTransport = RtmpPubTransportNew(_pWorker->m_pEngine->m_nTransportType, 1);
+        if ((nFd = RtmpPubTransportGetFd(_pWorker->m_pTransport)) < 0)
+                return 0;
+        event.events = EPOLLIN;
+        event.data.ptr = _pWorker->m_pTransport;
+        return epoll_ctl(_pWorker->m_nEpoll, EPOLL_CTL_ADD, nFd, &event);
+}
+
+int RtmpPubEngineStart(RtmpPubEngine * _pEngine)
+{
+        long nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned int i;
+
+        for (i = 0; i < _pEngine->m_nWorkers; i++) {
+                RtmpPubWorker * pWorker = &_pEngine->m_pWorkers[i];
+                cpu_set_t cpus;
+
+                if (InitTransport(pWorker) < 0) {
+                        RtmpPubLog("add transport to epoll err, errno = %d", errno);
+                        return -1;
+                }
+                atomic_store(&pWorker->m_bRunning, 1);
+                if (pthread_create(&pWorker->m_thread, NULL, WorkerThread, pWorker)) {
+                        atomic_store(&pWorker->m_bRunning, 0);
+                        return -1;
+                }
+                if (nCpus > 0) {
+                        CPU_ZERO(&cpus);
+                        CPU_SET(i % nCpus, &cpus);
+                        pthread_setaffinity_np(pWorker->m_thread, sizeof(cpus), &cpus);
+                }
+        }
+        return 0;
+}
+
+void RtmpPubEngineDel(RtmpPubEngine * _pEngine)
+{
+        RtmpPubSession * pSession;
+        unsigned int i;
+        uint64_t nOne = 1;
+
+        if (!_pEngine)
+                return;
+        for (i = 0; i < _pEngine->m_nWorkers; i++) {
+                RtmpPubWorker * pWorker = &_pEngine->m_pWorkers[i];
+
+                if (atomic_exchange(&pWorker->m_bRunning, 0)) {
+                        if (write(pWorker->m_nEventFd, &nOne, sizeof(nOne)) < 0)
+                                RtmpPubLog("eventfd write err, errno = %d", errno);
+                        pthread_join(pWorker->m_thread, NULL);
+                }
+                // 还没有被worker接管的session也在待处理列表里
+                pSession = atomic_exchange(&pWorker->m_pNotifyHead, NULL);
+                while (pSession) {
+                        RtmpPubSession * pNext = pSession->m_pNextNotify;
+                        if (!pSession->m_bAttached)
+                                RtmpPubSessionFree(pSession);
+                        pSession = pNext;
+                }
+                while (pWorker->m_pSessions)
+                        Detach(pWorker, pWorker->m_pSessions);
+                FreeClosed(pWorker);
+                // session释放时已经等它们的发送结束了
+                RtmpPubTransportDel(pWorker->m_pTransport);
+                free(pWorker->m_pTimers);
+                if (pWorker->m_nEventFd >= 0)
+                        close(pWorker->m_nEventFd);
+                if (pWorker->m_nEpoll >= 0)
+                        close(pWorker->m_nEpoll);
+        }
+        free(_pEngine->m_pWorkers);
+        free(_pEngine);
+}
+
+unsigned int RtmpPubEngineGetWorkers(RtmpPubEngine * _pEngine)
+{
+        return _pEngine->m_nWorkers;
+}
+
+const char * RtmpPubEngineGetTransport(RtmpPubEngine * _pEngine, RtmpPubTransportStats * _pStats)
+{
+        RtmpPubTransportStats stats;
+        unsigned int i;
+
+        memset(_pStats, 0, sizeof(*_pStats));
+        for (i = 0; i < _pEngine->m_nWorkers; i++) {
+                RtmpPubTransportGetStats(_pEngine->m_pWorkers[i].m_pTransport, &stats);
+                _pStats->m_nSends += stats.m_nSends;
+                _pStats->m_nSyscalls += stats.m_nSyscalls;
+                _pStats->m_nZeroCopy += stats.m_nZeroCopy;
+                _pStats->m_nZeroCopyCopied += stats.m_nZeroCopyCopied;
+        }
+        return _pEngine->m_pWorkers[0].m_pTransport->m_pName;
+}
@@ -0,0 +1,147 @@
+#ifndef __RTMP_ENGINE_INTERNAL__
+#define __RTMP_ENGINE_INTERNAL__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include "rtmp_engine.h"
+#include "rtmp_chunk_writer.h"
+#include "rtmp_chunk_reader.h"
+#include "rtmp_publish_nalu.h"
+#include "rtmp_transcode.h"
+#include "rtmp_amf_template.h"
+#include "rtmp_metadata.h"
+#include "rtmp_adts.h"
+
+#define RTMP_PUB_SESSION_MAX_BATCH      16
+
+typedef struct RtmpPubWorker RtmpPubWorker;
+
+struct RtmpPubSession {
+        RtmpPubWorker * m_pWorker;
+        RtmpPubSessionConfig m_config;
+        RtmpPubContext * m_pRtmp;
+        char * m_pUrl;
+        char * m_pTcUrl;
+        AVal m_app;
+        AVal m_playpath;
+        RtmpPubCommandSet m_commands;           // 预先编码好的connect/publish等命令
+        struct sockaddr_storage m_addr;
+        socklen_t m_nAddrLen;
+        int m_nSocket;
+        atomic_int m_nState;
+        unsigned int m_nEvents;                 // 当前注册到epoll的事件
+
+        // 接收
+        char * m_pRecv;
+        unsigned int m_nRecvSize;
+        unsigned int m_nRecvCapacity;
+        RtmpPubChunkReader m_reader;
+        char * m_pHandshake;                    // C0C1和C2
+        int m_bC2Queued;
+
+        // 建立连接的进度, 事务id为0表示命令还没发出
+        int m_nTransactionId;
+        int m_nConnectTransaction;
+        int m_nCreateStreamTransaction;
+        int m_nPublishTransaction;
+        int m_bConnectDone;
+        long long int m_nStartTime;             // 开始tcp连接的时间
+        RtmpPubConnectTiming m_timing;          // 正在进行的这次连接, 只在worker线程访问
+
+        // 发送, 只在worker线程访问
+        RtmpPubChunkWriter m_writer;
+        unsigned int m_nVideoInFlight;
+        unsigned int m_nAudioInFlight;
+        int m_bVideoTimebaseSet;
+        RtmpPubAvcParamState m_avc;
+        RtmpPubDropPolicy m_drop;
+        RtmpPubNaluSpan m_nalus[RTMP_PUB_MAX_TAG_NALUS];
+        RtmpPubMetrics m_metrics;
+        RtmpPubBuffer * m_pVideoConfig;         // 分发端发来的AVC sequence header
+        RtmpPubTranscoder m_transcoder;         // g711/pcm输入转aac
+        RtmpPubMetadata m_metadata;
+
+        // 断线重连
+        RtmpPubBackoff m_backoff;
+        RtmpPubGopCache m_cache;
+        RtmpPubGopCache m_replay;               // 正在重发的GOP
+        unsigned int m_nReplayNext;
+        unsigned int m_nReplayInFlight;
+        int m_bPublished;                       // 曾经推流成功过
+        int m_bWaitKey;                         // 音视频都从第一个视频关键帧开始发送
+
+        // 生产者 -> worker
+        RtmpPubFrameRing m_video;
+        RtmpPubFrameRing m_audio;
+        RtmpPubAdtsDemuxer m_adts;              // 只由音频投递线程访问
+        atomic_int m_bNotified;
+        atomic_int m_bCloseRequested;
+        struct RtmpPubSession * m_pNextNotify;
+
+        // worker的定时器堆和session链表
+        int m_bAttached;
+        long long int m_nDeadline;
+        int m_nHeapIndex;                       // -1表示没有定时器
+        struct RtmpPubSession * m_pPrev;
+        struct RtmpPubSession * m_pNext;
+
+        atomic_ullong m_nWritevCalls;
+        atomic_ullong m_nMessages;
+        atomic_ullong m_nBytes;
+        atomic_ullong m_nSendErrors;
+        atomic_ullong m_nReconnects;
+        // 进入PUBLISHING时把m_timing复制过来, 用seqlock保证其它线程读到的是同一次连接的各个阶段
+        atomic_uint m_nTimingSeq;
+        atomic_llong m_nPubResolveUs;
+        atomic_llong m_nPubTcpUs;
+        atomic_llong m_nPubHandshakeUs;
+        atomic_llong m_nPubConnectUs;
+        atomic_llong m_nPubCreateStreamUs;
+        atomic_llong m_nPubPublishUs;
+};
+
+struct RtmpPubWorker {
+        RtmpPubEngine * m_pEngine;
+        unsigned int m_nIndex;
+        int m_nEpoll;
+        int m_nEventFd;
+        pthread_t m_thread;
+        atomic_int m_bRunning;
+        _Atomic(RtmpPubSession *) m_pNotifyHead;        // 待处理的session, 多生产者入栈, worker整体取走
+        RtmpPubSession ** m_pTimers;                    // 按m_nDeadline的最小堆
+        unsigned int m_nTimers;
+        unsigned int m_nTimerCapacity;
+        RtmpPubSession * m_pSessions;
+        RtmpPubSession * m_pClosed;                     // 已经关闭, 这一轮事件处理完后释放
+        RtmpPubTransport * m_pTransport;                // 这个worker所有session共用
+};
+
+struct RtmpPubEngine {
+        RtmpPubWorker * m_pWorkers;
+        unsigned int m_nWorkers;
+        atomic_uint m_nNextWorker;
+        RtmpPubTransportType m_nTransportType;
+};
+
+// worker提供给session的接口, 只能在session所属的worker线程调用
+int RtmpPubWorkerWatch(RtmpPubSession * _pSession, unsigned int _nEvents);
+void RtmpPubWorkerSetTimer(RtmpPubSession * _pSession, long long int _nDeadline);
+void RtmpPubWorkerCancelTimer(RtmpPubSession * _pSession);
+// 任意线程调用, 让worker在下一轮处理这个session
+void RtmpPubWorkerNotify(RtmpPubSession * _pSession);
+
+// session的事件处理, 由worker线程调用
+void RtmpPubSessionOnStart(RtmpPubSession * _pSession);
+void RtmpPubSessionOnEvent(RtmpPubSession * _pSession, unsigned int _nEvents);
+void RtmpPubSessionOnNotify(RtmpPubSession * _pSession);
+void RtmpPubSessionOnTimer(RtmpPubSession * _pSession);
+// 异步传输层上的发送完成了
+void RtmpPubSessionOnSendDone(RtmpPubSession * _pSession);
+void RtmpPubSessionFree(RtmpPubSession * _pSession);
+
+// 分发端使用: 按类型投递到对应轨道的队列, 不拷贝, _bIsReference只对VIDEO_TAG有意义
+int RtmpPubSessionPushTag(RtmpPubSession * _pSession, RtmpPubFrameType _nType, RtmpPubBuffer * _pBuffer, unsigned int _nPts,
+                          int _bIsKey, int _bIsReference);
+
+#endif
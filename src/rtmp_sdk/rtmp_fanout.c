@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rtmp_fanout.h"
+#include "rtmp_engine_internal.h"
+#include "rtmp_publish_internal.h"
+
+struct RtmpPubFanout {
+        RtmpPubSession ** m_pSessions;
+        unsigned int m_nSessions;
+        // 目的地的队列满时配置可能没有投递成功, 记下来在下一帧之前补发
+        unsigned char * m_pVideoStale;
+        unsigned char * m_pAudioStale;
+        RtmpPubBuffer * m_pVideoConfig;         // AVC sequence header的tag body
+        RtmpPubBuffer * m_pAudioConfig;         // AudioSpecificConfig
+        RtmpPubAvcParamState m_params;          // 和session一样按哈希判断sps/pps是否变化
+        char m_sps[RTMP_PUB_FANOUT_MAX_PARAM_SET];
+        unsigned int m_nSps;
+        char m_pps[RTMP_PUB_FANOUT_MAX_PARAM_SET];
+        unsigned int m_nPps;
+        RtmpPubNaluSpan m_nalus[RTMP_PUB_MAX_TAG_NALUS];
+        RtmpPubAdtsDemuxer m_adts;
+};
+
+RtmpPubFanout * RtmpPubFanoutNew(RtmpPubEngine * _pEngine, const char * const * _pUrls, unsigned int _nCount,
+                                 const RtmpPubSessionConfig * _pConfig)
+{
+        RtmpPubFanout * pFanout = (RtmpPubFanout *)calloc(1, sizeof(RtmpPubFanout));
+        unsigned int i;
+
+        if (!pFanout)
+                return NULL;
+        pFanout->m_pSessions = (RtmpPubSession **)calloc(_nCount, sizeof(RtmpPubSession *));
+        pFanout->m_pVideoStale = (unsigned char *)calloc(_nCount, 1);
+        pFanout->m_pAudioStale = (unsigned char *)calloc(_nCount, 1);
+        if (!pFanout->m_pSessions || !pFanout->m_pVideoStale || !pFanout->m_pAudioStale)
+                goto err;
+        RtmpPubAdtsDemuxerInit(&pFanout->m_adts);
+        for (i = 0; i < _nCount; i++) {
+                pFanout->m_pSessions[i] = RtmpPubEngineAddSession(_pEngine, _pUrls[i], _pConfig);
+                if (!pFanout->m_pSessions[i]) {
+                        RtmpPubLog("fanout add session %s err", _pUrls[i]);
+                        goto err;
+                }
+                pFanout->m_nSessions++;
+        }
+        return pFanout;
+err:
+        RtmpPubFanoutDel(pFanout);
+        return NULL;
+}
+
+void RtmpPubFanoutDel(RtmpPubFanout * _pFanout)
+{
+        unsigned int i;
+
+        if (!_pFanout)
+                return;
+        for (i = 0; i < _pFanout->m_nSessions; i++)
+                RtmpPubEngineCloseSession(_pFanout->m_pSessions[i]);
+        RtmpPubBufferUnref(_pFanout->m_pVideoConfig);
+        RtmpPubBufferUnref(_pFanout->m_pAudioConfig);
+        free(_pFanout->m_pSessions);
+        free(_pFanout->m_pVideoStale);
+        free(_pFanout->m_pAudioStale);
+        free(_pFanout);
+}
+
+unsigned int RtmpPubFanoutGetCount(RtmpPubFanout * _pFanout)
+{
+        return _pFanout->m_nSessions;
+}
+
+RtmpPubSession * RtmpPubFanoutGetSession(RtmpPubFanout * _pFanout, unsigned int _nIndex)
+{
+        return _nIndex < _pFanout->m_nSessions ? _pFanout->m_pSessions[_nIndex] : NULL;
+}
+
+// 返回1表示参数集变了, 生成sequence header还要用到原始数据, 变化时保存一份
+static int UpdateParamSet(RtmpPubFanout * _pFanout, uint64_t * _pHash, char * _pDst, unsigned int * _pSize,
+                          const RtmpPubNaluSpan * _pNalu)
+{
+        if (_pNalu->m_nSize > RTMP_PUB_FANOUT_MAX_PARAM_SET) {
+                RtmpPubLog("parameter set too large: %u", _pNalu->m_nSize);
+                return -1;
+        }
+        if (!RtmpPubAvcParamSetUpdate(&_pFanout->m_params, _pHash, _pNalu))
+                return 0;
+        memcpy(_pDst, _pNalu->m_pData, _pNalu->m_nSize);
+        *_pSize = _pNalu->m_nSize;
+        return 1;
+}
+
+// sps/pps变化后重新生成sequence header, 所有目的地都要在下一帧之前收到它
+static int UpdateVideoConfig(RtmpPubFanout * _pFanout)
+{
+        RtmpPubNalUnit sps = { H264_NALU_SPS, _pFanout->m_sps, _pFanout->m_nSps };
+        RtmpPubNalUnit pps = { H264_NALU_PPS, _pFanout->m_pps, _pFanout->m_nPps };
+        unsigned int nSize = RtmpPubGetAvcRecordSize(&sps, &pps);
+        RtmpPubBuffer * pConfig;
+
+        if (!nSize)
+                return 0;
+        if (!(pConfig = RtmpPubBufferAlloc(nSize)))
+                return -1;
+        RtmpPubBuildAvcRecord(&sps, &pps, pConfig->m_pData);
+        RtmpPubBufferUnref(_pFanout->m_pVideoConfig);
+        _pFanout->m_pVideoConfig = pConfig;
+        memset(_pFanout->m_pVideoStale, 1, _pFanout->m_nSessions);
+        return 0;
+}
+
+// 先补发这个目的地缺的配置, 配置投递不进去时这一帧也不投递
+static int PushTo(RtmpPubFanout * _pFanout, unsigned int _nIndex, RtmpPubFrameType _nType, RtmpPubBuffer * _pBuffer,
+                  unsigned int _nPts, int _bIsKey, int _bIsReference)
+{
+        RtmpPubSession * pSession = _pFanout->m_pSessions[_nIndex];
+        int bAudio = _nType == RTMP_PUB_FRAME_AUDIO;
+        unsigned char * pStale = bAudio ? &_pFanout->m_pAudioStale[_nIndex] : &_pFanout->m_pVideoStale[_nIndex];
+
+        if (*pStale) {
+                if (RtmpPubSessionPushTag(pSession, bAudio ? RTMP_PUB_FRAME_AUDIO_CONFIG : RTMP_PUB_FRAME_VIDEO_CONFIG,
+                                          bAudio ? _pFanout->m_pAudioConfig : _pFanout->m_pVideoConfig, _nPts, 0, 0) < 0)
+                        return -1;
+                *pStale = 0;
+        }
+        return RtmpPubSessionPushTag(pSession, _nType, _pBuffer, _nPts, _bIsKey, _bIsReference);
+}
+
+int RtmpPubFanoutPushVideo(RtmpPubFanout * _pFanout, const char * _pData, unsigned int _nSize, unsigned int _nPts, int _bIsKey)
+{
+        RtmpPubNaluSpan * pNalus = _pFanout->m_nalus;
+        int i, nNalus, nVcl = 0, nChanged = 0, nPushed = 0, bIsKey = 0, bIsReference = 0, ret;
+        RtmpPubBuffer * pTag;
+        unsigned int j;
+
+        nNalus = RtmpPubAnnexbParseNalus(_pData, _nSize, pNalus, RTMP_PUB_MAX_TAG_NALUS);
+        if (nNalus < 0) {
+                RtmpPubLog("too many nalus in one frame");
+                return -1;
+        }
+        // 码流里的IDR是关键帧, 采集端标记的关键帧(比如带recovery point的帧)也当作关键帧
+        for (i = 0; i < nNalus; i++) {
+                switch (pNalus[i].m_nType) {
+                case H264_NALU_SPS:
+                        ret = UpdateParamSet(_pFanout, &_pFanout->m_params.m_nSpsHash, _pFanout->m_sps, &_pFanout->m_nSps,
+                                             &pNalus[i]);
+                        break;
+                case H264_NALU_PPS:
+                        ret = UpdateParamSet(_pFanout, &_pFanout->m_params.m_nPpsHash, _pFanout->m_pps, &_pFanout->m_nPps,
+                                             &pNalus[i]);
+                        break;
+                case H264_NALU_IDR:
+                        bIsKey = 1;
+                        bIsReference = 1;
+                        pNalus[nVcl++] = pNalus[i];
+                        continue;
+                case H264_NALU_SLICE:
+                        if (pNalus[i].m_pData[0] & 0x60)
+                                bIsReference = 1;
+                        pNalus[nVcl++] = pNalus[i];
+                        continue;
+                case H264_NALU_SEI:
+                        pNalus[nVcl++] = pNalus[i];
+                        continue;
+                default:
+                        continue;
+                }
+                if (ret < 0)
+                        return -1;
+                nChanged |= ret;
+        }
+        if (nChanged && UpdateVideoConfig(_pFanout) < 0)
+                return -1;
+        if (!nVcl)
+                return 0;
+        bIsKey = bIsKey || _bIsKey;
+        bIsReference = bIsReference || bIsKey;
+
+        // 转换和封装只做一次, 所有目的地共享
+        if (!(pTag = RtmpPubBufferAlloc(RtmpPubGetVideoTagSize(pNalus, nVcl))))
+                return -1;
+        RtmpPubBuildVideoTag(pNalus, nVcl, bIsKey, pTag->m_pData);
+        for (j = 0; j < _pFanout->m_nSessions; j++) {
+                if (PushTo(_pFanout, j, RTMP_PUB_FRAME_VIDEO_TAG, pTag, _nPts, bIsKey, bIsReference) == 0)
+                        nPushed++;
+        }
+        RtmpPubBufferUnref(pTag);
+        return nPushed;
+}
+
+int RtmpPubFanoutPushAudio(RtmpPubFanout * _pFanout, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        RtmpPubBuffer * pFrame = RtmpPubBufferAlloc(_nSize);
+        int nPushed = 0;
+        unsigned int i;
+
+        if (!pFrame)
+                return -1;
+        memcpy(pFrame->m_pData, _pData, _nSize);
+        for (i = 0; i < _pFanout->m_nSessions; i++) {
+                if (PushTo(_pFanout, i, RTMP_PUB_FRAME_AUDIO, pFrame, _nPts, 0, 0) == 0)
+                        nPushed++;
+        }
+        RtmpPubBufferUnref(pFrame);
+        return nPushed;
+}
+
+int RtmpPubFanoutPushAudioConfig(RtmpPubFanout * _pFanout, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        RtmpPubBuffer * pConfig = RtmpPubBufferAlloc(_nSize);
+        int nPushed = 0;
+        unsigned int i;
+
+        if (!pConfig)
+                return -1;
+        memcpy(pConfig->m_pData, _pData, _nSize);
+        RtmpPubBufferUnref(_pFanout->m_pAudioConfig);
+        _pFanout->m_pAudioConfig = pConfig;
+        for (i = 0; i < _pFanout->m_nSessions; i++) {
+                _pFanout->m_pAudioStale[i] = 1;
+                if (RtmpPubSessionPushTag(_pFanout->m_pSessions[i], RTMP_PUB_FRAME_AUDIO_CONFIG, pConfig, _nPts, 0, 0) == 0) {
+                        _pFanout->m_pAudioStale[i] = 0;
+                        nPushed++;
+                }
+        }
+        return nPushed;
+}
+
+static int OnAdtsConfig(void * _pOpaque, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return RtmpPubFanoutPushAudioConfig((RtmpPubFanout *)_pOpaque, _pData, _nSize, _nPts);
+}
+
+static int OnAdtsFrame(void * _pOpaque, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return RtmpPubFanoutPushAudio((RtmpPubFanout *)_pOpaque, _pData, _nSize, _nPts);
+}
+
+int RtmpPubFanoutPushAdts(RtmpPubFanout * _pFanout, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        RtmpPubAdtsOutput output = { OnAdtsConfig, OnAdtsFrame, _pFanout };
+
+        // 每个目的地的配置由m_pAudioStale补发, 这里只有分配失败才算投递失败
+        return RtmpPubAdtsDemuxerPush(&_pFanout->m_adts, _pData, _nSize, _nPts, &output);
+}
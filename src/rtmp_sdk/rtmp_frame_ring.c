@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rtmp_frame_ring.h"
+
+long long int RtmpPubNowUs(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long int)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int RtmpPubFrameRingInit(RtmpPubFrameRing * _pRing, unsigned int _nSlots)
+{
+        unsigned int nSlots = 2;
+
+        while (nSlots < _nSlots)
+                nSlots <<= 1;
+        memset(_pRing, 0, sizeof(*_pRing));
+        _pRing->m_pSlots = (RtmpPubFrame *)calloc(nSlots, sizeof(RtmpPubFrame));
+        if (!_pRing->m_pSlots)
+                return -1;
+        _pRing->m_nMask = nSlots - 1;
+        atomic_init(&_pRing->m_nHead, 0);
+        atomic_init(&_pRing->m_nTail, 0);
+        atomic_init(&_pRing->m_nHighWater, 0);
+        atomic_init(&_pRing->m_nPushed, 0);
+        atomic_init(&_pRing->m_nDropped, 0);
+        return 0;
+}
+
+void RtmpPubFrameRingDestroy(RtmpPubFrameRing * _pRing)
+{
+        unsigned int i;
+
+        if (!_pRing->m_pSlots)
+                return;
+        for (i = 0; i <= _pRing->m_nMask; i++)
+                RtmpPubBufferUnref(_pRing->m_pSlots[i].m_pBuffer);
+        free(_pRing->m_pSlots);
+        _pRing->m_pSlots = NULL;
+}
+
+static RtmpPubFrame * Claim(RtmpPubFrameRing * _pRing)
+{
+        unsigned int nHead = atomic_load_explicit(&_pRing->m_nHead, memory_order_relaxed);
+        unsigned int nTail = atomic_load_explicit(&_pRing->m_nTail, memory_order_acquire);
+        RtmpPubFrame * pFrame;
+
+        if (nHead - nTail > _pRing->m_nMask) {
+                atomic_fetch_add_explicit(&_pRing->m_nDropped, 1, memory_order_relaxed);
+                return NULL;
+        }
+        pFrame = &_pRing->m_pSlots[nHead & _pRing->m_nMask];
+        // 上一次Reserve之后没有Commit
+        RtmpPubBufferUnref(pFrame->m_pBuffer);
+        pFrame->m_pBuffer = NULL;
+        pFrame->m_bIsKey = 0;
+        pFrame->m_bIsReference = 0;
+        pFrame->m_nSliceFlags = 0;
+        pFrame->m_nEnqueueTime = RtmpPubNowUs();
+        return pFrame;
+}
+
+RtmpPubFrame * RtmpPubFrameRingReserve(RtmpPubFrameRing * _pRing, unsigned int _nSize)
+{
+        RtmpPubFrame * pFrame = Claim(_pRing);
+
+        if (!pFrame)
+                return NULL;
+        if (!(pFrame->m_pBuffer = RtmpPubBufferAlloc(_nSize))) {
+                atomic_fetch_add_explicit(&_pRing->m_nDropped, 1, memory_order_relaxed);
+                return NULL;
+        }
+        pFrame->m_pData = pFrame->m_pBuffer->m_pData;
+        pFrame->m_nSize = _nSize;
+        return pFrame;
+}
+
+RtmpPubFrame * RtmpPubFrameRingReserveBuffer(RtmpPubFrameRing * _pRing, RtmpPubBuffer * _pBuffer)
+{
+        RtmpPubFrame * pFrame = Claim(_pRing);
+
+        if (!pFrame)
+                return NULL;
+        RtmpPubBufferRef(_pBuffer);
+        pFrame->m_pBuffer = _pBuffer;
+        pFrame->m_pData = _pBuffer->m_pData;
+        pFrame->m_nSize = _pBuffer->m_nSize;
+        return pFrame;
+}
+
+void RtmpPubFrameRingCommit(RtmpPubFrameRing * _pRing)
+{
+        unsigned int nHead = atomic_load_explicit(&_pRing->m_nHead, memory_order_relaxed) + 1;
+        unsigned int nDepth = nHead - atomic_load_explicit(&_pRing->m_nTail, memory_order_relaxed);
+
+        atomic_store_explicit(&_pRing->m_nHead, nHead, memory_order_release);
+        atomic_fetch_add_explicit(&_pRing->m_nPushed, 1, memory_order_relaxed);
+        if (nDepth > atomic_load_explicit(&_pRing->m_nHighWater, memory_order_relaxed))
+                atomic_store_explicit(&_pRing->m_nHighWater, nDepth, memory_order_relaxed);
+}
+
+RtmpPubFrame * RtmpPubFrameRingPeekAt(RtmpPubFrameRing * _pRing, unsigned int _nIndex)
+{
+        unsigned int nTail = atomic_load_explicit(&_pRing->m_nTail, memory_order_relaxed);
+
+        if (atomic_load_explicit(&_pRing->m_nHead, memory_order_acquire) - nTail <= _nIndex)
+                return NULL;
+        return &_pRing->m_pSlots[(nTail + _nIndex) & _pRing->m_nMask];
+}
+
+RtmpPubFrame * RtmpPubFrameRingPeek(RtmpPubFrameRing * _pRing)
+{
+        return RtmpPubFrameRingPeekAt(_pRing, 0);
+}
+
+void RtmpPubFrameRingReleaseN(RtmpPubFrameRing * _pRing, unsigned int _nCount)
+{
+        unsigned int nTail = atomic_load_explicit(&_pRing->m_nTail, memory_order_relaxed);
+        RtmpPubFrame * pFrame;
+        unsigned int i;
+
+        for (i = 0; i < _nCount; i++) {
+                pFrame = &_pRing->m_pSlots[(nTail + i) & _pRing->m_nMask];
+                RtmpPubBufferUnref(pFrame->m_pBuffer);
+                pFrame->m_pBuffer = NULL;
+        }
+
+        atomic_store_explicit(&_pRing->m_nTail, nTail + _nCount, memory_order_release);
+}
+
+void RtmpPubFrameRingRelease(RtmpPubFrameRing * _pRing)
+{
+        RtmpPubFrameRingReleaseN(_pRing, 1);
+}
+
+void RtmpPubFrameRingGetStats(RtmpPubFrameRing * _pRing, RtmpPubRingStats * _pStats)
+{
+        _pStats->m_nDepth = atomic_load_explicit(&_pRing->m_nHead, memory_order_relaxed) -
+                            atomic_load_explicit(&_pRing->m_nTail, memory_order_relaxed);
+        _pStats->m_nHighWater = atomic_load_explicit(&_pRing->m_nHighWater, memory_order_relaxed);
+        _pStats->m_nPushed = atomic_load_explicit(&_pRing->m_nPushed, memory_order_relaxed);
+        _pStats->m_nDropped = atomic_load_explicit(&_pRing->m_nDropped, memory_order_relaxed);
+}
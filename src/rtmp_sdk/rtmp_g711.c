@@ -0,0 +1,248 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include "rtmp_transcode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RTMP_PUB_HAVE_X86_KERNELS
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#if defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#define RTMP_PUB_HAVE_NEON_KERNEL
+#endif
+
+/*
+ * g711展开: sdk里是逐个样本调用ALaw2Linear/ULaw2Linear, 多路转码时这是音频cpu的大头之一
+ * 标量版本查256项的表, 同时也是其它kernel的对照实现
+ * simd版本把段号(高3位)当作下标查16字节的小表得到1 << 段号, 再用一次16bit乘法代替移位,
+ * 所有kernel的结果和g711标准的参考实现逐个样本一致
+ */
+
+typedef void (*G711Kernel)(RtmpPubAudioType _nType, int16_t * _pOut, const uint8_t * _pIn, unsigned int _nSamples);
+
+static int16_t alawTable[256];
+static int16_t ulawTable[256];
+
+static int16_t Alaw2Linear(uint8_t _nVal)
+{
+        int t, seg;
+
+        _nVal ^= 0x55;
+        t = (_nVal & 0x0F) << 4;
+        seg = (_nVal & 0x70) >> 4;
+        if (seg == 0)
+                t += 8;
+        else
+                t = (t + 0x108) << (seg - 1);
+        return (int16_t)((_nVal & 0x80) ? t : -t);
+}
+
+static int16_t Ulaw2Linear(uint8_t _nVal)
+{
+        int t;
+
+        _nVal = ~_nVal;
+        t = (((_nVal & 0x0F) << 3) + 0x84) << ((_nVal & 0x70) >> 4);
+        return (int16_t)((_nVal & 0x80) ? (0x84 - t) : (t - 0x84));
+}
+
+static void DecodeScalar(RtmpPubAudioType _nType, int16_t * _pOut, const uint8_t * _pIn, unsigned int _nSamples)
+{
+        const int16_t * pTable = _nType == RTMP_PUB_AUDIO_G711A ? alawTable : ulawTable;
+        unsigned int i;
+
+        for (i = 0; i < _nSamples; i++)
+                _pOut[i] = pTable[_pIn[i]];
+}
+
+#ifdef RTMP_PUB_HAVE_X86_KERNELS
+// 8个样本(16bit lane)的尾数、乘数和符号掩码 -> pcm
+__attribute__((target("ssse3")))
+static __m128i ExpandSsse3(__m128i _mant, __m128i _mult, __m128i _neg, __m128i _bias, int _nMantShift)
+{
+        __m128i t = _mm_mullo_epi16(_mm_add_epi16(_mm_slli_epi16(_mant, _nMantShift), _bias), _mult);
+
+        return _mm_sub_epi16(_mm_xor_si128(t, _neg), _neg);
+}
+
+/*
+ * a律: t = ((mant << 4) + (seg ? 0x108 : 8)) << (seg ? seg - 1 : 0), 符号位为0时取负
+ * u律: t = ((mant << 3) + 0x84) << seg, 结果是t - 0x84, 取反后符号位为1时取负
+ * u律的-0x84放在取负之前做: (t - 0x84)取负等于0x84 - t
+ */
+__attribute__((target("ssse3")))
+static void DecodeSsse3(RtmpPubAudioType _nType, int16_t * _pOut, const uint8_t * _pIn, unsigned int _nSamples)
+{
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i low4 = _mm_set1_epi8(0x0F);
+        const __m128i low3 = _mm_set1_epi8(0x07);
+        const __m128i sign = _mm_set1_epi8((char)0x80);
+        const int bAlaw = _nType == RTMP_PUB_AUDIO_G711A;
+        const __m128i flip = bAlaw ? _mm_set1_epi8(0x55) : _mm_set1_epi8((char)0xFF);
+        const __m128i multTable = bAlaw ? _mm_setr_epi8(1, 1, 2, 4, 8, 16, 32, 64, 0, 0, 0, 0, 0, 0, 0, 0) :
+                                          _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0);
+        // a律段号不为0时偏置多0x100
+        const __m128i biasTable = bAlaw ? _mm_setr_epi8(0, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0) : zero;
+        const __m128i bias = bAlaw ? _mm_set1_epi16(8) : _mm_set1_epi16(0x84);
+        const __m128i ulawBias = _mm_set1_epi16(bAlaw ? 0 : 0x84);
+        const int nMantShift = bAlaw ? 4 : 3;
+        unsigned int i;
+
+        for (i = 0; i + 16 <= _nSamples; i += 16) {
+                __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(_pIn + i)), flip);
+                __m128i mant = _mm_and_si128(v, low4);
+                __m128i seg = _mm_and_si128(_mm_srli_epi16(v, 4), low3);
+                __m128i mult = _mm_shuffle_epi8(multTable, seg);
+                __m128i high = _mm_shuffle_epi8(biasTable, seg);
+                // a律符号位为0是负数, u律取反后符号位为1是负数
+                __m128i neg = _mm_cmpeq_epi8(_mm_and_si128(v, sign), bAlaw ? zero : sign);
+                __m128i lo, hi;
+
+                lo = ExpandSsse3(_mm_unpacklo_epi8(mant, zero), _mm_unpacklo_epi8(mult, zero),
+                                 _mm_unpacklo_epi8(neg, neg),
+                                 _mm_add_epi16(bias, _mm_unpacklo_epi8(zero, high)), nMantShift);
+                hi = ExpandSsse3(_mm_unpackhi_epi8(mant, zero), _mm_unpackhi_epi8(mult, zero),
+                                 _mm_unpackhi_epi8(neg, neg),
+                                 _mm_add_epi16(bias, _mm_unpackhi_epi8(zero, high)), nMantShift);
+                // u律: -(t) + 0x84 或 t - 0x84, 即取负之后再按符号加减0x84
+                lo = _mm_add_epi16(lo, _mm_sub_epi16(_mm_and_si128(_mm_unpacklo_epi8(neg, neg), ulawBias),
+                                                     _mm_andnot_si128(_mm_unpacklo_epi8(neg, neg), ulawBias)));
+                hi = _mm_add_epi16(hi, _mm_sub_epi16(_mm_and_si128(_mm_unpackhi_epi8(neg, neg), ulawBias),
+                                                     _mm_andnot_si128(_mm_unpackhi_epi8(neg, neg), ulawBias)));
+                _mm_storeu_si128((__m128i *)(_pOut + i), lo);
+                _mm_storeu_si128((__m128i *)(_pOut + i + 8), hi);
+        }
+        DecodeScalar(_nType, _pOut + i, _pIn + i, _nSamples - i);
+}
+#endif
+
+#ifdef RTMP_PUB_HAVE_NEON_KERNEL
+// 和ssse3版本一样, 用vtbl查1 << 段号, 一次8个样本
+static void DecodeNeon(RtmpPubAudioType _nType, int16_t * _pOut, const uint8_t * _pIn, unsigned int _nSamples)
+{
+        static const uint8_t alawMult[8] = { 1, 1, 2, 4, 8, 16, 32, 64 };
+        static const uint8_t ulawMult[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+        static const uint8_t alawHigh[8] = { 0, 1, 1, 1, 1, 1, 1, 1 };
+        const int bAlaw = _nType == RTMP_PUB_AUDIO_G711A;
+        const uint8x8_t flip = vdup_n_u8(bAlaw ? 0x55 : 0xFF);
+        const uint8x8_t multTable = vld1_u8(bAlaw ? alawMult : ulawMult);
+        const uint8x8_t highTable = bAlaw ? vld1_u8(alawHigh) : vdup_n_u8(0);
+        const uint16x8_t bias = vdupq_n_u16(bAlaw ? 8 : 0x84);
+        const int16x8_t ulawBias = vdupq_n_s16(bAlaw ? 0 : 0x84);
+        unsigned int i;
+
+        for (i = 0; i + 8 <= _nSamples; i += 8) {
+                uint8x8_t v = veor_u8(vld1_u8(_pIn + i), flip);
+                uint8x8_t mant = vand_u8(v, vdup_n_u8(0x0F));
+                uint8x8_t seg = vand_u8(vshr_n_u8(v, 4), vdup_n_u8(0x07));
+                uint16x8_t base = bAlaw ? vshll_n_u8(mant, 4) : vshll_n_u8(mant, 3);
+                uint16x8_t t;
+                int16x8_t neg, out;
+
+                base = vaddq_u16(vaddq_u16(base, bias), vshll_n_u8(vtbl1_u8(highTable, seg), 8));
+                t = vmulq_u16(base, vmovl_u8(vtbl1_u8(multTable, seg)));
+                // a律符号位为0是负数, u律取反后符号位为1是负数
+                neg = vmovl_s8(vreinterpret_s8_u8(bAlaw ? vceq_u8(vand_u8(v, vdup_n_u8(0x80)), vdup_n_u8(0)) :
+                                                          vtst_u8(v, vdup_n_u8(0x80))));
+                out = vsubq_s16(veorq_s16(vreinterpretq_s16_u16(t), neg), neg);
+                // u律的-0x84: 正数减, 负数加
+                out = vaddq_s16(out, vsubq_s16(vandq_s16(neg, ulawBias), vbicq_s16(ulawBias, neg)));
+                vst1q_s16(_pOut + i, out);
+        }
+        DecodeScalar(_nType, _pOut + i, _pIn + i, _nSamples - i);
+}
+#endif
+
+static const char * kernelNames[] = { "scalar", "ssse3", "neon" };
+static G711Kernel kernelFuncs[] = {
+        DecodeScalar,
+#ifdef RTMP_PUB_HAVE_X86_KERNELS
+        DecodeSsse3,
+#else
+        NULL,
+#endif
+#ifdef RTMP_PUB_HAVE_NEON_KERNEL
+        DecodeNeon,
+#else
+        NULL,
+#endif
+};
+
+// 编码池的worker和发送线程一直在读, 运行时可以切换, 都是relaxed读写, 每次调用只读一次函数指针
+static _Atomic(G711Kernel) decodeG711 = DecodeScalar;
+static _Atomic(RtmpPubG711Kernel) currentKernel = RTMP_PUB_G711_SCALAR;
+static pthread_once_t kernelOnce = PTHREAD_ONCE_INIT;
+
+static int KernelSupported(RtmpPubG711Kernel _nKernel)
+{
+        if (_nKernel < RTMP_PUB_G711_SCALAR || _nKernel > RTMP_PUB_G711_NEON || !kernelFuncs[_nKernel])
+                return 0;
+        switch (_nKernel) {
+#ifdef RTMP_PUB_HAVE_X86_KERNELS
+        case RTMP_PUB_G711_SSSE3:
+                return __builtin_cpu_supports("ssse3");
+#endif
+#ifdef RTMP_PUB_HAVE_NEON_KERNEL
+        case RTMP_PUB_G711_NEON:
+#if defined(__arm__)
+                return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+                return 1;
+#endif
+#endif
+        default:
+                return 1;
+        }
+}
+
+static void InitKernels(void)
+{
+        static const RtmpPubG711Kernel order[] = { RTMP_PUB_G711_NEON, RTMP_PUB_G711_SSSE3 };
+        unsigned int i;
+
+        for (i = 0; i < 256; i++) {
+                alawTable[i] = Alaw2Linear((uint8_t)i);
+                ulawTable[i] = Ulaw2Linear((uint8_t)i);
+        }
+        for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+                if (KernelSupported(order[i])) {
+                        atomic_store_explicit(&decodeG711, kernelFuncs[order[i]], memory_order_relaxed);
+                        atomic_store_explicit(&currentKernel, order[i], memory_order_relaxed);
+                        return;
+                }
+        }
+}
+
+int RtmpPubSelectG711Kernel(RtmpPubG711Kernel _nKernel)
+{
+        pthread_once(&kernelOnce, InitKernels);
+        if (!KernelSupported(_nKernel))
+                return -1;
+        atomic_store_explicit(&decodeG711, kernelFuncs[_nKernel], memory_order_relaxed);
+        atomic_store_explicit(&currentKernel, _nKernel, memory_order_relaxed);
+        return 0;
+}
+
+RtmpPubG711Kernel RtmpPubGetG711Kernel(void)
+{
+        pthread_once(&kernelOnce, InitKernels);
+        return atomic_load_explicit(&currentKernel, memory_order_relaxed);
+}
+
+const char * RtmpPubGetG711KernelName(RtmpPubG711Kernel _nKernel)
+{
+        if (_nKernel < RTMP_PUB_G711_SCALAR || _nKernel > RTMP_PUB_G711_NEON)
+                return "unknown";
+        return kernelNames[_nKernel];
+}
+
+void RtmpPubG711Decode(RtmpPubAudioType _nType, int16_t * _pOut, const uint8_t * _pIn, unsigned int _nSamples)
+{
+        pthread_once(&kernelOnce, InitKernels);
+        atomic_load_explicit(&decodeG711, memory_order_relaxed)(_nType, _pOut, _pIn, _nSamples);
+}
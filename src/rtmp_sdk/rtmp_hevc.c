@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rtmp_hevc.h"
+#include "rtmp_metadata.h"
+#include "rtmp_publish_internal.h"
+
+#define HEVC_RECORD_HEADER_SIZE         23
+#define HEVC_RECORD_ARRAY_HEADER_SIZE   5       // 类型, nalu个数, nalu长度
+#define HEVC_NALU_HEADER_SIZE           2
+
+void RtmpPubHevcParamsInit(RtmpPubHevcParams * _pParams)
+{
+        memset(_pParams, 0, sizeof(*_pParams));
+}
+
+void RtmpPubHevcParamsDestroy(RtmpPubHevcParams * _pParams)
+{
+        free(_pParams->m_vps.m_pData);
+        free(_pParams->m_sps.m_pData);
+        free(_pParams->m_pps.m_pData);
+        free(_pParams->m_pConfig);
+        memset(_pParams, 0, sizeof(*_pParams));
+}
+
+unsigned int RtmpPubGetHevcRecordSize(const RtmpPubNalUnit * _pVps, const RtmpPubNalUnit * _pSps, const RtmpPubNalUnit * _pPps)
+{
+        RtmpPubHevcSpsInfo info;
+
+        if (!_pVps->m_pData || !_pPps->m_pData || !_pSps->m_pData ||
+            RtmpPubParseHevcSps(_pSps->m_pData, _pSps->m_nSize, &info) < 0)
+                return 0;
+        return RTMP_PUB_FLV_VIDEO_HEADER_SIZE + HEVC_RECORD_HEADER_SIZE + 3 * HEVC_RECORD_ARRAY_HEADER_SIZE +
+               _pVps->m_nSize + _pSps->m_nSize + _pPps->m_nSize;
+}
+
+static char * WriteArray(char * _pOut, int _nType, const RtmpPubNalUnit * _pUnit)
+{
+        // array_completeness = 1: 参数集只在这里, 不会出现在码流中
+        *_pOut++ = (char)(0x80 | _nType);
+        *_pOut++ = 0;
+        *_pOut++ = 1;
+        *_pOut++ = (char)(_pUnit->m_nSize >> 8);
+        *_pOut++ = (char)_pUnit->m_nSize;
+        memcpy(_pOut, _pUnit->m_pData, _pUnit->m_nSize);
+        return _pOut + _pUnit->m_nSize;
+}
+
+int RtmpPubBuildHevcRecord(const RtmpPubNalUnit * _pVps, const RtmpPubNalUnit * _pSps, const RtmpPubNalUnit * _pPps,
+                           char * _pBody)
+{
+        RtmpPubHevcSpsInfo info;
+        char * pOut = _pBody;
+
+        if (!RtmpPubGetHevcRecordSize(_pVps, _pSps, _pPps))
+                return -1;
+        RtmpPubParseHevcSps(_pSps->m_pData, _pSps->m_nSize, &info);
+        *pOut++ = RTMP_PUB_FLV_EX_HEADER | RTMP_PUB_FLV_EX_KEY | RTMP_PUB_FLV_EX_SEQ_START;
+        memcpy(pOut, RTMP_PUB_FOURCC_HEVC, 4);
+        pOut += 4;
+        // HEVCDecoderConfigurationRecord, 保留位都是1
+        *pOut++ = 1;
+        *pOut++ = (char)((info.m_nProfileSpace << 6) | (info.m_nTier << 5) | info.m_nProfile);
+        RtmpPubWriteBe32(pOut, info.m_nCompatibility);
+        pOut += 4;
+        memcpy(pOut, info.m_constraints, sizeof(info.m_constraints));
+        pOut += sizeof(info.m_constraints);
+        *pOut++ = (char)info.m_nLevel;
+        *pOut++ = (char)0xF0;                           // min_spatial_segmentation_idc = 0
+        *pOut++ = 0;
+        *pOut++ = (char)0xFC;                           // parallelismType = 0, 未知
+        *pOut++ = (char)(0xFC | info.m_nChromaFormat);
+        *pOut++ = (char)(0xF8 | (info.m_nBitDepthLuma - 8));
+        *pOut++ = (char)(0xF8 | (info.m_nBitDepthChroma - 8));
+        *pOut++ = 0;                                    // avgFrameRate = 0, 未指定
+        *pOut++ = 0;
+        // constantFrameRate = 0, lengthSizeMinusOne = 3
+        *pOut++ = (char)(((info.m_nTemporalLayers & 0x07) << 3) | (info.m_bTemporalIdNested << 2) | 0x03);
+        *pOut++ = 3;
+        pOut = WriteArray(pOut, HEVC_NALU_VPS, _pVps);
+        pOut = WriteArray(pOut, HEVC_NALU_SPS, _pSps);
+        pOut = WriteArray(pOut, HEVC_NALU_PPS, _pPps);
+        return pOut - _pBody;
+}
+
+// 返回1表示参数集变了, 内存不足返回-1并保留旧的
+static int UpdateParam(RtmpPubNalUnit * _pUnit, const char * _pData, unsigned int _nSize)
+{
+        char * pData;
+
+        if (_pUnit->m_pData && _pUnit->m_nSize == _nSize && !memcmp(_pUnit->m_pData, _pData, _nSize))
+                return 0;
+        if (!(pData = (char *)realloc(_pUnit->m_pData, _nSize))) {
+                RtmpPubLog("no memory for hevc parameter set");
+                return -1;
+        }
+        memcpy(pData, _pData, _nSize);
+        _pUnit->m_pData = pData;
+        _pUnit->m_nSize = _nSize;
+        return 1;
+}
+
+static void SetParam(RtmpPubContext * _pRtmp, RtmpPubHevcParams * _pParams, int _nType, const RtmpPubNaluSpan * _pNalu)
+{
+        RtmpPubNalUnit * pUnit = _nType == HEVC_NALU_VPS ? &_pParams->m_vps : _nType == HEVC_NALU_SPS ? &_pParams->m_sps :
+                                 &_pParams->m_pps;
+        RtmpPubHevcSpsInfo info;
+        int bHadConfig = _pParams->m_vps.m_pData && _pParams->m_sps.m_pData && _pParams->m_pps.m_pData;
+
+        if (UpdateParam(pUnit, _pNalu->m_pData, _pNalu->m_nSize) <= 0)
+                return;
+        if (_nType == HEVC_NALU_SPS)
+                _pParams->m_nTemporalLayers = RtmpPubParseHevcSps(pUnit->m_pData, pUnit->m_nSize, &info) < 0 ? 0 :
+                                              info.m_nTemporalLayers;
+        if (bHadConfig)
+                _pParams->m_nChanges++;
+        _pParams->m_nConfig = 0;
+        _pRtmp->m_nIsVideoConfigSent = 0;
+}
+
+int RtmpPubPrepareHevcFrame(RtmpPubContext * _pRtmp, RtmpPubHevcParams * _pParams, char * _pData, unsigned int _nSize,
+                            RtmpPubAuFormat _nFormat, unsigned int _nPts, int _bInPlace, RtmpPubNaluSpan * _pNalus,
+                            unsigned int _nMaxNalus, int * _pTimebaseSet, int * _pIsKey, int * _pIsReference)
+{
+        int i, nNalus, nType, nVcl = 0;
+        unsigned int nTemporalIdPlus1;
+
+        *_pIsKey = 0;
+        *_pIsReference = 0;
+        nNalus = RtmpPubAccessUnitToNalus(_pData, _nSize, _nFormat, _bInPlace, _pNalus, _nMaxNalus);
+        if (nNalus < 0) {
+                RtmpPubLog("too many nalus in one frame or bad avcc length");
+                return -1;
+        }
+        for (i = 0; i < nNalus; i++) {
+                if (_pNalus[i].m_nSize < HEVC_NALU_HEADER_SIZE)
+                        continue;
+                nType = HEVC_NALU_TYPE((uint8_t)_pNalus[i].m_pData[0]);
+                _pNalus[i].m_nType = nType;
+                switch (nType) {
+                case HEVC_NALU_SPS:
+                        // 和avc一样, 时间基只在第一个sps时设置
+                        if (!*_pTimebaseSet) {
+                                RtmpPubSetVideoTimebase(_pRtmp, _nPts);
+                                *_pTimebaseSet = 1;
+                        }
+                        /* fall through */
+                case HEVC_NALU_VPS:
+                case HEVC_NALU_PPS:
+                        SetParam(_pRtmp, _pParams, nType, &_pNalus[i]);
+                        break;
+                case HEVC_NALU_SEI_PREFIX:
+                case HEVC_NALU_SEI_SUFFIX:
+                        _pNalus[nVcl++] = _pNalus[i];
+                        break;
+                default:
+                        if (nType > HEVC_NALU_VCL_MAX)
+                                break;
+                        if (nType >= HEVC_NALU_BLA_W_LP && nType <= HEVC_NALU_IRAP_MAX)
+                                *_pIsKey = 1;
+                        // 类型号为偶数的是sub-layer non-reference, 只有在最高时间层上才没有别的帧参考它
+                        nTemporalIdPlus1 = (uint8_t)_pNalus[i].m_pData[1] & 0x07;
+                        if (nType >= HEVC_NALU_BLA_W_LP || (nType & 1) || nTemporalIdPlus1 != _pParams->m_nTemporalLayers)
+                                *_pIsReference = 1;
+                        _pNalus[nVcl++] = _pNalus[i];
+                        break;
+                }
+        }
+        return nVcl;
+}
+
+static int WriteHevcConfig(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, RtmpPubHevcParams * _pParams,
+                           unsigned int _nPts)
+{
+        unsigned int nSize;
+        struct iovec iov;
+        uint32_t nStamp = 0;
+        uint8_t nHeaderType = 0;
+        char * pConfig;
+
+        if (!_pParams->m_nConfig) {
+                if (!(nSize = RtmpPubGetHevcRecordSize(&_pParams->m_vps, &_pParams->m_sps, &_pParams->m_pps)))
+                        return -1;
+                if (!(pConfig = (char *)realloc(_pParams->m_pConfig, nSize)))
+                        return -1;
+                _pParams->m_pConfig = pConfig;
+                _pParams->m_nConfig = RtmpPubBuildHevcRecord(&_pParams->m_vps, &_pParams->m_sps, &_pParams->m_pps, pConfig);
+        }
+        // 下一帧就可能改写m_pConfig, 发送队列里放一份拷贝
+        if (RtmpPubChunkWriterReserve(_pWriter, _pParams->m_nConfig) < 0)
+                return -1;
+        iov.iov_base = RtmpPubChunkWriterAlloc(_pWriter, _pParams->m_nConfig);
+        iov.iov_len = _pParams->m_nConfig;
+        memcpy(iov.iov_base, _pParams->m_pConfig, _pParams->m_nConfig);
+        RtmpPubGetVideoStamp(_pRtmp, _nPts, &nStamp, &nHeaderType);
+        return RtmpPubChunkWriterQueue(_pWriter, RTMP_PUB_MEDIA_CHANNEL, RTMP_PACKET_TYPE_VIDEO, nHeaderType, nStamp,
+                                       _pRtmp->m_pRtmp->m_stream_id, &iov, 1);
+}
+
+int RtmpPubWriteHevcNalus(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, RtmpPubHevcParams * _pParams,
+                          const RtmpPubNaluSpan * _pNalus, unsigned int _nCount, int _bIsKey, unsigned int _presentationTime)
+{
+        char header[RTMP_PUB_FLV_VIDEO_HEADER_SIZE];
+
+        if (!_nCount)
+                return 0;
+        if (_nCount > RTMP_PUB_MAX_TAG_NALUS)
+                return -1;
+        // 没有sequence header的关键帧播放端无法解码, 不发送
+        if (_bIsKey && !_pRtmp->m_nIsVideoConfigSent) {
+                if (WriteHevcConfig(_pWriter, _pRtmp, _pParams, _presentationTime) < 0) {
+                        RtmpPubLog("hevc sequence header not ready, vps/sps/pps missing or bad sps, skip key frame");
+                        return -1;
+                }
+                _pRtmp->m_nIsVideoConfigSent = 1;
+        }
+        header[0] = (char)(RTMP_PUB_FLV_EX_HEADER | (_bIsKey ? RTMP_PUB_FLV_EX_KEY : RTMP_PUB_FLV_EX_INTER) |
+                           RTMP_PUB_FLV_EX_CODED_FRAMES_X);
+        memcpy(header + 1, RTMP_PUB_FOURCC_HEVC, 4);
+        return RtmpPubQueueVideoNalus(_pWriter, _pRtmp, header, _pNalus, _nCount, _presentationTime);
+}
@@ -0,0 +1,179 @@
+#include <string.h>
+#include "rtmp_interleave.h"
+
+// 按队头时间戳排序, 相同时轨道序号小的在前
+static int Before(RtmpPubInterleaver * _pInterleaver, unsigned int _nA, unsigned int _nB)
+{
+        int nDiff = (int)(_pInterleaver->m_tracks[_nA].m_nDts - _pInterleaver->m_tracks[_nB].m_nDts);
+
+        return nDiff < 0 || (nDiff == 0 && _nA < _nB);
+}
+
+static void SwapHeap(RtmpPubInterleaver * _pInterleaver, unsigned int _nA, unsigned int _nB)
+{
+        unsigned int nTrack = _pInterleaver->m_heap[_nA];
+
+        _pInterleaver->m_heap[_nA] = _pInterleaver->m_heap[_nB];
+        _pInterleaver->m_heap[_nB] = nTrack;
+        _pInterleaver->m_tracks[_pInterleaver->m_heap[_nA]].m_nHeapIndex = _nA;
+        _pInterleaver->m_tracks[_pInterleaver->m_heap[_nB]].m_nHeapIndex = _nB;
+}
+
+static void SiftUp(RtmpPubInterleaver * _pInterleaver, unsigned int _nIndex)
+{
+        while (_nIndex > 0) {
+                unsigned int nParent = (_nIndex - 1) / 2;
+                if (!Before(_pInterleaver, _pInterleaver->m_heap[_nIndex], _pInterleaver->m_heap[nParent]))
+                        break;
+                SwapHeap(_pInterleaver, nParent, _nIndex);
+                _nIndex = nParent;
+        }
+}
+
+static void SiftDown(RtmpPubInterleaver * _pInterleaver, unsigned int _nIndex)
+{
+        for (;;) {
+                unsigned int nMin = _nIndex, nChild = _nIndex * 2 + 1;
+                if (nChild < _pInterleaver->m_nHeap && Before(_pInterleaver, _pInterleaver->m_heap[nChild], _pInterleaver->m_heap[nMin]))
+                        nMin = nChild;
+                nChild++;
+                if (nChild < _pInterleaver->m_nHeap && Before(_pInterleaver, _pInterleaver->m_heap[nChild], _pInterleaver->m_heap[nMin]))
+                        nMin = nChild;
+                if (nMin == _nIndex)
+                        break;
+                SwapHeap(_pInterleaver, nMin, _nIndex);
+                _nIndex = nMin;
+        }
+}
+
+void RtmpPubInterleaverInit(RtmpPubInterleaver * _pInterleaver, unsigned int _nTracks, const RtmpPubInterleaveConfig * _pConfig)
+{
+        unsigned int i;
+
+        memset(_pInterleaver, 0, sizeof(*_pInterleaver));
+        atomic_init(&_pInterleaver->m_nFrames, 0);
+        atomic_init(&_pInterleaver->m_nHeld, 0);
+        atomic_init(&_pInterleaver->m_nForced, 0);
+        atomic_init(&_pInterleaver->m_nLate, 0);
+        atomic_init(&_pInterleaver->m_nHoldUs, 0);
+        atomic_init(&_pInterleaver->m_nMaxHoldUs, 0);
+        if (_pConfig)
+                _pInterleaver->m_config = *_pConfig;
+        if (!_pInterleaver->m_config.m_nSilenceMs)
+                _pInterleaver->m_config.m_nSilenceMs = _pInterleaver->m_config.m_nWindowMs;
+        _pInterleaver->m_nTracks = _nTracks < RTMP_PUB_INTERLEAVE_MAX_TRACKS ? _nTracks : RTMP_PUB_INTERLEAVE_MAX_TRACKS;
+        for (i = 0; i < RTMP_PUB_INTERLEAVE_MAX_TRACKS; i++)
+                _pInterleaver->m_tracks[i].m_nHeapIndex = -1;
+}
+
+void RtmpPubInterleaverPush(RtmpPubInterleaver * _pInterleaver, unsigned int _nTrack, unsigned int _nDts, long long int _nArrivalUs)
+{
+        RtmpPubInterleaveTrack * pTrack;
+
+        if (_nTrack >= _pInterleaver->m_nTracks)
+                return;
+        pTrack = &_pInterleaver->m_tracks[_nTrack];
+        if (pTrack->m_bHasHead)
+                return;
+        // 轨道内的时间戳回退时不能越过同一轨道前面的帧, 按上一帧算
+        if (!pTrack->m_bSeen || (int)(_nDts - pTrack->m_nDts) > 0)
+                pTrack->m_nDts = _nDts;
+        pTrack->m_nArrivalUs = _nArrivalUs;
+        pTrack->m_bHasHead = 1;
+        pTrack->m_bSeen = 1;
+        pTrack->m_nHeapIndex = _pInterleaver->m_nHeap;
+        _pInterleaver->m_heap[_pInterleaver->m_nHeap++] = _nTrack;
+        SiftUp(_pInterleaver, pTrack->m_nHeapIndex);
+}
+
+int RtmpPubInterleaverNext(RtmpPubInterleaver * _pInterleaver, long long int _nNowUs, long long int * _pWaitUs)
+{
+        RtmpPubInterleaveTrack * pHead, * pTrack;
+        long long int nDeadline, nSilentAt, nLastSilentAt = 0;
+        unsigned int i, nTop;
+
+        *_pWaitUs = -1;
+        if (!_pInterleaver->m_nHeap)
+                return -1;
+        nTop = _pInterleaver->m_heap[0];
+        pHead = &_pInterleaver->m_tracks[nTop];
+        if (!_pInterleaver->m_config.m_nWindowMs)
+                return (int)nTop;
+        for (i = 0; i < _pInterleaver->m_nTracks; i++) {
+                pTrack = &_pInterleaver->m_tracks[i];
+                if (i == nTop || pTrack->m_bHasHead || !pTrack->m_bSeen)
+                        continue;
+                // 同一轨道时间戳单调, 它之后的帧不会比堆顶早
+                if ((int)(pTrack->m_nDts - pHead->m_nDts) >= 0)
+                        continue;
+                nSilentAt = pTrack->m_nArrivalUs + (long long int)_pInterleaver->m_config.m_nSilenceMs * 1000;
+                if (_nNowUs >= nSilentAt)
+                        continue;
+                if (nSilentAt > nLastSilentAt)
+                        nLastSilentAt = nSilentAt;
+        }
+        if (!nLastSilentAt)
+                return (int)nTop;
+        if (!pHead->m_bHeld) {
+                pHead->m_bHeld = 1;
+                pHead->m_nHeldSinceUs = _nNowUs;
+                atomic_fetch_add_explicit(&_pInterleaver->m_nHeld, 1, memory_order_relaxed);
+        }
+        nDeadline = pHead->m_nArrivalUs + (long long int)_pInterleaver->m_config.m_nWindowMs * 1000;
+        if (_nNowUs >= nDeadline) {
+                atomic_fetch_add_explicit(&_pInterleaver->m_nForced, 1, memory_order_relaxed);
+                return (int)nTop;
+        }
+        // 窗口到期, 或者等待的轨道全部静默
+        *_pWaitUs = (nDeadline < nLastSilentAt ? nDeadline : nLastSilentAt) - _nNowUs;
+        return -1;
+}
+
+unsigned long long RtmpPubInterleaverPop(RtmpPubInterleaver * _pInterleaver, unsigned int _nTrack, long long int _nNowUs)
+{
+        RtmpPubInterleaveTrack * pTrack;
+        unsigned int nIndex, nMoved;
+        unsigned long long nHoldUs = 0;
+
+        if (_nTrack >= _pInterleaver->m_nTracks)
+                return 0;
+        pTrack = &_pInterleaver->m_tracks[_nTrack];
+        if (!pTrack->m_bHasHead)
+                return 0;
+        nIndex = (unsigned int)pTrack->m_nHeapIndex;
+        pTrack->m_bHasHead = 0;
+        pTrack->m_nHeapIndex = -1;
+        // 用最后一个元素填补空位, 它可能需要上浮也可能需要下沉
+        if (nIndex != --_pInterleaver->m_nHeap) {
+                nMoved = _pInterleaver->m_heap[_pInterleaver->m_nHeap];
+                _pInterleaver->m_heap[nIndex] = nMoved;
+                _pInterleaver->m_tracks[nMoved].m_nHeapIndex = nIndex;
+                SiftUp(_pInterleaver, nIndex);
+                SiftDown(_pInterleaver, _pInterleaver->m_tracks[nMoved].m_nHeapIndex);
+        }
+        if (pTrack->m_bHeld) {
+                nHoldUs = _nNowUs > pTrack->m_nHeldSinceUs ? (unsigned long long)(_nNowUs - pTrack->m_nHeldSinceUs) : 0;
+                atomic_fetch_add_explicit(&_pInterleaver->m_nHoldUs, nHoldUs, memory_order_relaxed);
+                // 只有发送线程写, 不需要compare exchange
+                if (nHoldUs > atomic_load_explicit(&_pInterleaver->m_nMaxHoldUs, memory_order_relaxed))
+                        atomic_store_explicit(&_pInterleaver->m_nMaxHoldUs, nHoldUs, memory_order_relaxed);
+                pTrack->m_bHeld = 0;
+        }
+        if (_pInterleaver->m_bEmitted && (int)(pTrack->m_nDts - _pInterleaver->m_nLastDts) < 0)
+                atomic_fetch_add_explicit(&_pInterleaver->m_nLate, 1, memory_order_relaxed);
+        else
+                _pInterleaver->m_nLastDts = pTrack->m_nDts;
+        _pInterleaver->m_bEmitted = 1;
+        atomic_fetch_add_explicit(&_pInterleaver->m_nFrames, 1, memory_order_relaxed);
+        return nHoldUs;
+}
+
+void RtmpPubInterleaverGetStats(RtmpPubInterleaver * _pInterleaver, RtmpPubInterleaveStats * _pStats)
+{
+        _pStats->m_nFrames = atomic_load_explicit(&_pInterleaver->m_nFrames, memory_order_relaxed);
+        _pStats->m_nHeld = atomic_load_explicit(&_pInterleaver->m_nHeld, memory_order_relaxed);
+        _pStats->m_nForced = atomic_load_explicit(&_pInterleaver->m_nForced, memory_order_relaxed);
+        _pStats->m_nLate = atomic_load_explicit(&_pInterleaver->m_nLate, memory_order_relaxed);
+        _pStats->m_nHoldUs = atomic_load_explicit(&_pInterleaver->m_nHoldUs, memory_order_relaxed);
+        _pStats->m_nMaxHoldUs = atomic_load_explicit(&_pInterleaver->m_nMaxHoldUs, memory_order_relaxed);
+}
@@ -0,0 +1,422 @@
+#include <string.h>
+#include "rtmp_metadata.h"
+#include "rtmp_publish_internal.h"
+
+#define FLV_CODEC_AVC           7
+#define FLV_CODEC_HEVC          0x68766331      // FourCC 'hvc1'
+#define FLV_CODEC_G711A         7
+#define FLV_CODEC_G711U         8
+#define FLV_CODEC_AAC           10
+#define G711_SAMPLE_RATE        8000
+
+typedef struct {
+        const uint8_t * m_pData;
+        unsigned int m_nBits;
+        unsigned int m_nPos;
+        int m_bError;                   // 读过了结尾
+} BitReader;
+
+static const unsigned int sampleRates[] = {
+        96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+};
+
+static uint32_t ReadBits(BitReader * _pReader, unsigned int _nBits)
+{
+        uint32_t nValue = 0;
+
+        if (_pReader->m_nPos + _nBits > _pReader->m_nBits) {
+                _pReader->m_bError = 1;
+                _pReader->m_nPos = _pReader->m_nBits;
+                return 0;
+        }
+        while (_nBits--) {
+                nValue = (nValue << 1) | ((_pReader->m_pData[_pReader->m_nPos >> 3] >> (7 - (_pReader->m_nPos & 7))) & 1);
+                _pReader->m_nPos++;
+        }
+        return nValue;
+}
+
+// exp-Golomb, 超过32位的码字当作错误
+static uint32_t ReadUe(BitReader * _pReader)
+{
+        unsigned int nZeros = 0;
+
+        while (!ReadBits(_pReader, 1)) {
+                if (_pReader->m_bError || ++nZeros > 31) {
+                        _pReader->m_bError = 1;
+                        return 0;
+                }
+        }
+        return nZeros ? (1U << nZeros) - 1 + ReadBits(_pReader, nZeros) : 0;
+}
+
+static int32_t ReadSe(BitReader * _pReader)
+{
+        uint32_t nValue = ReadUe(_pReader);
+
+        return nValue & 1 ? (int32_t)((nValue + 1) / 2) : -(int32_t)(nValue / 2);
+}
+
+static void SkipScalingList(BitReader * _pReader, unsigned int _nSize)
+{
+        int nLast = 8, nNext = 8;
+        unsigned int i;
+
+        for (i = 0; i < _nSize && !_pReader->m_bError; i++) {
+                if (nNext)
+                        nNext = (nLast + ReadSe(_pReader) + 256) % 256;
+                if (nNext)
+                        nLast = nNext;
+        }
+}
+
+// 去掉防竞争字节00 00 03
+static unsigned int Unescape(const char * _pData, unsigned int _nSize, uint8_t * _pOut)
+{
+        const uint8_t * p = (const uint8_t *)_pData;
+        unsigned int i, nOut = 0, nZeros = 0;
+
+        for (i = 0; i < _nSize; i++) {
+                if (nZeros >= 2 && p[i] == 3) {
+                        nZeros = 0;
+                        continue;
+                }
+                nZeros = p[i] ? 0 : nZeros + 1;
+                _pOut[nOut++] = p[i];
+        }
+        return nOut;
+}
+
+static void ParseVuiTiming(BitReader * _pReader, RtmpPubSpsInfo * _pInfo)
+{
+        uint32_t nUnits, nScale;
+
+        if (ReadBits(_pReader, 1) && ReadBits(_pReader, 8) == 255)      // aspect_ratio_info, Extended_SAR
+                ReadBits(_pReader, 32);
+        if (ReadBits(_pReader, 1))                                      // overscan_info
+                ReadBits(_pReader, 1);
+        if (ReadBits(_pReader, 1)) {                                    // video_signal_type
+                ReadBits(_pReader, 4);
+                if (ReadBits(_pReader, 1))                              // colour_description
+                        ReadBits(_pReader, 24);
+        }
+        if (ReadBits(_pReader, 1)) {                                    // chroma_loc_info
+                ReadUe(_pReader);
+                ReadUe(_pReader);
+        }
+        if (!ReadBits(_pReader, 1))                                     // timing_info
+                return;
+        nUnits = ReadBits(_pReader, 32);
+        nScale = ReadBits(_pReader, 32);
+        // 一帧两场, 帧率是time_scale / (2 * num_units_in_tick)
+        if (!_pReader->m_bError && nUnits && nScale)
+                _pInfo->m_fFrameRate = (double)nScale / (2.0 * nUnits);
+}
+
+int RtmpPubParseSps(const char * _pData, unsigned int _nSize, RtmpPubSpsInfo * _pInfo)
+{
+        uint8_t sps[RTMP_PUB_META_MAX_SPS];
+        unsigned int nChroma = 1, nWidthMbs, nHeightMaps, bFrameMbsOnly, i, nCropX, nCropY;
+        unsigned int nLeft = 0, nRight = 0, nTop = 0, nBottom = 0;
+        BitReader reader;
+
+        memset(_pInfo, 0, sizeof(*_pInfo));
+        if (_nSize < 4 || _nSize > sizeof(sps) || (_pData[0] & 0x1F) != H264_NALU_SPS)
+                return -1;
+        reader.m_pData = sps;
+        reader.m_nBits = Unescape(_pData + 1, _nSize - 1, sps) * 8;
+        reader.m_nPos = 0;
+        reader.m_bError = 0;
+
+        _pInfo->m_nProfile = ReadBits(&reader, 8);
+        ReadBits(&reader, 8);                                           // constraint_set flags
+        _pInfo->m_nLevel = ReadBits(&reader, 8);
+        ReadUe(&reader);                                                // seq_parameter_set_id
+        switch (_pInfo->m_nProfile) {
+        case 100: case 110: case 122: case 244: case 44: case 83: case 86: case 118: case 128: case 138: case 139: case 134:
+        case 135:
+                if ((nChroma = ReadUe(&reader)) == 3)
+                        ReadBits(&reader, 1);                           // separate_colour_plane_flag
+                ReadUe(&reader);                                        // bit_depth_luma_minus8
+                ReadUe(&reader);                                        // bit_depth_chroma_minus8
+                ReadBits(&reader, 1);                                   // qpprime_y_zero_transform_bypass_flag
+                if (ReadBits(&reader, 1)) {                             // seq_scaling_matrix_present_flag
+                        for (i = 0; i < (nChroma != 3 ? 8U : 12U); i++) {
+                                if (ReadBits(&reader, 1))
+                                        SkipScalingList(&reader, i < 6 ? 16 : 64);
+                        }
+                }
+                break;
+        default:
+                break;
+        }
+        ReadUe(&reader);                                                // log2_max_frame_num_minus4
+        switch (ReadUe(&reader)) {                                      // pic_order_cnt_type
+        case 0:
+                ReadUe(&reader);                                        // log2_max_pic_order_cnt_lsb_minus4
+                break;
+        case 1:
+                ReadBits(&reader, 1);                                   // delta_pic_order_always_zero_flag
+                ReadSe(&reader);                                        // offset_for_non_ref_pic
+                ReadSe(&reader);                                        // offset_for_top_to_bottom_field
+                for (i = ReadUe(&reader); i > 0 && !reader.m_bError; i--)
+                        ReadSe(&reader);                                // offset_for_ref_frame
+                break;
+        default:
+                break;
+        }
+        ReadUe(&reader);                                                // max_num_ref_frames
+        ReadBits(&reader, 1);                                           // gaps_in_frame_num_value_allowed_flag
+        nWidthMbs = ReadUe(&reader) + 1;
+        nHeightMaps = ReadUe(&reader) + 1;
+        if (!(bFrameMbsOnly = ReadBits(&reader, 1)))
+                ReadBits(&reader, 1);                                   // mb_adaptive_frame_field_flag
+        ReadBits(&reader, 1);                                           // direct_8x8_inference_flag
+        if (ReadBits(&reader, 1)) {                                     // frame_cropping_flag
+                nLeft = ReadUe(&reader);
+                nRight = ReadUe(&reader);
+                nTop = ReadUe(&reader);
+                nBottom = ReadUe(&reader);
+        }
+        if (reader.m_bError || nChroma > 3)
+                return -1;
+        // 裁剪的单位: 4:2:0是2x2, 4:2:2是2x1, 4:4:4和黑白是1x1, 场编码时高度再乘2
+        nCropX = nChroma == 1 || nChroma == 2 ? 2 : 1;
+        nCropY = (nChroma == 1 ? 2 : 1) * (2 - bFrameMbsOnly);
+        // 裁掉的不能比编码尺寸还大, 否则宽高会下溢, 按64位算, 防止很大的ue值溢出
+        if (nCropX * ((unsigned long long)nLeft + nRight) >= nWidthMbs * 16ULL ||
+            nCropY * ((unsigned long long)nTop + nBottom) >= (2 - bFrameMbsOnly) * nHeightMaps * 16ULL)
+                return -1;
+        _pInfo->m_nWidth = nWidthMbs * 16 - nCropX * (nLeft + nRight);
+        _pInfo->m_nHeight = (2 - bFrameMbsOnly) * nHeightMaps * 16 - nCropY * (nTop + nBottom);
+        if (ReadBits(&reader, 1))                                       // vui_parameters_present_flag
+                ParseVuiTiming(&reader, _pInfo);
+        return 0;
+}
+
+int RtmpPubParseHevcSps(const char * _pData, unsigned int _nSize, RtmpPubHevcSpsInfo * _pInfo)
+{
+        uint8_t sps[RTMP_PUB_META_MAX_SPS];
+        unsigned int i, nSubLayers, nProfilePresent = 0, nLevelPresent = 0, nCropX, nCropY;
+        unsigned int nLeft = 0, nRight = 0, nTop = 0, nBottom = 0;
+        BitReader reader;
+
+        memset(_pInfo, 0, sizeof(*_pInfo));
+        if (_nSize < 16 || _nSize > sizeof(sps) || HEVC_NALU_TYPE((uint8_t)_pData[0]) != HEVC_NALU_SPS)
+                return -1;
+        reader.m_pData = sps;
+        reader.m_nBits = Unescape(_pData + 2, _nSize - 2, sps) * 8;
+        reader.m_nPos = 0;
+        reader.m_bError = 0;
+
+        ReadBits(&reader, 4);                                           // sps_video_parameter_set_id
+        nSubLayers = ReadBits(&reader, 3);                              // sps_max_sub_layers_minus1
+        _pInfo->m_nTemporalLayers = nSubLayers + 1;
+        _pInfo->m_bTemporalIdNested = ReadBits(&reader, 1);
+        // profile_tier_level, general部分正好字节对齐, 约束标志原样拷贝
+        _pInfo->m_nProfileSpace = ReadBits(&reader, 2);
+        _pInfo->m_nTier = ReadBits(&reader, 1);
+        _pInfo->m_nProfile = ReadBits(&reader, 5);
+        _pInfo->m_nCompatibility = ReadBits(&reader, 32);
+        for (i = 0; i < sizeof(_pInfo->m_constraints); i++)
+                _pInfo->m_constraints[i] = (uint8_t)ReadBits(&reader, 8);
+        _pInfo->m_nLevel = ReadBits(&reader, 8);
+        for (i = 0; i < nSubLayers; i++) {
+                nProfilePresent |= ReadBits(&reader, 1) << i;
+                nLevelPresent |= ReadBits(&reader, 1) << i;
+        }
+        if (nSubLayers > 0)
+                ReadBits(&reader, 2 * (8 - nSubLayers));                // reserved_zero_2bits
+        for (i = 0; i < nSubLayers; i++) {
+                if (nProfilePresent & (1U << i)) {
+                        ReadBits(&reader, 32);                          // sub_layer profile, 共88位
+                        ReadBits(&reader, 32);
+                        ReadBits(&reader, 24);
+                }
+                if (nLevelPresent & (1U << i))
+                        ReadBits(&reader, 8);
+        }
+        ReadUe(&reader);                                                // sps_seq_parameter_set_id
+        if ((_pInfo->m_nChromaFormat = ReadUe(&reader)) == 3)
+                ReadBits(&reader, 1);                                   // separate_colour_plane_flag
+        _pInfo->m_nWidth = ReadUe(&reader);
+        _pInfo->m_nHeight = ReadUe(&reader);
+        if (ReadBits(&reader, 1)) {                                     // conformance_window_flag
+                nLeft = ReadUe(&reader);
+                nRight = ReadUe(&reader);
+                nTop = ReadUe(&reader);
+                nBottom = ReadUe(&reader);
+        }
+        _pInfo->m_nBitDepthLuma = ReadUe(&reader) + 8;
+        _pInfo->m_nBitDepthChroma = ReadUe(&reader) + 8;
+        if (reader.m_bError || _pInfo->m_nChromaFormat > 3 || _pInfo->m_nBitDepthLuma > 16 || _pInfo->m_nBitDepthChroma > 16)
+                return -1;
+        // 裁剪的单位和avc一样按色度采样, 同样按64位比较
+        nCropX = _pInfo->m_nChromaFormat == 1 || _pInfo->m_nChromaFormat == 2 ? 2 : 1;
+        nCropY = _pInfo->m_nChromaFormat == 1 ? 2 : 1;
+        if (nCropX * ((unsigned long long)nLeft + nRight) >= _pInfo->m_nWidth ||
+            nCropY * ((unsigned long long)nTop + nBottom) >= _pInfo->m_nHeight)
+                return -1;
+        _pInfo->m_nWidth -= nCropX * (nLeft + nRight);
+        _pInfo->m_nHeight -= nCropY * (nTop + nBottom);
+        return 0;
+}
+
+int RtmpPubParseAacConfig(const char * _pData, unsigned int _nSize, RtmpPubAacInfo * _pInfo)
+{
+        BitReader reader = { (const uint8_t *)_pData, _nSize * 8, 0, 0 };
+        unsigned int nIndex;
+
+        memset(_pInfo, 0, sizeof(*_pInfo));
+        if ((_pInfo->m_nObjectType = ReadBits(&reader, 5)) == 31)
+                _pInfo->m_nObjectType = 32 + ReadBits(&reader, 6);
+        nIndex = ReadBits(&reader, 4);
+        _pInfo->m_nSampleRate = nIndex == 15 ? ReadBits(&reader, 24) :
+                                nIndex < sizeof(sampleRates) / sizeof(sampleRates[0]) ? sampleRates[nIndex] : 0;
+        _pInfo->m_nChannels = ReadBits(&reader, 4);
+        // 显式信令的SBR/PS, 播放器看到的是扩展后的采样率
+        if (_pInfo->m_nObjectType == 5 || _pInfo->m_nObjectType == 29) {
+                nIndex = ReadBits(&reader, 4);
+                _pInfo->m_nSampleRate = nIndex == 15 ? ReadBits(&reader, 24) :
+                                        nIndex < sizeof(sampleRates) / sizeof(sampleRates[0]) ? sampleRates[nIndex] : 0;
+        }
+        if (reader.m_bError || !_pInfo->m_nSampleRate)
+                return -1;
+        return 0;
+}
+
+void RtmpPubMetadataInit(RtmpPubMetadata * _pMeta)
+{
+        memset(_pMeta, 0, sizeof(*_pMeta));
+}
+
+void RtmpPubMetadataReset(RtmpPubMetadata * _pMeta)
+{
+        _pMeta->m_bSent = 0;
+}
+
+static void SetValue(RtmpPubMetadata * _pMeta, RtmpPubMetaField _nField, double _fValue)
+{
+        if (_pMeta->m_values[_nField] != _fValue) {
+                _pMeta->m_values[_nField] = _fValue;
+                _pMeta->m_bChanged = 1;
+        }
+}
+
+void RtmpPubMetadataSetSps(RtmpPubMetadata * _pMeta, const char * _pSps, unsigned int _nSize)
+{
+        RtmpPubSpsInfo info;
+
+        if (!_pSps || !_nSize || _nSize > sizeof(_pMeta->m_sps) ||
+            (_nSize == _pMeta->m_nSps && !memcmp(_pMeta->m_sps, _pSps, _nSize)))
+                return;
+        memcpy(_pMeta->m_sps, _pSps, _nSize);
+        _pMeta->m_nSps = _nSize;
+        if (RtmpPubParseSps(_pSps, _nSize, &info) < 0) {
+                RtmpPubLog("bad sps, size = %u", _nSize);
+                return;
+        }
+        _pMeta->m_bHasVideo = 1;
+        SetValue(_pMeta, RTMP_PUB_META_WIDTH, info.m_nWidth);
+        SetValue(_pMeta, RTMP_PUB_META_HEIGHT, info.m_nHeight);
+        SetValue(_pMeta, RTMP_PUB_META_FRAMERATE, info.m_fFrameRate);
+        SetValue(_pMeta, RTMP_PUB_META_VIDEO_CODECID, FLV_CODEC_AVC);
+}
+
+void RtmpPubMetadataSetHevcSps(RtmpPubMetadata * _pMeta, const char * _pSps, unsigned int _nSize)
+{
+        RtmpPubHevcSpsInfo info;
+
+        if (!_pSps || !_nSize || _nSize > sizeof(_pMeta->m_sps) ||
+            (_nSize == _pMeta->m_nSps && !memcmp(_pMeta->m_sps, _pSps, _nSize)))
+                return;
+        memcpy(_pMeta->m_sps, _pSps, _nSize);
+        _pMeta->m_nSps = _nSize;
+        if (RtmpPubParseHevcSps(_pSps, _nSize, &info) < 0) {
+                RtmpPubLog("bad hevc sps, size = %u", _nSize);
+                return;
+        }
+        _pMeta->m_bHasVideo = 1;
+        SetValue(_pMeta, RTMP_PUB_META_WIDTH, info.m_nWidth);
+        SetValue(_pMeta, RTMP_PUB_META_HEIGHT, info.m_nHeight);
+        SetValue(_pMeta, RTMP_PUB_META_FRAMERATE, 0);
+        SetValue(_pMeta, RTMP_PUB_META_VIDEO_CODECID, FLV_CODEC_HEVC);
+}
+
+void RtmpPubMetadataSetAvcConfig(RtmpPubMetadata * _pMeta, const char * _pBody, unsigned int _nSize)
+{
+        const uint8_t * p = (const uint8_t *)_pBody;
+        unsigned int nSps;
+
+        // 5字节flv视频头, 6字节AVCDecoderConfigurationRecord头, 2字节sps长度
+        if (_nSize < RTMP_PUB_FLV_VIDEO_HEADER_SIZE + 8 || !(p[RTMP_PUB_FLV_VIDEO_HEADER_SIZE + 5] & 0x1F))
+                return;
+        nSps = (p[RTMP_PUB_FLV_VIDEO_HEADER_SIZE + 6] << 8) | p[RTMP_PUB_FLV_VIDEO_HEADER_SIZE + 7];
+        if (nSps > _nSize - RTMP_PUB_FLV_VIDEO_HEADER_SIZE - 8)
+                return;
+        RtmpPubMetadataSetSps(_pMeta, _pBody + RTMP_PUB_FLV_VIDEO_HEADER_SIZE + 8, nSps);
+}
+
+void RtmpPubMetadataSetAac(RtmpPubMetadata * _pMeta, const char * _pConfig, unsigned int _nSize)
+{
+        RtmpPubAacInfo info;
+
+        if (!_pConfig || !_nSize || _nSize > sizeof(_pMeta->m_aac) ||
+            (_nSize == _pMeta->m_nAac && !memcmp(_pMeta->m_aac, _pConfig, _nSize)))
+                return;
+        memcpy(_pMeta->m_aac, _pConfig, _nSize);
+        _pMeta->m_nAac = _nSize;
+        if (RtmpPubParseAacConfig(_pConfig, _nSize, &info) < 0) {
+                RtmpPubLog("bad aac config, size = %u", _nSize);
+                return;
+        }
+        RtmpPubMetadataSetAudio(_pMeta, FLV_CODEC_AAC, info.m_nSampleRate, info.m_nChannels);
+}
+
+void RtmpPubMetadataSetAudio(RtmpPubMetadata * _pMeta, unsigned int _nCodecId, unsigned int _nSampleRate,
+                             unsigned int _nChannels)
+{
+        _pMeta->m_bHasAudio = 1;
+        SetValue(_pMeta, RTMP_PUB_META_AUDIO_CODECID, _nCodecId);
+        SetValue(_pMeta, RTMP_PUB_META_AUDIO_SAMPLERATE, _nSampleRate);
+        SetValue(_pMeta, RTMP_PUB_META_AUDIO_SAMPLESIZE, 16);
+        SetValue(_pMeta, RTMP_PUB_META_STEREO, _nChannels > 1);
+}
+
+void RtmpPubMetadataUpdate(RtmpPubMetadata * _pMeta, RtmpPubContext * _pRtmp)
+{
+        RtmpPubMetadataSetSps(_pMeta, _pRtmp->m_pSps.m_pData, _pRtmp->m_pSps.m_nSize);
+        switch (_pRtmp->m_nAudioOutputType) {
+        case RTMP_PUB_AUDIO_AAC:
+                RtmpPubMetadataSetAac(_pMeta, _pRtmp->m_aac.m_pData, _pRtmp->m_aac.m_nSize);
+                break;
+        case RTMP_PUB_AUDIO_G711A:
+                RtmpPubMetadataSetAudio(_pMeta, FLV_CODEC_G711A, G711_SAMPLE_RATE, 1);
+                break;
+        case RTMP_PUB_AUDIO_G711U:
+                RtmpPubMetadataSetAudio(_pMeta, FLV_CODEC_G711U, G711_SAMPLE_RATE, 1);
+                break;
+        default:
+                break;
+        }
+}
+
+int RtmpPubWriteMetadata(RtmpPubChunkWriter * _pWriter, RtmpPubMetadata * _pMeta, int32_t _nStreamId)
+{
+        unsigned int nSize = RtmpPubGetMetadataSize();
+        struct iovec iov;
+
+        if ((_pMeta->m_bSent && !_pMeta->m_bChanged) || (!_pMeta->m_bHasVideo && !_pMeta->m_bHasAudio))
+                return 0;
+        if (RtmpPubChunkWriterReserve(_pWriter, nSize) < 0)
+                return -1;
+        iov.iov_base = RtmpPubChunkWriterAlloc(_pWriter, nSize);
+        iov.iov_len = RtmpPubBuildMetadata(iov.iov_base, _pMeta->m_values);
+        // 单独的chunk stream, 不影响音视频的时间戳压缩
+        if (RtmpPubChunkWriterQueue(_pWriter, RTMP_PUB_DATA_CHANNEL, RTMP_PACKET_TYPE_INFO, RTMP_PACKET_SIZE_LARGE, 0,
+                                    _nStreamId, &iov, 1) < 0)
+                return -1;
+        _pMeta->m_bSent = 1;
+        _pMeta->m_bChanged = 0;
+        return 0;
+}
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "rtmp_metrics.h"
+
+#define SUB_BUCKETS     (1 << RTMP_PUB_HISTOGRAM_SUB_BITS)
+
+static const char * s_stageNames[RTMP_PUB_STAGE_COUNT] = { "convert", "queue", "interleave", "serialize", "send" };
+static const char * s_trackNames[RTMP_PUB_TRACK_COUNT] = { "video", "audio" };
+
+// prometheus直方图的le, 单位ns
+static const unsigned long long s_promBounds[] = {
+        10000ULL, 50000ULL, 100000ULL, 250000ULL, 500000ULL, 1000000ULL, 2500000ULL, 5000000ULL, 10000000ULL,
+        25000000ULL, 50000000ULL, 100000000ULL, 250000000ULL, 500000000ULL, 1000000000ULL, 2500000000ULL,
+};
+
+long long int RtmpPubNowNs(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long int)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned int BucketIndex(unsigned long long _nValue)
+{
+        int nMsb, nShift;
+
+        if (_nValue < SUB_BUCKETS)
+                return (unsigned int)_nValue;
+        nMsb = 63 - __builtin_clzll(_nValue);
+        if (nMsb >= RTMP_PUB_HISTOGRAM_MAX_BITS)
+                return RTMP_PUB_HISTOGRAM_BUCKETS - 1;
+        nShift = nMsb - RTMP_PUB_HISTOGRAM_SUB_BITS;
+        return ((nShift + 1) << RTMP_PUB_HISTOGRAM_SUB_BITS) + ((_nValue >> nShift) & (SUB_BUCKETS - 1));
+}
+
+// 桶里能放的最大值
+static unsigned long long BucketUpper(unsigned int _nIndex)
+{
+        int nShift;
+
+        if (_nIndex < SUB_BUCKETS)
+                return _nIndex;
+        nShift = (_nIndex >> RTMP_PUB_HISTOGRAM_SUB_BITS) - 1;
+        return (((unsigned long long)(SUB_BUCKETS + (_nIndex & (SUB_BUCKETS - 1))) + 1) << nShift) - 1;
+}
+
+void RtmpPubMetricsInit(RtmpPubMetrics * _pMetrics)
+{
+        memset(_pMetrics, 0, sizeof(*_pMetrics));
+}
+
+// 单写者: 普通的load+store就够了, 不需要fetch_add的总线锁
+#define SingleWriterAdd(_pCounter, _nDelta) \
+        atomic_store_explicit(_pCounter, atomic_load_explicit(_pCounter, memory_order_relaxed) + (_nDelta), memory_order_relaxed)
+
+void RtmpPubHistogramRecord(RtmpPubHistogram * _pHistogram, unsigned long long _nValue)
+{
+        SingleWriterAdd(&_pHistogram->m_nBuckets[BucketIndex(_nValue)], 1);
+        SingleWriterAdd(&_pHistogram->m_nSum, _nValue);
+        if (_nValue > atomic_load_explicit(&_pHistogram->m_nMax, memory_order_relaxed))
+                atomic_store_explicit(&_pHistogram->m_nMax, _nValue, memory_order_relaxed);
+}
+
+void RtmpPubMetricsAddFrame(RtmpPubMetrics * _pMetrics, RtmpPubTrack _nTrack, unsigned int _nBytes)
+{
+        SingleWriterAdd(&_pMetrics->m_tracks[_nTrack].m_nFrames, 1);
+        SingleWriterAdd(&_pMetrics->m_tracks[_nTrack].m_nBytes, _nBytes);
+}
+
+void RtmpPubMetricsAddDrop(RtmpPubMetrics * _pMetrics, RtmpPubTrack _nTrack)
+{
+        SingleWriterAdd(&_pMetrics->m_tracks[_nTrack].m_nDropped, 1);
+}
+
+void RtmpPubMetricsGetSnapshot(RtmpPubMetrics * _pMetrics, RtmpPubMetricsSnapshot * _pSnapshot)
+{
+        int i, j;
+
+        memset(_pSnapshot, 0, sizeof(*_pSnapshot));
+        for (i = 0; i < RTMP_PUB_STAGE_COUNT; i++) {
+                RtmpPubHistogram * pSrc = &_pMetrics->m_stages[i];
+                RtmpPubHistogramSnapshot * pDst = &_pSnapshot->m_stages[i];
+
+                // 总数按桶累加, 和桶保持一致
+                for (j = 0; j < RTMP_PUB_HISTOGRAM_BUCKETS; j++) {
+                        pDst->m_nBuckets[j] = atomic_load_explicit(&pSrc->m_nBuckets[j], memory_order_relaxed);
+                        pDst->m_nCount += pDst->m_nBuckets[j];
+                }
+                pDst->m_nSum = atomic_load_explicit(&pSrc->m_nSum, memory_order_relaxed);
+                pDst->m_nMax = atomic_load_explicit(&pSrc->m_nMax, memory_order_relaxed);
+        }
+        for (i = 0; i < RTMP_PUB_TRACK_COUNT; i++) {
+                _pSnapshot->m_tracks[i].m_nFrames = atomic_load_explicit(&_pMetrics->m_tracks[i].m_nFrames, memory_order_relaxed);
+                _pSnapshot->m_tracks[i].m_nBytes = atomic_load_explicit(&_pMetrics->m_tracks[i].m_nBytes, memory_order_relaxed);
+                _pSnapshot->m_tracks[i].m_nDropped = atomic_load_explicit(&_pMetrics->m_tracks[i].m_nDropped, memory_order_relaxed);
+        }
+}
+
+void RtmpPubMetricsMerge(RtmpPubMetricsSnapshot * _pDst, const RtmpPubMetricsSnapshot * _pSrc)
+{
+        int i, j;
+
+        for (i = 0; i < RTMP_PUB_STAGE_COUNT; i++) {
+                RtmpPubHistogramSnapshot * pDst = &_pDst->m_stages[i];
+                const RtmpPubHistogramSnapshot * pSrc = &_pSrc->m_stages[i];
+
+                for (j = 0; j < RTMP_PUB_HISTOGRAM_BUCKETS; j++)
+                        pDst->m_nBuckets[j] += pSrc->m_nBuckets[j];
+                pDst->m_nCount += pSrc->m_nCount;
+                pDst->m_nSum += pSrc->m_nSum;
+                if (pSrc->m_nMax > pDst->m_nMax)
+                        pDst->m_nMax = pSrc->m_nMax;
+        }
+        for (i = 0; i < RTMP_PUB_TRACK_COUNT; i++) {
+                _pDst->m_tracks[i].m_nFrames += _pSrc->m_tracks[i].m_nFrames;
+                _pDst->m_tracks[i].m_nBytes += _pSrc->m_tracks[i].m_nBytes;
+                _pDst->m_tracks[i].m_nDropped += _pSrc->m_tracks[i].m_nDropped;
+        }
+        _pDst->m_nReconnects += _pSrc->m_nReconnects;
+        _pDst->m_nSendErrors += _pSrc->m_nSendErrors;
+}
+
+unsigned long long RtmpPubHistogramPercentile(const RtmpPubHistogramSnapshot * _pHistogram, double _fPercentile)
+{
+        unsigned long long nRank, nSeen = 0, nUpper;
+        int i;
+
+        if (!_pHistogram->m_nCount)
+                return 0;
+        nRank = (unsigned long long)(_pHistogram->m_nCount * _fPercentile / 100.0 + 0.5);
+        if (nRank < 1)
+                nRank = 1;
+        for (i = 0; i < RTMP_PUB_HISTOGRAM_BUCKETS; i++) {
+                nSeen += _pHistogram->m_nBuckets[i];
+                if (nSeen >= nRank)
+                        break;
+        }
+        nUpper = BucketUpper(i < RTMP_PUB_HISTOGRAM_BUCKETS ? i : RTMP_PUB_HISTOGRAM_BUCKETS - 1);
+        return nUpper < _pHistogram->m_nMax ? nUpper : _pHistogram->m_nMax;
+}
+
+typedef struct {
+        char * m_pBuf;
+        unsigned int m_nSize;
+        unsigned int m_nUsed;
+        int m_bOverflow;
+} Output;
+
+static void Append(Output * _pOut, const char * _pFmt, ...)
+{
+        va_list ap;
+        int n;
+
+        if (_pOut->m_bOverflow)
+                return;
+        va_start(ap, _pFmt);
+        n = vsnprintf(_pOut->m_pBuf + _pOut->m_nUsed, _pOut->m_nSize - _pOut->m_nUsed, _pFmt, ap);
+        va_end(ap);
+        if (n < 0 || (unsigned int)n >= _pOut->m_nSize - _pOut->m_nUsed) {
+                _pOut->m_bOverflow = 1;
+                return;
+        }
+        _pOut->m_nUsed += n;
+}
+
+static void DumpText(Output * _pOut, const RtmpPubMetricsSnapshot * _pSnapshot, const char * _pName)
+{
+        const RtmpPubTrackSnapshot * pVideo = &_pSnapshot->m_tracks[RTMP_PUB_TRACK_VIDEO];
+        const RtmpPubTrackSnapshot * pAudio = &_pSnapshot->m_tracks[RTMP_PUB_TRACK_AUDIO];
+        int i;
+
+        Append(_pOut, "%s: video frames:%llu bytes:%llu dropped:%llu, audio frames:%llu bytes:%llu dropped:%llu, "
+               "reconnects:%llu send errors:%llu\n", _pName, pVideo->m_nFrames, pVideo->m_nBytes, pVideo->m_nDropped,
+               pAudio->m_nFrames, pAudio->m_nBytes, pAudio->m_nDropped, _pSnapshot->m_nReconnects, _pSnapshot->m_nSendErrors);
+        for (i = 0; i < RTMP_PUB_STAGE_COUNT; i++) {
+                const RtmpPubHistogramSnapshot * pHistogram = &_pSnapshot->m_stages[i];
+
+                Append(_pOut, "  %-9s count:%llu avg:%.1fus p50:%.1fus p99:%.1fus p999:%.1fus max:%.1fus\n",
+                       s_stageNames[i], pHistogram->m_nCount,
+                       pHistogram->m_nCount ? pHistogram->m_nSum / 1000.0 / pHistogram->m_nCount : 0.0,
+                       RtmpPubHistogramPercentile(pHistogram, 50) / 1000.0, RtmpPubHistogramPercentile(pHistogram, 99) / 1000.0,
+                       RtmpPubHistogramPercentile(pHistogram, 99.9) / 1000.0, pHistogram->m_nMax / 1000.0);
+        }
+}
+
+static void DumpPromHistograms(Output * _pOut, const RtmpPubMetricsSnapshot * _pSnapshot, const char * _pName)
+{
+        unsigned int i, j, nBucket;
+
+        for (i = 0; i < RTMP_PUB_STAGE_COUNT; i++) {
+                const RtmpPubHistogramSnapshot * pHistogram = &_pSnapshot->m_stages[i];
+                unsigned long long nCumulative = 0;
+
+                nBucket = 0;
+                for (j = 0; j < sizeof(s_promBounds) / sizeof(s_promBounds[0]); j++) {
+                        for (; nBucket < RTMP_PUB_HISTOGRAM_BUCKETS && BucketUpper(nBucket) <= s_promBounds[j]; nBucket++)
+                                nCumulative += pHistogram->m_nBuckets[nBucket];
+                        Append(_pOut, "rtmp_pub_stage_latency_seconds_bucket{stream=\"%s\",stage=\"%s\",le=\"%g\"} %llu\n",
+                               _pName, s_stageNames[i], s_promBounds[j] / 1e9, nCumulative);
+                }
+                Append(_pOut, "rtmp_pub_stage_latency_seconds_bucket{stream=\"%s\",stage=\"%s\",le=\"+Inf\"} %llu\n",
+                       _pName, s_stageNames[i], pHistogram->m_nCount);
+                Append(_pOut, "rtmp_pub_stage_latency_seconds_sum{stream=\"%s\",stage=\"%s\"} %.9f\n",
+                       _pName, s_stageNames[i], pHistogram->m_nSum / 1e9);
+                Append(_pOut, "rtmp_pub_stage_latency_seconds_count{stream=\"%s\",stage=\"%s\"} %llu\n",
+                       _pName, s_stageNames[i], pHistogram->m_nCount);
+        }
+}
+
+// 同一个指标的所有样本要放在一起, 所以按指标循环各路
+static void DumpPrometheus(Output * _pOut, const RtmpPubMetricsSnapshot * _pSnapshots, const char * const * _pNames,
+                           unsigned int _nCount)
+{
+        static const char * trackMetrics[] = { "frames", "bytes", "dropped_frames" };
+        unsigned int i, j, k;
+
+        Append(_pOut, "# HELP rtmp_pub_stage_latency_seconds Time a frame spends in each publishing stage.\n");
+        Append(_pOut, "# TYPE rtmp_pub_stage_latency_seconds histogram\n");
+        for (i = 0; i < _nCount; i++)
+                DumpPromHistograms(_pOut, &_pSnapshots[i], _pNames[i]);
+        for (k = 0; k < sizeof(trackMetrics) / sizeof(trackMetrics[0]); k++) {
+                Append(_pOut, "# TYPE rtmp_pub_%s_total counter\n", trackMetrics[k]);
+                for (i = 0; i < _nCount; i++) {
+                        for (j = 0; j < RTMP_PUB_TRACK_COUNT; j++) {
+                                const RtmpPubTrackSnapshot * pTrack = &_pSnapshots[i].m_tracks[j];
+                                unsigned long long nValue = k == 0 ? pTrack->m_nFrames : k == 1 ? pTrack->m_nBytes : pTrack->m_nDropped;
+
+                                Append(_pOut, "rtmp_pub_%s_total{stream=\"%s\",track=\"%s\"} %llu\n",
+                                       trackMetrics[k], _pNames[i], s_trackNames[j], nValue);
+                        }
+                }
+        }
+        Append(_pOut, "# TYPE rtmp_pub_reconnects_total counter\n");
+        for (i = 0; i < _nCount; i++)
+                Append(_pOut, "rtmp_pub_reconnects_total{stream=\"%s\"} %llu\n", _pNames[i], _pSnapshots[i].m_nReconnects);
+        Append(_pOut, "# TYPE rtmp_pub_send_errors_total counter\n");
+        for (i = 0; i < _nCount; i++)
+                Append(_pOut, "rtmp_pub_send_errors_total{stream=\"%s\"} %llu\n", _pNames[i], _pSnapshots[i].m_nSendErrors);
+}
+
+int RtmpPubMetricsDump(RtmpPubMetricsFormat _nFormat, const RtmpPubMetricsSnapshot * _pSnapshots, const char * const * _pNames,
+                       unsigned int _nCount, char * _pBuf, unsigned int _nSize)
+{
+        Output out = { _pBuf, _nSize, 0, 0 };
+        unsigned int i;
+
+        if (!_nSize)
+                return -1;
+        _pBuf[0] = 0;
+        if (_nFormat == RTMP_PUB_METRICS_PROMETHEUS) {
+                DumpPrometheus(&out, _pSnapshots, _pNames, _nCount);
+        } else {
+                for (i = 0; i < _nCount; i++)
+                        DumpText(&out, &_pSnapshots[i], _pNames[i]);
+        }
+        return out.m_bOverflow ? -1 : (int)out.m_nUsed;
+}
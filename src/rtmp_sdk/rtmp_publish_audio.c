@@ -0,0 +1,79 @@
+#include <string.h>
+#include "rtmp_publish_audio.h"
+#include "rtmp_publish_internal.h"
+
+static int WriteAudioTag(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, char _nAacType, const char * _pData,
+                         unsigned int _nSize, unsigned int _nPts)
+{
+        struct iovec iov[2];
+        uint32_t nStamp = 0;
+        uint8_t nHeaderType = 0;
+        char * pHeader;
+
+        if (RtmpPubChunkWriterReserve(_pWriter, RTMP_PUB_FLV_AUDIO_HEADER_SIZE) < 0)
+                return -1;
+        pHeader = RtmpPubChunkWriterAlloc(_pWriter, RTMP_PUB_FLV_AUDIO_HEADER_SIZE);
+        pHeader[0] = (char)RTMP_PUB_FLV_AAC_HEADER;
+        pHeader[1] = _nAacType;
+        iov[0].iov_base = pHeader;
+        iov[0].iov_len = RTMP_PUB_FLV_AUDIO_HEADER_SIZE;
+        iov[1].iov_base = (void *)_pData;
+        iov[1].iov_len = _nSize;
+
+        RtmpPubGetAudioStamp(_pRtmp, _nPts, &nStamp, &nHeaderType);
+        return RtmpPubChunkWriterQueue(_pWriter, RTMP_PUB_MEDIA_CHANNEL, RTMP_PACKET_TYPE_AUDIO, nHeaderType, nStamp,
+                                       _pRtmp->m_pRtmp->m_stream_id, iov, 2);
+}
+
+void RtmpPubUpdateAac(RtmpPubContext * _pRtmp, const char * _pData, unsigned int _nSize)
+{
+        if (_pRtmp->m_aac.m_pData && _pRtmp->m_aac.m_nSize == _nSize && !memcmp(_pRtmp->m_aac.m_pData, _pData, _nSize))
+                return;
+        RtmpPubSetAac(_pRtmp, _pData, _nSize);
+        _pRtmp->m_nIsAudioConfigSent = 0;
+}
+
+static int WriteAacConfig(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, unsigned int _nPts)
+{
+        if (_pRtmp->m_nIsAudioConfigSent)
+                return 0;
+        if (!_pRtmp->m_aac.m_pData || _pRtmp->m_aac.m_nSize < 2)
+                return -1;
+        if (WriteAudioTag(_pWriter, _pRtmp, RTMP_PUB_FLV_AAC_SEQ_HEADER, _pRtmp->m_aac.m_pData, _pRtmp->m_aac.m_nSize, _nPts) < 0)
+                return -1;
+        _pRtmp->m_nIsAudioConfigSent = 1;
+        return 0;
+}
+
+int RtmpPubWriteAacFrame(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, const char * _pData, unsigned int _nSize,
+                         unsigned int _presentationTime)
+{
+        if (WriteAacConfig(_pWriter, _pRtmp, _presentationTime) < 0)
+                return -1;
+        return WriteAudioTag(_pWriter, _pRtmp, RTMP_PUB_FLV_AAC_RAW, _pData, _nSize, _presentationTime);
+}
+
+int RtmpPubWriteAacFrameCopy(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, const char * _pData, unsigned int _nSize,
+                             unsigned int _presentationTime)
+{
+        uint32_t nStamp = 0;
+        uint8_t nHeaderType = 0;
+        struct iovec iov;
+        char * pBody;
+
+        if (WriteAacConfig(_pWriter, _pRtmp, _presentationTime) < 0)
+                return -1;
+        // 头和数据放在一起, 一个iovec
+        if (RtmpPubChunkWriterReserve(_pWriter, RTMP_PUB_FLV_AUDIO_HEADER_SIZE + _nSize) < 0)
+                return -1;
+        pBody = RtmpPubChunkWriterAlloc(_pWriter, RTMP_PUB_FLV_AUDIO_HEADER_SIZE + _nSize);
+        pBody[0] = (char)RTMP_PUB_FLV_AAC_HEADER;
+        pBody[1] = RTMP_PUB_FLV_AAC_RAW;
+        memcpy(pBody + RTMP_PUB_FLV_AUDIO_HEADER_SIZE, _pData, _nSize);
+        iov.iov_base = pBody;
+        iov.iov_len = RTMP_PUB_FLV_AUDIO_HEADER_SIZE + _nSize;
+
+        RtmpPubGetAudioStamp(_pRtmp, _presentationTime, &nStamp, &nHeaderType);
+        return RtmpPubChunkWriterQueue(_pWriter, RTMP_PUB_MEDIA_CHANNEL, RTMP_PACKET_TYPE_AUDIO, nHeaderType, nStamp,
+                                       _pRtmp->m_pRtmp->m_stream_id, &iov, 1);
+}
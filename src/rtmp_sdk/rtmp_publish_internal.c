@@ -0,0 +1,152 @@
+#include <string.h>
+#include "rtmp_publish_internal.h"
+
+// 与sdk内部的GetInfoRelative一致: 音视频共用一条时间轴
+static void GetStampRelative(RtmpPubContext * _pRtmp, unsigned int _nPts, uint32_t * _pStamp, uint8_t * _pHeaderType)
+{
+        long long int nPts = _nPts;
+        long long int nDelta;
+
+        if (nPts < _pRtmp->m_nLastMediaTimeStamp) {
+                nPts = _pRtmp->m_nLastMediaTimeStamp;
+                _pRtmp->m_bIsMediaPktSmall = 0;
+        }
+        nDelta = nPts - _pRtmp->m_nMediaTimebase;
+        if (nDelta < 0) {
+                _pRtmp->m_nMediaTimebase = nPts;
+                nDelta = 0;
+                _pRtmp->m_bIsMediaPktSmall = 0;
+        }
+        _pRtmp->m_nLastMediaTimeStamp = nPts;
+        *_pStamp = (uint32_t)nDelta;
+        *_pHeaderType = RTMP_PACKET_SIZE_MEDIUM;
+        if (!_pRtmp->m_bIsMediaPktSmall) {
+                *_pHeaderType = RTMP_PACKET_SIZE_LARGE;
+                _pRtmp->m_bIsMediaPktSmall = 1;
+        }
+}
+
+// 每个轨道单独的时间轴, pts回退时沿用上一次的, 保证时间戳不回退; 重设时间基时会一起重设*_pLast
+static void GetStampAbs(long long int * _pLast, unsigned int * _pTimebase, unsigned int _nPts, uint32_t * _pStamp,
+                        uint8_t * _pHeaderType)
+{
+        long long int nPts = _nPts;
+        long long int nDelta;
+
+        if (nPts < *_pLast)
+                nPts = *_pLast;
+        nDelta = nPts - *_pTimebase;
+        if (nDelta < 0) {
+                *_pTimebase = (unsigned int)nPts;
+                nDelta = 0;
+        }
+        *_pLast = nPts;
+        *_pStamp = (uint32_t)nDelta;
+        *_pHeaderType = RTMP_PACKET_SIZE_LARGE;
+}
+
+void RtmpPubGetVideoStamp(RtmpPubContext * _pRtmp, unsigned int _nPts, uint32_t * _pStamp, uint8_t * _pHeaderType)
+{
+        if (_pRtmp->m_nTimePolicy == RTMP_PUB_TIMESTAMP_ABSOLUTE)
+                GetStampAbs(&_pRtmp->m_nLastVideoTimeStamp, &_pRtmp->m_nVideoTimebase, _nPts, _pStamp, _pHeaderType);
+        else
+                GetStampRelative(_pRtmp, _nPts, _pStamp, _pHeaderType);
+}
+
+void RtmpPubGetAudioStamp(RtmpPubContext * _pRtmp, unsigned int _nPts, uint32_t * _pStamp, uint8_t * _pHeaderType)
+{
+        if (_pRtmp->m_nTimePolicy == RTMP_PUB_TIMESTAMP_ABSOLUTE)
+                GetStampAbs(&_pRtmp->m_nLastAudioTimeStamp, &_pRtmp->m_nAudioTimebase, _nPts, _pStamp, _pHeaderType);
+        else
+                GetStampRelative(_pRtmp, _nPts, _pStamp, _pHeaderType);
+}
+
+void RtmpPubRebaseTimestamps(RtmpPubContext * _pRtmp, unsigned int _nPts)
+{
+        // 相对时间戳模式下sdk只在m_nMediaTimebase小于0时才设置它
+        _pRtmp->m_nMediaTimebase = -1;
+        RtmpPubSetVideoTimebase(_pRtmp, _nPts);
+        RtmpPubSetAudioTimebase(_pRtmp, _nPts);
+}
+
+int RtmpPubSendRtmpPacket(RtmpPubContext * _pRtmp, RTMPPacket * _pPacket, uint8_t _nType, uint32_t _nStamp, uint8_t _nHeaderType)
+{
+        struct RTMP * pRtmp = _pRtmp->m_pRtmp;
+
+        _pPacket->m_packetType = _nType;
+        _pPacket->m_nChannel = RTMP_PUB_MEDIA_CHANNEL;
+        _pPacket->m_headerType = _nHeaderType;
+        _pPacket->m_nTimeStamp = _nStamp;
+        _pPacket->m_nInfoField2 = pRtmp->m_stream_id;
+        _pPacket->m_hasAbsTimestamp = 0;
+        if (!RTMP_SendPacket(pRtmp, _pPacket, 0))
+                return -1;
+        return 0;
+}
+
+unsigned int RtmpPubGetAvcRecordSize(const RtmpPubNalUnit * _pSps, const RtmpPubNalUnit * _pPps)
+{
+        if (!_pSps->m_pData || _pSps->m_nSize < 4 || !_pPps->m_pData || !_pPps->m_nSize)
+                return 0;
+        return RTMP_PUB_FLV_VIDEO_HEADER_SIZE + 11 + _pSps->m_nSize + _pPps->m_nSize;
+}
+
+int RtmpPubBuildAvcRecord(const RtmpPubNalUnit * _pSps, const RtmpPubNalUnit * _pPps, char * _pBody)
+{
+        int nOffset = 0;
+
+        if (!RtmpPubGetAvcRecordSize(_pSps, _pPps))
+                return -1;
+        _pBody[nOffset++] = RTMP_PUB_FLV_VIDEO_KEY;
+        _pBody[nOffset++] = RTMP_PUB_FLV_AVC_SEQ_HEADER;
+        _pBody[nOffset++] = 0;
+        _pBody[nOffset++] = 0;
+        _pBody[nOffset++] = 0;
+        // AVCDecoderConfigurationRecord
+        _pBody[nOffset++] = 1;
+        _pBody[nOffset++] = _pSps->m_pData[1];
+        _pBody[nOffset++] = _pSps->m_pData[2];
+        _pBody[nOffset++] = _pSps->m_pData[3];
+        _pBody[nOffset++] = (char)0xff;
+        _pBody[nOffset++] = (char)0xe1;
+        _pBody[nOffset++] = (char)(_pSps->m_nSize >> 8);
+        _pBody[nOffset++] = (char)_pSps->m_nSize;
+        memcpy(_pBody + nOffset, _pSps->m_pData, _pSps->m_nSize);
+        nOffset += _pSps->m_nSize;
+        _pBody[nOffset++] = 1;
+        _pBody[nOffset++] = (char)(_pPps->m_nSize >> 8);
+        _pBody[nOffset++] = (char)_pPps->m_nSize;
+        memcpy(_pBody + nOffset, _pPps->m_pData, _pPps->m_nSize);
+        nOffset += _pPps->m_nSize;
+        return nOffset;
+}
+
+unsigned int RtmpPubGetAvcConfigSize(RtmpPubContext * _pRtmp)
+{
+        return RtmpPubGetAvcRecordSize(&_pRtmp->m_pSps, &_pRtmp->m_pPps);
+}
+
+int RtmpPubBuildAvcConfig(RtmpPubContext * _pRtmp, char * _pBody)
+{
+        return RtmpPubBuildAvcRecord(&_pRtmp->m_pSps, &_pRtmp->m_pPps, _pBody);
+}
+
+int RtmpPubSendAvcConfig(RtmpPubContext * _pRtmp, unsigned int _nPts)
+{
+        RTMPPacket packet;
+        RtmpPubBuffer * pBody;
+        uint32_t nStamp = 0;
+        uint8_t nHeaderType = 0;
+        unsigned int nSize = RtmpPubGetAvcConfigSize(_pRtmp);
+        int ret;
+
+        if (!nSize || !(pBody = RtmpPubBufferAlloc(nSize)))
+                return -1;
+        RtmpPubPacketAttach(&packet, pBody);
+        packet.m_nBodySize = RtmpPubBuildAvcConfig(_pRtmp, packet.m_body);
+
+        RtmpPubGetVideoStamp(_pRtmp, _nPts, &nStamp, &nHeaderType);
+        ret = RtmpPubSendRtmpPacket(_pRtmp, &packet, RTMP_PACKET_TYPE_VIDEO, nStamp, nHeaderType);
+        RtmpPubBufferUnref(pBody);
+        return ret;
+}
@@ -0,0 +1,120 @@
+#ifndef __RTMP_PUBLISH_INTERNAL__
+#define __RTMP_PUBLISH_INTERNAL__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rtmp_publish.h"
+#include "rtmp_publish_nalu.h"
+#include "rtmp_buffer_pool.h"
+
+/*
+ * 推流sdk扩展模块内部使用的公共函数，不对外导出
+ * 时间戳/chunk stream id的计算规则和librtmp_sdk.a内部保持一致,
+ * 这样扩展接口和sdk原有接口可以在同一个RtmpPubContext上混用
+ */
+
+#define RtmpPubLog(fmt, args...) printf("%s:%d $ "fmt"\n", __FUNCTION__, __LINE__, ##args)
+
+#define RTMP_PUB_MEDIA_CHANNEL          4
+#define RTMP_PUB_DATA_CHANNEL           5       // onMetaData
+
+#define H264_NALU_SLICE 1
+#define H264_NALU_IDR   5
+#define H264_NALU_SEI   6
+#define H264_NALU_SPS   7
+#define H264_NALU_PPS   8
+
+// hevc的nalu类型在nalu头第一个字节的bit1~6
+#define HEVC_NALU_TYPE(b)       (((b) >> 1) & 0x3F)
+#define HEVC_NALU_BLA_W_LP      16      // 16~23是IRAP(BLA/IDR/CRA), 可以作为随机访问点
+#define HEVC_NALU_IRAP_MAX      23
+#define HEVC_NALU_VCL_MAX       31
+#define HEVC_NALU_VPS           32
+#define HEVC_NALU_SPS           33
+#define HEVC_NALU_PPS           34
+#define HEVC_NALU_SEI_PREFIX    39
+#define HEVC_NALU_SEI_SUFFIX    40
+
+#define RTMP_PUB_FLV_VIDEO_KEY          0x17
+#define RTMP_PUB_FLV_VIDEO_INTER        0x27
+#define RTMP_PUB_FLV_AVC_SEQ_HEADER     0x00
+#define RTMP_PUB_FLV_AVC_NALU           0x01
+#define RTMP_PUB_FLV_VIDEO_HEADER_SIZE  5
+
+// Enhanced RTMP: 第一个字节是IsExHeader | FrameType << 4 | PacketType, 后面跟4字节FourCC
+#define RTMP_PUB_FLV_EX_HEADER          0x80
+#define RTMP_PUB_FLV_EX_KEY             0x10
+#define RTMP_PUB_FLV_EX_INTER           0x20
+#define RTMP_PUB_FLV_EX_SEQ_START       0
+#define RTMP_PUB_FLV_EX_CODED_FRAMES_X  3       // 没有composition time, 头部和avc一样是5字节
+#define RTMP_PUB_FOURCC_HEVC            "hvc1"
+
+// 和sdk一致: aac, 44k, 16bit, stereo
+#define RTMP_PUB_FLV_AAC_HEADER         0xAF
+#define RTMP_PUB_FLV_AAC_SEQ_HEADER     0x00
+#define RTMP_PUB_FLV_AAC_RAW            0x01
+#define RTMP_PUB_FLV_AUDIO_HEADER_SIZE  2
+
+static inline void RtmpPubWriteBe32(char * _pBuf, unsigned int _nVal)
+{
+        _pBuf[0] = (char)(_nVal >> 24);
+        _pBuf[1] = (char)(_nVal >> 16);
+        _pBuf[2] = (char)(_nVal >> 8);
+        _pBuf[3] = (char)_nVal;
+}
+
+void RtmpPubGetVideoStamp(RtmpPubContext * _pRtmp, unsigned int _nPts, uint32_t * _pStamp, uint8_t * _pHeaderType);
+void RtmpPubGetAudioStamp(RtmpPubContext * _pRtmp, unsigned int _nPts, uint32_t * _pStamp, uint8_t * _pHeaderType);
+
+#if RTMP_PUB_BUFFER_HEADROOM < RTMP_MAX_HEADER_SIZE
+#error "buffer headroom too small for rtmp chunk header"
+#endif
+
+// 用池里的缓冲作为packet的body, librtmp会把chunk头写在m_body前面的headroom里, 不能用RTMPPacket_Free释放
+static inline void RtmpPubPacketAttach(RTMPPacket * _pPacket, RtmpPubBuffer * _pBuffer)
+{
+        RTMPPacket_Reset(_pPacket);
+        _pPacket->m_body = _pBuffer->m_pData;
+        _pPacket->m_nBodySize = _pBuffer->m_nSize;
+}
+
+// 发送一个已经分配好body的packet, 发送完成后packet由调用者释放
+int RtmpPubSendRtmpPacket(RtmpPubContext * _pRtmp, RTMPPacket * _pPacket, uint8_t _nType, uint32_t _nStamp, uint8_t _nHeaderType);
+
+// 用给定的sps/pps生成AVC sequence header, 和下面两个一样, 不依赖RtmpPubContext
+unsigned int RtmpPubGetAvcRecordSize(const RtmpPubNalUnit * _pSps, const RtmpPubNalUnit * _pPps);
+int RtmpPubBuildAvcRecord(const RtmpPubNalUnit * _pSps, const RtmpPubNalUnit * _pPps, char * _pBody);
+
+// AVC sequence header整个flv tag body的大小, sps/pps还没有设置时返回0
+unsigned int RtmpPubGetAvcConfigSize(RtmpPubContext * _pRtmp);
+// 写入AVC sequence header, _pBody至少要有RtmpPubGetAvcConfigSize字节, 返回写入的字节数
+int RtmpPubBuildAvcConfig(RtmpPubContext * _pRtmp, char * _pBody);
+int RtmpPubSendAvcConfig(RtmpPubContext * _pRtmp, unsigned int _nPts);
+// 同上, 加入_pWriter的发送队列, 数据拷贝到scratch里
+int RtmpPubWriteAvcConfig(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, unsigned int _nPts);
+
+/*
+ * 把_pHeader(RTMP_PUB_FLV_VIDEO_HEADER_SIZE字节的flv视频头)和nalu列表作为一个video tag加入_pWriter的发送队列,
+ * 每个nalu前加4字节长度, nalu数据不拷贝, avc和hevc共用
+ */
+int RtmpPubQueueVideoNalus(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, const char * _pHeader,
+                           const RtmpPubNaluSpan * _pNalus, unsigned int _nCount, unsigned int _presentationTime);
+
+// 重连之后新的连接从_nPts开始重新计算音视频时间戳, 并且重新发送两个sequence header
+void RtmpPubRebaseTimestamps(RtmpPubContext * _pRtmp, unsigned int _nPts);
+
+uint64_t RtmpPubHashParamSet(const char * _pData, unsigned int _nSize);
+// 参数集的哈希和*_pHash不同时更新它并返回1, 之前收到过的才算一次变化, 相同返回0
+int RtmpPubAvcParamSetUpdate(RtmpPubAvcParamState * _pState, uint64_t * _pHash, const RtmpPubNaluSpan * _pNalu);
+
+/*
+ * 转换一帧annexb或者avcc, sps/pps按_pState里的哈希比较, 变化时才交给sdk并重新发送sequence header,
+ * _pNalus里只留下需要发送的slice/sei, 返回它们的个数
+ * _bInPlace为1时把4字节startcode原地改写为nalu长度, 帧缓冲还被其它地方引用时要传0, avcc不需要改写
+ * *_pTimebaseSet为0时用这一帧的pts设置视频时间基
+ */
+int RtmpPubPrepareVideoFrame(RtmpPubContext * _pRtmp, RtmpPubAvcParamState * _pState, char * _pData, unsigned int _nSize,
+                             RtmpPubAuFormat _nFormat, unsigned int _nPts, int _bInPlace, RtmpPubNaluSpan * _pNalus,
+                             unsigned int _nMaxNalus, int * _pTimebaseSet, int * _pIsKey, int * _pIsReference);
+
+#endif
@@ -0,0 +1,385 @@
+#include <string.h>
+#include "rtmp_publish_nalu.h"
+#include "rtmp_publish_internal.h"
+
+static int ScanNalus(char * _pData, unsigned int _nSize, RtmpPubNaluSpan * _pNalus, unsigned int _nMaxNalus, int _bRewrite)
+{
+        uint8_t * pStart = (uint8_t *)_pData;
+        uint8_t * pEnd = pStart + _nSize;
+        uint8_t * pSc, * pNal, * pNalEnd;
+        unsigned int nCount = 0;
+
+        pSc = (uint8_t *)RtmpPubFindStartcode(pStart, pEnd);
+        while (pSc < pEnd) {
+                pNal = pSc;
+                while (pNal < pEnd && !*pNal)
+                        pNal++;
+                if (pNal == pEnd)
+                        break;
+                pNal++;         // 跳过startcode的0x01
+                if (pNal == pEnd)
+                        break;
+                pNalEnd = (uint8_t *)RtmpPubFindStartcode(pNal, pEnd);
+                if (nCount == _nMaxNalus)
+                        return -1;
+                _pNalus[nCount].m_nType = pNal[0] & 0x1F;
+                _pNalus[nCount].m_pData = (const char *)pNal;
+                _pNalus[nCount].m_nSize = pNalEnd - pNal;
+                _pNalus[nCount].m_bPrefixed = 0;
+                if (_bRewrite && pNal - pSc == 4) {
+                        RtmpPubWriteBe32((char *)pSc, pNalEnd - pNal);
+                        _pNalus[nCount].m_bPrefixed = 1;
+                }
+                nCount++;
+                pSc = pNalEnd;
+        }
+        return nCount;
+}
+
+int RtmpPubAnnexbToNalus(char * _pData, unsigned int _nSize, RtmpPubNaluSpan * _pNalus, unsigned int _nMaxNalus)
+{
+        return ScanNalus(_pData, _nSize, _pNalus, _nMaxNalus, 1);
+}
+
+int RtmpPubAnnexbParseNalus(const char * _pData, unsigned int _nSize, RtmpPubNaluSpan * _pNalus, unsigned int _nMaxNalus)
+{
+        return ScanNalus((char *)_pData, _nSize, _pNalus, _nMaxNalus, 0);
+}
+
+int RtmpPubAvccParseNalus(const char * _pData, unsigned int _nSize, RtmpPubNaluSpan * _pNalus, unsigned int _nMaxNalus)
+{
+        const uint8_t * pNal = (const uint8_t *)_pData;
+        const uint8_t * pEnd = pNal + _nSize;
+        unsigned int nCount = 0, nLen;
+
+        while (pEnd - pNal >= 4) {
+                nLen = ((unsigned int)pNal[0] << 24) | (pNal[1] << 16) | (pNal[2] << 8) | pNal[3];
+                pNal += 4;
+                if (nLen > (unsigned int)(pEnd - pNal) || nCount == _nMaxNalus)
+                        return -1;
+                if (nLen) {
+                        _pNalus[nCount].m_nType = pNal[0] & 0x1F;
+                        _pNalus[nCount].m_pData = (const char *)pNal;
+                        _pNalus[nCount].m_nSize = nLen;
+                        _pNalus[nCount].m_bPrefixed = 1;
+                        nCount++;
+                }
+                pNal += nLen;
+        }
+        return pNal == pEnd ? (int)nCount : -1;
+}
+
+int RtmpPubAccessUnitToNalus(char * _pData, unsigned int _nSize, RtmpPubAuFormat _nFormat, int _bInPlace,
+                             RtmpPubNaluSpan * _pNalus, unsigned int _nMaxNalus)
+{
+        if (_nFormat == RTMP_PUB_AU_AVCC)
+                return RtmpPubAvccParseNalus(_pData, _nSize, _pNalus, _nMaxNalus);
+        return ScanNalus(_pData, _nSize, _pNalus, _nMaxNalus, _bInPlace);
+}
+
+uint64_t RtmpPubHashParamSet(const char * _pData, unsigned int _nSize)
+{
+        uint64_t nHash = 0xcbf29ce484222325ULL;
+        unsigned int i;
+
+        // FNV-1a, 参数集只有几十字节
+        for (i = 0; i < _nSize; i++) {
+                nHash ^= (uint8_t)_pData[i];
+                nHash *= 0x100000001b3ULL;
+        }
+        return nHash;
+}
+
+int RtmpPubAvcParamSetUpdate(RtmpPubAvcParamState * _pState, uint64_t * _pHash, const RtmpPubNaluSpan * _pNalu)
+{
+        uint64_t nHash = RtmpPubHashParamSet(_pNalu->m_pData, _pNalu->m_nSize);
+
+        if (nHash == *_pHash)
+                return 0;
+        if (*_pHash)
+                _pState->m_nChanges++;
+        *_pHash = nHash;
+        return 1;
+}
+
+// 参数集和上一次的哈希相同时什么都不做, 避免每个关键帧都让sdk重新分配和拷贝一次
+static void UpdateParamSet(RtmpPubContext * _pRtmp, RtmpPubAvcParamState * _pState, uint64_t * _pHash,
+                           const RtmpPubNaluSpan * _pNalu, void (*_pSet)(RtmpPubContext *, const char *, unsigned int))
+{
+        unsigned long long nChanges = _pState->m_nChanges;
+
+        if (!RtmpPubAvcParamSetUpdate(_pState, _pHash, _pNalu))
+                return;
+        if (_pState->m_nChanges != nChanges)
+                _pRtmp->m_nIsVideoConfigSent = 0;
+        _pSet(_pRtmp, _pNalu->m_pData, _pNalu->m_nSize);
+}
+
+int RtmpPubAnnexbIsIdr(const char * _pData, unsigned int _nSize)
+{
+        const uint8_t * pEnd = (const uint8_t *)_pData + _nSize;
+        const uint8_t * pNal = RtmpPubFindStartcode((const uint8_t *)_pData, pEnd);
+        int nType;
+
+        while (pNal < pEnd) {
+                while (pNal < pEnd && !*pNal)
+                        pNal++;
+                if (++pNal >= pEnd)
+                        break;
+                nType = pNal[0] & 0x1F;
+                if (nType == H264_NALU_IDR)
+                        return 1;
+                if (nType == H264_NALU_SLICE)
+                        return 0;
+                pNal = RtmpPubFindStartcode(pNal, pEnd);
+        }
+        return 0;
+}
+
+int RtmpPubPrepareVideoFrame(RtmpPubContext * _pRtmp, RtmpPubAvcParamState * _pState, char * _pData, unsigned int _nSize,
+                             RtmpPubAuFormat _nFormat, unsigned int _nPts, int _bInPlace, RtmpPubNaluSpan * _pNalus,
+                             unsigned int _nMaxNalus, int * _pTimebaseSet, int * _pIsKey, int * _pIsReference)
+{
+        int i, nNalus, nVcl = 0;
+
+        *_pIsKey = 0;
+        *_pIsReference = 0;
+        nNalus = RtmpPubAccessUnitToNalus(_pData, _nSize, _nFormat, _bInPlace, _pNalus, _nMaxNalus);
+        if (nNalus < 0) {
+                RtmpPubLog("too many nalus in one frame or bad avcc length");
+                return -1;
+        }
+        for (i = 0; i < nNalus; i++) {
+                switch (_pNalus[i].m_nType) {
+                case H264_NALU_SPS:
+                        // 时间基只在第一个sps时设置, 每个关键帧都重设会让视频时间戳回到0
+                        if (!*_pTimebaseSet) {
+                                RtmpPubSetVideoTimebase(_pRtmp, _nPts);
+                                *_pTimebaseSet = 1;
+                        }
+                        UpdateParamSet(_pRtmp, _pState, &_pState->m_nSpsHash, &_pNalus[i], RtmpPubSetSps);
+                        break;
+                case H264_NALU_PPS:
+                        UpdateParamSet(_pRtmp, _pState, &_pState->m_nPpsHash, &_pNalus[i], RtmpPubSetPps);
+                        break;
+                case H264_NALU_IDR:
+                        *_pIsKey = 1;
+                        *_pIsReference = 1;
+                        _pNalus[nVcl++] = _pNalus[i];
+                        break;
+                case H264_NALU_SLICE:
+                        if (_pNalus[i].m_pData[0] & 0x60)
+                                *_pIsReference = 1;
+                        _pNalus[nVcl++] = _pNalus[i];
+                        break;
+                case H264_NALU_SEI:
+                        _pNalus[nVcl++] = _pNalus[i];
+                        break;
+                default:
+                        break;
+                }
+        }
+        return nVcl;
+}
+
+int RtmpPubSendVideoNalus(RtmpPubContext * _pRtmp, const RtmpPubNaluSpan * _pNalus, unsigned int _nCount, int _bIsKey,
+                                                                unsigned int _presentationTime)
+{
+        RTMPPacket packet;
+        RtmpPubBuffer * pBody;
+        uint32_t nStamp = 0;
+        uint8_t nHeaderType = 0;
+        unsigned int i, nBodySize = RTMP_PUB_FLV_VIDEO_HEADER_SIZE;
+        char * pOut;
+        int ret;
+
+        if (!_nCount)
+                return 0;
+        // 没有sequence header的关键帧播放端无法解码, 不发送
+        if (_bIsKey && !_pRtmp->m_nIsVideoConfigSent) {
+                if (RtmpPubSendAvcConfig(_pRtmp, _presentationTime) < 0) {
+                        RtmpPubLog("avc sequence header not sent, sps/pps missing, skip key frame");
+                        return -1;
+                }
+                _pRtmp->m_nIsVideoConfigSent = 1;
+        }
+
+        for (i = 0; i < _nCount; i++)
+                nBodySize += 4 + _pNalus[i].m_nSize;
+
+        if (!(pBody = RtmpPubBufferAlloc(nBodySize)))
+                return -1;
+        RtmpPubPacketAttach(&packet, pBody);
+        pOut = packet.m_body;
+        *pOut++ = _bIsKey ? RTMP_PUB_FLV_VIDEO_KEY : RTMP_PUB_FLV_VIDEO_INTER;
+        *pOut++ = RTMP_PUB_FLV_AVC_NALU;
+        *pOut++ = 0;
+        *pOut++ = 0;
+        *pOut++ = 0;
+        for (i = 0; i < _nCount; i++) {
+                const char * pRun = _pNalus[i].m_pData;
+                unsigned int nRun = _pNalus[i].m_nSize;
+
+                if (!_pNalus[i].m_bPrefixed) {
+                        RtmpPubWriteBe32(pOut, nRun);
+                        pOut += 4;
+                        memcpy(pOut, pRun, nRun);
+                        pOut += nRun;
+                        continue;
+                }
+                // 连续的、已经原地改写过长度的nalu合并为一次拷贝
+                pRun -= 4;
+                nRun += 4;
+                while (i + 1 < _nCount && _pNalus[i + 1].m_bPrefixed &&
+                                _pNalus[i + 1].m_pData - 4 == pRun + nRun) {
+                        i++;
+                        nRun += 4 + _pNalus[i].m_nSize;
+                }
+                memcpy(pOut, pRun, nRun);
+                pOut += nRun;
+        }
+        packet.m_nBodySize = nBodySize;
+
+        RtmpPubGetVideoStamp(_pRtmp, _presentationTime, &nStamp, &nHeaderType);
+        ret = RtmpPubSendRtmpPacket(_pRtmp, &packet, RTMP_PACKET_TYPE_VIDEO, nStamp, nHeaderType);
+        RtmpPubBufferUnref(pBody);
+        return ret;
+}
+
+int RtmpPubWriteAvcConfig(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, unsigned int _nPts)
+{
+        unsigned int nSize = RtmpPubGetAvcConfigSize(_pRtmp);
+        struct iovec iov;
+        uint32_t nStamp = 0;
+        uint8_t nHeaderType = 0;
+
+        if (!nSize || RtmpPubChunkWriterReserve(_pWriter, nSize) < 0)
+                return -1;
+        iov.iov_base = RtmpPubChunkWriterAlloc(_pWriter, nSize);
+        iov.iov_len = RtmpPubBuildAvcConfig(_pRtmp, (char *)iov.iov_base);
+        RtmpPubGetVideoStamp(_pRtmp, _nPts, &nStamp, &nHeaderType);
+        return RtmpPubChunkWriterQueue(_pWriter, RTMP_PUB_MEDIA_CHANNEL, RTMP_PACKET_TYPE_VIDEO, nHeaderType, nStamp,
+                                       _pRtmp->m_pRtmp->m_stream_id, &iov, 1);
+}
+
+int RtmpPubQueueVideoNalus(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, const char * _pHeader,
+                           const RtmpPubNaluSpan * _pNalus, unsigned int _nCount, unsigned int _presentationTime)
+{
+        struct iovec iov[1 + 2 * RTMP_PUB_MAX_TAG_NALUS];
+        uint32_t nStamp = 0;
+        uint8_t nHeaderType = 0;
+        unsigned int i;
+        int nIov = 0;
+        char * pOut;
+
+        if (_nCount > RTMP_PUB_MAX_TAG_NALUS)
+                return -1;
+        // flv视频头和3字节startcode的nalu长度放在scratch里, 其它都直接指向原始数据
+        if (RtmpPubChunkWriterReserve(_pWriter, RTMP_PUB_FLV_VIDEO_HEADER_SIZE + 4 * _nCount) < 0)
+                return -1;
+        pOut = RtmpPubChunkWriterAlloc(_pWriter, RTMP_PUB_FLV_VIDEO_HEADER_SIZE);
+        memcpy(pOut, _pHeader, RTMP_PUB_FLV_VIDEO_HEADER_SIZE);
+        iov[nIov].iov_base = pOut;
+        iov[nIov++].iov_len = RTMP_PUB_FLV_VIDEO_HEADER_SIZE;
+        for (i = 0; i < _nCount; i++) {
+                const char * pRun = _pNalus[i].m_pData;
+                unsigned int nRun = _pNalus[i].m_nSize;
+
+                if (!_pNalus[i].m_bPrefixed) {
+                        pOut = RtmpPubChunkWriterAlloc(_pWriter, 4);
+                        RtmpPubWriteBe32(pOut, nRun);
+                        iov[nIov].iov_base = pOut;
+                        iov[nIov++].iov_len = 4;
+                        iov[nIov].iov_base = (void *)pRun;
+                        iov[nIov++].iov_len = nRun;
+                        continue;
+                }
+                pRun -= 4;
+                nRun += 4;
+                while (i + 1 < _nCount && _pNalus[i + 1].m_bPrefixed &&
+                                _pNalus[i + 1].m_pData - 4 == pRun + nRun) {
+                        i++;
+                        nRun += 4 + _pNalus[i].m_nSize;
+                }
+                iov[nIov].iov_base = (void *)pRun;
+                iov[nIov++].iov_len = nRun;
+        }
+
+        RtmpPubGetVideoStamp(_pRtmp, _presentationTime, &nStamp, &nHeaderType);
+        return RtmpPubChunkWriterQueue(_pWriter, RTMP_PUB_MEDIA_CHANNEL, RTMP_PACKET_TYPE_VIDEO, nHeaderType, nStamp,
+                                       _pRtmp->m_pRtmp->m_stream_id, iov, nIov);
+}
+
+int RtmpPubWriteVideoNalus(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, const RtmpPubNaluSpan * _pNalus,
+                           unsigned int _nCount, int _bIsKey, unsigned int _presentationTime)
+{
+        char header[RTMP_PUB_FLV_VIDEO_HEADER_SIZE] = { RTMP_PUB_FLV_VIDEO_INTER, RTMP_PUB_FLV_AVC_NALU, 0, 0, 0 };
+
+        if (!_nCount)
+                return 0;
+        if (_nCount > RTMP_PUB_MAX_TAG_NALUS)
+                return -1;
+        // 没有sequence header的关键帧播放端无法解码, 不发送
+        if (_bIsKey && !_pRtmp->m_nIsVideoConfigSent) {
+                if (RtmpPubWriteAvcConfig(_pWriter, _pRtmp, _presentationTime) < 0) {
+                        RtmpPubLog("avc sequence header not queued, sps/pps missing, skip key frame");
+                        return -1;
+                }
+                _pRtmp->m_nIsVideoConfigSent = 1;
+        }
+        if (_bIsKey)
+                header[0] = RTMP_PUB_FLV_VIDEO_KEY;
+        return RtmpPubQueueVideoNalus(_pWriter, _pRtmp, header, _pNalus, _nCount, _presentationTime);
+}
+
+unsigned int RtmpPubGetVideoTagSize(const RtmpPubNaluSpan * _pNalus, unsigned int _nCount)
+{
+        unsigned int i, nSize = RTMP_PUB_FLV_VIDEO_HEADER_SIZE;
+
+        for (i = 0; i < _nCount; i++)
+                nSize += 4 + _pNalus[i].m_nSize;
+        return nSize;
+}
+
+unsigned int RtmpPubBuildVideoTag(const RtmpPubNaluSpan * _pNalus, unsigned int _nCount, int _bIsKey, char * _pBody)
+{
+        char * pOut = _pBody;
+        unsigned int i;
+
+        *pOut++ = _bIsKey ? RTMP_PUB_FLV_VIDEO_KEY : RTMP_PUB_FLV_VIDEO_INTER;
+        *pOut++ = RTMP_PUB_FLV_AVC_NALU;
+        *pOut++ = 0;
+        *pOut++ = 0;
+        *pOut++ = 0;
+        for (i = 0; i < _nCount; i++) {
+                RtmpPubWriteBe32(pOut, _pNalus[i].m_nSize);
+                memcpy(pOut + 4, _pNalus[i].m_pData, _pNalus[i].m_nSize);
+                pOut += 4 + _pNalus[i].m_nSize;
+        }
+        return pOut - _pBody;
+}
+
+int RtmpPubWriteVideoTag(RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, const char * _pConfig, unsigned int _nConfigSize,
+                         const char * _pTag, unsigned int _nSize, int _bIsKey, unsigned int _presentationTime)
+{
+        struct iovec iov;
+        uint32_t nStamp = 0;
+        uint8_t nHeaderType = 0;
+
+        if (_bIsKey && !_pRtmp->m_nIsVideoConfigSent) {
+                iov.iov_base = (void *)_pConfig;
+                iov.iov_len = _nConfigSize;
+                RtmpPubGetVideoStamp(_pRtmp, _presentationTime, &nStamp, &nHeaderType);
+                if (!_pConfig || RtmpPubChunkWriterQueue(_pWriter, RTMP_PUB_MEDIA_CHANNEL, RTMP_PACKET_TYPE_VIDEO, nHeaderType,
+                                                         nStamp, _pRtmp->m_pRtmp->m_stream_id, &iov, 1) < 0) {
+                        RtmpPubLog("avc sequence header not queued, skip key frame");
+                        return -1;
+                }
+                _pRtmp->m_nIsVideoConfigSent = 1;
+        }
+        iov.iov_base = (void *)_pTag;
+        iov.iov_len = _nSize;
+        RtmpPubGetVideoStamp(_pRtmp, _presentationTime, &nStamp, &nHeaderType);
+        return RtmpPubChunkWriterQueue(_pWriter, RTMP_PUB_MEDIA_CHANNEL, RTMP_PACKET_TYPE_VIDEO, nHeaderType, nStamp,
+                                       _pRtmp->m_pRtmp->m_stream_id, &iov, 1);
+}
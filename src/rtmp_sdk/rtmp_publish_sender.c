@@ -0,0 +1,678 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "rtmp_publish_sender.h"
+#include "rtmp_publish_audio.h"
+#include "rtmp_publish_internal.h"
+
+// 封装耗时扣除其中写socket的时间, 写socket单独记在RTMP_PUB_STAGE_SEND
+static void RecordSerialize(RtmpPubSender * _pSender, long long int _nStart, unsigned long long _nSendNs)
+{
+        RtmpPubMetricsRecord(&_pSender->m_metrics, RTMP_PUB_STAGE_SERIALIZE,
+                             RtmpPubNowNs() - _nStart - (_pSender->m_writer.m_nSendNs - _nSendNs));
+}
+
+// m_avc/m_hevc只在发送线程访问, 变化次数复制一份给其它线程读
+static void MirrorParamChanges(RtmpPubSender * _pSender)
+{
+        atomic_store_explicit(&_pSender->m_nParamChanges, _pSender->m_avc.m_nChanges + _pSender->m_hevc.m_nChanges,
+                              memory_order_relaxed);
+}
+
+// 参数有变化或者新连接上还没有发送过时先发onMetaData, 失败不影响音视频
+static void WriteMetadata(RtmpPubSender * _pSender)
+{
+        RtmpPubMetadataUpdate(&_pSender->m_metadata, _pSender->m_pRtmp);
+        if (_pSender->m_nVideoCodec == RTMP_PUB_VIDEO_HEVC)
+                RtmpPubMetadataSetHevcSps(&_pSender->m_metadata, _pSender->m_hevc.m_sps.m_pData, _pSender->m_hevc.m_sps.m_nSize);
+        if (RtmpPubWriteMetadata(&_pSender->m_writer, &_pSender->m_metadata, _pSender->m_pRtmp->m_pRtmp->m_stream_id) < 0)
+                RtmpPubLog("write metadata err");
+}
+
+static int SendVideoFrame(RtmpPubSender * _pSender, RtmpPubFrame * _pFrame, long long int _nLatencyUs)
+{
+        RtmpPubContext * pRtmp = _pSender->m_pRtmp;
+        int nVcl, bIsKey = 0, bIsReference = 0, ret;
+        long long int nStart = RtmpPubNowNs();
+        unsigned long long nSendNs;
+        RtmpPubAuFormat nFormat = _pFrame->m_nType == RTMP_PUB_FRAME_VIDEO_AVCC ? RTMP_PUB_AU_AVCC : RTMP_PUB_AU_ANNEXB;
+
+        if (_pSender->m_nVideoCodec == RTMP_PUB_VIDEO_HEVC)
+                nVcl = RtmpPubPrepareHevcFrame(pRtmp, &_pSender->m_hevc, _pFrame->m_pData, _pFrame->m_nSize, nFormat,
+                                               _pFrame->m_nPts, !RtmpPubBufferShared(_pFrame->m_pBuffer), _pSender->m_nalus,
+                                               RTMP_PUB_SENDER_MAX_NALUS, &_pSender->m_bVideoTimebaseSet, &bIsKey,
+                                               &bIsReference);
+        else
+                nVcl = RtmpPubPrepareVideoFrame(pRtmp, &_pSender->m_avc, _pFrame->m_pData, _pFrame->m_nSize, nFormat,
+                                                _pFrame->m_nPts, !RtmpPubBufferShared(_pFrame->m_pBuffer), _pSender->m_nalus,
+                                                RTMP_PUB_SENDER_MAX_NALUS, &_pSender->m_bVideoTimebaseSet, &bIsKey, &bIsReference);
+        MirrorParamChanges(_pSender);
+        if (nVcl < 0)
+                return -1;
+        RtmpPubMetricsRecord(&_pSender->m_metrics, RTMP_PUB_STAGE_CONVERT, RtmpPubNowNs() - nStart);
+        if (_pSender->m_bWaitKey) {
+                if (!bIsKey) {
+                        RtmpPubMetricsAddDrop(&_pSender->m_metrics, RTMP_PUB_TRACK_VIDEO);
+                        return 0;
+                }
+                _pSender->m_bWaitKey = 0;
+                RtmpPubRebaseTimestamps(pRtmp, _pFrame->m_nPts);
+        }
+        // sps/pps已经在上面交给sdk了, 丢帧只丢图像数据
+        if (RtmpPubDropPolicyCheck(&_pSender->m_drop, bIsKey, bIsReference, _nLatencyUs)) {
+                RtmpPubMetricsAddDrop(&_pSender->m_metrics, RTMP_PUB_TRACK_VIDEO);
+                return 0;
+        }
+        // sps只会随关键帧变化
+        if (bIsKey)
+                WriteMetadata(_pSender);
+        nStart = RtmpPubNowNs();
+        nSendNs = _pSender->m_writer.m_nSendNs;
+        if (_pSender->m_nVideoCodec == RTMP_PUB_VIDEO_HEVC)
+                ret = RtmpPubWriteHevcNalus(&_pSender->m_writer, pRtmp, &_pSender->m_hevc, _pSender->m_nalus, nVcl, bIsKey,
+                                            _pFrame->m_nPts);
+        else
+                ret = RtmpPubWriteVideoNalus(&_pSender->m_writer, pRtmp, _pSender->m_nalus, nVcl, bIsKey, _pFrame->m_nPts);
+        RecordSerialize(_pSender, nStart, nSendNs);
+        if (ret == 0)
+                RtmpPubMetricsAddFrame(&_pSender->m_metrics, RTMP_PUB_TRACK_VIDEO, _pFrame->m_nSize);
+        return ret;
+}
+
+// 低延时模式: 第一个slice决定整帧是否发送, 之后的slice直接追加到已经打开的消息里
+static int SendVideoSlice(RtmpPubSender * _pSender, RtmpPubFrame * _pFrame, long long int _nLatencyUs)
+{
+        RtmpPubContext * pRtmp = _pSender->m_pRtmp;
+        RtmpPubSliceTag * pSlice = &_pSender->m_slice;
+        int nVcl, bIsKey = 0, bIsReference = 0, bFirst = _pFrame->m_nSliceFlags & RTMP_PUB_SLICE_FIRST, ret;
+        long long int nStart = RtmpPubNowNs();
+        unsigned long long nSendNs;
+
+        // 上一帧的最后一个slice没有入队, 在这里补齐
+        if (bFirst && pSlice->m_bActive && RtmpPubSliceTagEnd(pSlice, &_pSender->m_writer, pRtmp) < 0)
+                return -1;
+        // 这一帧在第一个slice时已经丢弃
+        if (!bFirst && !pSlice->m_bActive)
+                return 0;
+        nVcl = RtmpPubPrepareVideoFrame(pRtmp, &_pSender->m_avc, _pFrame->m_pData, _pFrame->m_nSize, RTMP_PUB_AU_ANNEXB,
+                                        _pFrame->m_nPts, !RtmpPubBufferShared(_pFrame->m_pBuffer), _pSender->m_nalus,
+                                        RTMP_PUB_SENDER_MAX_NALUS, &_pSender->m_bVideoTimebaseSet, &bIsKey, &bIsReference);
+        MirrorParamChanges(_pSender);
+        if (nVcl < 0)
+                return -1;
+        RtmpPubMetricsRecord(&_pSender->m_metrics, RTMP_PUB_STAGE_CONVERT, RtmpPubNowNs() - nStart);
+        if (bFirst) {
+                // 第一个slice可能只有sps/pps, 以采集端的标记为准
+                bIsKey = bIsKey || _pFrame->m_bIsKey;
+                if (_pSender->m_bWaitKey) {
+                        if (!bIsKey) {
+                                RtmpPubMetricsAddDrop(&_pSender->m_metrics, RTMP_PUB_TRACK_VIDEO);
+                                return 0;
+                        }
+                        _pSender->m_bWaitKey = 0;
+                        RtmpPubRebaseTimestamps(pRtmp, _pFrame->m_nPts);
+                }
+                if (RtmpPubDropPolicyCheck(&_pSender->m_drop, bIsKey, bIsReference || bIsKey, _nLatencyUs)) {
+                        RtmpPubMetricsAddDrop(&_pSender->m_metrics, RTMP_PUB_TRACK_VIDEO);
+                        return 0;
+                }
+                if (bIsKey)
+                        WriteMetadata(_pSender);
+        }
+        nStart = RtmpPubNowNs();
+        nSendNs = _pSender->m_writer.m_nSendNs;
+        ret = bFirst ? RtmpPubSliceTagBegin(pSlice, &_pSender->m_writer, pRtmp, bIsKey, _pFrame->m_nPts) : 0;
+        if (ret == 0)
+                ret = RtmpPubSliceTagWrite(pSlice, &_pSender->m_writer, pRtmp, _pSender->m_nalus, nVcl);
+        if (ret == 0 && (_pFrame->m_nSliceFlags & RTMP_PUB_SLICE_LAST)) {
+                ret = RtmpPubSliceTagEnd(pSlice, &_pSender->m_writer, pRtmp);
+                if (ret == 0)
+                        RtmpPubMetricsAddFrame(&_pSender->m_metrics, RTMP_PUB_TRACK_VIDEO, pSlice->m_nSize);
+        }
+        RecordSerialize(_pSender, nStart, nSendNs);
+        return ret;
+}
+
+static int SendAudioFrame(RtmpPubSender * _pSender, RtmpPubFrame * _pFrame)
+{
+        RtmpPubContext * pRtmp = _pSender->m_pRtmp;
+        long long int nStart;
+        unsigned long long nSendNs;
+        int ret;
+
+        if (_pSender->m_bWaitKey) {
+                // 有视频时音频等视频关键帧一起开始, 纯音频流直接从这一帧开始
+                if (_pSender->m_bVideoTimebaseSet) {
+                        RtmpPubMetricsAddDrop(&_pSender->m_metrics, RTMP_PUB_TRACK_AUDIO);
+                        return 0;
+                }
+                _pSender->m_bWaitKey = 0;
+                RtmpPubRebaseTimestamps(pRtmp, _pFrame->m_nPts);
+        }
+        WriteMetadata(_pSender);
+        if (pRtmp->m_nAudioInputType == RTMP_PUB_AUDIO_AAC) {
+                nStart = RtmpPubNowNs();
+                nSendNs = _pSender->m_writer.m_nSendNs;
+                ret = RtmpPubWriteAacFrame(&_pSender->m_writer, pRtmp, _pFrame->m_pData, _pFrame->m_nSize, _pFrame->m_nPts);
+                RecordSerialize(_pSender, nStart, nSendNs);
+        } else if (pRtmp->m_nAudioOutputType == RTMP_PUB_AUDIO_AAC) {
+                nStart = RtmpPubNowNs();
+                nSendNs = _pSender->m_writer.m_nSendNs;
+                ret = RtmpPubWriteTranscodedAudio(&_pSender->m_transcoder, &_pSender->m_writer, pRtmp, _pFrame->m_pData,
+                                                  _pFrame->m_nSize, _pFrame->m_nPts);
+                RtmpPubMetricsRecord(&_pSender->m_metrics, RTMP_PUB_STAGE_CONVERT,
+                                     RtmpPubNowNs() - nStart - (_pSender->m_writer.m_nSendNs - nSendNs));
+        } else {
+                // 不转码的g711等仍然交给sdk, 直接调用RTMP_SendPacket之前要先把排队的数据发出去
+                if (RtmpPubChunkWriterFlush(&_pSender->m_writer) < 0)
+                        return -1;
+                nStart = RtmpPubNowNs();
+                ret = RtmpPubSendAudioFrame(pRtmp, _pFrame->m_pData, _pFrame->m_nSize, _pFrame->m_nPts) < 0 ? -1 : 0;
+                RtmpPubMetricsRecord(&_pSender->m_metrics, RTMP_PUB_STAGE_CONVERT, RtmpPubNowNs() - nStart);
+        }
+        if (ret == 0)
+                RtmpPubMetricsAddFrame(&_pSender->m_metrics, RTMP_PUB_TRACK_AUDIO, _pFrame->m_nSize);
+        return ret;
+}
+
+// _bReplay为1时是重发GOP缓存里的帧, 不再进入缓存, 也不按排队延时丢帧
+static int SendFrame(RtmpPubSender * _pSender, RtmpPubFrame * _pFrame, int _bReplay)
+{
+        long long int nLatencyUs = 0;
+
+        // 先进入缓存, 被缓存引用的帧发送时不会原地改写
+        if (!_bReplay && _pFrame->m_nType != RTMP_PUB_FRAME_AUDIO_CONFIG) {
+                RtmpPubGopCacheAdd(&_pSender->m_cache, _pFrame);
+                nLatencyUs = RtmpPubNowUs() - _pFrame->m_nEnqueueTime;
+                RtmpPubMetricsRecord(&_pSender->m_metrics, RTMP_PUB_STAGE_QUEUE, nLatencyUs * 1000);
+        }
+        switch (_pFrame->m_nType) {
+        case RTMP_PUB_FRAME_VIDEO:
+        case RTMP_PUB_FRAME_VIDEO_AVCC:
+                return SendVideoFrame(_pSender, _pFrame, nLatencyUs);
+        case RTMP_PUB_FRAME_VIDEO_SLICE:
+                return SendVideoSlice(_pSender, _pFrame, nLatencyUs);
+        case RTMP_PUB_FRAME_AUDIO:
+                return SendAudioFrame(_pSender, _pFrame);
+        case RTMP_PUB_FRAME_AUDIO_CONFIG:
+                // 排队中的sequence header可能还指向旧的config
+                if (RtmpPubChunkWriterFlush(&_pSender->m_writer) < 0)
+                        return -1;
+                RtmpPubSetAudioTimebase(_pSender->m_pRtmp, _pFrame->m_nPts);
+                RtmpPubUpdateAac(_pSender->m_pRtmp, _pFrame->m_pData, _pFrame->m_nSize);
+                return 0;
+        case RTMP_PUB_FRAME_VIDEO_TAG:
+        case RTMP_PUB_FRAME_VIDEO_CONFIG:
+                // 打包好的tag只有分发端的session会收到, 发送线程的队列里不应该出现
+                RtmpPubLog("unexpected frame type %d in sender queue", _pFrame->m_nType);
+                return -1;
+        }
+        return -1;
+}
+
+// 已经在本批次里的帧跳过, 下一帧由交错器按时间戳决定, 需要等待迟到的轨道时返回NULL, *_pWaitUs是最多等待的时间
+static RtmpPubFrameRing * NextRing(RtmpPubSender * _pSender, RtmpPubFrame ** _ppFrame, long long int * _pWaitUs)
+{
+        RtmpPubInterleaver * pInterleave = &_pSender->m_interleave;
+        RtmpPubFrame * pVideo = RtmpPubFrameRingPeekAt(&_pSender->m_video, _pSender->m_nVideoInFlight);
+        RtmpPubFrame * pAudio = RtmpPubFrameRingPeekAt(&_pSender->m_audio, _pSender->m_nAudioInFlight);
+        long long int nNow = RtmpPubNowUs();
+        int nTrack;
+
+        if (pVideo && !RtmpPubInterleaverHasHead(pInterleave, RTMP_PUB_TRACK_VIDEO))
+                RtmpPubInterleaverPush(pInterleave, RTMP_PUB_TRACK_VIDEO, pVideo->m_nPts, pVideo->m_nEnqueueTime);
+        if (pAudio && !RtmpPubInterleaverHasHead(pInterleave, RTMP_PUB_TRACK_AUDIO))
+                RtmpPubInterleaverPush(pInterleave, RTMP_PUB_TRACK_AUDIO, pAudio->m_nPts, pAudio->m_nEnqueueTime);
+        // 低延时模式下一帧的消息还没有结束, 只能继续取这一帧的slice; 断线后旧消息已经作废
+        if (_pSender->m_bConnected && RtmpPubChunkWriterOpen(&_pSender->m_writer)) {
+                *_pWaitUs = -1;
+                nTrack = pVideo ? RTMP_PUB_TRACK_VIDEO : -1;
+        } else {
+                nTrack = RtmpPubInterleaverNext(pInterleave, nNow, _pWaitUs);
+        }
+        if (nTrack < 0)
+                return NULL;
+        RtmpPubMetricsRecord(&_pSender->m_metrics, RTMP_PUB_STAGE_INTERLEAVE,
+                             RtmpPubInterleaverPop(pInterleave, nTrack, nNow) * 1000);
+        if (nTrack == RTMP_PUB_TRACK_VIDEO) {
+                *_ppFrame = pVideo;
+                return &_pSender->m_video;
+        }
+        *_ppFrame = pAudio;
+        return &_pSender->m_audio;
+}
+
+// 一次writev发出本批次的所有消息, 然后归还队列槽位
+static void FlushBatch(RtmpPubSender * _pSender)
+{
+        RtmpPubChunkWriter * pWriter = &_pSender->m_writer;
+
+        if (RtmpPubChunkWriterFlush(pWriter) < 0)
+                atomic_fetch_add(&_pSender->m_nSendErrors, 1);
+        RtmpPubFrameRingReleaseN(&_pSender->m_video, _pSender->m_nVideoInFlight);
+        RtmpPubFrameRingReleaseN(&_pSender->m_audio, _pSender->m_nAudioInFlight);
+        _pSender->m_nVideoInFlight = 0;
+        _pSender->m_nAudioInFlight = 0;
+        atomic_store_explicit(&_pSender->m_nWritevCalls, pWriter->m_nWritevCalls, memory_order_relaxed);
+        atomic_store_explicit(&_pSender->m_nMessages, pWriter->m_nMessages, memory_order_relaxed);
+        atomic_store_explicit(&_pSender->m_nBytes, pWriter->m_nBytes, memory_order_relaxed);
+}
+
+// 写socket失败或者librtmp已经关闭了连接时, 开启了重连就转入断线状态
+static int CheckConnection(RtmpPubSender * _pSender)
+{
+        if (!RtmpPubBackoffEnabled(&_pSender->m_backoff) ||
+            (!RtmpPubChunkWriterFailed(&_pSender->m_writer) && RTMP_IsConnected(_pSender->m_pRtmp->m_pRtmp)))
+                return 0;
+        if (_pSender->m_bConnected)
+                RtmpPubLog("connection lost, errno = %d", _pSender->m_writer.m_nError);
+        _pSender->m_bConnected = 0;
+        return -1;
+}
+
+// 断线期间帧不发送, 只更新音频配置并进入GOP缓存, 队列不会被旧数据占满
+static void DrainToCache(RtmpPubSender * _pSender)
+{
+        RtmpPubFrameRing * pRing;
+        RtmpPubFrame * pFrame;
+        long long int nWaitUs;
+
+        while ((pRing = NextRing(_pSender, &pFrame, &nWaitUs)) != NULL) {
+                if (pFrame->m_nType == RTMP_PUB_FRAME_AUDIO_CONFIG) {
+                        RtmpPubSetAudioTimebase(_pSender->m_pRtmp, pFrame->m_nPts);
+                        RtmpPubUpdateAac(_pSender->m_pRtmp, pFrame->m_pData, pFrame->m_nSize);
+                } else {
+                        RtmpPubGopCacheAdd(&_pSender->m_cache, pFrame);
+                }
+                RtmpPubFrameRingRelease(pRing);
+        }
+}
+
+// 等待新的帧, 最多_nTimeoutUs, 小于0时一直等
+static void WaitWakeup(RtmpPubSender * _pSender, long long int _nTimeoutUs)
+{
+        struct timespec ts;
+
+        if (_nTimeoutUs < 0) {
+                while (sem_wait(&_pSender->m_wakeup) < 0 && errno == EINTR)
+                        ;
+                return;
+        }
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += _nTimeoutUs / 1000000;
+        ts.tv_nsec += _nTimeoutUs % 1000000 * 1000;
+        if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+        }
+        sem_timedwait(&_pSender->m_wakeup, &ts);
+}
+
+static void WaitBackoff(RtmpPubSender * _pSender)
+{
+        long long int nDeadline = RtmpPubNowUs() + (long long int)RtmpPubBackoffNext(&_pSender->m_backoff) * 1000;
+        long long int nNow;
+
+        while (atomic_load(&_pSender->m_bRunning) && (nNow = RtmpPubNowUs()) < nDeadline) {
+                DrainToCache(_pSender);
+                WaitWakeup(_pSender, nDeadline - nNow);
+        }
+        DrainToCache(_pSender);
+}
+
+// 重新publish之后先把缓存的GOP发出去, 时间戳从它的IDR开始重新计算
+static void Replay(RtmpPubSender * _pSender)
+{
+        RtmpPubFrame frame;
+        unsigned int i;
+
+        if (RtmpPubGopCacheCopy(&_pSender->m_replay, &_pSender->m_cache) < 0) {
+                RtmpPubLog("no memory for gop replay");
+                return;
+        }
+        for (i = 0; i < _pSender->m_replay.m_nEntries; i++) {
+                RtmpPubGopCacheGet(&_pSender->m_replay, i, &frame);
+                if (SendFrame(_pSender, &frame, 1) < 0)
+                        atomic_fetch_add(&_pSender->m_nSendErrors, 1);
+                if ((i + 1) % RTMP_PUB_SENDER_MAX_BATCH == 0)
+                        FlushBatch(_pSender);
+        }
+        FlushBatch(_pSender);
+}
+
+static int Reconnect(RtmpPubSender * _pSender)
+{
+        RtmpPubContext * pContext = _pSender->m_pRtmp;
+        struct RTMP * pRtmp = pContext->m_pRtmp;
+        RtmpPubChunkWriter * pWriter = &_pSender->m_writer;
+        unsigned long long nWritevCalls = pWriter->m_nWritevCalls, nMessages = pWriter->m_nMessages, nBytes = pWriter->m_nBytes;
+
+        WaitBackoff(_pSender);
+        if (!atomic_load(&_pSender->m_bRunning))
+                return -1;
+        // 旧连接已经不可用, 不要再在上面发FCUnpublish/deleteStream
+        pRtmp->m_stream_id = 0;
+        RTMP_Close(pRtmp);
+        pRtmp->m_inChunkSize = RTMP_DEFAULT_CHUNKSIZE;
+        pRtmp->m_outChunkSize = RTMP_DEFAULT_CHUNKSIZE;
+        if (RtmpPubConnect(pContext)) {
+                RtmpPubLog("reconnect %s err, errno = %d", pContext->m_pPubUrl, errno);
+                return -1;
+        }
+        RtmpPubChunkWriterDestroy(pWriter);
+        RtmpPubChunkWriterInit(pWriter, pRtmp);
+        RtmpPubDropPolicyLimitSocket(&_pSender->m_drop, pRtmp->m_sb.sb_socket);
+        RtmpPubChunkWriterSetTransport(pWriter, _pSender->m_pTransport, _pSender);
+        // 旧连接上没有发完的一帧已经不完整了
+        RtmpPubSliceTagReset(&_pSender->m_slice);
+        // 统计是整个发送线程累计的
+        pWriter->m_nWritevCalls = nWritevCalls;
+        pWriter->m_nMessages = nMessages;
+        pWriter->m_nBytes = nBytes;
+        pWriter->m_pSendLatency = &_pSender->m_metrics.m_stages[RTMP_PUB_STAGE_SEND];
+        if (_pSender->m_nChunkSize != RTMP_DEFAULT_CHUNKSIZE && RtmpPubSetChunkSize(pContext, _pSender->m_nChunkSize)) {
+                RtmpPubLog("set chunk size after reconnect err, errno = %d", errno);
+                return -1;
+        }
+        _pSender->m_bConnected = 1;
+        _pSender->m_bWaitKey = 1;
+        RtmpPubMetadataReset(&_pSender->m_metadata);
+        RtmpPubBackoffReset(&_pSender->m_backoff);
+        atomic_fetch_add(&_pSender->m_nReconnects, 1);
+        RtmpPubLog("reconnected %s, replay %u cached frames", pContext->m_pPubUrl, _pSender->m_cache.m_nEntries);
+        Replay(_pSender);
+        return CheckConnection(_pSender);
+}
+
+static void * SenderThread(void * _pParam)
+{
+        RtmpPubSender * pSender = (RtmpPubSender *)_pParam;
+        RtmpPubFrameRing * pRing;
+        RtmpPubFrame * pFrame;
+        long long int nWaitUs = -1;
+
+        while (atomic_load(&pSender->m_bRunning)) {
+                // 交错器在等迟到的轨道时, 到时间即使没有新帧也要醒来
+                WaitWakeup(pSender, nWaitUs);
+                nWaitUs = -1;
+                if (!pSender->m_bConnected && Reconnect(pSender) < 0)
+                        continue;
+                while ((pRing = NextRing(pSender, &pFrame, &nWaitUs)) != NULL) {
+                        if (SendFrame(pSender, pFrame, 0) < 0) {
+                                atomic_fetch_add(&pSender->m_nSendErrors, 1);
+                                RtmpPubLog("send frame err, errno = %d", errno);
+                        }
+                        if (pRing == &pSender->m_video)
+                                pSender->m_nVideoInFlight++;
+                        else
+                                pSender->m_nAudioInFlight++;
+                        if (pSender->m_nVideoInFlight + pSender->m_nAudioInFlight >= RTMP_PUB_SENDER_MAX_BATCH)
+                                FlushBatch(pSender);
+                        if (CheckConnection(pSender) < 0)
+                                break;
+                }
+                FlushBatch(pSender);
+                CheckConnection(pSender);
+        }
+        return NULL;
+}
+
+RtmpPubSender * RtmpPubSenderNew(RtmpPubContext * _pRtmp, unsigned int _nVideoSlots, unsigned int _nAudioSlots)
+{
+        RtmpPubSender * pSender = (RtmpPubSender *)calloc(1, sizeof(RtmpPubSender));
+
+        if (!pSender)
+                return NULL;
+        pSender->m_pRtmp = _pRtmp;
+        if (RtmpPubFrameRingInit(&pSender->m_video, _nVideoSlots) < 0)
+                goto err;
+        if (RtmpPubFrameRingInit(&pSender->m_audio, _nAudioSlots) < 0)
+                goto err;
+        if (sem_init(&pSender->m_wakeup, 0, 0) < 0)
+                goto err;
+        atomic_init(&pSender->m_bRunning, 0);
+        atomic_init(&pSender->m_nSendErrors, 0);
+        atomic_init(&pSender->m_nWritevCalls, 0);
+        atomic_init(&pSender->m_nMessages, 0);
+        atomic_init(&pSender->m_nBytes, 0);
+        atomic_init(&pSender->m_nReconnects, 0);
+        atomic_init(&pSender->m_nParamChanges, 0);
+        RtmpPubBackoffInit(&pSender->m_backoff, NULL);
+        RtmpPubMetricsInit(&pSender->m_metrics);
+        RtmpPubTranscoderInit(&pSender->m_transcoder);
+        RtmpPubMetadataInit(&pSender->m_metadata);
+        RtmpPubSliceTagInit(&pSender->m_slice);
+        RtmpPubInterleaverInit(&pSender->m_interleave, RTMP_PUB_TRACK_COUNT, NULL);
+        RtmpPubHevcParamsInit(&pSender->m_hevc);
+        RtmpPubAdtsDemuxerInit(&pSender->m_adts);
+        return pSender;
+err:
+        RtmpPubFrameRingDestroy(&pSender->m_video);
+        RtmpPubFrameRingDestroy(&pSender->m_audio);
+        free(pSender);
+        return NULL;
+}
+
+void RtmpPubSenderSetDropPolicy(RtmpPubSender * _pSender, const RtmpPubDropConfig * _pConfig)
+{
+        RtmpPubDropPolicyInit(&_pSender->m_drop, _pConfig);
+}
+
+void RtmpPubSenderSetReconnect(RtmpPubSender * _pSender, const RtmpPubReconnectConfig * _pConfig)
+{
+        RtmpPubBackoffInit(&_pSender->m_backoff, _pConfig);
+        RtmpPubGopCacheInit(&_pSender->m_cache, _pConfig ? _pConfig->m_nGopCacheBytes : 0);
+        RtmpPubGopCacheInit(&_pSender->m_replay, _pConfig ? _pConfig->m_nGopCacheBytes : 0);
+}
+
+void RtmpPubSenderSetSliceBudget(RtmpPubSender * _pSender, unsigned int _nKeyBytes, unsigned int _nInterBytes)
+{
+        RtmpPubSliceTagSetBudget(&_pSender->m_slice, _nKeyBytes, _nInterBytes);
+}
+
+void RtmpPubSenderSetInterleave(RtmpPubSender * _pSender, const RtmpPubInterleaveConfig * _pConfig)
+{
+        RtmpPubInterleaverInit(&_pSender->m_interleave, RTMP_PUB_TRACK_COUNT, _pConfig);
+}
+
+void RtmpPubSenderSetVideoCodec(RtmpPubSender * _pSender, RtmpPubVideoCodec _nCodec)
+{
+        _pSender->m_nVideoCodec = _nCodec;
+}
+
+void RtmpPubSenderSetTransport(RtmpPubSender * _pSender, RtmpPubTransportType _nType)
+{
+        _pSender->m_nTransportType = _nType;
+}
+
+int RtmpPubSenderStart(RtmpPubSender * _pSender)
+{
+        RtmpPubChunkWriterInit(&_pSender->m_writer, _pSender->m_pRtmp->m_pRtmp);
+        RtmpPubDropPolicyLimitSocket(&_pSender->m_drop, _pSender->m_pRtmp->m_pRtmp->m_sb.sb_socket);
+        _pSender->m_writer.m_pSendLatency = &_pSender->m_metrics.m_stages[RTMP_PUB_STAGE_SEND];
+        // 只有发送线程写socket, 用同步模式, 每次Flush提交之后就等完成
+        _pSender->m_pTransport = RtmpPubTransportNew(_pSender->m_nTransportType, 0);
+        RtmpPubChunkWriterSetTransport(&_pSender->m_writer, _pSender->m_pTransport, _pSender);
+        _pSender->m_nChunkSize = _pSender->m_pRtmp->m_pRtmp->m_outChunkSize;
+        _pSender->m_bConnected = 1;
+        atomic_store(&_pSender->m_bRunning, 1);
+        if (pthread_create(&_pSender->m_thread, NULL, SenderThread, _pSender)) {
+                atomic_store(&_pSender->m_bRunning, 0);
+                return -1;
+        }
+        return 0;
+}
+
+void RtmpPubSenderDel(RtmpPubSender * _pSender)
+{
+        if (!_pSender)
+                return;
+        if (atomic_exchange(&_pSender->m_bRunning, 0)) {
+                sem_post(&_pSender->m_wakeup);
+                pthread_join(_pSender->m_thread, NULL);
+        }
+        sem_destroy(&_pSender->m_wakeup);
+        RtmpPubChunkWriterDestroy(&_pSender->m_writer);
+        RtmpPubTransportDel(_pSender->m_pTransport);
+        RtmpPubFrameRingDestroy(&_pSender->m_video);
+        RtmpPubFrameRingDestroy(&_pSender->m_audio);
+        RtmpPubGopCacheDestroy(&_pSender->m_cache);
+        RtmpPubGopCacheDestroy(&_pSender->m_replay);
+        RtmpPubTranscoderDestroy(&_pSender->m_transcoder);
+        RtmpPubSliceTagDestroy(&_pSender->m_slice);
+        RtmpPubHevcParamsDestroy(&_pSender->m_hevc);
+        free(_pSender);
+}
+
+static int CommitFrame(RtmpPubSender * _pSender, RtmpPubFrameRing * _pRing, RtmpPubFrame * _pFrame, RtmpPubFrameType _nType,
+                       unsigned int _nPts, int _bIsKey)
+{
+        if (!_pFrame)
+                return -1;
+        _pFrame->m_nType = _nType;
+        _pFrame->m_nPts = _nPts;
+        _pFrame->m_bIsKey = _bIsKey;
+        RtmpPubFrameRingCommit(_pRing);
+        sem_post(&_pSender->m_wakeup);
+        return 0;
+}
+
+static int PushFrame(RtmpPubSender * _pSender, RtmpPubFrameRing * _pRing, RtmpPubFrameType _nType,
+                     const char * _pData, unsigned int _nSize, unsigned int _nPts, int _bIsKey)
+{
+        RtmpPubFrame * pFrame = RtmpPubFrameRingReserve(_pRing, _nSize);
+
+        if (pFrame)
+                memcpy(pFrame->m_pData, _pData, _nSize);
+        return CommitFrame(_pSender, _pRing, pFrame, _nType, _nPts, _bIsKey);
+}
+
+int RtmpPubSenderPushAccessUnit(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, RtmpPubAuFormat _nFormat,
+                                unsigned int _nPts, int _bIsKey)
+{
+        return PushFrame(_pSender, &_pSender->m_video, _nFormat == RTMP_PUB_AU_AVCC ? RTMP_PUB_FRAME_VIDEO_AVCC : RTMP_PUB_FRAME_VIDEO,
+                         _pData, _nSize, _nPts, _bIsKey);
+}
+
+int RtmpPubSenderPushVideo(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, unsigned int _nPts, int _bIsKey)
+{
+        return RtmpPubSenderPushAccessUnit(_pSender, _pData, _nSize, RTMP_PUB_AU_ANNEXB, _nPts, _bIsKey);
+}
+
+int RtmpPubSenderPushSlice(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, unsigned int _nPts, int _bIsKey,
+                           int _bIsLast)
+{
+        RtmpPubFrame * pFrame;
+        int bFirst = !_pSender->m_bSliceOpen;
+
+        if (_pSender->m_nVideoCodec != RTMP_PUB_VIDEO_H264)
+                return -1;
+        _pSender->m_bSliceOpen = !_bIsLast;
+        if (bFirst)
+                _pSender->m_bSliceDropped = 0;
+        if (_pSender->m_bSliceDropped)
+                return -1;
+        if ((pFrame = RtmpPubFrameRingReserve(&_pSender->m_video, _nSize)) != NULL) {
+                memcpy(pFrame->m_pData, _pData, _nSize);
+                pFrame->m_nSliceFlags = (bFirst ? RTMP_PUB_SLICE_FIRST : 0) | (_bIsLast ? RTMP_PUB_SLICE_LAST : 0);
+        }
+        if (CommitFrame(_pSender, &_pSender->m_video, pFrame, RTMP_PUB_FRAME_VIDEO_SLICE, _nPts, _bIsKey) < 0) {
+                _pSender->m_bSliceDropped = 1;
+                return -1;
+        }
+        return 0;
+}
+
+int RtmpPubSenderPushAudio(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return PushFrame(_pSender, &_pSender->m_audio, RTMP_PUB_FRAME_AUDIO, _pData, _nSize, _nPts, 0);
+}
+
+int RtmpPubSenderPushVideoBuffer(RtmpPubSender * _pSender, RtmpPubBuffer * _pBuffer, unsigned int _nPts, int _bIsKey)
+{
+        return CommitFrame(_pSender, &_pSender->m_video, RtmpPubFrameRingReserveBuffer(&_pSender->m_video, _pBuffer),
+                           RTMP_PUB_FRAME_VIDEO, _nPts, _bIsKey);
+}
+
+int RtmpPubSenderPushAudioBuffer(RtmpPubSender * _pSender, RtmpPubBuffer * _pBuffer, unsigned int _nPts)
+{
+        return CommitFrame(_pSender, &_pSender->m_audio, RtmpPubFrameRingReserveBuffer(&_pSender->m_audio, _pBuffer),
+                           RTMP_PUB_FRAME_AUDIO, _nPts, 0);
+}
+
+int RtmpPubSenderPushAudioConfig(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return PushFrame(_pSender, &_pSender->m_audio, RTMP_PUB_FRAME_AUDIO_CONFIG, _pData, _nSize, _nPts, 0);
+}
+
+static int OnAdtsConfig(void * _pOpaque, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return RtmpPubSenderPushAudioConfig((RtmpPubSender *)_pOpaque, _pData, _nSize, _nPts);
+}
+
+static int OnAdtsFrame(void * _pOpaque, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return RtmpPubSenderPushAudio((RtmpPubSender *)_pOpaque, _pData, _nSize, _nPts);
+}
+
+int RtmpPubSenderPushAdts(RtmpPubSender * _pSender, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        RtmpPubAdtsOutput output = { OnAdtsConfig, OnAdtsFrame, _pSender };
+
+        return RtmpPubAdtsDemuxerPush(&_pSender->m_adts, _pData, _nSize, _nPts, &output);
+}
+
+void RtmpPubSenderGetStats(RtmpPubSender * _pSender, RtmpPubRingStats * _pVideo, RtmpPubRingStats * _pAudio)
+{
+        if (_pVideo)
+                RtmpPubFrameRingGetStats(&_pSender->m_video, _pVideo);
+        if (_pAudio)
+                RtmpPubFrameRingGetStats(&_pSender->m_audio, _pAudio);
+}
+
+// 拥塞丢帧的计数由发送线程更新, 这里只做统计展示
+void RtmpPubSenderGetDropStats(RtmpPubSender * _pSender, RtmpPubDropStats * _pStats)
+{
+        RtmpPubDropPolicyGetStats(&_pSender->m_drop, _pStats);
+}
+
+void RtmpPubSenderGetInterleaveStats(RtmpPubSender * _pSender, RtmpPubInterleaveStats * _pStats)
+{
+        RtmpPubInterleaverGetStats(&_pSender->m_interleave, _pStats);
+}
+
+unsigned long long RtmpPubSenderGetParamChanges(RtmpPubSender * _pSender)
+{
+        return atomic_load_explicit(&_pSender->m_nParamChanges, memory_order_relaxed);
+}
+
+void RtmpPubSenderGetWriteStats(RtmpPubSender * _pSender, unsigned long long * _pWritevCalls, unsigned long long * _pMessages,
+                                unsigned long long * _pBytes)
+{
+        *_pWritevCalls = atomic_load_explicit(&_pSender->m_nWritevCalls, memory_order_relaxed);
+        *_pMessages = atomic_load_explicit(&_pSender->m_nMessages, memory_order_relaxed);
+        *_pBytes = atomic_load_explicit(&_pSender->m_nBytes, memory_order_relaxed);
+}
+
+unsigned long long RtmpPubSenderGetReconnects(RtmpPubSender * _pSender)
+{
+        return atomic_load_explicit(&_pSender->m_nReconnects, memory_order_relaxed);
+}
+
+const char * RtmpPubSenderGetTransport(RtmpPubSender * _pSender, RtmpPubTransportStats * _pStats)
+{
+        RtmpPubTransport * pTransport = _pSender->m_pTransport ? _pSender->m_pTransport : RtmpPubSocketTransport();
+
+        RtmpPubTransportGetStats(pTransport, _pStats);
+        return pTransport->m_pName;
+}
+
+void RtmpPubSenderGetMetrics(RtmpPubSender * _pSender, RtmpPubMetricsSnapshot * _pSnapshot)
+{
+        RtmpPubMetricsGetSnapshot(&_pSender->m_metrics, _pSnapshot);
+        _pSnapshot->m_tracks[RTMP_PUB_TRACK_VIDEO].m_nDropped += atomic_load_explicit(&_pSender->m_video.m_nDropped, memory_order_relaxed);
+        _pSnapshot->m_tracks[RTMP_PUB_TRACK_AUDIO].m_nDropped += atomic_load_explicit(&_pSender->m_audio.m_nDropped, memory_order_relaxed);
+        _pSnapshot->m_nReconnects = atomic_load_explicit(&_pSender->m_nReconnects, memory_order_relaxed);
+        _pSnapshot->m_nSendErrors = atomic_load_explicit(&_pSender->m_nSendErrors, memory_order_relaxed);
+}
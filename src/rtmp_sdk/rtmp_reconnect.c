@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rtmp_reconnect.h"
+#include "rtmp_publish_nalu.h"
+
+void RtmpPubBackoffInit(RtmpPubBackoff * _pBackoff, const RtmpPubReconnectConfig * _pConfig)
+{
+        memset(_pBackoff, 0, sizeof(*_pBackoff));
+        if (_pConfig)
+                _pBackoff->m_config = *_pConfig;
+        if (!_pBackoff->m_config.m_nMaxDelayMs)
+                _pBackoff->m_config.m_nMaxDelayMs = RTMP_PUB_RECONNECT_MAX_DELAY_MS;
+        if (_pBackoff->m_config.m_nMaxDelayMs < _pBackoff->m_config.m_nMinDelayMs)
+                _pBackoff->m_config.m_nMaxDelayMs = _pBackoff->m_config.m_nMinDelayMs;
+        _pBackoff->m_nDelayMs = _pBackoff->m_config.m_nMinDelayMs;
+        _pBackoff->m_nSeed = (unsigned int)(RtmpPubNowUs() ^ (long long int)(size_t)_pBackoff);
+}
+
+unsigned int RtmpPubBackoffNext(RtmpPubBackoff * _pBackoff)
+{
+        unsigned int nDelay = _pBackoff->m_nDelayMs;
+
+        if (_pBackoff->m_nDelayMs < _pBackoff->m_config.m_nMaxDelayMs / 2)
+                _pBackoff->m_nDelayMs *= 2;
+        else
+                _pBackoff->m_nDelayMs = _pBackoff->m_config.m_nMaxDelayMs;
+        return nDelay - nDelay / 2 + (unsigned int)rand_r(&_pBackoff->m_nSeed) % (nDelay / 2 + 1);
+}
+
+void RtmpPubBackoffReset(RtmpPubBackoff * _pBackoff)
+{
+        _pBackoff->m_nDelayMs = _pBackoff->m_config.m_nMinDelayMs;
+}
+
+void RtmpPubGopCacheInit(RtmpPubGopCache * _pCache, unsigned int _nBytes)
+{
+        memset(_pCache, 0, sizeof(*_pCache));
+        _pCache->m_nCapacity = _nBytes;
+}
+
+void RtmpPubGopCacheClear(RtmpPubGopCache * _pCache)
+{
+        unsigned int i;
+
+        for (i = 0; i < _pCache->m_nEntries; i++)
+                RtmpPubBufferUnref(_pCache->m_pEntries[i].m_pBuffer);
+        _pCache->m_nEntries = 0;
+        _pCache->m_nUsed = 0;
+}
+
+void RtmpPubGopCacheDestroy(RtmpPubGopCache * _pCache)
+{
+        RtmpPubGopCacheClear(_pCache);
+        free(_pCache->m_pEntries);
+        _pCache->m_pEntries = NULL;
+}
+
+static int Alloc(RtmpPubGopCache * _pCache)
+{
+        if (_pCache->m_pEntries)
+                return 0;
+        _pCache->m_pEntries = (RtmpPubGopEntry *)malloc(RTMP_PUB_GOP_CACHE_MAX_FRAMES * sizeof(RtmpPubGopEntry));
+        return _pCache->m_pEntries ? 0 : -1;
+}
+
+void RtmpPubGopCacheAdd(RtmpPubGopCache * _pCache, const RtmpPubFrame * _pFrame)
+{
+        RtmpPubGopEntry * pEntry;
+        int bIsKey;
+
+        if (!_pCache->m_nCapacity || Alloc(_pCache) < 0)
+                return;
+        // 采集端给的关键帧标记不一定可靠, 以码流里的IDR为准
+        bIsKey = (_pFrame->m_nType == RTMP_PUB_FRAME_VIDEO &&
+                  (_pFrame->m_bIsKey || RtmpPubAnnexbIsIdr(_pFrame->m_pData, _pFrame->m_nSize))) ||
+                 ((_pFrame->m_nType == RTMP_PUB_FRAME_VIDEO_TAG || _pFrame->m_nType == RTMP_PUB_FRAME_VIDEO_AVCC) &&
+                  _pFrame->m_bIsKey) ||
+                 (_pFrame->m_nType == RTMP_PUB_FRAME_VIDEO_SLICE && (_pFrame->m_nSliceFlags & RTMP_PUB_SLICE_FIRST) &&
+                  (_pFrame->m_bIsKey || RtmpPubAnnexbIsIdr(_pFrame->m_pData, _pFrame->m_nSize)));
+        if (bIsKey)
+                RtmpPubGopCacheClear(_pCache);
+        else if (!_pCache->m_nEntries)
+                return;
+        if (_pCache->m_nUsed + _pFrame->m_pBuffer->m_nCapacity > _pCache->m_nCapacity ||
+            _pCache->m_nEntries == RTMP_PUB_GOP_CACHE_MAX_FRAMES) {
+                // 不完整的GOP重发出去也无法解码, 直接放弃
+                RtmpPubGopCacheClear(_pCache);
+                _pCache->m_nOverflows++;
+                return;
+        }
+        pEntry = &_pCache->m_pEntries[_pCache->m_nEntries++];
+        pEntry->m_nType = _pFrame->m_nType;
+        pEntry->m_nPts = _pFrame->m_nPts;
+        pEntry->m_bIsKey = bIsKey;
+        pEntry->m_bIsReference = _pFrame->m_bIsReference;
+        pEntry->m_nSliceFlags = _pFrame->m_nSliceFlags;
+        pEntry->m_pBuffer = _pFrame->m_pBuffer;
+        RtmpPubBufferRef(pEntry->m_pBuffer);
+        _pCache->m_nUsed += pEntry->m_pBuffer->m_nCapacity;
+}
+
+int RtmpPubGopCacheCopy(RtmpPubGopCache * _pDst, const RtmpPubGopCache * _pSrc)
+{
+        unsigned int i;
+
+        RtmpPubGopCacheClear(_pDst);
+        if (!_pSrc->m_nEntries)
+                return 0;
+        if (_pDst->m_nCapacity < _pSrc->m_nUsed || Alloc(_pDst) < 0)
+                return -1;
+        memcpy(_pDst->m_pEntries, _pSrc->m_pEntries, _pSrc->m_nEntries * sizeof(RtmpPubGopEntry));
+        for (i = 0; i < _pSrc->m_nEntries; i++)
+                RtmpPubBufferRef(_pDst->m_pEntries[i].m_pBuffer);
+        _pDst->m_nUsed = _pSrc->m_nUsed;
+        _pDst->m_nEntries = _pSrc->m_nEntries;
+        return 0;
+}
+
+void RtmpPubGopCacheGet(RtmpPubGopCache * _pCache, unsigned int _nIndex, RtmpPubFrame * _pFrame)
+{
+        RtmpPubGopEntry * pEntry = &_pCache->m_pEntries[_nIndex];
+
+        memset(_pFrame, 0, sizeof(*_pFrame));
+        _pFrame->m_nType = pEntry->m_nType;
+        _pFrame->m_nPts = pEntry->m_nPts;
+        _pFrame->m_bIsKey = pEntry->m_bIsKey;
+        _pFrame->m_bIsReference = pEntry->m_bIsReference;
+        _pFrame->m_nSliceFlags = pEntry->m_nSliceFlags;
+        _pFrame->m_pBuffer = pEntry->m_pBuffer;
+        _pFrame->m_pData = pEntry->m_pBuffer->m_pData;
+        _pFrame->m_nSize = pEntry->m_pBuffer->m_nSize;
+        _pFrame->m_nEnqueueTime = RtmpPubNowUs();
+}
@@ -0,0 +1,1002 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include "rtmp_engine_internal.h"
+#include "rtmp_publish_internal.h"
+#include "rtmp_publish_audio.h"
+#include "rtmp_channel_table.h"
+
+#define RTMP_PUB_HANDSHAKE_VERSION      3
+#define RTMP_PUB_HANDSHAKE_SIZE         1536
+#define RTMP_PUB_COMMAND_CHANNEL        3
+#define RTMP_PUB_CONTROL_CHANNEL        2
+#define RTMP_PUB_RECV_INITIAL           4096
+#define RTMP_PUB_RECV_MAX               (1 << 20)
+#define RTMP_PUB_SESSION_MAX_ROUNDS     4       // 一次通知最多发送的批次, 超过后让出给其它session
+#define RTMP_PUB_USER_CONTROL_PING      6
+#define RTMP_PUB_USER_CONTROL_PONG      7
+#define RTMP_PUB_PIPELINE_STREAM_ID     1       // 流水线publish时假定的流id
+
+static const char * s_stateNames[] = { "init", "connecting", "handshake", "commands", "publishing", "reconnect wait", "closed" };
+
+// 回到刚创建时的状态, 只保留GOP缓存、重连退避和时间戳
+static void ResetConnection(RtmpPubSession * _pSession)
+{
+        RtmpPubChunkWriter * pWriter = &_pSession->m_writer;
+        unsigned long long nWritevCalls = pWriter->m_nWritevCalls, nMessages = pWriter->m_nMessages, nBytes = pWriter->m_nBytes;
+
+        // io_uring上还有发送时它持有socket的引用, 先取消, close之后连接才会真正关闭
+        RtmpPubChunkWriterDestroy(pWriter);
+        if (_pSession->m_nSocket >= 0) {
+                // close会把socket从epoll里删除
+                close(_pSession->m_nSocket);
+                _pSession->m_nSocket = -1;
+                _pSession->m_nEvents = 0;
+        }
+        RtmpPubChunkWriterInitSocket(pWriter, -1, RTMP_DEFAULT_CHUNKSIZE);
+        // 统计是整个session累计的
+        pWriter->m_nWritevCalls = nWritevCalls;
+        pWriter->m_nMessages = nMessages;
+        pWriter->m_nBytes = nBytes;
+        pWriter->m_pSendLatency = &_pSession->m_metrics.m_stages[RTMP_PUB_STAGE_SEND];
+        // 已经交给writer的帧在GOP缓存里都有
+        RtmpPubFrameRingReleaseN(&_pSession->m_video, _pSession->m_nVideoInFlight);
+        RtmpPubFrameRingReleaseN(&_pSession->m_audio, _pSession->m_nAudioInFlight);
+        _pSession->m_nVideoInFlight = 0;
+        _pSession->m_nAudioInFlight = 0;
+        _pSession->m_nReplayNext = _pSession->m_replay.m_nEntries;
+        _pSession->m_nReplayInFlight = 0;
+        RtmpPubChunkReaderDestroy(&_pSession->m_reader);
+        RtmpPubChunkReaderInit(&_pSession->m_reader, _pSession->m_reader.m_pCallback, _pSession);
+        _pSession->m_nRecvSize = 0;
+        free(_pSession->m_pHandshake);
+        _pSession->m_pHandshake = NULL;
+        _pSession->m_bC2Queued = 0;
+        _pSession->m_nTransactionId = 0;
+        _pSession->m_nConnectTransaction = 0;
+        _pSession->m_nCreateStreamTransaction = 0;
+        _pSession->m_nPublishTransaction = 0;
+        _pSession->m_bConnectDone = 0;
+        RtmpPubMetadataReset(&_pSession->m_metadata);
+        memset(&_pSession->m_timing.m_nTcpUs, 0, sizeof(RtmpPubConnectTiming) - offsetof(RtmpPubConnectTiming, m_nTcpUs));
+        _pSession->m_pRtmp->m_pRtmp->m_stream_id = 0;
+}
+
+static void Fail(RtmpPubSession * _pSession, const char * _pReason)
+{
+        unsigned int nDelayMs;
+
+        RtmpPubLog("session %s %s in state %s, errno = %d", _pSession->m_pUrl, _pReason,
+                   s_stateNames[atomic_load(&_pSession->m_nState)], errno);
+        ResetConnection(_pSession);
+        if (!RtmpPubBackoffEnabled(&_pSession->m_backoff)) {
+                atomic_store(&_pSession->m_nState, RTMP_PUB_SESSION_CLOSED);
+                RtmpPubWorkerCancelTimer(_pSession);
+                return;
+        }
+        nDelayMs = RtmpPubBackoffNext(&_pSession->m_backoff);
+        atomic_store(&_pSession->m_nState, RTMP_PUB_SESSION_RECONNECT_WAIT);
+        RtmpPubWorkerSetTimer(_pSession, RtmpPubNowUs() + (long long int)nDelayMs * 1000);
+}
+
+static void SetState(RtmpPubSession * _pSession, RtmpPubSessionState _nState)
+{
+        atomic_store(&_pSession->m_nState, _nState);
+        if (_nState < RTMP_PUB_SESSION_PUBLISHING)
+                RtmpPubWorkerSetTimer(_pSession, RtmpPubNowUs() + (long long int)_pSession->m_config.m_nTimeout * 1000000);
+        else
+                RtmpPubWorkerCancelTimer(_pSession);
+}
+
+static void ReleaseInFlight(RtmpPubSession * _pSession)
+{
+        RtmpPubChunkWriter * pWriter = &_pSession->m_writer;
+
+        RtmpPubFrameRingReleaseN(&_pSession->m_video, _pSession->m_nVideoInFlight);
+        RtmpPubFrameRingReleaseN(&_pSession->m_audio, _pSession->m_nAudioInFlight);
+        _pSession->m_nVideoInFlight = 0;
+        _pSession->m_nAudioInFlight = 0;
+        _pSession->m_nReplayInFlight = 0;
+        atomic_store_explicit(&_pSession->m_nWritevCalls, pWriter->m_nWritevCalls, memory_order_relaxed);
+        atomic_store_explicit(&_pSession->m_nMessages, pWriter->m_nMessages, memory_order_relaxed);
+        atomic_store_explicit(&_pSession->m_nBytes, pWriter->m_nBytes, memory_order_relaxed);
+}
+
+// 返回0表示已经全部写出, 1表示等待EPOLLOUT(或者传输层的完成事件), -1表示session已经失败
+static int Flush(RtmpPubSession * _pSession)
+{
+        int ret = RtmpPubChunkWriterFlush(&_pSession->m_writer);
+        int bWaitWritable = ret > 0 && !RtmpPubChunkWriterInFlight(&_pSession->m_writer);
+
+        if (ret < 0) {
+                Fail(_pSession, "write failed");
+                return -1;
+        }
+        if (ret == 0)
+                ReleaseInFlight(_pSession);
+        if (RtmpPubWorkerWatch(_pSession, EPOLLIN | EPOLLRDHUP | (bWaitWritable ? EPOLLOUT : 0)) < 0) {
+                Fail(_pSession, "epoll failed");
+                return -1;
+        }
+        return ret;
+}
+
+static int QueueInvoke(RtmpPubSession * _pSession, int _nChannel, int32_t _nStreamId, const char * _pBody, unsigned int _nSize)
+{
+        struct iovec iov;
+
+        if (RtmpPubChunkWriterReserve(&_pSession->m_writer, _nSize) < 0)
+                return -1;
+        iov.iov_base = RtmpPubChunkWriterAlloc(&_pSession->m_writer, _nSize);
+        iov.iov_len = _nSize;
+        memcpy(iov.iov_base, _pBody, _nSize);
+        return RtmpPubChunkWriterQueue(&_pSession->m_writer, _nChannel, RTMP_PACKET_TYPE_INVOKE, RTMP_PACKET_SIZE_MEDIUM,
+                                       0, _nStreamId, &iov, 1);
+}
+
+// 命令在创建会话时已经编码好, 这里只改写事务id
+static int QueueCommand(RtmpPubSession * _pSession, RtmpPubCommand _nCommand, int _nChannel, int32_t _nStreamId,
+                        int _nTransaction)
+{
+        unsigned int nSize;
+        const char * pBody = RtmpPubCommandSetGet(&_pSession->m_commands, _nCommand, _nTransaction, &nSize);
+
+        return QueueInvoke(_pSession, _nChannel, _nStreamId, pBody, nSize);
+}
+
+static int QueueControl(RtmpPubSession * _pSession, uint8_t _nType, const char * _pBody, unsigned int _nSize)
+{
+        struct iovec iov;
+
+        if (RtmpPubChunkWriterReserve(&_pSession->m_writer, _nSize) < 0)
+                return -1;
+        iov.iov_base = RtmpPubChunkWriterAlloc(&_pSession->m_writer, _nSize);
+        iov.iov_len = _nSize;
+        memcpy(iov.iov_base, _pBody, _nSize);
+        return RtmpPubChunkWriterQueue(&_pSession->m_writer, RTMP_PUB_CONTROL_CHANNEL, _nType, RTMP_PACKET_SIZE_LARGE,
+                                       0, 0, &iov, 1);
+}
+
+// 两个轨道都有数据时取时间戳小的, 已经在本批次里的帧跳过
+static RtmpPubFrameRing * NextRing(RtmpPubSession * _pSession, RtmpPubFrame ** _ppFrame)
+{
+        RtmpPubFrame * pVideo = RtmpPubFrameRingPeekAt(&_pSession->m_video, _pSession->m_nVideoInFlight);
+        RtmpPubFrame * pAudio = RtmpPubFrameRingPeekAt(&_pSession->m_audio, _pSession->m_nAudioInFlight);
+
+        if (pVideo && (!pAudio || (int)(pAudio->m_nPts - pVideo->m_nPts) >= 0)) {
+                *_ppFrame = pVideo;
+                return &_pSession->m_video;
+        }
+        if (pAudio) {
+                *_ppFrame = pAudio;
+                return &_pSession->m_audio;
+        }
+        return NULL;
+}
+
+// 封装耗时扣除其中写socket的时间, 写socket单独记在RTMP_PUB_STAGE_SEND
+static void RecordSerialize(RtmpPubSession * _pSession, long long int _nStart, unsigned long long _nSendNs)
+{
+        RtmpPubMetricsRecord(&_pSession->m_metrics, RTMP_PUB_STAGE_SERIALIZE,
+                             RtmpPubNowNs() - _nStart - (_pSession->m_writer.m_nSendNs - _nSendNs));
+}
+
+// 音视频配置只更新状态, 不直接发送, 返回0表示不是配置帧
+static int ApplyConfig(RtmpPubSession * _pSession, RtmpPubFrame * _pFrame)
+{
+        RtmpPubContext * pRtmp = _pSession->m_pRtmp;
+
+        switch (_pFrame->m_nType) {
+        case RTMP_PUB_FRAME_AUDIO_CONFIG:
+                RtmpPubSetAudioTimebase(pRtmp, _pFrame->m_nPts);
+                RtmpPubUpdateAac(pRtmp, _pFrame->m_pData, _pFrame->m_nSize);
+                return 1;
+        case RTMP_PUB_FRAME_VIDEO_CONFIG:
+                if (!_pSession->m_bVideoTimebaseSet) {
+                        RtmpPubSetVideoTimebase(pRtmp, _pFrame->m_nPts);
+                        _pSession->m_bVideoTimebaseSet = 1;
+                }
+                RtmpPubMetadataSetAvcConfig(&_pSession->m_metadata, _pFrame->m_pData, _pFrame->m_nSize);
+                RtmpPubBufferRef(_pFrame->m_pBuffer);
+                RtmpPubBufferUnref(_pSession->m_pVideoConfig);
+                _pSession->m_pVideoConfig = _pFrame->m_pBuffer;
+                pRtmp->m_nIsVideoConfigSent = 0;
+                return 1;
+        default:
+                return 0;
+        }
+}
+
+// 参数有变化或者新连接上还没有发送过时先发onMetaData, 失败不影响音视频
+static void WriteMetadata(RtmpPubSession * _pSession)
+{
+        RtmpPubMetadataUpdate(&_pSession->m_metadata, _pSession->m_pRtmp);
+        if (RtmpPubWriteMetadata(&_pSession->m_writer, &_pSession->m_metadata, _pSession->m_pRtmp->m_pRtmp->m_stream_id) < 0)
+                RtmpPubLog("session %s write metadata err", _pSession->m_pUrl);
+}
+
+// _bReplay为1时是重发GOP缓存里的帧, 不再进入缓存, 也不按排队延时丢帧
+static int SendFrame(RtmpPubSession * _pSession, RtmpPubFrame * _pFrame, int _bReplay)
+{
+        RtmpPubContext * pRtmp = _pSession->m_pRtmp;
+        RtmpPubMetrics * pMetrics = &_pSession->m_metrics;
+        RtmpPubBuffer * pConfig = _pSession->m_pVideoConfig;
+        int nVcl = 0, bIsKey = 0, bIsReference = 0, ret;
+        long long int nLatencyUs = 0, nStart;
+        unsigned long long nSendNs;
+
+        if (ApplyConfig(_pSession, _pFrame))
+                return 0;
+        // 先进入缓存, 被缓存引用的帧发送时不会原地改写
+        if (!_bReplay) {
+                RtmpPubGopCacheAdd(&_pSession->m_cache, _pFrame);
+                nLatencyUs = RtmpPubNowUs() - _pFrame->m_nEnqueueTime;
+                RtmpPubMetricsRecord(pMetrics, RTMP_PUB_STAGE_QUEUE, nLatencyUs * 1000);
+        }
+        switch (_pFrame->m_nType) {
+        case RTMP_PUB_FRAME_VIDEO:
+        case RTMP_PUB_FRAME_VIDEO_TAG:
+                if (_pFrame->m_nType == RTMP_PUB_FRAME_VIDEO) {
+                        nStart = RtmpPubNowNs();
+                        nVcl = RtmpPubPrepareVideoFrame(pRtmp, &_pSession->m_avc, _pFrame->m_pData, _pFrame->m_nSize,
+                                                        RTMP_PUB_AU_ANNEXB, _pFrame->m_nPts,
+                                                        !RtmpPubBufferShared(_pFrame->m_pBuffer), _pSession->m_nalus,
+                                                        RTMP_PUB_MAX_TAG_NALUS, &_pSession->m_bVideoTimebaseSet, &bIsKey, &bIsReference);
+                        if (nVcl < 0)
+                                return -1;
+                        RtmpPubMetricsRecord(pMetrics, RTMP_PUB_STAGE_CONVERT, RtmpPubNowNs() - nStart);
+                } else {
+                        // 分发端已经转换过了
+                        bIsKey = _pFrame->m_bIsKey;
+                        bIsReference = _pFrame->m_bIsReference;
+                }
+                if (_pSession->m_bWaitKey) {
+                        if (!bIsKey) {
+                                RtmpPubMetricsAddDrop(pMetrics, RTMP_PUB_TRACK_VIDEO);
+                                return 0;
+                        }
+                        _pSession->m_bWaitKey = 0;
+                        RtmpPubRebaseTimestamps(pRtmp, _pFrame->m_nPts);
+                }
+                if (!_bReplay && RtmpPubDropPolicyCheck(&_pSession->m_drop, bIsKey, bIsReference, nLatencyUs)) {
+                        RtmpPubMetricsAddDrop(pMetrics, RTMP_PUB_TRACK_VIDEO);
+                        return 0;
+                }
+                // sps只会随关键帧变化
+                if (bIsKey)
+                        WriteMetadata(_pSession);
+                nStart = RtmpPubNowNs();
+                nSendNs = _pSession->m_writer.m_nSendNs;
+                if (_pFrame->m_nType == RTMP_PUB_FRAME_VIDEO)
+                        ret = RtmpPubWriteVideoNalus(&_pSession->m_writer, pRtmp, _pSession->m_nalus, nVcl, bIsKey, _pFrame->m_nPts);
+                else
+                        ret = RtmpPubWriteVideoTag(&_pSession->m_writer, pRtmp, pConfig ? pConfig->m_pData : NULL,
+                                                   pConfig ? pConfig->m_nSize : 0, _pFrame->m_pData, _pFrame->m_nSize,
+                                                   bIsKey, _pFrame->m_nPts);
+                RecordSerialize(_pSession, nStart, nSendNs);
+                if (ret == 0)
+                        RtmpPubMetricsAddFrame(pMetrics, RTMP_PUB_TRACK_VIDEO, _pFrame->m_nSize);
+                return ret;
+        case RTMP_PUB_FRAME_AUDIO:
+                if (_pSession->m_bWaitKey) {
+                        // 有视频时音频等视频关键帧一起开始, 纯音频流直接从这一帧开始
+                        if (_pSession->m_bVideoTimebaseSet) {
+                                RtmpPubMetricsAddDrop(pMetrics, RTMP_PUB_TRACK_AUDIO);
+                                return 0;
+                        }
+                        _pSession->m_bWaitKey = 0;
+                        RtmpPubRebaseTimestamps(pRtmp, _pFrame->m_nPts);
+                }
+                WriteMetadata(_pSession);
+                nStart = RtmpPubNowNs();
+                nSendNs = _pSession->m_writer.m_nSendNs;
+                if (pRtmp->m_nAudioInputType == RTMP_PUB_AUDIO_AAC) {
+                        ret = RtmpPubWriteAacFrame(&_pSession->m_writer, pRtmp, _pFrame->m_pData, _pFrame->m_nSize,
+                                                   _pFrame->m_nPts);
+                        RecordSerialize(_pSession, nStart, nSendNs);
+                } else {
+                        ret = RtmpPubWriteTranscodedAudio(&_pSession->m_transcoder, &_pSession->m_writer, pRtmp,
+                                                          _pFrame->m_pData, _pFrame->m_nSize, _pFrame->m_nPts);
+                        RtmpPubMetricsRecord(pMetrics, RTMP_PUB_STAGE_CONVERT,
+                                             RtmpPubNowNs() - nStart - (_pSession->m_writer.m_nSendNs - nSendNs));
+                }
+                if (ret == 0)
+                        RtmpPubMetricsAddFrame(pMetrics, RTMP_PUB_TRACK_AUDIO, _pFrame->m_nSize);
+                return ret;
+        default:
+                return -1;
+        }
+}
+
+// 还没有开始推流时帧不发送, 只更新音视频配置并进入GOP缓存, 队列不会被旧数据占满
+static void DrainToCache(RtmpPubSession * _pSession)
+{
+        RtmpPubFrameRing * pRing;
+        RtmpPubFrame * pFrame;
+
+        while ((pRing = NextRing(_pSession, &pFrame)) != NULL) {
+                if (!ApplyConfig(_pSession, pFrame))
+                        RtmpPubGopCacheAdd(&_pSession->m_cache, pFrame);
+                RtmpPubFrameRingRelease(pRing);
+        }
+}
+
+static void Pump(RtmpPubSession * _pSession)
+{
+        RtmpPubSessionState nState = atomic_load(&_pSession->m_nState);
+        RtmpPubFrameRing * pRing;
+        RtmpPubFrame * pFrame, replay;
+        int nRounds;
+
+        if (nState != RTMP_PUB_SESSION_PUBLISHING) {
+                if (nState != RTMP_PUB_SESSION_CLOSED && RtmpPubGopCacheEnabled(&_pSession->m_cache))
+                        DrainToCache(_pSession);
+                return;
+        }
+        for (nRounds = 0; nRounds < RTMP_PUB_SESSION_MAX_ROUNDS; nRounds++) {
+                if (atomic_load(&_pSession->m_nState) != RTMP_PUB_SESSION_PUBLISHING ||
+                    RtmpPubChunkWriterPending(&_pSession->m_writer))
+                        return;
+                while (_pSession->m_nVideoInFlight + _pSession->m_nAudioInFlight + _pSession->m_nReplayInFlight <
+                       RTMP_PUB_SESSION_MAX_BATCH) {
+                        // 先重发缓存的GOP, 再发队列里的新帧
+                        if (_pSession->m_nReplayNext < _pSession->m_replay.m_nEntries) {
+                                RtmpPubGopCacheGet(&_pSession->m_replay, _pSession->m_nReplayNext++, &replay);
+                                if (SendFrame(_pSession, &replay, 1) < 0)
+                                        atomic_fetch_add(&_pSession->m_nSendErrors, 1);
+                                _pSession->m_nReplayInFlight++;
+                                continue;
+                        }
+                        if ((pRing = NextRing(_pSession, &pFrame)) == NULL)
+                                break;
+                        // 本批次里的sequence header可能还指向旧的配置, 先发出去
+                        if (RtmpPubFrameIsConfig(pFrame->m_nType) && _pSession->m_writer.m_nQueuedMessages)
+                                break;
+                        if (SendFrame(_pSession, pFrame, 0) < 0)
+                                atomic_fetch_add(&_pSession->m_nSendErrors, 1);
+                        if (pRing == &_pSession->m_video)
+                                _pSession->m_nVideoInFlight++;
+                        else
+                                _pSession->m_nAudioInFlight++;
+                }
+                if (!_pSession->m_nVideoInFlight && !_pSession->m_nAudioInFlight && !_pSession->m_nReplayInFlight)
+                        return;
+                if (Flush(_pSession) != 0)
+                        return;
+        }
+        // 还有数据, 让同一个worker上的其它session先处理
+        RtmpPubWorkerNotify(_pSession);
+}
+
+static long long int Elapsed(RtmpPubSession * _pSession)
+{
+        long long int nElapsed = RtmpPubNowUs() - _pSession->m_nStartTime;
+
+        return nElapsed > 0 ? nElapsed : 1;
+}
+
+static int QueuePublish(RtmpPubSession * _pSession, int32_t _nStreamId)
+{
+        _pSession->m_pRtmp->m_pRtmp->m_stream_id = _nStreamId;
+        _pSession->m_nPublishTransaction = ++_pSession->m_nTransactionId;
+        return QueueCommand(_pSession, RTMP_PUB_CMD_PUBLISH, RTMP_PUB_MEDIA_CHANNEL, _nStreamId,
+                            _pSession->m_nPublishTransaction);
+}
+
+// 按流水线模式把当前不需要再等回应的命令都排进发送队列, 已经发过的不会重复发送
+static int QueueCommands(RtmpPubSession * _pSession)
+{
+        RtmpPubPipelineMode nPipeline = _pSession->m_config.m_nPipeline;
+
+        if (!_pSession->m_nConnectTransaction) {
+                _pSession->m_nConnectTransaction = ++_pSession->m_nTransactionId;
+                if (QueueCommand(_pSession, RTMP_PUB_CMD_CONNECT, RTMP_PUB_COMMAND_CHANNEL, 0, _pSession->m_nConnectTransaction) < 0)
+                        return -1;
+        }
+        if (!_pSession->m_bConnectDone && nPipeline == RTMP_PUB_PIPELINE_NONE)
+                return 0;
+        if (!_pSession->m_nCreateStreamTransaction) {
+                // 和librtmp一样, releaseStream/FCPublish/createStream一起发出, 不等前两个的回应
+                if (QueueCommand(_pSession, RTMP_PUB_CMD_RELEASE_STREAM, RTMP_PUB_COMMAND_CHANNEL, 0, ++_pSession->m_nTransactionId) < 0 ||
+                    QueueCommand(_pSession, RTMP_PUB_CMD_FC_PUBLISH, RTMP_PUB_COMMAND_CHANNEL, 0, ++_pSession->m_nTransactionId) < 0)
+                        return -1;
+                _pSession->m_nCreateStreamTransaction = ++_pSession->m_nTransactionId;
+                if (QueueCommand(_pSession, RTMP_PUB_CMD_CREATE_STREAM, RTMP_PUB_COMMAND_CHANNEL, 0,
+                                 _pSession->m_nCreateStreamTransaction) < 0)
+                        return -1;
+        }
+        if (!_pSession->m_nPublishTransaction && nPipeline == RTMP_PUB_PIPELINE_PUBLISH)
+                return QueuePublish(_pSession, RTMP_PUB_PIPELINE_STREAM_ID);
+        return 0;
+}
+
+// 只有worker写, seq为奇数表示正在写, 读的一方发现seq变了就重读
+static void PublishTiming(RtmpPubSession * _pSession)
+{
+        unsigned int nSeq = atomic_load_explicit(&_pSession->m_nTimingSeq, memory_order_relaxed);
+
+        atomic_store_explicit(&_pSession->m_nTimingSeq, nSeq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        atomic_store_explicit(&_pSession->m_nPubResolveUs, _pSession->m_timing.m_nResolveUs, memory_order_relaxed);
+        atomic_store_explicit(&_pSession->m_nPubTcpUs, _pSession->m_timing.m_nTcpUs, memory_order_relaxed);
+        atomic_store_explicit(&_pSession->m_nPubHandshakeUs, _pSession->m_timing.m_nHandshakeUs, memory_order_relaxed);
+        atomic_store_explicit(&_pSession->m_nPubConnectUs, _pSession->m_timing.m_nConnectUs, memory_order_relaxed);
+        atomic_store_explicit(&_pSession->m_nPubCreateStreamUs, _pSession->m_timing.m_nCreateStreamUs, memory_order_relaxed);
+        atomic_store_explicit(&_pSession->m_nPubPublishUs, _pSession->m_timing.m_nPublishUs, memory_order_relaxed);
+        atomic_store_explicit(&_pSession->m_nTimingSeq, nSeq + 2, memory_order_release);
+}
+
+// 推流开始: 重连之后从关键帧开始并重新计算时间戳, 有缓存的GOP时先重发它
+static void OnPublishStart(RtmpPubSession * _pSession)
+{
+        _pSession->m_timing.m_nPublishUs = Elapsed(_pSession);
+        PublishTiming(_pSession);
+        SetState(_pSession, RTMP_PUB_SESSION_PUBLISHING);
+        RtmpPubBackoffReset(&_pSession->m_backoff);
+        if (_pSession->m_bPublished) {
+                atomic_fetch_add(&_pSession->m_nReconnects, 1);
+                RtmpPubLog("session %s reconnected, replay %u cached frames", _pSession->m_pUrl, _pSession->m_cache.m_nEntries);
+        }
+        if (_pSession->m_bPublished || _pSession->m_cache.m_nEntries)
+                _pSession->m_bWaitKey = 1;
+        _pSession->m_bPublished = 1;
+        if (RtmpPubGopCacheCopy(&_pSession->m_replay, &_pSession->m_cache) < 0)
+                RtmpPubLog("session %s no memory for gop replay", _pSession->m_pUrl);
+        _pSession->m_nReplayNext = 0;
+}
+
+static int OnCommand(RtmpPubSession * _pSession, RtmpPubMessage * _pMessage)
+{
+        static const AVal avResult = AVC("_result"), avError = AVC("_error"), avOnStatus = AVC("onStatus");
+        static const AVal avCode = AVC("code"), avLevel = AVC("level"), avErrorLevel = AVC("error");
+        static const AVal avPublishStart = AVC("NetStream.Publish.Start");
+        AMFObject object, info;
+        AVal name, code, level;
+        int nTransaction, nStreamId, ret = 0;
+
+        if (AMF_Decode(&object, _pMessage->m_pBody, _pMessage->m_nBodySize, 0) < 0)
+                return 0;
+        AMFProp_GetString(AMF_GetProp(&object, NULL, 0), &name);
+        nTransaction = (int)AMFProp_GetNumber(AMF_GetProp(&object, NULL, 1));
+
+        if (AVMATCH(&name, &avResult) && nTransaction == _pSession->m_nConnectTransaction) {
+                _pSession->m_bConnectDone = 1;
+                _pSession->m_timing.m_nConnectUs = Elapsed(_pSession);
+                ret = QueueCommands(_pSession);
+        } else if (AVMATCH(&name, &avResult) && nTransaction == _pSession->m_nCreateStreamTransaction) {
+                _pSession->m_timing.m_nCreateStreamUs = Elapsed(_pSession);
+                nStreamId = (int)AMFProp_GetNumber(AMF_GetProp(&object, NULL, 3));
+                if (!_pSession->m_nPublishTransaction) {
+                        ret = QueuePublish(_pSession, nStreamId);
+                } else if (nStreamId != _pSession->m_pRtmp->m_pRtmp->m_stream_id) {
+                        RtmpPubLog("session %s got stream id %d, publish pipelining needs %d", _pSession->m_pUrl,
+                                   nStreamId, RTMP_PUB_PIPELINE_STREAM_ID);
+                        ret = -1;
+                }
+        } else if (AVMATCH(&name, &avError)) {
+                // releaseStream/FCPublish不等回应, 很多服务器对它们回_error, 和librtmp一样忽略
+                RtmpPubLog("session %s command %d rejected", _pSession->m_pUrl, nTransaction);
+                // 事务id为0表示命令还没发出, 不能拿来匹配
+                if (nTransaction > 0 && (nTransaction == _pSession->m_nConnectTransaction ||
+                                         nTransaction == _pSession->m_nCreateStreamTransaction ||
+                                         nTransaction == _pSession->m_nPublishTransaction))
+                        ret = -1;
+        } else if (AVMATCH(&name, &avOnStatus)) {
+                AMFProp_GetObject(AMF_GetProp(&object, NULL, 3), &info);
+                AMFProp_GetString(AMF_GetProp(&info, &avCode, -1), &code);
+                AMFProp_GetString(AMF_GetProp(&info, &avLevel, -1), &level);
+                if (AVMATCH(&code, &avPublishStart)) {
+                        OnPublishStart(_pSession);
+                } else if (AVMATCH(&level, &avErrorLevel)) {
+                        RtmpPubLog("session %s status %.*s", _pSession->m_pUrl, code.av_len, code.av_val);
+                        ret = -1;
+                }
+        }
+        AMF_Reset(&object);
+        return ret;
+}
+
+static int OnMessage(void * _pOpaque, RtmpPubMessage * _pMessage)
+{
+        RtmpPubSession * pSession = (RtmpPubSession *)_pOpaque;
+        char pong[6];
+
+        switch (_pMessage->m_nType) {
+        case RTMP_PACKET_TYPE_INVOKE:
+                return OnCommand(pSession, _pMessage);
+        case RTMP_PACKET_TYPE_CONTROL:
+                if (_pMessage->m_nBodySize >= 6 && _pMessage->m_pBody[0] == 0 &&
+                    _pMessage->m_pBody[1] == RTMP_PUB_USER_CONTROL_PING) {
+                        pong[0] = 0;
+                        pong[1] = RTMP_PUB_USER_CONTROL_PONG;
+                        memcpy(pong + 2, _pMessage->m_pBody + 2, 4);
+                        return QueueControl(pSession, RTMP_PACKET_TYPE_CONTROL, pong, sizeof(pong));
+                }
+                return 0;
+        default:
+                return 0;
+        }
+}
+
+static int OnHandshake(RtmpPubSession * _pSession)
+{
+        char * pC2 = _pSession->m_pHandshake + 1 + RTMP_PUB_HANDSHAKE_SIZE;
+
+        // 收到S0S1就回C2, 收到S2后握手完成
+        if (!_pSession->m_bC2Queued && _pSession->m_nRecvSize >= 1 + RTMP_PUB_HANDSHAKE_SIZE) {
+                if (_pSession->m_pRecv[0] != RTMP_PUB_HANDSHAKE_VERSION) {
+                        RtmpPubLog("session %s unsupported handshake version %d", _pSession->m_pUrl, _pSession->m_pRecv[0]);
+                        return -1;
+                }
+                memcpy(pC2, _pSession->m_pRecv + 1, RTMP_PUB_HANDSHAKE_SIZE);
+                if (RtmpPubChunkWriterQueueRaw(&_pSession->m_writer, pC2, RTMP_PUB_HANDSHAKE_SIZE) < 0)
+                        return -1;
+                _pSession->m_bC2Queued = 1;
+                // 流水线时connect紧跟在C2后面, 不等S2
+                if (_pSession->m_config.m_nPipeline != RTMP_PUB_PIPELINE_NONE &&
+                    (RtmpPubChunkWriterSetChunkSize(&_pSession->m_writer, _pSession->m_config.m_nChunkSize) < 0 ||
+                     QueueCommands(_pSession) < 0))
+                        return -1;
+        }
+        if (_pSession->m_nRecvSize < 1 + 2 * RTMP_PUB_HANDSHAKE_SIZE)
+                return 0;
+        _pSession->m_timing.m_nHandshakeUs = Elapsed(_pSession);
+        _pSession->m_nRecvSize -= 1 + 2 * RTMP_PUB_HANDSHAKE_SIZE;
+        memmove(_pSession->m_pRecv, _pSession->m_pRecv + 1 + 2 * RTMP_PUB_HANDSHAKE_SIZE, _pSession->m_nRecvSize);
+        if (_pSession->m_config.m_nPipeline == RTMP_PUB_PIPELINE_NONE &&
+            (RtmpPubChunkWriterSetChunkSize(&_pSession->m_writer, _pSession->m_config.m_nChunkSize) < 0 ||
+             QueueCommands(_pSession) < 0))
+                return -1;
+        SetState(_pSession, RTMP_PUB_SESSION_COMMANDS);
+        return 0;
+}
+
+// 收完socket里所有数据并处理, 返回-1表示session已经失败
+static int Receive(RtmpPubSession * _pSession)
+{
+        RtmpPubSessionState nState;
+        ssize_t nRead;
+        int nParsed;
+
+        for (;;) {
+                if (_pSession->m_nRecvSize == _pSession->m_nRecvCapacity) {
+                        unsigned int nCapacity = _pSession->m_nRecvCapacity * 2;
+                        char * pRecv;
+                        if (nCapacity > RTMP_PUB_RECV_MAX) {
+                                Fail(_pSession, "chunk too large");
+                                return -1;
+                        }
+                        pRecv = (char *)realloc(_pSession->m_pRecv, nCapacity);
+                        if (!pRecv) {
+                                Fail(_pSession, "no memory");
+                                return -1;
+                        }
+                        _pSession->m_pRecv = pRecv;
+                        _pSession->m_nRecvCapacity = nCapacity;
+                }
+                nRead = recv(_pSession->m_nSocket, _pSession->m_pRecv + _pSession->m_nRecvSize,
+                             _pSession->m_nRecvCapacity - _pSession->m_nRecvSize, 0);
+                if (nRead == 0) {
+                        Fail(_pSession, "closed by server");
+                        return -1;
+                }
+                if (nRead < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK)
+                                return 0;
+                        Fail(_pSession, "recv failed");
+                        return -1;
+                }
+                _pSession->m_nRecvSize += nRead;
+
+                nState = atomic_load(&_pSession->m_nState);
+                if (nState == RTMP_PUB_SESSION_HANDSHAKE && OnHandshake(_pSession) < 0) {
+                        Fail(_pSession, "handshake failed");
+                        return -1;
+                }
+                if (atomic_load(&_pSession->m_nState) < RTMP_PUB_SESSION_COMMANDS)
+                        continue;
+                nParsed = RtmpPubChunkReaderParse(&_pSession->m_reader, _pSession->m_pRecv, _pSession->m_nRecvSize);
+                if (nParsed < 0) {
+                        Fail(_pSession, "bad message");
+                        return -1;
+                }
+                _pSession->m_nRecvSize -= nParsed;
+                memmove(_pSession->m_pRecv, _pSession->m_pRecv + nParsed, _pSession->m_nRecvSize);
+        }
+}
+
+static int OnConnected(RtmpPubSession * _pSession)
+{
+        char * pC0C1;
+        int i;
+
+        _pSession->m_pHandshake = (char *)malloc(1 + 2 * RTMP_PUB_HANDSHAKE_SIZE);
+        if (!_pSession->m_pHandshake)
+                return -1;
+        pC0C1 = _pSession->m_pHandshake;
+        pC0C1[0] = RTMP_PUB_HANDSHAKE_VERSION;
+        RtmpPubWriteBe32(pC0C1 + 1, (unsigned int)(RtmpPubNowUs() / 1000));
+        memset(pC0C1 + 5, 0, 4);
+        for (i = 9; i < 1 + RTMP_PUB_HANDSHAKE_SIZE; i++)
+                pC0C1[i] = (char)rand();
+        _pSession->m_timing.m_nTcpUs = Elapsed(_pSession);
+        // writer在AddSession/ResetConnection里已经初始化, 这里只绑定新的socket和worker的传输层
+        _pSession->m_writer.m_nSocket = _pSession->m_nSocket;
+        RtmpPubChunkWriterSetTransport(&_pSession->m_writer, _pSession->m_pWorker->m_pTransport, _pSession);
+        if (RtmpPubChunkWriterQueueRaw(&_pSession->m_writer, pC0C1, 1 + RTMP_PUB_HANDSHAKE_SIZE) < 0)
+                return -1;
+        SetState(_pSession, RTMP_PUB_SESSION_HANDSHAKE);
+        return Flush(_pSession) < 0 ? -1 : 0;
+}
+
+void RtmpPubSessionOnStart(RtmpPubSession * _pSession)
+{
+        int nOne = 1;
+
+        _pSession->m_nStartTime = RtmpPubNowUs();
+        _pSession->m_nSocket = socket(_pSession->m_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (_pSession->m_nSocket < 0) {
+                Fail(_pSession, "socket failed");
+                return;
+        }
+        setsockopt(_pSession->m_nSocket, IPPROTO_TCP, TCP_NODELAY, &nOne, sizeof(nOne));
+        RtmpPubDropPolicyLimitSocket(&_pSession->m_drop, _pSession->m_nSocket);
+        if (connect(_pSession->m_nSocket, (struct sockaddr *)&_pSession->m_addr, _pSession->m_nAddrLen) == 0) {
+                if (OnConnected(_pSession) < 0)
+                        Fail(_pSession, "handshake failed");
+                return;
+        }
+        if (errno != EINPROGRESS) {
+                Fail(_pSession, "connect failed");
+                return;
+        }
+        SetState(_pSession, RTMP_PUB_SESSION_CONNECTING);
+        if (RtmpPubWorkerWatch(_pSession, EPOLLOUT) < 0)
+                Fail(_pSession, "epoll failed");
+}
+
+void RtmpPubSessionOnEvent(RtmpPubSession * _pSession, unsigned int _nEvents)
+{
+        RtmpPubSessionState nState = atomic_load(&_pSession->m_nState);
+        socklen_t nLen = sizeof(int);
+        int nError = 0;
+
+        if (nState == RTMP_PUB_SESSION_CLOSED)
+                return;
+        if (nState == RTMP_PUB_SESSION_CONNECTING) {
+                if (getsockopt(_pSession->m_nSocket, SOL_SOCKET, SO_ERROR, &nError, &nLen) < 0 || nError) {
+                        errno = nError;
+                        Fail(_pSession, "connect failed");
+                } else if (OnConnected(_pSession) < 0) {
+                        Fail(_pSession, "handshake failed");
+                }
+                return;
+        }
+        if (_nEvents & EPOLLIN) {
+                if (Receive(_pSession) < 0)
+                        return;
+        } else if (_nEvents & (EPOLLERR | EPOLLHUP)) {
+                Fail(_pSession, "socket error");
+                return;
+        }
+        // 处理消息时可能排队了回应, 可写时继续发送没写完的数据
+        if (Flush(_pSession) == 0)
+                Pump(_pSession);
+}
+
+void RtmpPubSessionOnSendDone(RtmpPubSession * _pSession)
+{
+        if (atomic_load(&_pSession->m_nState) == RTMP_PUB_SESSION_CLOSED)
+                return;
+        if (Flush(_pSession) == 0)
+                Pump(_pSession);
+}
+
+void RtmpPubSessionOnNotify(RtmpPubSession * _pSession)
+{
+        Pump(_pSession);
+}
+
+void RtmpPubSessionOnTimer(RtmpPubSession * _pSession)
+{
+        RtmpPubSessionState nState = atomic_load(&_pSession->m_nState);
+
+        if (nState == RTMP_PUB_SESSION_RECONNECT_WAIT) {
+                RtmpPubSessionOnStart(_pSession);
+        } else if (nState < RTMP_PUB_SESSION_PUBLISHING) {
+                errno = ETIMEDOUT;
+                Fail(_pSession, "timeout");
+        }
+}
+
+void RtmpPubSessionFree(RtmpPubSession * _pSession)
+{
+        RtmpPubChunkWriterDestroy(&_pSession->m_writer);
+        if (_pSession->m_nSocket >= 0)
+                close(_pSession->m_nSocket);
+        RtmpPubChunkReaderDestroy(&_pSession->m_reader);
+        RtmpPubFrameRingDestroy(&_pSession->m_video);
+        RtmpPubFrameRingDestroy(&_pSession->m_audio);
+        RtmpPubGopCacheDestroy(&_pSession->m_cache);
+        RtmpPubGopCacheDestroy(&_pSession->m_replay);
+        RtmpPubBufferUnref(_pSession->m_pVideoConfig);
+        RtmpPubTranscoderDestroy(&_pSession->m_transcoder);
+        if (_pSession->m_pRtmp)
+                RtmpPubDel(_pSession->m_pRtmp);
+        free(_pSession->m_pRecv);
+        free(_pSession->m_pHandshake);
+        free(_pSession->m_app.av_val);
+        free(_pSession->m_playpath.av_val);
+        free(_pSession->m_pTcUrl);
+        RtmpPubCommandSetDestroy(&_pSession->m_commands);
+        free(_pSession->m_pUrl);
+        free(_pSession);
+}
+
+/*
+ * rtmp://host[:port]/app/playpath, 最后一个'/'之后是流名, 之前都是app
+ * 域名在这里解析, worker线程里不做阻塞的dns查询
+ */
+static int ParseUrl(RtmpPubSession * _pSession)
+{
+        const char * pHost, * pPath, * pName, * pPort;
+        char host[256], port[8] = "1935";
+        struct addrinfo hints, * pResult;
+        size_t nHostLen, nAppLen;
+        AVal tcUrl;
+
+        if (strncmp(_pSession->m_pUrl, "rtmp://", 7))
+                return -1;
+        pHost = _pSession->m_pUrl + 7;
+        pPath = strchr(pHost, '/');
+        pName = strrchr(pHost, '/');
+        if (!pPath || pName == pPath || !pName[1])
+                return -1;
+        nHostLen = pPath - pHost;
+        pPort = memchr(pHost, ':', nHostLen);
+        if (pPort) {
+                if ((size_t)(pPath - pPort - 1) >= sizeof(port))
+                        return -1;
+                memcpy(port, pPort + 1, pPath - pPort - 1);
+                port[pPath - pPort - 1] = 0;
+                nHostLen = pPort - pHost;
+        }
+        if (nHostLen >= sizeof(host))
+                return -1;
+        memcpy(host, pHost, nHostLen);
+        host[nHostLen] = 0;
+
+        nAppLen = pName - pPath - 1;
+        _pSession->m_app.av_val = strndup(pPath + 1, nAppLen);
+        _pSession->m_app.av_len = nAppLen;
+        _pSession->m_playpath.av_val = strdup(pName + 1);
+        _pSession->m_playpath.av_len = strlen(pName + 1);
+        _pSession->m_pTcUrl = strndup(_pSession->m_pUrl, pName - _pSession->m_pUrl);
+        if (!_pSession->m_app.av_val || !_pSession->m_playpath.av_val || !_pSession->m_pTcUrl)
+                return -1;
+        tcUrl.av_val = _pSession->m_pTcUrl;
+        tcUrl.av_len = strlen(_pSession->m_pTcUrl);
+        if (RtmpPubCommandSetInit(&_pSession->m_commands, &_pSession->m_app, &tcUrl, &_pSession->m_playpath) < 0)
+                return -1;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, port, &hints, &pResult)) {
+                RtmpPubLog("resolve %s failed", host);
+                return -1;
+        }
+        memcpy(&_pSession->m_addr, pResult->ai_addr, pResult->ai_addrlen);
+        _pSession->m_nAddrLen = pResult->ai_addrlen;
+        freeaddrinfo(pResult);
+        return 0;
+}
+
+RtmpPubSession * RtmpPubEngineAddSession(RtmpPubEngine * _pEngine, const char * _pUrl, const RtmpPubSessionConfig * _pConfig)
+{
+        RtmpPubSession * pSession;
+
+        // 引擎自己管理socket, 用不了sdk内部需要librtmp连接的发送路径, 非aac输入只能转码成aac
+        if (_pConfig->m_nAudioInputType != RTMP_PUB_AUDIO_AAC && _pConfig->m_nAudioInputType != RTMP_PUB_AUDIO_NONE &&
+            _pConfig->m_nAudioOutputType != RTMP_PUB_AUDIO_AAC) {
+                RtmpPubLog("engine session only supports aac output");
+                return NULL;
+        }
+        pSession = (RtmpPubSession *)calloc(1, sizeof(RtmpPubSession));
+        if (!pSession)
+                return NULL;
+        pSession->m_config = *_pConfig;
+        if (!pSession->m_config.m_nChunkSize)
+                pSession->m_config.m_nChunkSize = 4096;
+        if (!pSession->m_config.m_nTimeout)
+                pSession->m_config.m_nTimeout = 10;
+        pSession->m_nSocket = -1;
+        pSession->m_nHeapIndex = -1;
+        atomic_init(&pSession->m_nState, RTMP_PUB_SESSION_INIT);
+        atomic_init(&pSession->m_bNotified, 0);
+        atomic_init(&pSession->m_bCloseRequested, 0);
+        atomic_init(&pSession->m_nWritevCalls, 0);
+        atomic_init(&pSession->m_nMessages, 0);
+        atomic_init(&pSession->m_nBytes, 0);
+        atomic_init(&pSession->m_nSendErrors, 0);
+        atomic_init(&pSession->m_nReconnects, 0);
+        atomic_init(&pSession->m_nTimingSeq, 0);
+        atomic_init(&pSession->m_nPubResolveUs, 0);
+        atomic_init(&pSession->m_nPubTcpUs, 0);
+        atomic_init(&pSession->m_nPubHandshakeUs, 0);
+        atomic_init(&pSession->m_nPubConnectUs, 0);
+        atomic_init(&pSession->m_nPubCreateStreamUs, 0);
+        atomic_init(&pSession->m_nPubPublishUs, 0);
+        RtmpPubChunkReaderInit(&pSession->m_reader, OnMessage, pSession);
+        RtmpPubChunkWriterInitSocket(&pSession->m_writer, -1, RTMP_DEFAULT_CHUNKSIZE);
+        RtmpPubMetricsInit(&pSession->m_metrics);
+        RtmpPubTranscoderInit(&pSession->m_transcoder);
+        RtmpPubMetadataInit(&pSession->m_metadata);
+        RtmpPubAdtsDemuxerInit(&pSession->m_adts);
+        pSession->m_writer.m_pSendLatency = &pSession->m_metrics.m_stages[RTMP_PUB_STAGE_SEND];
+        RtmpPubDropPolicyInit(&pSession->m_drop, &pSession->m_config.m_drop);
+        RtmpPubBackoffInit(&pSession->m_backoff, &pSession->m_config.m_reconnect);
+        RtmpPubGopCacheInit(&pSession->m_cache, pSession->m_config.m_reconnect.m_nGopCacheBytes);
+        RtmpPubGopCacheInit(&pSession->m_replay, pSession->m_config.m_reconnect.m_nGopCacheBytes);
+
+        pSession->m_pUrl = strdup(_pUrl);
+        pSession->m_pRecv = (char *)malloc(RTMP_PUB_RECV_INITIAL);
+        pSession->m_nRecvCapacity = RTMP_PUB_RECV_INITIAL;
+        pSession->m_timing.m_nResolveUs = RtmpPubNowUs();
+        if (!pSession->m_pUrl || !pSession->m_pRecv || ParseUrl(pSession) < 0) {
+                RtmpPubLog("bad url %s", _pUrl);
+                goto err;
+        }
+        pSession->m_timing.m_nResolveUs = RtmpPubNowUs() - pSession->m_timing.m_nResolveUs;
+        if (RtmpPubFrameRingInit(&pSession->m_video, _pConfig->m_nVideoSlots ? _pConfig->m_nVideoSlots : 64) < 0 ||
+            RtmpPubFrameRingInit(&pSession->m_audio, _pConfig->m_nAudioSlots ? _pConfig->m_nAudioSlots : 128) < 0)
+                goto err;
+        pSession->m_pRtmp = RtmpPubNew(pSession->m_pUrl, pSession->m_config.m_nTimeout, _pConfig->m_nAudioInputType,
+                                       _pConfig->m_nAudioOutputType, _pConfig->m_nTimePolicy);
+        if (!pSession->m_pRtmp || RtmpPubInit(pSession->m_pRtmp))
+                goto err;
+        // 这个RTMP结构只用来保存stream id, 它的channel数组不会被用到
+        RtmpPubTrimChannels(pSession->m_pRtmp);
+
+        pSession->m_pWorker = &_pEngine->m_pWorkers[atomic_fetch_add(&_pEngine->m_nNextWorker, 1) % _pEngine->m_nWorkers];
+        RtmpPubWorkerNotify(pSession);
+        return pSession;
+err:
+        RtmpPubSessionFree(pSession);
+        return NULL;
+}
+
+void RtmpPubEngineCloseSession(RtmpPubSession * _pSession)
+{
+        atomic_store(&_pSession->m_bCloseRequested, 1);
+        // 已经在待处理列表里时也会在取出时看到关闭请求
+        RtmpPubWorkerNotify(_pSession);
+}
+
+static int CommitFrame(RtmpPubSession * _pSession, RtmpPubFrameRing * _pRing, RtmpPubFrame * _pFrame, RtmpPubFrameType _nType,
+                       unsigned int _nPts, int _bIsKey)
+{
+        if (!_pFrame)
+                return -1;
+        _pFrame->m_nType = _nType;
+        _pFrame->m_nPts = _nPts;
+        _pFrame->m_bIsKey = _bIsKey;
+        RtmpPubFrameRingCommit(_pRing);
+        RtmpPubWorkerNotify(_pSession);
+        return 0;
+}
+
+static int PushFrame(RtmpPubSession * _pSession, RtmpPubFrameRing * _pRing, RtmpPubFrameType _nType,
+                     const char * _pData, unsigned int _nSize, unsigned int _nPts, int _bIsKey)
+{
+        RtmpPubFrame * pFrame;
+
+        if (atomic_load_explicit(&_pSession->m_nState, memory_order_relaxed) == RTMP_PUB_SESSION_CLOSED)
+                return -1;
+        if ((pFrame = RtmpPubFrameRingReserve(_pRing, _nSize)) != NULL)
+                memcpy(pFrame->m_pData, _pData, _nSize);
+        return CommitFrame(_pSession, _pRing, pFrame, _nType, _nPts, _bIsKey);
+}
+
+int RtmpPubSessionPushVideo(RtmpPubSession * _pSession, const char * _pData, unsigned int _nSize, unsigned int _nPts, int _bIsKey)
+{
+        return PushFrame(_pSession, &_pSession->m_video, RTMP_PUB_FRAME_VIDEO, _pData, _nSize, _nPts, _bIsKey);
+}
+
+int RtmpPubSessionPushAudio(RtmpPubSession * _pSession, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return PushFrame(_pSession, &_pSession->m_audio, RTMP_PUB_FRAME_AUDIO, _pData, _nSize, _nPts, 0);
+}
+
+int RtmpPubSessionPushTag(RtmpPubSession * _pSession, RtmpPubFrameType _nType, RtmpPubBuffer * _pBuffer, unsigned int _nPts,
+                          int _bIsKey, int _bIsReference)
+{
+        RtmpPubFrameRing * pRing = _nType == RTMP_PUB_FRAME_AUDIO || _nType == RTMP_PUB_FRAME_AUDIO_CONFIG ?
+                                   &_pSession->m_audio : &_pSession->m_video;
+        RtmpPubFrame * pFrame;
+
+        if (atomic_load_explicit(&_pSession->m_nState, memory_order_relaxed) == RTMP_PUB_SESSION_CLOSED)
+                return -1;
+        if ((pFrame = RtmpPubFrameRingReserveBuffer(pRing, _pBuffer)) != NULL)
+                pFrame->m_bIsReference = _bIsReference;
+        return CommitFrame(_pSession, pRing, pFrame, _nType, _nPts, _bIsKey);
+}
+
+int RtmpPubSessionPushVideoBuffer(RtmpPubSession * _pSession, RtmpPubBuffer * _pBuffer, unsigned int _nPts, int _bIsKey)
+{
+        return RtmpPubSessionPushTag(_pSession, RTMP_PUB_FRAME_VIDEO, _pBuffer, _nPts, _bIsKey, 0);
+}
+
+int RtmpPubSessionPushAudioBuffer(RtmpPubSession * _pSession, RtmpPubBuffer * _pBuffer, unsigned int _nPts)
+{
+        return RtmpPubSessionPushTag(_pSession, RTMP_PUB_FRAME_AUDIO, _pBuffer, _nPts, 0, 0);
+}
+
+int RtmpPubSessionPushAudioConfig(RtmpPubSession * _pSession, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return PushFrame(_pSession, &_pSession->m_audio, RTMP_PUB_FRAME_AUDIO_CONFIG, _pData, _nSize, _nPts, 0);
+}
+
+static int OnAdtsConfig(void * _pOpaque, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return RtmpPubSessionPushAudioConfig((RtmpPubSession *)_pOpaque, _pData, _nSize, _nPts);
+}
+
+static int OnAdtsFrame(void * _pOpaque, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        return RtmpPubSessionPushAudio((RtmpPubSession *)_pOpaque, _pData, _nSize, _nPts);
+}
+
+int RtmpPubSessionPushAdts(RtmpPubSession * _pSession, const char * _pData, unsigned int _nSize, unsigned int _nPts)
+{
+        RtmpPubAdtsOutput output = { OnAdtsConfig, OnAdtsFrame, _pSession };
+
+        return RtmpPubAdtsDemuxerPush(&_pSession->m_adts, _pData, _nSize, _nPts, &output);
+}
+
+RtmpPubSessionState RtmpPubSessionGetState(RtmpPubSession * _pSession)
+{
+        return atomic_load(&_pSession->m_nState);
+}
+
+void RtmpPubSessionGetStats(RtmpPubSession * _pSession, RtmpPubSessionStats * _pStats)
+{
+        unsigned int nSeq;
+
+        _pStats->m_nState = atomic_load(&_pSession->m_nState);
+        RtmpPubFrameRingGetStats(&_pSession->m_video, &_pStats->m_video);
+        RtmpPubFrameRingGetStats(&_pSession->m_audio, &_pStats->m_audio);
+        _pStats->m_nWritevCalls = atomic_load_explicit(&_pSession->m_nWritevCalls, memory_order_relaxed);
+        _pStats->m_nMessages = atomic_load_explicit(&_pSession->m_nMessages, memory_order_relaxed);
+        _pStats->m_nBytes = atomic_load_explicit(&_pSession->m_nBytes, memory_order_relaxed);
+        _pStats->m_nSendErrors = atomic_load_explicit(&_pSession->m_nSendErrors, memory_order_relaxed);
+        _pStats->m_nReconnects = atomic_load_explicit(&_pSession->m_nReconnects, memory_order_relaxed);
+        // m_timing重连时会被worker清掉重写, 这里读的是PublishTiming发布的最近一次完整连接
+        do {
+                nSeq = atomic_load_explicit(&_pSession->m_nTimingSeq, memory_order_acquire);
+                _pStats->m_timing.m_nResolveUs = atomic_load_explicit(&_pSession->m_nPubResolveUs, memory_order_relaxed);
+                _pStats->m_timing.m_nTcpUs = atomic_load_explicit(&_pSession->m_nPubTcpUs, memory_order_relaxed);
+                _pStats->m_timing.m_nHandshakeUs = atomic_load_explicit(&_pSession->m_nPubHandshakeUs, memory_order_relaxed);
+                _pStats->m_timing.m_nConnectUs = atomic_load_explicit(&_pSession->m_nPubConnectUs, memory_order_relaxed);
+                _pStats->m_timing.m_nCreateStreamUs = atomic_load_explicit(&_pSession->m_nPubCreateStreamUs, memory_order_relaxed);
+                _pStats->m_timing.m_nPublishUs = atomic_load_explicit(&_pSession->m_nPubPublishUs, memory_order_relaxed);
+                atomic_thread_fence(memory_order_acquire);
+        } while ((nSeq & 1) || nSeq != atomic_load_explicit(&_pSession->m_nTimingSeq, memory_order_relaxed));
+}
+
+void RtmpPubSessionGetMetrics(RtmpPubSession * _pSession, RtmpPubMetricsSnapshot * _pSnapshot)
+{
+        RtmpPubMetricsGetSnapshot(&_pSession->m_metrics, _pSnapshot);
+        _pSnapshot->m_tracks[RTMP_PUB_TRACK_VIDEO].m_nDropped += atomic_load_explicit(&_pSession->m_video.m_nDropped, memory_order_relaxed);
+        _pSnapshot->m_tracks[RTMP_PUB_TRACK_AUDIO].m_nDropped += atomic_load_explicit(&_pSession->m_audio.m_nDropped, memory_order_relaxed);
+        _pSnapshot->m_nReconnects = atomic_load_explicit(&_pSession->m_nReconnects, memory_order_relaxed);
+        _pSnapshot->m_nSendErrors = atomic_load_explicit(&_pSession->m_nSendErrors, memory_order_relaxed);
+}
@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rtmp_slice.h"
+#include "rtmp_publish_internal.h"
+
+#define H264_NALU_FILLER        12
+#define FILLER_BLOCK            4096
+#define MAX_MESSAGE_SIZE        0xffffff
+
+static pthread_once_t fillerOnce = PTHREAD_ONCE_INIT;
+static char fillerBytes[FILLER_BLOCK];
+
+static void InitFiller(void)
+{
+        memset(fillerBytes, 0xFF, sizeof(fillerBytes));
+}
+
+void RtmpPubSliceTagInit(RtmpPubSliceTag * _pSlice)
+{
+        memset(_pSlice, 0, sizeof(*_pSlice));
+        pthread_once(&fillerOnce, InitFiller);
+}
+
+void RtmpPubSliceTagDestroy(RtmpPubSliceTag * _pSlice)
+{
+        free(_pSlice->m_pPending);
+        memset(_pSlice, 0, sizeof(*_pSlice));
+}
+
+static unsigned int ClampBudget(unsigned long long _nBytes)
+{
+        if (_nBytes > MAX_MESSAGE_SIZE)
+                return MAX_MESSAGE_SIZE;
+        if (_nBytes && _nBytes < RTMP_PUB_FLV_VIDEO_HEADER_SIZE + RTMP_PUB_SLICE_FILLER_MIN)
+                return RTMP_PUB_FLV_VIDEO_HEADER_SIZE + RTMP_PUB_SLICE_FILLER_MIN;
+        return (unsigned int)_nBytes;
+}
+
+void RtmpPubSliceTagSetBudget(RtmpPubSliceTag * _pSlice, unsigned int _nKeyBytes, unsigned int _nInterBytes)
+{
+        _pSlice->m_nBudget[1] = ClampBudget(_nKeyBytes);
+        _pSlice->m_nBudget[0] = ClampBudget(_nInterBytes);
+        _pSlice->m_bFixedBudget = _nKeyBytes || _nInterBytes;
+}
+
+void RtmpPubSliceTagReset(RtmpPubSliceTag * _pSlice)
+{
+        _pSlice->m_bActive = 0;
+        _pSlice->m_bOpened = 0;
+        _pSlice->m_nLeft = 0;
+        _pSlice->m_nPending = 0;
+}
+
+static char * AllocFlvHeader(RtmpPubChunkWriter * _pWriter, int _bIsKey)
+{
+        char * pOut = RtmpPubChunkWriterAlloc(_pWriter, RTMP_PUB_FLV_VIDEO_HEADER_SIZE);
+
+        pOut[0] = _bIsKey ? RTMP_PUB_FLV_VIDEO_KEY : RTMP_PUB_FLV_VIDEO_INTER;
+        pOut[1] = RTMP_PUB_FLV_AVC_NALU;
+        pOut[2] = 0;
+        pOut[3] = 0;
+        pOut[4] = 0;
+        return pOut;
+}
+
+// 打开一条_nBodySize字节的video消息并写出flv头
+static int BeginMessage(RtmpPubSliceTag * _pSlice, RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp,
+                        unsigned int _nBodySize)
+{
+        struct iovec iov;
+        uint32_t nStamp = 0;
+        uint8_t nHeaderType = 0;
+
+        // sps和pps可能在不同的slice里, 到这一帧真正开始发送时才写sequence header, 写不出来时不发送这一帧
+        if (_pSlice->m_bIsKey && !_pRtmp->m_nIsVideoConfigSent) {
+                if (RtmpPubWriteAvcConfig(_pWriter, _pRtmp, _pSlice->m_nPts) < 0) {
+                        RtmpPubLog("avc sequence header not queued, sps/pps missing, skip key frame");
+                        return -1;
+                }
+                _pRtmp->m_nIsVideoConfigSent = 1;
+        }
+        if (RtmpPubChunkWriterReserve(_pWriter, RTMP_PUB_FLV_VIDEO_HEADER_SIZE) < 0)
+                return -1;
+        iov.iov_base = AllocFlvHeader(_pWriter, _pSlice->m_bIsKey);
+        iov.iov_len = RTMP_PUB_FLV_VIDEO_HEADER_SIZE;
+        RtmpPubGetVideoStamp(_pRtmp, _pSlice->m_nPts, &nStamp, &nHeaderType);
+        if (RtmpPubChunkWriterBegin(_pWriter, RTMP_PUB_MEDIA_CHANNEL, RTMP_PACKET_TYPE_VIDEO, nHeaderType, nStamp,
+                                    _pRtmp->m_pRtmp->m_stream_id, _nBodySize) < 0)
+                return -1;
+        return RtmpPubChunkWriterAppend(_pWriter, &iov, 1);
+}
+
+int RtmpPubSliceTagBegin(RtmpPubSliceTag * _pSlice, RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, int _bIsKey,
+                         unsigned int _nPts)
+{
+        if (_pSlice->m_bActive)
+                return -1;
+        _pSlice->m_bActive = 1;
+        _pSlice->m_bIsKey = _bIsKey != 0;
+        _pSlice->m_nPts = _nPts;
+        _pSlice->m_nSize = RTMP_PUB_FLV_VIDEO_HEADER_SIZE;
+        _pSlice->m_nLeft = 0;
+        _pSlice->m_nPending = 0;
+        _pSlice->m_bOpened = 0;
+        _pSlice->m_bTruncated = 0;
+        _pSlice->m_bBuffering = 0;
+        _pSlice->m_nFrames++;
+        return 0;
+}
+
+// 剩下的空间要么正好用完, 要么还能放下一个filler
+static int Fits(unsigned int _nSize, unsigned int _nLeft)
+{
+        return _nSize == _nLeft || _nSize + RTMP_PUB_SLICE_FILLER_MIN <= _nLeft;
+}
+
+// 第一个有数据的slice到达时决定是按预算边收边发, 还是攒齐整帧发送
+static int Open(RtmpPubSliceTag * _pSlice, RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp, unsigned int _nSize)
+{
+        unsigned int nBudget = _pSlice->m_nBudget[_pSlice->m_bIsKey];
+
+        if (!nBudget || !Fits(_nSize, nBudget - RTMP_PUB_FLV_VIDEO_HEADER_SIZE)) {
+                _pSlice->m_bBuffering = 1;
+                _pSlice->m_nBuffered++;
+                return 0;
+        }
+        // 打开失败时这一帧剩下的slice都不再发送
+        if (BeginMessage(_pSlice, _pWriter, _pRtmp, nBudget) < 0) {
+                _pSlice->m_bTruncated = 1;
+                return -1;
+        }
+        _pSlice->m_bOpened = 1;
+        _pSlice->m_nLeft = nBudget - RTMP_PUB_FLV_VIDEO_HEADER_SIZE;
+        return 0;
+}
+
+static int AppendPending(RtmpPubSliceTag * _pSlice, const RtmpPubNaluSpan * _pNalus, unsigned int _nCount, unsigned int _nSize)
+{
+        unsigned int i, nCapacity = _pSlice->m_nPendingCapacity;
+        char * pOut;
+
+        if (_pSlice->m_nPending + _nSize > nCapacity) {
+                while (_pSlice->m_nPending + _nSize > nCapacity)
+                        nCapacity = nCapacity ? nCapacity * 2 : 64 * 1024;
+                if (!(pOut = (char *)realloc(_pSlice->m_pPending, nCapacity)))
+                        return -1;
+                _pSlice->m_pPending = pOut;
+                _pSlice->m_nPendingCapacity = nCapacity;
+        }
+        pOut = _pSlice->m_pPending + _pSlice->m_nPending;
+        for (i = 0; i < _nCount; i++) {
+                RtmpPubWriteBe32(pOut, _pNalus[i].m_nSize);
+                memcpy(pOut + 4, _pNalus[i].m_pData, _pNalus[i].m_nSize);
+                pOut += 4 + _pNalus[i].m_nSize;
+        }
+        _pSlice->m_nPending += _nSize;
+        return 0;
+}
+
+int RtmpPubSliceTagWrite(RtmpPubSliceTag * _pSlice, RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp,
+                         const RtmpPubNaluSpan * _pNalus, unsigned int _nCount)
+{
+        struct iovec iov[2 * RTMP_PUB_MAX_TAG_NALUS];
+        unsigned int i, nSize = 0;
+        int nIov = 0;
+        char * pLength;
+
+        if (!_pSlice->m_bActive || _nCount > RTMP_PUB_MAX_TAG_NALUS)
+                return -1;
+        for (i = 0; i < _nCount; i++)
+                nSize += 4 + _pNalus[i].m_nSize;
+        _pSlice->m_nSize += nSize;
+        if (_pSlice->m_bTruncated || !nSize)
+                return 0;
+        if (!_pSlice->m_bOpened && !_pSlice->m_bBuffering && Open(_pSlice, _pWriter, _pRtmp, nSize) < 0)
+                return -1;
+        if (_pSlice->m_bBuffering)
+                return AppendPending(_pSlice, _pNalus, _nCount, nSize);
+        if (!Fits(nSize, _pSlice->m_nLeft)) {
+                RtmpPubLog("slice over budget %u, drop rest of frame", _pSlice->m_nBudget[_pSlice->m_bIsKey]);
+                _pSlice->m_bTruncated = 1;
+                _pSlice->m_nOverflows++;
+                return 0;
+        }
+
+        // 整个消息在Begin时已经声明, 这里的Reserve即使Flush也只会发出已经入队的部分
+        if (RtmpPubChunkWriterReserve(_pWriter, 4 * _nCount) < 0)
+                return -1;
+        for (i = 0; i < _nCount; i++) {
+                if (_pNalus[i].m_bPrefixed) {
+                        iov[nIov].iov_base = (void *)(_pNalus[i].m_pData - 4);
+                        iov[nIov++].iov_len = 4 + _pNalus[i].m_nSize;
+                        continue;
+                }
+                pLength = RtmpPubChunkWriterAlloc(_pWriter, 4);
+                RtmpPubWriteBe32(pLength, _pNalus[i].m_nSize);
+                iov[nIov].iov_base = pLength;
+                iov[nIov++].iov_len = 4;
+                iov[nIov].iov_base = (void *)_pNalus[i].m_pData;
+                iov[nIov++].iov_len = _pNalus[i].m_nSize;
+        }
+        if (RtmpPubChunkWriterAppend(_pWriter, iov, nIov) < 0)
+                return -1;
+        _pSlice->m_nLeft -= nSize;
+        return 0;
+}
+
+// 用一个filler nalu补齐_nSize字节: 4字节长度, nalu头, 0xFF..., rbsp_trailing_bits
+static int WriteFiller(RtmpPubChunkWriter * _pWriter, unsigned int _nSize)
+{
+        unsigned int nBody = _nSize - RTMP_PUB_SLICE_FILLER_MIN, nPiece;
+        struct iovec iov;
+        char * pHeader;
+
+        if (RtmpPubChunkWriterReserve(_pWriter, RTMP_PUB_SLICE_FILLER_MIN) < 0)
+                return -1;
+        pHeader = RtmpPubChunkWriterAlloc(_pWriter, RTMP_PUB_SLICE_FILLER_MIN);
+        RtmpPubWriteBe32(pHeader, _nSize - 4);
+        pHeader[4] = H264_NALU_FILLER;
+        pHeader[5] = (char)0x80;
+        iov.iov_base = pHeader;
+        iov.iov_len = 5;
+        if (RtmpPubChunkWriterAppend(_pWriter, &iov, 1) < 0)
+                return -1;
+        for (; nBody > 0; nBody -= nPiece) {
+                nPiece = nBody < FILLER_BLOCK ? nBody : FILLER_BLOCK;
+                iov.iov_base = fillerBytes;
+                iov.iov_len = nPiece;
+                if (RtmpPubChunkWriterAppend(_pWriter, &iov, 1) < 0)
+                        return -1;
+        }
+        iov.iov_base = pHeader + 5;
+        iov.iov_len = 1;
+        return RtmpPubChunkWriterAppend(_pWriter, &iov, 1);
+}
+
+// 涨得快落得慢: 比预算大时立即提高, 比预算小时每帧回落一部分
+static void UpdateBudget(RtmpPubSliceTag * _pSlice)
+{
+        unsigned int * pBudget = &_pSlice->m_nBudget[_pSlice->m_bIsKey];
+        unsigned int nWanted = ClampBudget((unsigned long long)_pSlice->m_nSize + _pSlice->m_nSize / RTMP_PUB_SLICE_HEADROOM +
+                                           RTMP_PUB_SLICE_FILLER_MIN);
+
+        if (_pSlice->m_bFixedBudget)
+                return;
+        if (nWanted >= *pBudget)
+                *pBudget = nWanted;
+        else
+                *pBudget -= (*pBudget - nWanted) / RTMP_PUB_SLICE_DECAY;
+}
+
+int RtmpPubSliceTagEnd(RtmpPubSliceTag * _pSlice, RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp)
+{
+        struct iovec iov;
+        unsigned int nLeft = _pSlice->m_nLeft;
+
+        if (!_pSlice->m_bActive)
+                return -1;
+        _pSlice->m_bActive = 0;
+        _pSlice->m_nLeft = 0;
+        // 整帧没有数据, 什么都不发
+        if (!_pSlice->m_bOpened && !_pSlice->m_bBuffering)
+                return 0;
+        _pSlice->m_bOpened = 0;
+        UpdateBudget(_pSlice);
+        if (!_pSlice->m_bBuffering) {
+                _pSlice->m_nPadding += nLeft;
+                return nLeft ? WriteFiller(_pWriter, nLeft) : 0;
+        }
+        if (_pSlice->m_nSize > MAX_MESSAGE_SIZE)
+                return -1;
+        if (BeginMessage(_pSlice, _pWriter, _pRtmp, RTMP_PUB_FLV_VIDEO_HEADER_SIZE + _pSlice->m_nPending) < 0)
+                return -1;
+        iov.iov_base = _pSlice->m_pPending;
+        iov.iov_len = _pSlice->m_nPending;
+        if (_pSlice->m_nPending && RtmpPubChunkWriterAppend(_pWriter, &iov, 1) < 0)
+                return -1;
+        // 下一帧还会使用m_pPending
+        return RtmpPubChunkWriterFlush(_pWriter) < 0 ? -1 : 0;
+}
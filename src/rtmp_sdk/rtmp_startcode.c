@@ -0,0 +1,243 @@
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "rtmp_publish_nalu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RTMP_PUB_HAVE_X86_KERNELS
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#if defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#define RTMP_PUB_HAVE_NEON_KERNEL
+#endif
+
+/*
+ * startcode扫描是高码率下每帧cpu占用最高的部分
+ * 这里所有kernel语义一致: 返回[p, end)中第一个00 00 01的位置, 没找到返回end
+ * 标量版本作为兜底, 同时也是其它kernel的对照实现
+ */
+
+typedef const uint8_t * (*StartcodeKernel)(const uint8_t * p, const uint8_t * end);
+
+static const uint8_t * FindStartcodeScalar(const uint8_t * p, const uint8_t * end)
+{
+        const uint8_t * a = p + 4 - ((intptr_t)p & 3);
+
+        for (end -= 3; p < a && p < end; p++) {
+                if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+                        return p;
+        }
+
+        for (end -= 3; p < end; p += 4) {
+                uint32_t x;
+                memcpy(&x, p, 4);
+                if ((x - 0x01010101) & (~x) & 0x80808080) {
+                        if (p[1] == 0) {
+                                if (p[0] == 0 && p[2] == 1)
+                                        return p;
+                                if (p[2] == 0 && p[3] == 1)
+                                        return p + 1;
+                        }
+                        if (p[3] == 0) {
+                                if (p[2] == 0 && p[4] == 1)
+                                        return p + 2;
+                                if (p[4] == 0 && p[5] == 1)
+                                        return p + 3;
+                        }
+                }
+        }
+
+        for (end += 3; p < end; p++) {
+                if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+                        return p;
+        }
+
+        return end + 3;
+}
+
+// 剩余不足一个向量宽度的尾部, 和标量版本一样不返回最后3字节内的startcode
+static const uint8_t * FindStartcodeTail(const uint8_t * p, const uint8_t * end)
+{
+        for (; p + 3 < end; p++) {
+                if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+                        return p;
+        }
+        return end;
+}
+
+#ifdef RTMP_PUB_HAVE_X86_KERNELS
+/*
+ * 一次取32字节, 分别得到"等于0"和"等于1"的位图, 00 00 01即 zero & zero>>1 & one>>2
+ * 为了不跨块处理进位, 每次只确认前30个位置, 步长30
+ * 和标量版本一致, 紧贴末尾(最后3字节内)的startcode不算
+ */
+__attribute__((target("sse2")))
+static const uint8_t * FindStartcodeSse2(const uint8_t * p, const uint8_t * end)
+{
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+
+        for (; p + 33 <= end; p += 30) {
+                __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+                __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+                uint32_t z = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v0, zero)) |
+                             ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v1, zero)) << 16);
+                uint32_t o, hit;
+
+                if (!(z & (z >> 1)))
+                        continue;
+                o = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v0, one)) |
+                    ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v1, one)) << 16);
+                hit = z & (z >> 1) & (o >> 2) & 0x3FFFFFFF;
+                if (hit)
+                        return p + __builtin_ctz(hit);
+        }
+        return FindStartcodeTail(p, end);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t * FindStartcodeAvx2(const uint8_t * p, const uint8_t * end)
+{
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one = _mm256_set1_epi8(1);
+
+        for (; p + 65 <= end; p += 62) {
+                __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+                __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+                uint64_t z = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, zero)) |
+                             ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, zero)) << 32);
+                uint64_t o, hit;
+
+                if (!(z & (z >> 1)))
+                        continue;
+                o = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, one)) |
+                    ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, one)) << 32);
+                hit = z & (z >> 1) & (o >> 2) & 0x3FFFFFFFFFFFFFFFULL;
+                if (hit)
+                        return p + __builtin_ctzll(hit);
+        }
+        return FindStartcodeSse2(p, end);
+}
+#endif
+
+#ifdef RTMP_PUB_HAVE_NEON_KERNEL
+static const uint8_t * FindStartcodeNeon(const uint8_t * p, const uint8_t * end)
+{
+        const uint8x16_t zero = vdupq_n_u8(0);
+        const uint8x16_t one = vdupq_n_u8(1);
+
+        // 每次比较p[i], p[i+1], p[i+2]三个错位的向量, 紧贴末尾的startcode不算
+        for (; p + 19 <= end; p += 16) {
+                uint8x16_t hit = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(p), zero), vceqq_u8(vld1q_u8(p + 1), zero)),
+                                          vceqq_u8(vld1q_u8(p + 2), one));
+                uint64x2_t wide = vreinterpretq_u64_u8(hit);
+                // armv7上没有vmaxvq, 先判断整体是否命中, 命中后再在16字节内定位
+                if (vgetq_lane_u64(wide, 0) | vgetq_lane_u64(wide, 1))
+                        return FindStartcodeTail(p, p + 19);
+        }
+        return FindStartcodeTail(p, end);
+}
+#endif
+
+static const char * kernelNames[] = { "scalar", "sse2", "avx2", "neon" };
+static StartcodeKernel kernelFuncs[] = {
+        FindStartcodeScalar,
+#ifdef RTMP_PUB_HAVE_X86_KERNELS
+        FindStartcodeSse2,
+        FindStartcodeAvx2,
+#else
+        NULL,
+        NULL,
+#endif
+#ifdef RTMP_PUB_HAVE_NEON_KERNEL
+        FindStartcodeNeon,
+#else
+        NULL,
+#endif
+};
+
+// 发送线程和worker一直在读, 运行时可以切换, 都是relaxed读写, 每次调用只读一次函数指针
+static _Atomic(StartcodeKernel) findStartcode = FindStartcodeScalar;
+static _Atomic(RtmpPubStartcodeKernel) currentKernel = RTMP_PUB_STARTCODE_SCALAR;
+static pthread_once_t kernelOnce = PTHREAD_ONCE_INIT;
+
+static int KernelSupported(RtmpPubStartcodeKernel _nKernel)
+{
+        if (_nKernel < RTMP_PUB_STARTCODE_SCALAR || _nKernel > RTMP_PUB_STARTCODE_NEON || !kernelFuncs[_nKernel])
+                return 0;
+        switch (_nKernel) {
+#ifdef RTMP_PUB_HAVE_X86_KERNELS
+        case RTMP_PUB_STARTCODE_SSE2:
+                return __builtin_cpu_supports("sse2");
+        case RTMP_PUB_STARTCODE_AVX2:
+                return __builtin_cpu_supports("avx2");
+#endif
+#ifdef RTMP_PUB_HAVE_NEON_KERNEL
+        case RTMP_PUB_STARTCODE_NEON:
+#if defined(__arm__)
+                return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+                return 1;
+#endif
+#endif
+        default:
+                return 1;
+        }
+}
+
+static void SelectBestKernel(void)
+{
+        static const RtmpPubStartcodeKernel order[] = {
+                RTMP_PUB_STARTCODE_AVX2, RTMP_PUB_STARTCODE_NEON, RTMP_PUB_STARTCODE_SSE2
+        };
+        unsigned int i;
+
+        for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+                if (KernelSupported(order[i])) {
+                        atomic_store_explicit(&findStartcode, kernelFuncs[order[i]], memory_order_relaxed);
+                        atomic_store_explicit(&currentKernel, order[i], memory_order_relaxed);
+                        return;
+                }
+        }
+}
+
+int RtmpPubSelectStartcodeKernel(RtmpPubStartcodeKernel _nKernel)
+{
+        pthread_once(&kernelOnce, SelectBestKernel);
+        if (!KernelSupported(_nKernel))
+                return -1;
+        atomic_store_explicit(&findStartcode, kernelFuncs[_nKernel], memory_order_relaxed);
+        atomic_store_explicit(&currentKernel, _nKernel, memory_order_relaxed);
+        return 0;
+}
+
+RtmpPubStartcodeKernel RtmpPubGetStartcodeKernel(void)
+{
+        pthread_once(&kernelOnce, SelectBestKernel);
+        return atomic_load_explicit(&currentKernel, memory_order_relaxed);
+}
+
+const char * RtmpPubGetStartcodeKernelName(RtmpPubStartcodeKernel _nKernel)
+{
+        if (_nKernel < RTMP_PUB_STARTCODE_SCALAR || _nKernel > RTMP_PUB_STARTCODE_NEON)
+                return "unknown";
+        return kernelNames[_nKernel];
+}
+
+// 返回startcode的起始位置, 4字节startcode返回前导的0
+const uint8_t * RtmpPubFindStartcode(const uint8_t * _pStart, const uint8_t * _pEnd)
+{
+        const uint8_t * out;
+
+        pthread_once(&kernelOnce, SelectBestKernel);
+        out = atomic_load_explicit(&findStartcode, memory_order_relaxed)(_pStart, _pEnd);
+        if (_pStart < out && out < _pEnd && !out[-1])
+                out--;
+        return out;
+}
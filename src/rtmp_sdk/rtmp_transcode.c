@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rtmp_transcode.h"
+#include "rtmp_publish_audio.h"
+#include "rtmp_publish_internal.h"
+#include "rtmp_metrics.h"
+#include "aac_encoder.h"
+
+void RtmpPubTranscoderInit(RtmpPubTranscoder * _pTranscoder)
+{
+        memset(_pTranscoder, 0, sizeof(*_pTranscoder));
+}
+
+void RtmpPubTranscoderDestroy(RtmpPubTranscoder * _pTranscoder)
+{
+        free(_pTranscoder->m_pArena);
+        RtmpPubTranscoderInit(_pTranscoder);
+}
+
+static int ReserveArena(RtmpPubTranscoder * _pTranscoder, unsigned int _nSize)
+{
+        char * pArena;
+
+        if (_nSize <= _pTranscoder->m_nArenaSize)
+                return 0;
+        // 按2的幂增长, 帧长稳定之后不再分配
+        _nSize = 1U << (32 - __builtin_clz(_nSize - 1));
+        if (!(pArena = (char *)realloc(_pTranscoder->m_pArena, _nSize)))
+                return -1;
+        _pTranscoder->m_pArena = pArena;
+        _pTranscoder->m_nArenaSize = _nSize;
+        return 0;
+}
+
+int RtmpPubEncodeAudio(RtmpPubTranscoder * _pTranscoder, void * _pEncoder, RtmpPubAudioType _nType, const char * _pData,
+                       unsigned int _nSize, const char ** _ppOut)
+{
+        unsigned int nSamples, nPcmSize, nOutCapacity;
+        const char * pPcm = _pData;
+        size_t nOutSize = 0;
+        long long int nStart;
+        char * pOut;
+
+        if (_nType != RTMP_PUB_AUDIO_G711A && _nType != RTMP_PUB_AUDIO_G711U && _nType != RTMP_PUB_AUDIO_PCM)
+                return -1;
+        // pcm输入直接交给编码器, g711先展开到arena里
+        nSamples = _nType == RTMP_PUB_AUDIO_PCM ? _nSize / 2 : _nSize;
+        nPcmSize = _nType == RTMP_PUB_AUDIO_PCM ? 0 : nSamples * 2;
+        // 输出上限和sdk一致
+        nOutCapacity = (nSamples + 0x1400) * 2;
+        if (ReserveArena(_pTranscoder, nPcmSize + nOutCapacity) < 0)
+                return -1;
+        pOut = _pTranscoder->m_pArena + nPcmSize;
+
+        nStart = RtmpPubNowNs();
+        if (nPcmSize) {
+                RtmpPubG711Decode(_nType, (int16_t *)_pTranscoder->m_pArena, (const uint8_t *)_pData, nSamples);
+                pPcm = _pTranscoder->m_pArena;
+        }
+        _pTranscoder->m_nDecodeNs += RtmpPubNowNs() - nStart;
+        nStart = RtmpPubNowNs();
+        if (AacEncoderEncodePcm(_pEncoder, pOut, &nOutSize, pPcm, nSamples * 2) < 0) {
+                RtmpPubLog("aac encode err");
+                return -1;
+        }
+        _pTranscoder->m_nEncodeNs += RtmpPubNowNs() - nStart;
+        _pTranscoder->m_nFrames++;
+        _pTranscoder->m_nSamples += nSamples;
+        *_ppOut = pOut;
+        return (int)nOutSize;
+}
+
+int RtmpPubTranscodeAudio(RtmpPubTranscoder * _pTranscoder, RtmpPubContext * _pRtmp, const char * _pData, unsigned int _nSize,
+                          const char ** _ppOut)
+{
+        if (_pRtmp->m_nAudioOutputType != RTMP_PUB_AUDIO_AAC || !_pRtmp->m_pAudioEncoderContext)
+                return -1;
+        return RtmpPubEncodeAudio(_pTranscoder, _pRtmp->m_pAudioEncoderContext, _pRtmp->m_nAudioInputType, _pData, _nSize,
+                                  _ppOut);
+}
+
+int RtmpPubWriteTranscodedAudio(RtmpPubTranscoder * _pTranscoder, RtmpPubChunkWriter * _pWriter, RtmpPubContext * _pRtmp,
+                                const char * _pData, unsigned int _nSize, unsigned int _presentationTime)
+{
+        unsigned int nHeaderSize, nDurationMs, nPts = _presentationTime;
+        const char * pOut, * pEnd;
+        char config[RTMP_PUB_AAC_CONFIG_SIZE];
+        int nOutSize, nFrameSize;
+
+        if ((nOutSize = RtmpPubTranscodeAudio(_pTranscoder, _pRtmp, _pData, _nSize, &pOut)) < 0)
+                return -1;
+        // 编码器攒够1024个样本才输出一帧, 一次可能输出0个或多个adts帧
+        for (pEnd = pOut + nOutSize; pOut < pEnd; pOut += nFrameSize) {
+                nFrameSize = RtmpPubParseAdts(pOut, pEnd - pOut, &nHeaderSize, &nDurationMs);
+                if (nFrameSize < 0) {
+                        RtmpPubLog("bad adts frame");
+                        return -1;
+                }
+                if (!_pRtmp->m_aac.m_pData) {
+                        RtmpPubAdtsToConfig(pOut, config);
+                        RtmpPubSetAac(_pRtmp, config, sizeof(config));
+                }
+                if (RtmpPubWriteAacFrameCopy(_pWriter, _pRtmp, pOut + nHeaderSize, nFrameSize - nHeaderSize, nPts) < 0)
+                        return -1;
+                nPts += nDurationMs;
+        }
+        return 0;
+}
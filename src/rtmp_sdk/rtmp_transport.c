@@ -0,0 +1,441 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "rtmp_transport.h"
+#include "rtmp_publish_internal.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// 零拷贝发送是6.1才有的, 头文件太旧时只用普通的SENDMSG
+#ifdef IORING_CQE_F_NOTIF
+#define RTMP_PUB_HAVE_URING     1
+#endif
+#endif
+#endif
+
+#define SingleWriterAdd(_pCounter, _nDelta) \
+        atomic_store_explicit(_pCounter, atomic_load_explicit(_pCounter, memory_order_relaxed) + (_nDelta), memory_order_relaxed)
+
+// socket后端被所有线程的writer共用, 不统计, 发送次数就是writer的m_nWritevCalls
+static int SocketSend(RtmpPubTransport * _pTransport, RtmpPubTransportOp * _pOp, int _nSocket, unsigned int _nBytes)
+{
+        // 和writev一样的聚集写, 对端已经关闭时返回EPIPE而不是产生SIGPIPE
+        ssize_t nWritten = sendmsg(_nSocket, &_pOp->m_msg, MSG_NOSIGNAL);
+
+        _pOp->m_nResult = nWritten < 0 ? -errno : nWritten;
+        _pOp->m_bDone = 1;
+        return 0;
+}
+
+static int SocketWait(RtmpPubTransport * _pTransport, RtmpPubTransportOp * _pOp)
+{
+        return 0;
+}
+
+static void SocketCancel(RtmpPubTransport * _pTransport, RtmpPubTransportOp * _pOp)
+{
+        _pOp->m_bDone = 0;
+}
+
+static RtmpPubTransport s_socket = {
+        .m_nType = RTMP_PUB_TRANSPORT_SOCKET,
+        .m_pName = "socket",
+        .m_pfnSend = SocketSend,
+        .m_pfnWait = SocketWait,
+        .m_pfnCancel = SocketCancel,
+};
+
+RtmpPubTransport * RtmpPubSocketTransport(void)
+{
+        return &s_socket;
+}
+
+#ifdef RTMP_PUB_HAVE_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+typedef struct {
+        RtmpPubTransport m_base;
+        int m_nFd;
+        int m_bZeroCopy;                        // 内核支持IORING_OP_SENDMSG_ZC
+        // ring fd只能注册在一个线程里, 只有这个线程用注册过的下标进入内核
+        int m_bRegistered;
+        int m_nRegisteredIndex;
+        pthread_t m_owner;
+        void * m_pRing;
+        size_t m_nRingSize;
+        struct io_uring_sqe * m_pSqes;
+        size_t m_nSqesSize;
+        unsigned int * m_pSqHead;
+        unsigned int * m_pSqTail;
+        unsigned int m_nSqMask;
+        unsigned int m_nSqEntries;
+        unsigned int * m_pCqHead;
+        unsigned int * m_pCqTail;
+        unsigned int m_nCqMask;
+        struct io_uring_cqe * m_pCqes;
+        unsigned int m_nSqTail;
+        unsigned int m_nToSubmit;               // 已经放进提交队列还没有交给内核的请求
+        RtmpPubTransportOp * m_pDoneHead;
+        RtmpPubTransportOp * m_pDoneTail;
+} RtmpPubUring;
+
+static int Enter(RtmpPubUring * _pUring, unsigned int _nSubmit, unsigned int _nWait, unsigned int _nFlags)
+{
+        int nFd = _pUring->m_nFd, ret;
+        struct io_uring_rsrc_update update;
+
+        // 第一次在某个线程里进入时把ring fd注册到这个线程, 之后进入内核不用再查fd表
+        if (!_pUring->m_bRegistered) {
+                _pUring->m_bRegistered = 1;
+                _pUring->m_owner = pthread_self();
+                memset(&update, 0, sizeof(update));
+                update.offset = -1U;
+                update.data = (uint64_t)_pUring->m_nFd;
+                if (syscall(__NR_io_uring_register, _pUring->m_nFd, IORING_REGISTER_RING_FDS, &update, 1) == 1)
+                        _pUring->m_nRegisteredIndex = update.offset;
+        }
+        if (_pUring->m_nRegisteredIndex >= 0 && pthread_equal(_pUring->m_owner, pthread_self())) {
+                nFd = _pUring->m_nRegisteredIndex;
+                _nFlags |= IORING_ENTER_REGISTERED_RING;
+        }
+        // 已经提交了一部分时不会返回EINTR, 被打断时什么都没有提交
+        while ((ret = syscall(__NR_io_uring_enter, nFd, _nSubmit, _nWait, _nFlags, NULL, 0)) < 0 && errno == EINTR)
+                ;
+        SingleWriterAdd(&_pUring->m_base.m_nSyscalls, 1);
+        if (ret > 0)
+                _pUring->m_nToSubmit -= (unsigned int)ret < _pUring->m_nToSubmit ? (unsigned int)ret : _pUring->m_nToSubmit;
+        return ret;
+}
+
+static struct io_uring_sqe * GetSqe(RtmpPubUring * _pUring)
+{
+        struct io_uring_sqe * pSqe;
+
+        if (_pUring->m_nSqTail - __atomic_load_n(_pUring->m_pSqHead, __ATOMIC_ACQUIRE) >= _pUring->m_nSqEntries) {
+                // 提交队列满了, 先把已经排队的交给内核
+                Enter(_pUring, _pUring->m_nToSubmit, 0, 0);
+                if (_pUring->m_nSqTail - __atomic_load_n(_pUring->m_pSqHead, __ATOMIC_ACQUIRE) >= _pUring->m_nSqEntries)
+                        return NULL;
+        }
+        pSqe = &_pUring->m_pSqes[_pUring->m_nSqTail & _pUring->m_nSqMask];
+        memset(pSqe, 0, sizeof(*pSqe));
+        return pSqe;
+}
+
+static void PushSqe(RtmpPubUring * _pUring)
+{
+        _pUring->m_nSqTail++;
+        __atomic_store_n(_pUring->m_pSqTail, _pUring->m_nSqTail, __ATOMIC_RELEASE);
+        _pUring->m_nToSubmit++;
+}
+
+static void OnCompletion(RtmpPubUring * _pUring, const struct io_uring_cqe * _pCqe)
+{
+        RtmpPubTransportOp * pOp = (RtmpPubTransportOp *)(uintptr_t)_pCqe->user_data;
+
+        // 取消请求自己的结果不关心
+        if (!pOp)
+                return;
+        if (_pCqe->flags & IORING_CQE_F_NOTIF) {
+                if ((uint32_t)_pCqe->res & IORING_NOTIF_USAGE_ZC_COPIED)
+                        SingleWriterAdd(&_pUring->m_base.m_nZeroCopyCopied, 1);
+                pOp->m_bNotifPending = 0;
+        } else {
+                pOp->m_nResult = _pCqe->res;
+                pOp->m_bDone = 1;
+                // 零拷贝时后面还有一个通知, 到了之后才能释放数据
+                pOp->m_bNotifPending = (_pCqe->flags & IORING_CQE_F_MORE) != 0;
+        }
+        if (!pOp->m_bDone || pOp->m_bNotifPending)
+                return;
+        pOp->m_bInFlight = 0;
+        if (!_pUring->m_base.m_bAsync)
+                return;
+        pOp->m_pNextDone = NULL;
+        pOp->m_bOnDoneList = 1;
+        if (_pUring->m_pDoneTail)
+                _pUring->m_pDoneTail->m_pNextDone = pOp;
+        else
+                _pUring->m_pDoneHead = pOp;
+        _pUring->m_pDoneTail = pOp;
+}
+
+static void Reap(RtmpPubUring * _pUring)
+{
+        unsigned int nHead = *_pUring->m_pCqHead, nTail = __atomic_load_n(_pUring->m_pCqTail, __ATOMIC_ACQUIRE);
+
+        for (; nHead != nTail; nHead++)
+                OnCompletion(_pUring, &_pUring->m_pCqes[nHead & _pUring->m_nCqMask]);
+        __atomic_store_n(_pUring->m_pCqHead, nHead, __ATOMIC_RELEASE);
+}
+
+static int UringWait(RtmpPubTransport * _pTransport, RtmpPubTransportOp * _pOp)
+{
+        RtmpPubUring * pUring = (RtmpPubUring *)_pTransport;
+
+        while (_pOp->m_bInFlight) {
+                if (Enter(pUring, pUring->m_nToSubmit, 1, IORING_ENTER_GETEVENTS) < 0) {
+                        RtmpPubLog("io_uring_enter err, errno = %d", errno);
+                        return -1;
+                }
+                Reap(pUring);
+        }
+        return 0;
+}
+
+static int UringSend(RtmpPubTransport * _pTransport, RtmpPubTransportOp * _pOp, int _nSocket, unsigned int _nBytes)
+{
+        RtmpPubUring * pUring = (RtmpPubUring *)_pTransport;
+        struct io_uring_sqe * pSqe = GetSqe(pUring);
+        int bZeroCopy = pUring->m_bZeroCopy && _nBytes >= RTMP_PUB_URING_ZC_MIN;
+
+        if (!pSqe) {
+                errno = EBUSY;
+                return -1;
+        }
+        pSqe->opcode = bZeroCopy ? IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+        pSqe->fd = _nSocket;
+        pSqe->addr = (uint64_t)(uintptr_t)&_pOp->m_msg;
+        pSqe->len = 1;
+        // 短写由内核继续发完, 不用再提交一次
+        pSqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        if (bZeroCopy)
+                pSqe->ioprio = IORING_SEND_ZC_REPORT_USAGE;
+        pSqe->user_data = (uint64_t)(uintptr_t)_pOp;
+        PushSqe(pUring);
+        _pOp->m_bInFlight = 1;
+        _pOp->m_bDone = 0;
+        _pOp->m_bNotifPending = 0;
+        SingleWriterAdd(&_pTransport->m_nSends, 1);
+        if (bZeroCopy)
+                SingleWriterAdd(&_pTransport->m_nZeroCopy, 1);
+        return _pTransport->m_bAsync ? 0 : UringWait(_pTransport, _pOp);
+}
+
+static void UringCancel(RtmpPubTransport * _pTransport, RtmpPubTransportOp * _pOp)
+{
+        RtmpPubUring * pUring = (RtmpPubUring *)_pTransport;
+        RtmpPubTransportOp * pOp, * pPrev = NULL;
+        struct io_uring_sqe * pSqe;
+
+        if (_pOp->m_bInFlight && (pSqe = GetSqe(pUring)) != NULL) {
+                pSqe->opcode = IORING_OP_ASYNC_CANCEL;
+                pSqe->addr = (uint64_t)(uintptr_t)_pOp;
+                PushSqe(pUring);
+        }
+        // 发送已经开始时取消不了, 要等它(和零拷贝的通知)结束
+        UringWait(_pTransport, _pOp);
+        if (_pOp->m_bOnDoneList) {
+                for (pOp = pUring->m_pDoneHead; pOp != _pOp; pOp = pOp->m_pNextDone)
+                        pPrev = pOp;
+                if (pPrev)
+                        pPrev->m_pNextDone = _pOp->m_pNextDone;
+                else
+                        pUring->m_pDoneHead = _pOp->m_pNextDone;
+                if (pUring->m_pDoneTail == _pOp)
+                        pUring->m_pDoneTail = pPrev;
+                _pOp->m_bOnDoneList = 0;
+        }
+        _pOp->m_bDone = 0;
+}
+
+static void UringDestroy(RtmpPubTransport * _pTransport)
+{
+        RtmpPubUring * pUring = (RtmpPubUring *)_pTransport;
+
+        if (pUring->m_pSqes)
+                munmap(pUring->m_pSqes, pUring->m_nSqesSize);
+        if (pUring->m_pRing)
+                munmap(pUring->m_pRing, pUring->m_nRingSize);
+        if (pUring->m_nFd >= 0)
+                close(pUring->m_nFd);
+        free(pUring);
+}
+
+static int Setup(RtmpPubUring * _pUring, struct io_uring_params * _pParams)
+{
+        // 每个session同时最多一个发送, 零拷贝再多一个通知, 完成队列留大一些; 溢出时内核会暂存(FEAT_NODROP)
+        memset(_pParams, 0, sizeof(*_pParams));
+        _pParams->flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+        _pParams->cq_entries = RTMP_PUB_URING_ENTRIES * 4;
+        _pUring->m_nFd = syscall(__NR_io_uring_setup, RTMP_PUB_URING_ENTRIES, _pParams);
+        if (_pUring->m_nFd < 0 && errno == EINVAL) {
+                // COOP_TASKRUN是5.19才有的
+                _pParams->flags = IORING_SETUP_CQSIZE;
+                _pUring->m_nFd = syscall(__NR_io_uring_setup, RTMP_PUB_URING_ENTRIES, _pParams);
+        }
+        return _pUring->m_nFd < 0 ? -1 : 0;
+}
+
+static int Probe(RtmpPubUring * _pUring)
+{
+        struct io_uring_probe * pProbe;
+        int ret = -1;
+
+        pProbe = (struct io_uring_probe *)calloc(1, sizeof(*pProbe) + 256 * sizeof(struct io_uring_probe_op));
+        if (!pProbe)
+                return -1;
+        if (syscall(__NR_io_uring_register, _pUring->m_nFd, IORING_REGISTER_PROBE, pProbe, 256) == 0 &&
+            pProbe->last_op >= IORING_OP_SENDMSG && (pProbe->ops[IORING_OP_SENDMSG].flags & IO_URING_OP_SUPPORTED)) {
+                _pUring->m_bZeroCopy = pProbe->last_op >= IORING_OP_SENDMSG_ZC &&
+                                       (pProbe->ops[IORING_OP_SENDMSG_ZC].flags & IO_URING_OP_SUPPORTED);
+                ret = 0;
+        }
+        free(pProbe);
+        return ret;
+}
+
+RtmpPubTransport * RtmpPubUringTransportNew(int _bAsync)
+{
+        RtmpPubUring * pUring = (RtmpPubUring *)calloc(1, sizeof(RtmpPubUring));
+        struct io_uring_params params;
+        size_t nCqSize;
+        char * pRing;
+        unsigned int i, * pArray;
+
+        if (!pUring)
+                return NULL;
+        pUring->m_base.m_nType = RTMP_PUB_TRANSPORT_URING;
+        pUring->m_base.m_pName = "io_uring";
+        pUring->m_base.m_bAsync = _bAsync;
+        pUring->m_base.m_pfnSend = UringSend;
+        pUring->m_base.m_pfnWait = UringWait;
+        pUring->m_base.m_pfnCancel = UringCancel;
+        pUring->m_base.m_pfnDestroy = UringDestroy;
+        pUring->m_nRegisteredIndex = -1;
+        if (Setup(pUring, &params) < 0) {
+                RtmpPubLog("io_uring_setup err, errno = %d", errno);
+                goto err;
+        }
+        // 只支持5.5之后的内核: 一次mmap映射两个队列, 完成事件不会丢
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP) || Probe(pUring) < 0) {
+                RtmpPubLog("io_uring too old, features = 0x%x", params.features);
+                goto err;
+        }
+        pUring->m_nRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        nCqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (nCqSize > pUring->m_nRingSize)
+                pUring->m_nRingSize = nCqSize;
+        pRing = (char *)mmap(NULL, pUring->m_nRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pUring->m_nFd,
+                             IORING_OFF_SQ_RING);
+        if (pRing == MAP_FAILED)
+                goto err;
+        pUring->m_pRing = pRing;
+        pUring->m_nSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        pUring->m_pSqes = (struct io_uring_sqe *)mmap(NULL, pUring->m_nSqesSize, PROT_READ | PROT_WRITE,
+                                                      MAP_SHARED | MAP_POPULATE, pUring->m_nFd, IORING_OFF_SQES);
+        if (pUring->m_pSqes == MAP_FAILED) {
+                pUring->m_pSqes = NULL;
+                goto err;
+        }
+        pUring->m_pSqHead = (unsigned int *)(pRing + params.sq_off.head);
+        pUring->m_pSqTail = (unsigned int *)(pRing + params.sq_off.tail);
+        pUring->m_nSqMask = *(unsigned int *)(pRing + params.sq_off.ring_mask);
+        pUring->m_nSqEntries = params.sq_entries;
+        pUring->m_nSqTail = *pUring->m_pSqTail;
+        // sqe和提交队列的下标一一对应, 之后不用再填
+        pArray = (unsigned int *)(pRing + params.sq_off.array);
+        for (i = 0; i < params.sq_entries; i++)
+                pArray[i] = i;
+        pUring->m_pCqHead = (unsigned int *)(pRing + params.cq_off.head);
+        pUring->m_pCqTail = (unsigned int *)(pRing + params.cq_off.tail);
+        pUring->m_nCqMask = *(unsigned int *)(pRing + params.cq_off.ring_mask);
+        pUring->m_pCqes = (struct io_uring_cqe *)(pRing + params.cq_off.cqes);
+        atomic_init(&pUring->m_base.m_nSends, 0);
+        atomic_init(&pUring->m_base.m_nSyscalls, 0);
+        atomic_init(&pUring->m_base.m_nZeroCopy, 0);
+        atomic_init(&pUring->m_base.m_nZeroCopyCopied, 0);
+        return &pUring->m_base;
+err:
+        UringDestroy(&pUring->m_base);
+        return NULL;
+}
+#else
+RtmpPubTransport * RtmpPubUringTransportNew(int _bAsync)
+{
+        RtmpPubLog("built without io_uring");
+        return NULL;
+}
+#endif
+
+RtmpPubTransport * RtmpPubTransportNew(RtmpPubTransportType _nType, int _bAsync)
+{
+        RtmpPubTransport * pTransport;
+
+        if (_nType != RTMP_PUB_TRANSPORT_URING)
+                return &s_socket;
+        if (!(pTransport = RtmpPubUringTransportNew(_bAsync))) {
+                RtmpPubLog("io_uring not available, fall back to socket");
+                return &s_socket;
+        }
+        return pTransport;
+}
+
+void RtmpPubTransportDel(RtmpPubTransport * _pTransport)
+{
+        if (_pTransport && _pTransport->m_pfnDestroy)
+                _pTransport->m_pfnDestroy(_pTransport);
+}
+
+int RtmpPubTransportGetFd(RtmpPubTransport * _pTransport)
+{
+#ifdef RTMP_PUB_HAVE_URING
+        if (_pTransport->m_nType == RTMP_PUB_TRANSPORT_URING)
+                return ((RtmpPubUring *)_pTransport)->m_nFd;
+#endif
+        return -1;
+}
+
+int RtmpPubTransportSubmit(RtmpPubTransport * _pTransport)
+{
+#ifdef RTMP_PUB_HAVE_URING
+        RtmpPubUring * pUring = (RtmpPubUring *)_pTransport;
+
+        if (_pTransport->m_nType == RTMP_PUB_TRANSPORT_URING && pUring->m_nToSubmit &&
+            Enter(pUring, pUring->m_nToSubmit, 0, 0) < 0) {
+                // 完成队列暂存满了(EBUSY)等情况, 下一轮再提交
+                RtmpPubLog("io_uring submit err, errno = %d", errno);
+                return -1;
+        }
+#endif
+        return 0;
+}
+
+void RtmpPubTransportReap(RtmpPubTransport * _pTransport)
+{
+#ifdef RTMP_PUB_HAVE_URING
+        if (_pTransport->m_nType == RTMP_PUB_TRANSPORT_URING)
+                Reap((RtmpPubUring *)_pTransport);
+#endif
+}
+
+RtmpPubTransportOp * RtmpPubTransportNextDone(RtmpPubTransport * _pTransport)
+{
+#ifdef RTMP_PUB_HAVE_URING
+        RtmpPubUring * pUring = (RtmpPubUring *)_pTransport;
+        RtmpPubTransportOp * pOp;
+
+        if (_pTransport->m_nType != RTMP_PUB_TRANSPORT_URING || !(pOp = pUring->m_pDoneHead))
+                return NULL;
+        if (!(pUring->m_pDoneHead = pOp->m_pNextDone))
+                pUring->m_pDoneTail = NULL;
+        pOp->m_bOnDoneList = 0;
+        return pOp;
+#else
+        return NULL;
+#endif
+}
+
+void RtmpPubTransportGetStats(RtmpPubTransport * _pTransport, RtmpPubTransportStats * _pStats)
+{
+        _pStats->m_nSends = atomic_load_explicit(&_pTransport->m_nSends, memory_order_relaxed);
+        _pStats->m_nSyscalls = atomic_load_explicit(&_pTransport->m_nSyscalls, memory_order_relaxed);
+        _pStats->m_nZeroCopy = atomic_load_explicit(&_pTransport->m_nZeroCopy, memory_order_relaxed);
+        _pStats->m_nZeroCopyCopied = atomic_load_explicit(&_pTransport->m_nZeroCopyCopied, memory_order_relaxed);
+}
@@ -0,0 +1,831 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "rtmp.h"
+#include "amf.h"
+#include "rtmp_chunk_reader.h"
+#include "rtmp_chunk_writer.h"
+
+/*
+* 本地的rtmp收流端, 用来离线压测和回归测试推流路径, 不转发也不保存数据
+* 只做推流需要的部分: 握手, 回应connect/createStream/publish, chunk解析,
+* 然后按flv tag检查每个连接收到的音视频: 时间戳, sequence header和关键帧的先后, avcc长度,
+* avc/hevc的sequence header按DecoderConfigurationRecord解析, 和其中的sps对照
+* 每个连接一个线程, 连接关闭时打印统计
+* avc按frame_num检查参考帧是否连续, 推流端丢帧只能丢非参考帧或者丢到下一个IDR
+* -r按指定码率限速读取, 模拟上行带宽不足, 用来检查推流端的丢帧策略, 每一帧落后于媒体时间线多少
+* 就是端到端延时, -l给出延时上限, 超过算错误
+* -d让握手和每一批命令回应都晚一些发出, 模拟到服务端的RTT, 用来对比连接命令的流水线
+* -k模拟服务端进程被杀: 收到媒体数据若干秒后重置所有连接, 停止监听一段时间再恢复, 用来检查推流端的重连
+*/
+
+#define log(fmt, args...) printf("%s $ "fmt"\n", __FUNCTION__, ##args)
+
+#define DEFAULT_PORT        1935
+#define HANDSHAKE_SIZE      1536
+#define RECV_BUF_SIZE       (1 << 20)
+#define WINDOW_ACK_SIZE     2500000
+#define STREAM_ID           1
+#define MAX_ERROR_LOGS      10 // 每个连接只打印前10个错误, 之后只计数
+#define CMD_BUF_SIZE        512
+#define THROTTLE_RCVBUF     (16 << 10) // 限速时的接收缓冲, 积压留在推流端, 而不是内核里
+#define THROTTLE_SLICE_MS   20 // 限速时每次最多读20ms的数据量
+#define KILL_OUTAGE_MS      3000 // -k重置连接之后这么久不接受连接
+
+#define FLV_CODEC_AVC       7
+#define FLV_CODEC_AAC       10
+#define FLV_EX_HEADER       0x80
+#define FLV_EX_SEQ_START    0
+#define FLV_EX_CODED_FRAMES 1
+#define FLV_EX_CODED_FRAMES_X 3
+#define FLV_KEY_FRAME       1
+
+typedef struct {
+	int seen;
+	int config;             // 收到过sequence header
+	int started;            // 视频收到过关键帧, 音频收到过第一帧
+	unsigned int last_ts;
+	unsigned long long frames;
+	unsigned long long keyframes;
+	unsigned long long configs;
+	unsigned long long bytes;
+} sink_track_t;
+
+typedef struct {
+	int id;
+	int fd;
+	RtmpPubChunkReader reader;
+	RtmpPubChunkWriter writer;
+	int published;
+	sink_track_t video;
+	sink_track_t audio;
+	int media_seen;
+	unsigned int last_media_ts;
+	unsigned long long messages;
+	unsigned long long metadata;
+	unsigned long long late;        // 时间戳比另一个轨道已经收到的小, 交错问题, 不算错误
+	unsigned long long recv_bytes;
+	unsigned long long errors;
+	int64_t start_ns;
+	int64_t first_media_ns;
+	int64_t last_media_ns;
+	unsigned int first_media_ts;
+	int64_t max_lag_ns;             // 收到的时刻落后于媒体时间线的最大值, 以第一帧为基准
+	int frame_num_bits;             // avc sps的log2_max_frame_num, 0表示不检查frame_num
+	int prev_ref_frame_num;         // 上一个参考帧的frame_num, -1表示还没有收到IDR
+	int64_t first_key_ns;
+	int killed;
+} sink_conn_t;
+
+static int verbose;
+static int conn_limit;
+static int throttle_kbps;
+static int max_lag_ms;
+static int reply_delay_ms;
+static int kill_after_secs;
+static atomic_llong kill_at;    // 第一个连接收到媒体数据时定下重置的时刻
+static atomic_int kill_done;   // 1: 已经停止监听, 2: 重新开始监听
+static int listen_fd;
+static atomic_int conn_next;
+static atomic_int conn_done;
+static atomic_int conn_failed;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sink_error(sink_conn_t *conn, const char *what, unsigned int ts)
+{
+	if (conn->errors++ < MAX_ERROR_LOGS)
+		log("conn %d: %s, ts:%u", conn->id, what, ts);
+}
+
+static int read_full(int fd, char *buf, int size)
+{
+	for (int got = 0; got < size;) {
+		int n = recv(fd, buf + got, size - got, 0);
+		if (n <= 0)
+			return -1;
+		got += n;
+	}
+	return 0;
+}
+
+// 简单握手: 不做digest校验, S2原样回显C1
+static int handshake(int fd)
+{
+	char c0c1[1 + HANDSHAKE_SIZE], s0s1s2[1 + 2 * HANDSHAKE_SIZE], c2[HANDSHAKE_SIZE];
+	uint32_t now = htonl((uint32_t)time(NULL));
+
+	if (read_full(fd, c0c1, sizeof(c0c1)) < 0 || c0c1[0] != 3)
+		return -1;
+	memset(s0s1s2, 0, sizeof(s0s1s2));
+	s0s1s2[0] = 3;
+	memcpy(s0s1s2 + 1, &now, 4);
+	memcpy(s0s1s2 + 1 + HANDSHAKE_SIZE, c0c1 + 1, HANDSHAKE_SIZE);
+	if (reply_delay_ms)
+		usleep(reply_delay_ms * 1000);
+	if (send(fd, s0s1s2, sizeof(s0s1s2), MSG_NOSIGNAL) != sizeof(s0s1s2))
+		return -1;
+	return read_full(fd, c2, sizeof(c2));
+}
+
+// 回应都很小, 拷贝到writer的scratch里, 调用者的缓冲可以马上释放
+static int queue_message(sink_conn_t *conn, int channel, uint8_t type, int32_t stream_id, const char *body, int size)
+{
+	struct iovec iov;
+
+	if (RtmpPubChunkWriterReserve(&conn->writer, size) < 0)
+		return -1;
+	iov.iov_base = RtmpPubChunkWriterAlloc(&conn->writer, size);
+	iov.iov_len = size;
+	memcpy(iov.iov_base, body, size);
+	return RtmpPubChunkWriterQueue(&conn->writer, channel, type, RTMP_PACKET_SIZE_LARGE, 0, stream_id, &iov, 1);
+}
+
+#define SAVC(x) static const AVal av_##x = AVC(#x)
+SAVC(_result);
+SAVC(onStatus);
+SAVC(fmsVer);
+SAVC(capabilities);
+SAVC(level);
+SAVC(status);
+SAVC(code);
+SAVC(description);
+static const AVal av_fms_version = AVC("FMS/3,0,1,123");
+static const AVal av_connect_success = AVC("NetConnection.Connect.Success");
+static const AVal av_publish_start = AVC("NetStream.Publish.Start");
+static const AVal av_ok = AVC("ok");
+
+// _result或者onStatus, info为NULL时只有一个null参数
+static int queue_reply(sink_conn_t *conn, const AVal *name, double transaction, int props, const AVal *code, double result,
+		       int32_t stream_id)
+{
+	char body[CMD_BUF_SIZE], *end = body + sizeof(body), *p = body;
+
+	p = AMF_EncodeString(p, end, name);
+	p = AMF_EncodeNumber(p, end, transaction);
+	if (props) {
+		*p++ = AMF_OBJECT;
+		p = AMF_EncodeNamedString(p, end, &av_fmsVer, &av_fms_version);
+		p = AMF_EncodeNamedNumber(p, end, &av_capabilities, 31);
+		*p++ = 0;
+		*p++ = 0;
+		*p++ = AMF_OBJECT_END;
+	} else {
+		*p++ = AMF_NULL;
+	}
+	if (code) {
+		*p++ = AMF_OBJECT;
+		p = AMF_EncodeNamedString(p, end, &av_level, &av_status);
+		p = AMF_EncodeNamedString(p, end, &av_code, code);
+		p = AMF_EncodeNamedString(p, end, &av_description, &av_ok);
+		*p++ = 0;
+		*p++ = 0;
+		*p++ = AMF_OBJECT_END;
+	} else {
+		p = AMF_EncodeNumber(p, end, result);
+	}
+	if (!p)
+		return -1;
+	return queue_message(conn, 3, RTMP_PACKET_TYPE_INVOKE, stream_id, body, p - body);
+}
+
+static int on_command(sink_conn_t *conn, const char *body, unsigned int size)
+{
+	char control[5];
+	AVal name;
+	double transaction = 0;
+	unsigned int offset;
+
+	if (size < 3 || body[0] != AMF_STRING)
+		return 0;
+	AMF_DecodeString(body + 1, &name);
+	offset = 3 + name.av_len;
+	if (offset + 9 <= size && body[offset] == AMF_NUMBER)
+		transaction = AMF_DecodeNumber(body + offset + 1);
+	if (verbose)
+		log("conn %d: %.*s %.0f", conn->id, name.av_len, name.av_val, transaction);
+	if (name.av_len == 7 && !memcmp(name.av_val, "connect", 7)) {
+		AMF_EncodeInt32(control, control + 4, WINDOW_ACK_SIZE);
+		if (queue_message(conn, 2, RTMP_PACKET_TYPE_SERVER_BW, 0, control, 4) < 0)
+			return -1;
+		control[4] = 2; // dynamic
+		if (queue_message(conn, 2, RTMP_PACKET_TYPE_CLIENT_BW, 0, control, 5) < 0)
+			return -1;
+		return queue_reply(conn, &av__result, transaction, 1, &av_connect_success, 0, 0);
+	}
+	if (name.av_len == 12 && !memcmp(name.av_val, "createStream", 12))
+		return queue_reply(conn, &av__result, transaction, 0, NULL, STREAM_ID, 0);
+	if (name.av_len == 7 && !memcmp(name.av_val, "publish", 7)) {
+		conn->published = 1;
+		return queue_reply(conn, &av_onStatus, 0, 0, &av_publish_start, 0, STREAM_ID);
+	}
+	// releaseStream/FCPublish/deleteStream等不需要回应
+	return 0;
+}
+
+// 消息体是若干个4字节长度加nalu, 长度之和要正好等于消息体
+static int check_nalus(const uint8_t *p, unsigned int size)
+{
+	while (size >= 4) {
+		uint32_t len = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		if (!len || len > size - 4)
+			return -1;
+		p += 4 + len;
+		size -= 4 + len;
+	}
+	return size ? -1 : 0;
+}
+
+#define AVC_RECORD_HEADER   6  // version, profile, compat, level, lengthSizeMinusOne, sps个数
+#define HEVC_RECORD_HEADER  23
+#define HEVC_PTL_SIZE       12 // profile_space/tier/profile, 32位compat, 48位constraint, level
+#define HEVC_NALU_VPS       32
+#define HEVC_NALU_SPS       33
+#define HEVC_NALU_PPS       34
+#define AVC_NALU_SLICE      1
+#define AVC_NALU_IDR        5
+#define AVC_SPS_RBSP_MAX    256 // 只解析到gaps_in_frame_num_allowed, 缩放矩阵最长也不到这么多
+#define AVC_SLICE_RBSP_MAX  16 // first_mb_in_slice, slice_type, pps_id, frame_num
+
+// 去掉防竞争字节(00 00 03), 最多取size个rbsp字节, 返回取到的个数
+static unsigned int nalu_to_rbsp(const uint8_t *nalu, unsigned int len, uint8_t *out, unsigned int size)
+{
+	unsigned int i, n = 0, zeros = 0;
+
+	for (i = 0; i < len && n < size; i++) {
+		if (zeros >= 2 && nalu[i] == 3) {
+			zeros = 0;
+			continue;
+		}
+		zeros = nalu[i] ? 0 : zeros + 1;
+		out[n++] = nalu[i];
+	}
+	return n;
+}
+
+typedef struct {
+	const uint8_t *p;
+	unsigned int bits;
+	unsigned int pos;
+} bit_reader_t;
+
+// 读过了结尾时返回0, 调用者按解析出的值是否合理判断
+static unsigned int read_bits(bit_reader_t *br, int n)
+{
+	unsigned int v = 0;
+
+	while (n--) {
+		v <<= 1;
+		if (br->pos < br->bits)
+			v |= (br->p[br->pos >> 3] >> (7 - (br->pos & 7))) & 1;
+		br->pos++;
+	}
+	return v;
+}
+
+static unsigned int read_ue(bit_reader_t *br)
+{
+	int zeros = 0;
+
+	while (!read_bits(br, 1) && zeros < 31 && br->pos < br->bits)
+		zeros++;
+	return (1u << zeros) - 1 + read_bits(br, zeros);
+}
+
+// avc sps里取log2_max_frame_num, 解析不了或者允许frame_num有间隔时返回0, 不检查参考帧
+static int avc_frame_num_bits(const uint8_t *sps, unsigned int len)
+{
+	uint8_t rbsp[AVC_SPS_RBSP_MAX];
+	bit_reader_t br = { rbsp, 0, 8 };
+	unsigned int profile, bits, poc_type;
+
+	br.bits = nalu_to_rbsp(sps, len, rbsp, sizeof(rbsp)) * 8;
+	profile = read_bits(&br, 8);
+	read_bits(&br, 16);
+	read_ue(&br);
+	if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 || profile == 83 ||
+	    profile == 86 || profile == 118 || profile == 128 || profile == 138 || profile == 139 || profile == 134 ||
+	    profile == 135) {
+		unsigned int chroma = read_ue(&br);
+		// separate_colour_plane时frame_num前面还有colour_plane_id, 不检查
+		if (chroma == 3 && read_bits(&br, 1))
+			return 0;
+		read_ue(&br);
+		read_ue(&br);
+		read_bits(&br, 1);
+		if (read_bits(&br, 1)) {
+			for (int i = 0; i < (chroma == 3 ? 12 : 8); i++) {
+				if (!read_bits(&br, 1))
+					continue;
+				for (int j = 0, last = 8, next = 8; j < (i < 6 ? 16 : 64) && next; j++) {
+					unsigned int delta = read_ue(&br);
+					next = (last + (delta & 1 ? (int)(delta + 1) / 2 : -(int)(delta / 2)) + 256) % 256;
+					last = next ? next : last;
+				}
+			}
+		}
+	}
+	bits = read_ue(&br) + 4;
+	poc_type = read_ue(&br);
+	if (poc_type == 0) {
+		read_ue(&br);
+	} else if (poc_type == 1) {
+		read_bits(&br, 1);
+		read_ue(&br);
+		read_ue(&br);
+		for (unsigned int i = read_ue(&br); i && br.pos < br.bits; i--)
+			read_ue(&br);
+	}
+	read_ue(&br);
+	if (read_bits(&br, 1) || br.pos > br.bits || bits > 16)
+		return 0;
+	return bits;
+}
+
+// 一组参数集: 2字节长度加nalu, 检查长度不越界并且nalu类型和期望的一致, 返回第一个nalu
+static const uint8_t *check_param_sets(const uint8_t **p, const uint8_t *end, unsigned int count, int hevc, int type,
+				       unsigned int *first_len)
+{
+	const uint8_t *first = NULL;
+	unsigned int len;
+
+	while (count--) {
+		if (end - *p < 2)
+			return NULL;
+		len = ((*p)[0] << 8) | (*p)[1];
+		*p += 2;
+		if (!len || len > (unsigned int)(end - *p))
+			return NULL;
+		if ((hevc ? ((*p)[0] >> 1) & 0x3f : (*p)[0] & 0x1f) != type)
+			return NULL;
+		if (!first) {
+			first = *p;
+			*first_len = len;
+		}
+		*p += len;
+	}
+	return first;
+}
+
+// AVCDecoderConfigurationRecord: 版本1, 4字节长度, 至少一个sps和pps, profile/compat/level和sps一致
+static const char *check_avc_record(sink_conn_t *conn, const uint8_t *rec, unsigned int size)
+{
+	const uint8_t *p = rec + AVC_RECORD_HEADER, *end = rec + size, *sps;
+	unsigned int count, sps_len = 0, pps_len = 0;
+
+	if (size < AVC_RECORD_HEADER || rec[0] != 1)
+		return "bad avc record version";
+	if ((rec[4] & 0x03) != 3)
+		return "avc record lengthSizeMinusOne is not 3";
+	if (!(rec[5] & 0x1f) || !(sps = check_param_sets(&p, end, rec[5] & 0x1f, 0, 7, &sps_len)))
+		return "bad sps in avc record";
+	if (p >= end || !*p)
+		return "no pps in avc record";
+	count = *p++;
+	if (!check_param_sets(&p, end, count, 0, 8, &pps_len))
+		return "bad pps in avc record";
+	// high profile的record后面可能还有chroma/bit depth扩展, 不检查
+	if (sps_len < 4 || memcmp(rec + 1, sps + 1, 3))
+		return "avc record profile/level differs from sps";
+	conn->frame_num_bits = avc_frame_num_bits(sps, sps_len);
+	return NULL;
+}
+
+// HEVCDecoderConfigurationRecord: 版本1, 4字节长度, vps/sps/pps数组都在, 数组正好占满, PTL和sps一致
+static const char *check_hevc_record(const uint8_t *rec, unsigned int size)
+{
+	const uint8_t *p = rec + HEVC_RECORD_HEADER, *end = rec + size, *sps = NULL, *nalu;
+	unsigned int i, arrays, type, count, len = 0, sps_len = 0, seen = 0;
+	uint8_t rbsp[3 + HEVC_PTL_SIZE];
+
+	if (size < HEVC_RECORD_HEADER || rec[0] != 1)
+		return "bad hevc record version";
+	if ((rec[21] & 0x03) != 3)
+		return "hevc record lengthSizeMinusOne is not 3";
+	arrays = rec[22];
+	for (i = 0; i < arrays; i++) {
+		if (end - p < 3)
+			return "truncated hevc record array";
+		type = p[0] & 0x3f;
+		count = (p[1] << 8) | p[2];
+		p += 3;
+		if (!(nalu = check_param_sets(&p, end, count, 1, type, &len)))
+			return "bad nalu in hevc record array";
+		if (type >= HEVC_NALU_VPS && type <= HEVC_NALU_PPS)
+			seen |= 1 << (type - HEVC_NALU_VPS);
+		if (type == HEVC_NALU_SPS && !sps) {
+			sps = nalu;
+			sps_len = len;
+		}
+	}
+	if (p != end)
+		return "hevc record size differs from its arrays";
+	if (seen != 7)
+		return "hevc record misses vps/sps/pps";
+	// sps: 2字节nalu头, vps id/max_sub_layers/nesting一个字节, 然后是general PTL
+	if (nalu_to_rbsp(sps, sps_len, rbsp, sizeof(rbsp)) < sizeof(rbsp) || memcmp(rec + 1, rbsp + 3, HEVC_PTL_SIZE))
+		return "hevc record profile/tier/level differs from sps";
+	if (((rec[21] >> 3) & 0x07) != ((rbsp[2] >> 1) & 0x07) + 1)
+		return "hevc record temporal layers differ from sps";
+	return NULL;
+}
+
+// 每一帧的frame_num是上一个参考帧的加1, 中间丢了参考帧之后的帧都无法解码
+// 丢非参考帧或者从GOP中间丢到下一个IDR都不会破坏这个关系
+static void check_frame_num(sink_conn_t *conn, const uint8_t *p, unsigned int size, unsigned int ts)
+{
+	uint8_t rbsp[AVC_SLICE_RBSP_MAX];
+	bit_reader_t br = { rbsp, 0, 8 };
+
+	while (size >= 4) {
+		uint32_t len = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		const uint8_t *nalu = p + 4;
+		int type = nalu[0] & 0x1f;
+
+		p += 4 + len;
+		size -= 4 + len;
+		if (type != AVC_NALU_SLICE && type != AVC_NALU_IDR)
+			continue;
+		br.bits = nalu_to_rbsp(nalu, len, rbsp, sizeof(rbsp)) * 8;
+		br.pos = 8;
+		// 同一帧的其它slice的frame_num相同, 只看第一个
+		if (read_ue(&br))
+			continue;
+		read_ue(&br);
+		read_ue(&br);
+		int frame_num = read_bits(&br, conn->frame_num_bits);
+		if (type == AVC_NALU_IDR)
+			conn->prev_ref_frame_num = frame_num;
+		else if (conn->prev_ref_frame_num < 0)
+			continue;
+		else if (frame_num != (conn->prev_ref_frame_num + 1) % (1 << conn->frame_num_bits))
+			sink_error(conn, "frame_num gap, a reference frame is missing", ts);
+		if (nalu[0] & 0x60)
+			conn->prev_ref_frame_num = frame_num;
+	}
+}
+
+static void check_video(sink_conn_t *conn, const uint8_t *body, unsigned int size, unsigned int ts)
+{
+	sink_track_t *track = &conn->video;
+	int key = (body[0] >> 4) == FLV_KEY_FRAME, config, header;
+
+	if (body[0] & FLV_EX_HEADER) {
+		// Enhanced RTMP: 低4位是PacketType, 之后是FourCC, CodedFrames带3字节cts
+		int packet = body[0] & 0x0f;
+		key = ((body[0] >> 4) & 0x07) == FLV_KEY_FRAME;
+		if (size < 5 || memcmp(body + 1, "hvc1", 4)) {
+			sink_error(conn, "unsupported enhanced rtmp fourcc", ts);
+			return;
+		}
+		config = packet == FLV_EX_SEQ_START;
+		if (!config && packet != FLV_EX_CODED_FRAMES && packet != FLV_EX_CODED_FRAMES_X) {
+			sink_error(conn, "unsupported enhanced rtmp packet type", ts);
+			return;
+		}
+		header = packet == FLV_EX_CODED_FRAMES ? 8 : 5;
+	} else {
+		if ((body[0] & 0x0f) != FLV_CODEC_AVC || size < 5) {
+			sink_error(conn, "video is not avc", ts);
+			return;
+		}
+		config = body[1] == 0;
+		header = 5;
+	}
+	if (config) {
+		const char *err = body[0] & FLV_EX_HEADER ? check_hevc_record(body + 5, size - 5) :
+				  check_avc_record(conn, body + 5, size - 5);
+		if (err) {
+			sink_error(conn, err, ts);
+			return;
+		}
+		track->config = 1;
+		track->configs++;
+		return;
+	}
+	if (!track->config)
+		sink_error(conn, "video frame before sequence header", ts);
+	else if (!track->started && !key)
+		sink_error(conn, "first video frame is not a keyframe", ts);
+	if (size < (unsigned int)header || check_nalus(body + header, size - header) < 0)
+		sink_error(conn, "bad nalu length in video tag", ts);
+	else if (!(body[0] & FLV_EX_HEADER) && conn->frame_num_bits)
+		check_frame_num(conn, body + header, size - header, ts);
+	if (key && !track->started)
+		conn->first_key_ns = now_ns();
+	track->started |= key;
+	track->keyframes += key;
+	track->frames++;
+	if (verbose)
+		log("conn %d: video ts:%u size:%u%s", conn->id, ts, size, key ? " key" : "");
+}
+
+static void check_audio(sink_conn_t *conn, const uint8_t *body, unsigned int size, unsigned int ts)
+{
+	sink_track_t *track = &conn->audio;
+
+	// 不是aac的音频(g711等)没有sequence header
+	if ((body[0] >> 4) == FLV_CODEC_AAC) {
+		if (size < 2) {
+			sink_error(conn, "short aac tag", ts);
+			return;
+		}
+		if (body[1] == 0) {
+			track->config = 1;
+			track->configs++;
+			return;
+		}
+		if (!track->config)
+			sink_error(conn, "aac frame before AudioSpecificConfig", ts);
+	}
+	track->started = 1;
+	track->frames++;
+	if (verbose)
+		log("conn %d: audio ts:%u size:%u", conn->id, ts, size);
+}
+
+static void check_media(sink_conn_t *conn, RtmpPubMessage *msg)
+{
+	sink_track_t *track = msg->m_nType == RTMP_PACKET_TYPE_VIDEO ? &conn->video : &conn->audio;
+	unsigned int ts = msg->m_nTimeStamp;
+
+	if (!conn->published)
+		sink_error(conn, "media before publish", ts);
+	if (!msg->m_nBodySize) {
+		sink_error(conn, "empty media message", ts);
+		return;
+	}
+	// 同一轨道内dts不能回退, 轨道之间只统计
+	if (track->seen && (int)(ts - track->last_ts) < 0)
+		sink_error(conn, msg->m_nType == RTMP_PACKET_TYPE_VIDEO ? "video timestamp goes back" :
+			   "audio timestamp goes back", ts);
+	if (conn->media_seen && (int)(ts - conn->last_media_ts) < 0)
+		conn->late++;
+	else
+		conn->last_media_ts = ts;
+	track->seen = 1;
+	track->last_ts = ts;
+	track->bytes += msg->m_nBodySize;
+	conn->last_media_ns = now_ns();
+	if (!conn->media_seen) {
+		long long none = 0;
+		conn->first_media_ns = conn->last_media_ns;
+		conn->first_media_ts = ts;
+		if (kill_after_secs)
+			atomic_compare_exchange_strong(&kill_at, &none, conn->first_media_ns + kill_after_secs * 1000000000LL);
+	}
+	conn->media_seen = 1;
+	int64_t lag = conn->last_media_ns - conn->first_media_ns - (int64_t)(int)(ts - conn->first_media_ts) * 1000000;
+	if (lag > conn->max_lag_ns)
+		conn->max_lag_ns = lag;
+	if (msg->m_nType == RTMP_PACKET_TYPE_VIDEO)
+		check_video(conn, (const uint8_t *)msg->m_pBody, msg->m_nBodySize, ts);
+	else
+		check_audio(conn, (const uint8_t *)msg->m_pBody, msg->m_nBodySize, ts);
+}
+
+static int on_message(void *opaque, RtmpPubMessage *msg)
+{
+	sink_conn_t *conn = opaque;
+
+	conn->messages++;
+	switch (msg->m_nType) {
+	case RTMP_PACKET_TYPE_INVOKE:
+		return on_command(conn, msg->m_pBody, msg->m_nBodySize);
+	case RTMP_PACKET_TYPE_INFO:
+		conn->metadata++;
+		break;
+	case RTMP_PACKET_TYPE_AUDIO:
+	case RTMP_PACKET_TYPE_VIDEO:
+		check_media(conn, msg);
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void log_conn(sink_conn_t *conn)
+{
+	double secs = (now_ns() - conn->start_ns) / 1e9;
+	double media_secs = (conn->last_media_ns - conn->first_media_ns) / 1e9;
+
+	log("conn %d closed after %.2fs: %llu messages %llu bytes, media %.2fs %.1f Mbit/s %.0f msgs/s",
+	    conn->id, secs, conn->messages, conn->recv_bytes, media_secs,
+	    media_secs > 0 ? conn->recv_bytes * 8 / media_secs / 1e6 : 0.0,
+	    media_secs > 0 ? (conn->video.frames + conn->audio.frames) / media_secs : 0.0);
+	log("conn %d video frames:%llu keyframes:%llu configs:%llu bytes:%llu, audio frames:%llu configs:%llu bytes:%llu",
+	    conn->id, conn->video.frames, conn->video.keyframes, conn->video.configs, conn->video.bytes,
+	    conn->audio.frames, conn->audio.configs, conn->audio.bytes);
+	if (max_lag_ms && conn->max_lag_ns > (int64_t)max_lag_ms * 1000000)
+		sink_error(conn, "media lag over the limit", 0);
+	log("conn %d metadata:%llu interleave late:%llu max lag:%.0fms first keyframe after:%.0fms%s errors:%llu", conn->id,
+	    conn->metadata, conn->late, conn->max_lag_ns / 1e6,
+	    conn->first_key_ns ? (conn->first_key_ns - conn->start_ns) / 1e6 : 0.0, conn->killed ? " killed" : "",
+	    conn->errors);
+}
+
+// 到了重置的时刻, 在这之前建立的连接都用RST关闭, 第一个发现的连接顺便停止监听
+static int kill_due(sink_conn_t *conn)
+{
+	int64_t at = atomic_load(&kill_at);
+	struct linger linger = { 1, 0 };
+	int none = 0;
+
+	if (!at || conn->start_ns >= at || now_ns() < at)
+		return 0;
+	if (atomic_compare_exchange_strong(&kill_done, &none, 1)) {
+		log("kill all connections, refuse new ones for %dms", KILL_OUTAGE_MS);
+		shutdown(listen_fd, SHUT_RDWR);
+	}
+	setsockopt(conn->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+	conn->killed = 1;
+	return 1;
+}
+
+static void *conn_thread(void *param)
+{
+	sink_conn_t *conn = param;
+	char *buf = malloc(RECV_BUF_SIZE);
+	unsigned int used = 0;
+	int ret = -1;
+
+	conn->start_ns = now_ns();
+	conn->prev_ref_frame_num = -1;
+	RtmpPubChunkReaderInit(&conn->reader, on_message, conn);
+	RtmpPubChunkWriterInitSocket(&conn->writer, conn->fd, RTMP_DEFAULT_CHUNKSIZE);
+	if (!buf || handshake(conn->fd) < 0) {
+		log("conn %d: handshake failed", conn->id);
+		conn->errors++;
+		goto out;
+	}
+	int64_t read_start = now_ns();
+	unsigned long long read_bytes = 0;
+	for (;;) {
+		int size = RECV_BUF_SIZE - used;
+		if (throttle_kbps) {
+			// 按码率算出已读的数据应该在什么时候读完, 提前了就等一会
+			int64_t due = read_start + (int64_t)(read_bytes * 8000000 / throttle_kbps);
+			int64_t wait = due - now_ns();
+			if (wait > 0)
+				usleep(wait / 1000);
+			if (size > throttle_kbps * THROTTLE_SLICE_MS / 8)
+				size = throttle_kbps * THROTTLE_SLICE_MS / 8;
+		}
+		int n = recv(conn->fd, buf + used, size, 0);
+		if (n <= 0 || kill_due(conn))
+			break;
+		conn->recv_bytes += n;
+		read_bytes += n;
+		used += n;
+		int parsed = RtmpPubChunkReaderParse(&conn->reader, buf, used);
+		if (parsed < 0) {
+			sink_error(conn, "bad chunk stream", 0);
+			break;
+		}
+		used -= parsed;
+		memmove(buf, buf + parsed, used);
+		if (used == RECV_BUF_SIZE) {
+			sink_error(conn, "chunk larger than receive buffer", 0);
+			break;
+		}
+		if (!RtmpPubChunkWriterPending(&conn->writer))
+			continue;
+		// 同一次收到的命令一起回应, 客户端流水线发出的命令只等一次
+		if (reply_delay_ms)
+			usleep(reply_delay_ms * 1000);
+		if (RtmpPubChunkWriterFlush(&conn->writer) < 0)
+			break;
+	}
+	ret = 0;
+out:
+	if (!ret && !conn->published)
+		sink_error(conn, "closed without publish", 0);
+	log_conn(conn);
+	if (conn->errors)
+		atomic_fetch_add(&conn_failed, 1);
+	close(conn->fd);
+	RtmpPubChunkReaderDestroy(&conn->reader);
+	RtmpPubChunkWriterDestroy(&conn->writer);
+	free(buf);
+	free(conn);
+	fflush(stdout);
+	// 收满指定的连接数后退出, 有任何错误时退出码为1
+	if (conn_limit && atomic_fetch_add(&conn_done, 1) + 1 == conn_limit)
+		exit(atomic_load(&conn_failed) ? 1 : 0);
+	return NULL;
+}
+
+static int open_listener(int port)
+{
+	struct sockaddr_in addr;
+	int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	// 接受的连接继承监听socket的接收缓冲, 要在listen之前设置才能影响窗口
+	if (throttle_kbps) {
+		int rcvbuf = THROTTLE_RCVBUF;
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+		log("listen on 127.0.0.1:%d err, errno:%d", port, errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	int port = DEFAULT_PORT, opt, one = 1;
+
+	while ((opt = getopt(argc, argv, "p:n:r:l:d:k:v")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			conn_limit = atoi(optarg);
+			break;
+		case 'r':
+			throttle_kbps = atoi(optarg);
+			break;
+		case 'l':
+			max_lag_ms = atoi(optarg);
+			break;
+		case 'd':
+			reply_delay_ms = atoi(optarg);
+			break;
+		case 'k':
+			kill_after_secs = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			log("./rtmp-sink [-p port] [-n connections then exit] [-r read kbps] [-l max lag ms] [-d reply delay ms] [-k kill after secs] [-v]");
+			return 2;
+		}
+	}
+	signal(SIGPIPE, SIG_IGN);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	if ((listen_fd = open_listener(port)) < 0)
+		return 2;
+	log("listening on 127.0.0.1:%d", port);
+	for (;;) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			// -k停止监听之后accept返回错误, 等一段时间重新监听
+			if (atomic_load(&kill_done) == 1) {
+				close(listen_fd);
+				usleep(KILL_OUTAGE_MS * 1000);
+				if ((listen_fd = open_listener(port)) < 0)
+					return 2;
+				atomic_store(&kill_done, 2);
+				log("listening again on 127.0.0.1:%d", port);
+				continue;
+			}
+			log("accept err, errno:%d", errno);
+			return 2;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		sink_conn_t *conn = calloc(1, sizeof(sink_conn_t));
+		pthread_t tid;
+		if (!conn) {
+			close(fd);
+			continue;
+		}
+		conn->id = atomic_fetch_add(&conn_next, 1);
+		conn->fd = fd;
+		if (pthread_create(&tid, NULL, conn_thread, conn)) {
+			close(fd);
+			free(conn);
+			continue;
+		}
+		pthread_detach(tid);
+	}
+	return 0;
+}